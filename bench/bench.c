@@ -0,0 +1,592 @@
+/*
+ * Measures how long builds through lelcache take compared to builds without it. A synthetic project is generated with
+ * gen_project and compiled with fake_cc so that the results only depend on lelcache and the machine, not on a toolchain.
+ * For each parallelism from 1 up to the maximum (in powers of two) four builds of all units are measured with a fresh
+ * cache:
+ *     direct   without lelcache, the baseline
+ *     cold     through lelcache with an empty cache, every unit misses
+ *     warm     the same units again, every unit hits
+ *     partial  after changing some of the sources, the others hit
+ * The results are written to stdout as JSON, progress to stderr. Runs on Linux only.
+ *
+ * Usage (from the repository root):
+ *     ./build.sh release && bench/build.sh && bench/bench [<options>] > results.json
+ *
+ * Options:
+ *     -j<n>         maximum parallelism (default: number of processors)
+ *     -u<n>         number of translation units (default: 200)
+ *     -d<n>         include depth (default: 4)
+ *     -w<n>         headers per level (default: 8)
+ *     -s<kilobytes> size of each header (default: 16)
+ *     -c<ms>        compile time of fake_cc (default: 100)
+ *     -e<ms>        preprocessing time of fake_cc (default: 5)
+ *     -o<kilobytes> object file size (default: 64)
+ *     -p<percent>   units changed for the partial build (default: 10)
+ *     -x<compiler>  'gcc' or 'cl' (default: gcc)
+ *     -l<path>      lelcache executable (default: lelcache in the parent directory of bench)
+ *     -k<dir>       directory for the project and caches, kept afterwards (default: a temporary one that is deleted)
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_PATH_LENGTH 4096
+#define MAX_ARGS 32
+
+extern char** environ;
+
+enum BuildKind {
+	BUILD_DIRECT,
+	BUILD_COLD,
+	BUILD_WARM,
+	BUILD_PARTIAL,
+	NUM_BUILD_KINDS
+};
+
+const char* buildKindNames[NUM_BUILD_KINDS] = {"direct", "cold", "warm", "partial"};
+
+struct BuildResult {
+	double wallMs;
+	double meanMs; // Latency of a single compilation
+	double p50Ms;
+	double p95Ms;
+	double maxMs;
+	int numUnits;
+	int numFailed;
+	long long numHits; // Reported by 'lelcache -i json', -1 for direct builds
+	long long numMisses;
+};
+
+int maxParallelism = 0;
+int numUnits = 200;
+int depth = 4;
+int width = 8;
+int headerSize = 16;
+int compileMs = 100;
+int preprocessMs = 5;
+int objectSize = 64;
+int changedPercent = 10;
+const char* compilerName = "gcc";
+char lelcachePath[MAX_PATH_LENGTH];
+char benchDir[MAX_PATH_LENGTH];
+char workDir[MAX_PATH_LENGTH];
+
+double now_ms(void) {
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+/*
+ * Formats a path into a buffer of MAX_PATH_LENGTH chars. Returns 0 instead of truncating it if it doesn't fit.
+ */
+__attribute__((format(printf, 2, 3))) int format_path(char* path, const char* format, ...) {
+	va_list args;
+
+	va_start(args, format);
+
+	int length = vsnprintf(path, MAX_PATH_LENGTH, format, args);
+
+	va_end(args);
+
+	if(length < 0 || length >= MAX_PATH_LENGTH) {
+		fprintf(stderr, "The path '%.64s...' is too long\n", path);
+
+		return 0;
+	}
+
+	return 1;
+}
+
+pid_t spawn(char** args, int outputFd) {
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&actions);
+
+	if(outputFd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, outputFd, STDOUT_FILENO);
+
+	int result = posix_spawn(&pid, args[0], &actions, NULL, args, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	return result == 0 ? pid : -1;
+}
+
+int run(char** args) {
+	int status;
+	pid_t pid = spawn(args, -1);
+
+	return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Reads a counter from the output of 'lelcache -i json'.
+ */
+long long cache_statistic(const char* name) {
+	char* args[] = {lelcachePath, "-i", "json", NULL};
+	char output[16384];
+	char key[64];
+	int fds[2];
+	size_t size = 0;
+	ssize_t numRead;
+
+	if(pipe(fds) != 0)
+		return -1;
+
+	pid_t pid = spawn(args, fds[1]);
+
+	close(fds[1]);
+
+	while((numRead = read(fds[0], output + size, sizeof(output) - 1 - size)) > 0)
+		size += numRead;
+
+	close(fds[0]);
+	output[size] = '\0';
+
+	if(pid > 0)
+		waitpid(pid, NULL, 0);
+
+	snprintf(key, sizeof(key), "\"%s\": ", name);
+
+	const char* value = strstr(output, key);
+
+	return value ? atoll(value + strlen(key)) : -1;
+}
+
+int compare_doubles_for_qsort(const void* a, const void* b) {
+	double difference = *(const double*)a - *(const double*)b;
+
+	return difference < 0 ? -1 : difference > 0;
+}
+
+/*
+ * Compiles all units of the project with up to parallelism compilations at a time.
+ */
+struct BuildResult build(enum BuildKind kind, int parallelism) {
+	struct BuildResult result = {0};
+	char compilerPath[MAX_PATH_LENGTH];
+
+	if(!format_path(compilerPath, "%s/bin/%s", workDir, compilerName)) {
+		result.numFailed = numUnits;
+
+		return result;
+	}
+
+	double* latencies = calloc(numUnits, sizeof(double));
+	double* startTimes = calloc(numUnits, sizeof(double));
+	pid_t* pids = calloc(numUnits, sizeof(pid_t));
+	int isCl = strcmp(compilerName, "cl") == 0;
+	int numStarted = 0, numRunning = 0;
+	long long hitsBefore = kind != BUILD_DIRECT ? cache_statistic("cache_hits") : -1;
+	long long missesBefore = kind != BUILD_DIRECT ? cache_statistic("cache_misses") : -1;
+	double start = now_ms();
+
+	while(numStarted < numUnits || numRunning > 0) {
+		if(numStarted < numUnits && numRunning < parallelism) {
+			char sourceFile[64];
+			char objectFile[64];
+			char* args[MAX_ARGS];
+			int numArgs = 0;
+
+			snprintf(sourceFile, sizeof(sourceFile), "src/unit%d.c", numStarted);
+			snprintf(objectFile, sizeof(objectFile), isCl ? "/Fo:obj/unit%d.obj" : "obj/unit%d.o", numStarted);
+
+			if(kind != BUILD_DIRECT)
+				args[numArgs++] = lelcachePath;
+
+			args[numArgs++] = compilerPath;
+			args[numArgs++] = isCl ? "/c" : "-c";
+			args[numArgs++] = isCl ? "/Iinclude" : "-Iinclude";
+			args[numArgs++] = isCl ? "/O2" : "-O2";
+			args[numArgs++] = isCl ? "/DNDEBUG" : "-DNDEBUG";
+
+			if(!isCl)
+				args[numArgs++] = "-o";
+
+			args[numArgs++] = objectFile;
+			args[numArgs++] = sourceFile;
+			args[numArgs] = NULL;
+
+			startTimes[numStarted] = now_ms();
+			pids[numStarted] = spawn(args, -1);
+
+			if(pids[numStarted] > 0) {
+				++numRunning;
+			} else {
+				latencies[numStarted] = 0.0;
+				++result.numFailed;
+			}
+
+			++numStarted;
+
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+
+		if(pid < 0)
+			break;
+
+		double end = now_ms();
+
+		for(int i = 0; i < numStarted; ++i) {
+			if(pids[i] == pid) {
+				latencies[i] = end - startTimes[i];
+				pids[i] = 0;
+			}
+		}
+
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++result.numFailed;
+
+		--numRunning;
+	}
+
+	result.wallMs = now_ms() - start;
+	result.numUnits = numUnits;
+
+	qsort(latencies, numUnits, sizeof(double), compare_doubles_for_qsort);
+
+	for(int i = 0; i < numUnits; ++i)
+		result.meanMs += latencies[i] / numUnits;
+
+	result.p50Ms = latencies[numUnits / 2];
+	result.p95Ms = latencies[numUnits * 95 / 100];
+	result.maxMs = latencies[numUnits - 1];
+	result.numHits = kind != BUILD_DIRECT ? cache_statistic("cache_hits") - hitsBefore : -1;
+	result.numMisses = kind != BUILD_DIRECT ? cache_statistic("cache_misses") - missesBefore : -1;
+
+	free(latencies);
+	free(startTimes);
+	free(pids);
+
+	return result;
+}
+
+/*
+ * Appends a definition to changedPercent of the units so that their preprocessed source changes.
+ */
+int change_sources(int round) {
+	int numChanged = numUnits * changedPercent / 100;
+
+	for(int i = 0; i < numChanged; ++i) {
+		char path[MAX_PATH_LENGTH];
+		int unit = (int)((long long)i * numUnits / numChanged);
+
+		if(!format_path(path, "%s/project/src/unit%d.c", workDir, unit))
+			return 0;
+
+		FILE* file = fopen(path, "ab");
+
+		if(!file) {
+			fprintf(stderr, "Unable to change '%s'\n", path);
+
+			return 0;
+		}
+
+		fprintf(file, "\nint unit%d_changed%d = %d;\n", unit, round, round);
+		fclose(file);
+	}
+
+	return 1;
+}
+
+int generate_project(void) {
+	char projectDir[MAX_PATH_LENGTH];
+	char generatorPath[MAX_PATH_LENGTH];
+	char options[4][32];
+
+	if(!format_path(projectDir, "%s/project", workDir) || !format_path(generatorPath, "%s/gen_project", benchDir))
+		return 0;
+
+	snprintf(options[0], sizeof(options[0]), "-u%d", numUnits);
+	snprintf(options[1], sizeof(options[1]), "-d%d", depth);
+	snprintf(options[2], sizeof(options[2]), "-w%d", width);
+	snprintf(options[3], sizeof(options[3]), "-s%d", headerSize);
+
+	char* args[] = {generatorPath, projectDir, options[0], options[1], options[2], options[3], NULL};
+
+	if(!run(args)) {
+		fprintf(stderr, "Unable to generate the project with '%s'\n", generatorPath);
+
+		return 0;
+	}
+
+	if(!format_path(projectDir, "%s/project/obj", workDir))
+		return 0;
+
+	return mkdir(projectDir, 0777) == 0 || errno == EEXIST;
+}
+
+/*
+ * Creates the compiler names lelcache recognizes as links to fake_cc in the bin directory.
+ */
+int install_fake_compiler(void) {
+	char path[MAX_PATH_LENGTH];
+	char fakeCompilerPath[MAX_PATH_LENGTH];
+
+	if(!format_path(path, "%s/bin", workDir) || !format_path(fakeCompilerPath, "%s/fake_cc", benchDir))
+		return 0;
+
+	if(access(fakeCompilerPath, X_OK) != 0) {
+		fprintf(stderr, "Unable to find '%s', run bench/build.sh first\n", fakeCompilerPath);
+
+		return 0;
+	}
+
+	mkdir(path, 0777);
+
+	const char* names[] = {"gcc", "cl"};
+
+	for(int i = 0; i < 2; ++i) {
+		if(!format_path(path, "%s/bin/%s", workDir, names[i]))
+			return 0;
+
+		unlink(path);
+
+		if(symlink(fakeCompilerPath, path) != 0) {
+			fprintf(stderr, "Unable to create '%s'\n", path);
+
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Gives lelcache a config and cache of its own. Each parallelism starts with an empty cache.
+ */
+int use_fresh_cache(int parallelism) {
+	char path[MAX_PATH_LENGTH];
+
+	if(!format_path(path, "%s/config%d", workDir, parallelism))
+		return 0;
+
+	setenv("XDG_CONFIG_HOME", path, 1);
+
+	if(!format_path(path, "%s/cache%d", workDir, parallelism))
+		return 0;
+
+	setenv("XDG_CACHE_HOME", path, 1);
+
+	return 1;
+}
+
+void print_result(const char* name, const struct BuildResult* result, int last) {
+	printf("        \"%s\": {\"wall_ms\": %.1f, \"mean_ms\": %.2f, \"p50_ms\": %.2f, \"p95_ms\": %.2f, \"max_ms\": %.2f, "
+		   "\"units\": %d, \"failed\": %d",
+		   name, result->wallMs, result->meanMs, result->p50Ms, result->p95Ms, result->maxMs, result->numUnits, result->numFailed);
+
+	if(result->numHits >= 0)
+		printf(", \"hits\": %lld, \"misses\": %lld", result->numHits, result->numMisses);
+
+	printf("}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+	int keepWorkDir = 0;
+
+	maxParallelism = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(readlink("/proc/self/exe", benchDir, sizeof(benchDir) - 1) < 0) {
+		fprintf(stderr, "Unable to determine the path of bench\n");
+
+		return EXIT_FAILURE;
+	}
+
+	*strrchr(benchDir, '/') = '\0';
+	if(!format_path(lelcachePath, "%s/../lelcache", benchDir))
+		return EXIT_FAILURE;
+
+	for(int i = 1; i < argc; ++i) {
+		const char* value = argv[i] + 2;
+		char option = argv[i][1];
+
+		if(argv[i][0] != '-' || option == '\0') {
+			fprintf(stderr, "Unknown argument '%s', see the top of bench/bench.c for the options\n", argv[i]);
+
+			return EXIT_FAILURE;
+		}
+
+		if(*value == '\0' && i + 1 < argc)
+			value = argv[++i];
+
+		switch(option) {
+		case 'j':
+			maxParallelism = atoi(value);
+			break;
+		case 'u':
+			numUnits = atoi(value);
+			break;
+		case 'd':
+			depth = atoi(value);
+			break;
+		case 'w':
+			width = atoi(value);
+			break;
+		case 's':
+			headerSize = atoi(value);
+			break;
+		case 'c':
+			compileMs = atoi(value);
+			break;
+		case 'e':
+			preprocessMs = atoi(value);
+			break;
+		case 'o':
+			objectSize = atoi(value);
+			break;
+		case 'p':
+			changedPercent = atoi(value);
+			break;
+		case 'x':
+			compilerName = value;
+			break;
+		case 'l':
+			snprintf(lelcachePath, sizeof(lelcachePath), "%s", value);
+			break;
+		case 'k':
+			snprintf(workDir, sizeof(workDir), "%s", value);
+			keepWorkDir = 1;
+			break;
+		default:
+			fprintf(stderr, "Unknown option '-%c', see the top of bench/bench.c for the options\n", option);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(strcmp(compilerName, "gcc") != 0 && strcmp(compilerName, "cl") != 0) {
+		fprintf(stderr, "The -x option expects 'gcc' or 'cl'\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if(maxParallelism < 1 || numUnits < 1 || changedPercent < 0 || changedPercent > 100) {
+		fprintf(stderr, "Parallelism and the number of units must be positive and the changed units a percentage\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if(access(lelcachePath, X_OK) != 0) {
+		fprintf(stderr, "Unable to find lelcache at '%s', build it or pass its path with -l\n", lelcachePath);
+
+		return EXIT_FAILURE;
+	}
+
+	if(keepWorkDir) {
+		if(mkdir(workDir, 0777) != 0 && errno != EEXIST) {
+			fprintf(stderr, "Unable to create '%s'\n", workDir);
+
+			return EXIT_FAILURE;
+		}
+	} else {
+		snprintf(workDir, sizeof(workDir), "%s/lelcache-bench-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+
+		if(!mkdtemp(workDir)) {
+			fprintf(stderr, "Unable to create a temporary directory\n");
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	char path[MAX_PATH_LENGTH];
+
+	// The builds run in the project directory so relative paths wouldn't work anymore
+	if(!realpath(workDir, path) || !install_fake_compiler())
+		return EXIT_FAILURE;
+
+	snprintf(workDir, sizeof(workDir), "%s", path);
+
+	if(realpath(lelcachePath, path))
+		snprintf(lelcachePath, sizeof(lelcachePath), "%s", path);
+
+	char value[32];
+
+	snprintf(value, sizeof(value), "%d", compileMs);
+	setenv("FAKE_CC_COMPILE_MS", value, 1);
+	snprintf(value, sizeof(value), "%d", preprocessMs);
+	setenv("FAKE_CC_PREPROCESS_MS", value, 1);
+	snprintf(value, sizeof(value), "%d", objectSize);
+	setenv("FAKE_CC_OBJECT_KB", value, 1);
+	unsetenv("LELCACHE_NAMESPACE");
+	unsetenv("LELCACHE_SESSION");
+	unsetenv("LELCACHE_TRACE");
+
+	printf("{\n"
+		   "  \"config\": {\"compiler\": \"%s\", \"units\": %d, \"include_depth\": %d, \"headers_per_level\": %d, "
+		   "\"header_kb\": %d, \"compile_ms\": %d, \"preprocess_ms\": %d, \"object_kb\": %d, \"changed_percent\": %d},\n"
+		   "  \"results\": [\n",
+		   compilerName, numUnits, depth, width, headerSize, compileMs, preprocessMs, objectSize, changedPercent);
+
+	int failed = 0;
+
+	for(int parallelism = 1; parallelism <= maxParallelism && !failed; parallelism = parallelism * 2 > maxParallelism && parallelism != maxParallelism ? maxParallelism : parallelism * 2) {
+		struct BuildResult results[NUM_BUILD_KINDS];
+
+		// Every parallelism starts with the same sources
+		if(!generate_project() || chdir(workDir) != 0 || chdir("project") != 0 || !use_fresh_cache(parallelism)) {
+			failed = 1;
+
+			break;
+		}
+
+		for(int kind = 0; kind < NUM_BUILD_KINDS && !failed; ++kind) {
+			if(kind == BUILD_PARTIAL && !change_sources(parallelism))
+				failed = 1;
+
+			fprintf(stderr, "parallelism %d: %s build...\n", parallelism, buildKindNames[kind]);
+			results[kind] = build(kind, parallelism);
+			failed |= results[kind].numFailed > 0;
+		}
+
+		if(failed) {
+			fprintf(stderr, "Compilations failed, keep the directory with -k to investigate\n");
+
+			break;
+		}
+
+		printf("    {\n      \"parallelism\": %d,\n      \"builds\": {\n", parallelism);
+
+		for(int kind = 0; kind < NUM_BUILD_KINDS; ++kind)
+			print_result(buildKindNames[kind], &results[kind], kind == NUM_BUILD_KINDS - 1);
+
+		// What lelcache adds to a compilation that misses and what a hit costs compared to compiling
+		printf("      },\n"
+			   "      \"miss_overhead_ms\": %.2f,\n"
+			   "      \"hit_speedup\": %.2f\n"
+			   "    }%s\n",
+			   results[BUILD_COLD].meanMs - results[BUILD_DIRECT].meanMs,
+			   results[BUILD_WARM].wallMs > 0 ? results[BUILD_DIRECT].wallMs / results[BUILD_WARM].wallMs : 0.0,
+			   parallelism == maxParallelism ? "" : ",");
+	}
+
+	printf("  ]\n}\n");
+
+	if(!keepWorkDir) {
+		char* args[] = {"/bin/rm", "-rf", workDir, NULL};
+
+		if(chdir("/") == 0)
+			run(args);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
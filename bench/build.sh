@@ -0,0 +1,12 @@
+#!/bin/sh
+
+# Builds the benchmarks next to this script, see the top of bench.c and microbench.c
+
+cd "$(dirname "$0")" || exit 1
+
+CFLAGS="-std=gnu11 -Wall -Wextra -Wno-sign-compare -O2"
+
+${CC:-cc} $CFLAGS gen_project.c -o gen_project &&
+${CC:-cc} $CFLAGS fake_cc.c -o fake_cc &&
+${CC:-cc} $CFLAGS bench.c -o bench &&
+${CC:-cc} $CFLAGS -Wno-unknown-pragmas microbench.c ../platform_posix.c -o microbench -lpthread
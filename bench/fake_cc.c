@@ -0,0 +1,310 @@
+/*
+ * Stand-in for gcc and cl that lelcache can cache without a real toolchain, see bench.c.
+ * It behaves like gcc unless it is started as 'cl' or 'clang-cl', which is decided by the name it is started with.
+ * Preprocessing inlines every '#include "..."' once, looking next to the including file and in the -I directories.
+ * Compiling preprocesses the source as well, waits and writes an object file whose content depends on the preprocessed
+ * source. With -MD (gcc) a dependency file listing the headers is written too.
+ *
+ * The timing is configured with environment variables:
+ *     FAKE_CC_PREPROCESS_MS  how long preprocessing takes (default: 5)
+ *     FAKE_CC_COMPILE_MS     how long compiling takes in addition to preprocessing (default: 100)
+ *     FAKE_CC_OBJECT_KB      size of the object files (default: 64)
+ *
+ * Usage (as gcc):
+ *     gcc -c [-E [-P]] [-I<dir>...] [-MD [-MF <file>]] [-o <file>] <source>
+ * Usage (as cl):
+ *     cl /c [/EP /P /Fi:<file>] [/I<dir>...] [/Fo:<file>] <source>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MAX_PATH_LENGTH 4096
+#define MAX_INCLUDE_DIRS 64
+#define MAX_HEADERS 4096
+
+struct Output {
+	char* data;
+	size_t size;
+	size_t capacity;
+};
+
+const char* includeDirs[MAX_INCLUDE_DIRS];
+int numIncludeDirs = 0;
+char* headers[MAX_HEADERS]; // Headers that have been included already
+int numHeaders = 0;
+
+void append_output(struct Output* output, const char* data, size_t size) {
+	if(output->size + size > output->capacity) {
+		output->capacity = (output->size + size) * 2;
+		output->data = realloc(output->data, output->capacity);
+	}
+
+	memcpy(output->data + output->size, data, size);
+	output->size += size;
+}
+
+void sleep_ms(long milliseconds) {
+	struct timespec duration = {milliseconds / 1000, (milliseconds % 1000) * 1000000};
+
+	nanosleep(&duration, NULL);
+}
+
+long environment_value(const char* name, long defaultValue) {
+	const char* value = getenv(name);
+
+	return value ? atol(value) : defaultValue;
+}
+
+FILE* open_include(const char* includingFile, const char* name, char* outPath) {
+	const char* separator = strrchr(includingFile, '/');
+	FILE* file;
+
+	snprintf(outPath, MAX_PATH_LENGTH, "%.*s%s", separator ? (int)(separator - includingFile + 1) : 0, includingFile, name);
+
+	if((file = fopen(outPath, "rb")) != NULL)
+		return file;
+
+	for(int i = 0; i < numIncludeDirs; ++i) {
+		snprintf(outPath, MAX_PATH_LENGTH, "%s/%s", includeDirs[i], name);
+
+		if((file = fopen(outPath, "rb")) != NULL)
+			return file;
+	}
+
+	return NULL;
+}
+
+int preprocess(const char* path, FILE* file, struct Output* output) {
+	char line[4096];
+
+	while(fgets(line, sizeof(line), file)) {
+		const char* start = line + strspn(line, " \t");
+
+		if(strncmp(start, "#pragma once", 12) == 0)
+			continue;
+
+		if(strncmp(start, "#include \"", 10) != 0) {
+			append_output(output, line, strlen(line));
+
+			continue;
+		}
+
+		char name[MAX_PATH_LENGTH];
+		char headerPath[MAX_PATH_LENGTH];
+
+		snprintf(name, sizeof(name), "%.*s", (int)strcspn(start + 10, "\""), start + 10);
+
+		FILE* header = open_include(path, name, headerPath);
+
+		if(!header) {
+			fprintf(stderr, "%s: fatal error: %s: No such file or directory\n", path, name);
+
+			return 0;
+		}
+
+		int alreadyIncluded = 0;
+
+		for(int i = 0; i < numHeaders && !alreadyIncluded; ++i)
+			alreadyIncluded = strcmp(headers[i], headerPath) == 0;
+
+		if(!alreadyIncluded && numHeaders < MAX_HEADERS) {
+			headers[numHeaders++] = strdup(headerPath);
+
+			if(!preprocess(headerPath, header, output)) {
+				fclose(header);
+
+				return 0;
+			}
+		}
+
+		fclose(header);
+	}
+
+	return 1;
+}
+
+int write_file(const char* path, const void* data, size_t size) {
+	FILE* file = fopen(path, "wb");
+
+	if(!file || fwrite(data, 1, size, file) != size) {
+		fprintf(stderr, "Unable to write '%s'\n", path);
+
+		if(file)
+			fclose(file);
+
+		return 0;
+	}
+
+	fclose(file);
+
+	return 1;
+}
+
+/*
+ * The object file is filled with pseudo random bytes seeded with a hash of the preprocessed source.
+ */
+int write_object_file(const char* path, const struct Output* preprocessed) {
+	uint64_t state = 14695981039346656037ull;
+	size_t size = (size_t)environment_value("FAKE_CC_OBJECT_KB", 64) * 1024;
+	uint64_t* data = malloc(size + sizeof(uint64_t));
+
+	for(size_t i = 0; i < preprocessed->size; ++i)
+		state = (state ^ (unsigned char)preprocessed->data[i]) * 1099511628211ull;
+
+	for(size_t i = 0; i < size / sizeof(uint64_t) + 1; ++i) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		data[i] = state;
+	}
+
+	int result = write_file(path, data, size);
+
+	free(data);
+
+	return result;
+}
+
+int write_dependency_file(const char* path, const char* objectFile, const char* sourceFile) {
+	FILE* file = fopen(path, "wb");
+
+	if(!file) {
+		fprintf(stderr, "Unable to write '%s'\n", path);
+
+		return 0;
+	}
+
+	fprintf(file, "%s: %s", objectFile, sourceFile);
+
+	for(int i = 0; i < numHeaders; ++i)
+		fprintf(file, " \\\n  %s", headers[i]);
+
+	fprintf(file, "\n");
+	fclose(file);
+
+	return 1;
+}
+
+/*
+ * Returns the value of the option at argv[*index] if it starts with name, which is either the rest of it or the next
+ * argument. A ':' after the name is skipped like cl does.
+ */
+const char* option_value(int argc, char** argv, int* index, const char* name) {
+	size_t length = strlen(name);
+
+	if(strncmp(argv[*index], name, length) != 0)
+		return NULL;
+
+	const char* value = argv[*index] + length;
+
+	if(*value == ':')
+		++value;
+
+	if(*value == '\0' && *index + 1 < argc)
+		value = argv[++*index];
+
+	return value;
+}
+
+int main(int argc, char** argv) {
+	const char* name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+	int isCl = strcmp(name, "cl") == 0 || strcmp(name, "clang-cl") == 0;
+	int preprocessOnly = 0, compile = 0, dependencies = 0;
+	const char* sourceFile = NULL;
+	const char* outputFile = NULL;
+	const char* dependencyFile = NULL;
+	const char* value;
+
+	for(int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+
+		if(arg[0] != '-' && !(isCl && arg[0] == '/')) {
+			sourceFile = arg;
+		} else if(strcmp(arg + 1, "E") == 0 || strcmp(arg + 1, "EP") == 0) {
+			preprocessOnly = 1;
+		} else if(strcmp(arg + 1, "c") == 0) {
+			compile = 1;
+		} else if(!isCl && (strcmp(arg, "-MD") == 0 || strcmp(arg, "-MMD") == 0)) {
+			dependencies = 1;
+		} else if(!isCl && (value = option_value(argc, argv, &i, "-MF")) != NULL) {
+			dependencyFile = value;
+		} else if(!isCl && (value = option_value(argc, argv, &i, "-o")) != NULL) {
+			outputFile = value;
+		} else if(isCl && ((value = option_value(argc, argv, &i, "/Fi")) != NULL || (value = option_value(argc, argv, &i, "/Fo")) != NULL)) {
+			outputFile = value;
+		} else if((value = option_value(argc, argv, &i, isCl ? "/I" : "-I")) != NULL || (isCl && (value = option_value(argc, argv, &i, "-I")) != NULL)) {
+			if(numIncludeDirs < MAX_INCLUDE_DIRS)
+				includeDirs[numIncludeDirs++] = value;
+		}
+		// Everything else is accepted and ignored
+	}
+
+	if(!sourceFile || (!preprocessOnly && !compile)) {
+		fprintf(stderr, "%s: no input file or nothing to do\n", name);
+
+		return EXIT_FAILURE;
+	}
+
+	FILE* source = fopen(sourceFile, "rb");
+	struct Output preprocessed = {0};
+
+	if(!source) {
+		fprintf(stderr, "%s: error: %s: No such file or directory\n", name, sourceFile);
+
+		return EXIT_FAILURE;
+	}
+
+	int result = preprocess(sourceFile, source, &preprocessed);
+
+	fclose(source);
+	sleep_ms(environment_value("FAKE_CC_PREPROCESS_MS", 5));
+
+	if(!result)
+		return EXIT_FAILURE;
+
+	if(preprocessOnly) {
+		if(outputFile)
+			return write_file(outputFile, preprocessed.data, preprocessed.size) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+		fwrite(preprocessed.data, 1, preprocessed.size, stdout);
+
+		return EXIT_SUCCESS;
+	}
+
+	char objectFile[MAX_PATH_LENGTH];
+
+	if(outputFile) {
+		snprintf(objectFile, sizeof(objectFile), "%s", outputFile);
+	} else { // The base name of the source file with the extension '.o' or '.obj'
+		const char* baseName = strrchr(sourceFile, '/') ? strrchr(sourceFile, '/') + 1 : sourceFile;
+		const char* extension = strrchr(baseName, '.');
+
+		snprintf(objectFile, sizeof(objectFile), "%.*s%s", extension ? (int)(extension - baseName) : (int)strlen(baseName), baseName, isCl ? ".obj" : ".o");
+	}
+
+	sleep_ms(environment_value("FAKE_CC_COMPILE_MS", 100));
+
+	if(!write_object_file(objectFile, &preprocessed))
+		return EXIT_FAILURE;
+
+	if(dependencies) {
+		char dependencyPath[MAX_PATH_LENGTH];
+
+		if(dependencyFile) {
+			snprintf(dependencyPath, sizeof(dependencyPath), "%s", dependencyFile);
+		} else { // The object file with the extension '.d'
+			const char* extension = strrchr(objectFile, '.');
+
+			snprintf(dependencyPath, sizeof(dependencyPath), "%.*s.d", extension ? (int)(extension - objectFile) : (int)strlen(objectFile), objectFile);
+		}
+
+		if(!write_dependency_file(dependencyPath, objectFile, sourceFile))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
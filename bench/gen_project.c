@@ -0,0 +1,155 @@
+/*
+ * Generates a synthetic C project for benchmarking lelcache, see bench.c.
+ * The project consists of <units> translation units in src/ and <depth> levels of <width> headers each in include/. Every
+ * unit includes one header of the first level, every header includes two headers of the next level so that a unit sees
+ * up to 2^depth - 1 headers. Headers are padded with declarations to about <kilobytes> each.
+ *
+ * Usage:
+ *     gen_project <dir> [-u<units>] [-d<depth>] [-w<width>] [-s<kilobytes>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define MAX_PATH_LENGTH 4096
+
+int numUnits = 100;
+int depth = 4;
+int width = 8;
+int headerSize = 16 * 1024;
+
+int make_directory(const char* path) {
+	if(mkdir(path, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create '%s'\n", path);
+
+		return 0;
+	}
+
+	return 1;
+}
+
+int write_header(const char* dir, int level, int index) {
+	char path[MAX_PATH_LENGTH];
+
+	snprintf(path, sizeof(path), "%s/include/h%d_%d.h", dir, level, index);
+
+	FILE* file = fopen(path, "wb");
+
+	if(!file) {
+		fprintf(stderr, "Unable to create '%s'\n", path);
+
+		return 0;
+	}
+
+	fprintf(file, "#pragma once\n\n");
+
+	if(level + 1 < depth)
+		fprintf(file, "#include \"h%d_%d.h\"\n#include \"h%d_%d.h\"\n\n", level + 1, index, level + 1, (index + 1) % width);
+
+	fprintf(file, "struct h%d_%d_type {\n\tint values[%d];\n\tconst char* name;\n};\n\n", level, index, level + 1);
+
+	for(int i = 0; ftell(file) < headerSize; ++i)
+		fprintf(file, "int h%d_%d_function%d(struct h%d_%d_type* value, int count, const char* name);\n", level, index, i, level, index);
+
+	fclose(file);
+
+	return 1;
+}
+
+int write_unit(const char* dir, int index) {
+	char path[MAX_PATH_LENGTH];
+
+	snprintf(path, sizeof(path), "%s/src/unit%d.c", dir, index);
+
+	FILE* file = fopen(path, "wb");
+
+	if(!file) {
+		fprintf(stderr, "Unable to create '%s'\n", path);
+
+		return 0;
+	}
+
+	fprintf(file,
+			"#include \"h0_%d.h\"\n"
+			"\n"
+			"int unit%d_value = %d;\n"
+			"\n"
+			"int unit%d_function(struct h0_%d_type* value) {\n"
+			"\treturn h0_%d_function0(value, unit%d_value, \"unit%d\");\n"
+			"}\n",
+			index % width, index, index, index, index % width, index % width, index, index);
+	fclose(file);
+
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	const char* dir = NULL;
+
+	for(int i = 1; i < argc; ++i) {
+		if(argv[i][0] != '-') {
+			dir = argv[i];
+
+			continue;
+		}
+
+		int value = atoi(argv[i] + 2);
+
+		switch(argv[i][1]) {
+		case 'u':
+			numUnits = value;
+			break;
+		case 'd':
+			depth = value;
+			break;
+		case 'w':
+			width = value;
+			break;
+		case 's':
+			headerSize = value * 1024;
+			break;
+		default:
+			dir = NULL;
+			i = argc;
+			break;
+		}
+	}
+
+	if(!dir || numUnits < 1 || depth < 1 || width < 1) {
+		fprintf(stderr, "Usage: gen_project <dir> [-u<units>] [-d<depth>] [-w<width>] [-s<kilobytes>]\n");
+
+		return EXIT_FAILURE;
+	}
+
+	char path[MAX_PATH_LENGTH];
+
+	if(!make_directory(dir))
+		return EXIT_FAILURE;
+
+	snprintf(path, sizeof(path), "%s/include", dir);
+
+	if(!make_directory(path))
+		return EXIT_FAILURE;
+
+	snprintf(path, sizeof(path), "%s/src", dir);
+
+	if(!make_directory(path))
+		return EXIT_FAILURE;
+
+	for(int level = 0; level < depth; ++level) {
+		for(int i = 0; i < width; ++i) {
+			if(!write_header(dir, level, i))
+				return EXIT_FAILURE;
+		}
+	}
+
+	for(int i = 0; i < numUnits; ++i) {
+		if(!write_unit(dir, i))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+/*
+ * Measures the functions every invocation goes through before it knows its key: parsing the command line, building
+ * command line strings, turning hashes into paths, hashing file contents and all of them together as the key derivation.
+ * lelcache.c is included directly so that the functions are measured exactly as they are compiled into lelcache.
+ *
+ * Every benchmark is calibrated to run for about <milliseconds> (default: 50) per repetition and repeated a few times.
+ * The median and the fastest repetition are reported in nanoseconds per operation, together with the spread between the
+ * slowest and the fastest one and the throughput for the bytes an operation processes. It creates its files in
+ * 'microbench_data' in the current directory and deletes them afterwards.
+ *
+ * Parsing a command line that compiles (/c) creates the temporary file for the preprocessor, which usually costs more than
+ * the parsing itself and varies with the file system. The 'no /c' variant parses the same flags without it and without
+ * hashing them, use it to compare changes to the parser.
+ *
+ * Usage (from the repository root):
+ *     bench/build.sh && bench/microbench [<milliseconds>]
+ */
+
+#define LELCACHE_NO_MAIN
+
+#include "../lelcache.c"
+
+#define MICROBENCH_DIRECTORY L"microbench_data"
+#define MICROBENCH_REPETITIONS 9
+
+typedef void (*BenchmarkFunction)(LPVOID context, UINT64 numIterations);
+
+UINT64 repetitionTime = 50 * 10000; // In 100 nanosecond intervals like current_system_time
+volatile UINT64 sink; // Results are written here so that the compiler can't drop the work
+
+/*
+ * Command lines
+ */
+
+struct ClCommandLine {
+	struct StringList args;
+	SIZE_T size; // Of all arguments in bytes
+};
+
+/*
+ * Builds a cl command line with numFlags flags that looks like one of a large project: mostly include directories and
+ * macros, then warning and code generation flags and finally the output and source file. Without compilesToObj /c is
+ * replaced by another flag so that parse_cl_command_line rejects the command line once it has classified every flag.
+ */
+void make_cl_command_line(LPCWSTR compilerPath, int numFlags, BOOL compilesToObj, struct ClCommandLine* out) {
+	static const LPCWSTR codegenFlags[] = {
+		L"/nologo", L"/c", L"/W4", L"/WX", L"/O2", L"/Ob2", L"/Oi", L"/GS-", L"/Gy", L"/EHsc", L"/MD", L"/std:c++17",
+		L"/permissive-", L"/Zc:__cplusplus", L"/Zc:inline", L"/Zc:preprocessor", L"/utf-8", L"/bigobj", L"/fp:precise", L"/GR-"
+	};
+	int numCodegenFlags = ARRAYSIZE(codegenFlags);
+	int numIncludes = (numFlags - numCodegenFlags - 2) * 3 / 5;
+	int numDefines = numFlags - numCodegenFlags - 2 - numIncludes;
+
+	*out = (struct ClCommandLine){0};
+	add_to_string_list(&out->args, L"lelcache");
+	add_to_string_list(&out->args, compilerPath);
+
+	for(int i = 0; i < numIncludes; ++i) {
+		WCHAR flag[MAX_PATH];
+
+		swprintf(flag, MAX_PATH, L"/Ic:\\work\\project\\third_party\\library%d\\include\\library%d\\detail", i, i);
+		add_to_string_list(&out->args, flag);
+	}
+
+	for(int i = 0; i < numDefines; ++i) {
+		WCHAR flag[MAX_PATH];
+
+		swprintf(flag, MAX_PATH, L"/DPROJECT_FEATURE_%d_ENABLED=%d", i, i % 2);
+		add_to_string_list(&out->args, flag);
+	}
+
+	for(int i = 0; i < numCodegenFlags; ++i)
+		add_to_string_list(&out->args, !compilesToObj && wcscmp(codegenFlags[i], L"/c") == 0 ? L"/Zc:wchar_t" : codegenFlags[i]);
+
+	add_to_string_list(&out->args, L"/Fo:obj\\module\\source_file.obj");
+	add_to_string_list(&out->args, L"src\\module\\source_file.cpp");
+
+	for(int i = 0; i < out->args.count; ++i)
+		out->size += wcslen(out->args.strings[i]) * sizeof(WCHAR);
+}
+
+/*
+ * Benchmarks
+ */
+
+void benchmark_parse_cl_command_line(LPVOID context, UINT64 numIterations) {
+	struct ClCommandLine* cmdLine = context;
+	struct CommandLineInfo* cmdLineInfo = malloc(sizeof(*cmdLineInfo));
+
+	for(UINT64 i = 0; i < numIterations; ++i) {
+		memset(cmdLineInfo, 0, sizeof(*cmdLineInfo));
+
+		if(!parse_cl_command_line(cmdLine->args.count, cmdLine->args.strings, FALSE, cmdLineInfo)) {
+			wprintf(L"Unable to parse the command line: %ls\n", uncacheableReasonNames[cmdLineInfo->uncacheableReason].description);
+			exit(EXIT_FAILURE);
+		}
+
+		delete_file(cmdLineInfo->temporaryPreprocessedFile);
+		sink += cmdLineInfo->compilerCmdLineHash;
+	}
+
+	free(cmdLineInfo);
+}
+
+/*
+ * Parses a command line without /c, see make_cl_command_line.
+ */
+void benchmark_classify_cl_command_line(LPVOID context, UINT64 numIterations) {
+	struct ClCommandLine* cmdLine = context;
+	struct CommandLineInfo* cmdLineInfo = malloc(sizeof(*cmdLineInfo));
+
+	for(UINT64 i = 0; i < numIterations; ++i) {
+		memset(cmdLineInfo, 0, sizeof(*cmdLineInfo));
+
+		if(parse_cl_command_line(cmdLine->args.count, cmdLine->args.strings, FALSE, cmdLineInfo) ||
+		   cmdLineInfo->uncacheableReason != UNCACHEABLE_NO_COMPILE_FLAG) {
+			wprintf(L"Unable to parse the command line: %ls\n", uncacheableReasonNames[cmdLineInfo->uncacheableReason].description);
+			exit(EXIT_FAILURE);
+		}
+
+		sink += cmdLineInfo->numCompilerFlags;
+	}
+
+	free(cmdLineInfo);
+}
+
+void benchmark_make_cmd_line(LPVOID context, UINT64 numIterations) {
+	struct ClCommandLine* cmdLine = context;
+	LPWSTR buffer = malloc(cmdLine->size + cmdLine->args.count * 3 * sizeof(WCHAR));
+
+	for(UINT64 i = 0; i < numIterations; ++i) {
+		make_cmd_line(cmdLine->args.count, (const LPCWSTR*)cmdLine->args.strings, buffer);
+		sink += buffer[i % (cmdLine->size / sizeof(WCHAR))];
+	}
+
+	free(buffer);
+}
+
+void benchmark_hash_to_path(LPVOID context, UINT64 numIterations) {
+	Hash64String hashString;
+	WCHAR path[LEL_HASH64_STRING_LENGTH * 2];
+
+	UNREFERENCED_PARAMETER(context);
+
+	for(UINT64 i = 0; i < numIterations; ++i) {
+		hash64_to_string(XXH64(&i, sizeof(i), 0), hashString);
+		path_from_hash64_string(hashString, path);
+		sink += path[i % 12];
+	}
+}
+
+void benchmark_hash_file_content(LPVOID context, UINT64 numIterations) {
+	for(UINT64 i = 0; i < numIterations; ++i)
+		sink += hash_file_content(context);
+}
+
+struct KeyDerivation {
+	struct ClCommandLine* cmdLine;
+	LPCWSTR preprocessedFile; // Stands in for the output of the preprocessor which isn't run
+};
+
+/*
+ * Everything lelcache_main does to get from its arguments to the directory of the entry, except running the preprocessor.
+ */
+void benchmark_key_derivation(LPVOID context, UINT64 numIterations) {
+	struct KeyDerivation* derivation = context;
+	struct CommandLineInfo* cmdLineInfo = malloc(sizeof(*cmdLineInfo));
+	WCHAR entryDir[MAX_PATH];
+
+	for(UINT64 i = 0; i < numIterations; ++i) {
+		XXH64_hash_t generation = 0;
+
+		memset(cmdLineInfo, 0, sizeof(*cmdLineInfo));
+
+		if(!parse_cl_command_line(derivation->cmdLine->args.count, derivation->cmdLine->args.strings, FALSE, cmdLineInfo) ||
+		   !current_generation(derivation->cmdLine->args.strings[1], &generation) || !hash_hidden_inputs(generation, cmdLineInfo)) {
+			wprintf(L"Unable to derive the key\n");
+			exit(EXIT_FAILURE);
+		}
+
+		struct CacheKey key = {hash_file_content(derivation->preprocessedFile), cmdLineInfo->compilerCmdLineHash};
+
+		entry_directory(globalConfig.cachePath, &key, entryDir);
+		delete_file(cmdLineInfo->temporaryPreprocessedFile);
+		sink += entryDir[wcslen(entryDir) - 1];
+	}
+
+	free(cmdLineInfo);
+}
+
+int __cdecl compare_durations_for_qsort(const void* a, const void* b) {
+	UINT64 durationA = *(const UINT64*)a;
+	UINT64 durationB = *(const UINT64*)b;
+
+	return durationA < durationB ? -1 : durationA > durationB;
+}
+
+/*
+ * Doubles the number of iterations until a repetition takes long enough, then measures MICROBENCH_REPETITIONS of them.
+ */
+void run_benchmark(LPCWSTR name, BenchmarkFunction function, LPVOID context, SIZE_T bytesPerOp) {
+	UINT64 durations[MICROBENCH_REPETITIONS];
+	UINT64 numIterations = 1;
+
+	for(;;) {
+		UINT64 start = current_system_time();
+
+		function(context, numIterations);
+
+		if(current_system_time() - start >= repetitionTime / 4)
+			break;
+
+		numIterations *= 2;
+	}
+
+	numIterations *= 4;
+
+	for(int i = 0; i < MICROBENCH_REPETITIONS; ++i) {
+		UINT64 start = current_system_time();
+
+		function(context, numIterations);
+		durations[i] = current_system_time() - start;
+	}
+
+	qsort(durations, MICROBENCH_REPETITIONS, sizeof(*durations), compare_durations_for_qsort);
+
+	double medianNs = durations[MICROBENCH_REPETITIONS / 2] * 100.0 / numIterations;
+	double minNs = durations[0] * 100.0 / numIterations;
+	double spread = (durations[MICROBENCH_REPETITIONS - 1] - durations[0]) * 100.0 / durations[0];
+
+	wprintf(L"%-44ls %12.1f %12.1f %7.1f%%", name, medianNs, minNs, spread);
+
+	if(bytesPerOp > 0)
+		wprintf(L" %12.1f", bytesPerOp / (medianNs / 1e9) / (1024.0 * 1024.0));
+
+	wprintf(L"\n");
+	fflush(stdout);
+}
+
+BOOL write_data_file(LPCWSTR path, SIZE_T size) {
+	BYTE* data = malloc(size);
+	UINT64 state = 0x9e3779b97f4a7c15ull;
+	FileHandle file = open_file(path, OPEN_FOR_WRITING);
+
+	for(SIZE_T i = 0; i < size; ++i) {
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		data[i] = (BYTE)(state >> 56);
+	}
+
+	BOOL result = file != INVALID_FILE_HANDLE && write_file(file, data, size);
+
+	if(file != INVALID_FILE_HANDLE)
+		close_file(file);
+
+	free(data);
+
+	if(!result)
+		wprintf(L"Unable to write '%ls'\n", path);
+
+	return result;
+}
+
+int main(int argc, char** argv) {
+	static const SIZE_T fileSizes[] = {4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+	static const int flagCounts[] = {100, 300};
+	WCHAR compilerPath[MAX_PATH];
+	WCHAR filePath[MAX_PATH];
+	WCHAR name[64];
+
+	setlocale(LC_ALL, "");
+
+	if(argc > 1)
+		repetitionTime = (UINT64)atoi(argv[1]) * 10000;
+
+	// The compiler only needs to exist for current_generation, its generation is recorded in a cache of its own
+	swprintf(compilerPath, MAX_PATH, MICROBENCH_DIRECTORY PATH_SEPARATOR_STRING L"cl");
+	swprintf(globalConfig.cachePath, MAX_PATH, MICROBENCH_DIRECTORY PATH_SEPARATOR_STRING L"cache");
+
+	if(!make_path(globalConfig.cachePath) || !write_data_file(compilerPath, 1024))
+		return EXIT_FAILURE;
+
+	wprintf(L"%-44ls %12ls %12ls %8ls %12ls\n", L"benchmark", L"ns/op", L"min ns/op", L"spread", L"MB/s");
+
+	struct ClCommandLine cmdLines[ARRAYSIZE(flagCounts)];
+	struct ClCommandLine noCompileCmdLines[ARRAYSIZE(flagCounts)];
+
+	for(int i = 0; i < ARRAYSIZE(flagCounts); ++i) {
+		make_cl_command_line(compilerPath, flagCounts[i], FALSE, &noCompileCmdLines[i]);
+		swprintf(name, ARRAYSIZE(name), L"parse_cl_command_line (%d flags, no /c)", flagCounts[i]);
+		run_benchmark(name, benchmark_classify_cl_command_line, &noCompileCmdLines[i], noCompileCmdLines[i].size);
+	}
+
+	for(int i = 0; i < ARRAYSIZE(flagCounts); ++i) {
+		make_cl_command_line(compilerPath, flagCounts[i], TRUE, &cmdLines[i]);
+		swprintf(name, ARRAYSIZE(name), L"parse_cl_command_line (%d flags, temp file)", flagCounts[i]);
+		run_benchmark(name, benchmark_parse_cl_command_line, &cmdLines[i], cmdLines[i].size);
+	}
+
+	for(int i = 0; i < ARRAYSIZE(flagCounts); ++i) {
+		swprintf(name, ARRAYSIZE(name), L"make_cmd_line (%d flags)", flagCounts[i]);
+		run_benchmark(name, benchmark_make_cmd_line, &cmdLines[i], cmdLines[i].size);
+	}
+
+	run_benchmark(L"hash64_to_string + path_from_hash64_string", benchmark_hash_to_path, NULL, 0);
+
+	for(int i = 0; i < ARRAYSIZE(fileSizes); ++i) {
+		swprintf(filePath, MAX_PATH, MICROBENCH_DIRECTORY PATH_SEPARATOR_STRING L"data%d", i);
+
+		if(!write_data_file(filePath, fileSizes[i]))
+			return EXIT_FAILURE;
+
+		swprintf(name, ARRAYSIZE(name), L"hash_file_content (%llu KB)", (unsigned long long)(fileSizes[i] / 1024));
+		run_benchmark(name, benchmark_hash_file_content, filePath, fileSizes[i]);
+	}
+
+	// A megabyte is typical for a preprocessed C++ source
+	struct KeyDerivation derivation = {&cmdLines[ARRAYSIZE(flagCounts) - 1], filePath};
+
+	swprintf(filePath, MAX_PATH, MICROBENCH_DIRECTORY PATH_SEPARATOR_STRING L"data2");
+	swprintf(name, ARRAYSIZE(name), L"key derivation (%d flags, 1024 KB)", flagCounts[ARRAYSIZE(flagCounts) - 1]);
+	run_benchmark(name, benchmark_key_derivation, &derivation, 0);
+
+	for(int i = 0; i < ARRAYSIZE(flagCounts); ++i) {
+		free_string_list(&cmdLines[i].args);
+		free_string_list(&noCompileCmdLines[i].args);
+	}
+
+	// Deleting everything that was created, the generations file is the only file in the cache
+	struct StringList files = {0};
+
+	list_directory(globalConfig.cachePath, collect_file_names, &files);
+
+	for(int i = 0; i < files.count; ++i) {
+		swprintf(filePath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", globalConfig.cachePath, files.strings[i]);
+		delete_file(filePath);
+	}
+
+	free_string_list(&files);
+	remove_directory(globalConfig.cachePath);
+	list_directory(MICROBENCH_DIRECTORY, collect_file_names, &files);
+
+	for(int i = 0; i < files.count; ++i) {
+		swprintf(filePath, MAX_PATH, MICROBENCH_DIRECTORY PATH_SEPARATOR_STRING L"%ls", files.strings[i]);
+		delete_file(filePath);
+	}
+
+	free_string_list(&files);
+	remove_directory(MICROBENCH_DIRECTORY);
+
+	return EXIT_SUCCESS;
+}
@@ -8,4 +8,4 @@ if /I "%1" == "release" (
 	set CL_FLAGS=%CL_FLAGS% /Od
 )
 
-cl lelcache.c %CL_FLAGS% /link Shell32.lib Ole32.lib
+cl lelcache.c platform_win32.c %CL_FLAGS% /link Shell32.lib Ole32.lib Winhttp.lib Ws2_32.lib
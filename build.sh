@@ -0,0 +1,11 @@
+#!/bin/sh
+
+CFLAGS="-std=gnu11 -Wall -Wextra -Wno-sign-compare -Wno-unknown-pragmas -g"
+
+if [ "$1" = "release" ]; then
+	CFLAGS="$CFLAGS -O2 -DNDEBUG"
+else
+	CFLAGS="$CFLAGS -O0"
+fi
+
+${CC:-cc} $CFLAGS lelcache.c platform_posix.c -o lelcache -lpthread
@@ -0,0 +1,165 @@
+/*
+ * Generated by tools/gen_cl_flags.c from cl_flags.txt, do not edit.
+ */
+
+#define CL_FLAG_TABLE_SIZE 256
+#define CL_FLAG_NUM_BUCKETS 64
+#define CL_FLAG_MAX_LENGTH 21
+
+const BYTE clFlagDisplacements[CL_FLAG_NUM_BUCKETS] = {
+	0, 2, 3, 1, 1, 2, 0, 7, 1, 7, 1, 2, 2, 1, 1, 1,
+	6, 1, 2, 1, 2, 2, 1, 2, 2, 1, 4, 3, 2, 1, 5, 1,
+	0, 0, 3, 2, 0, 2, 1, 4, 3, 1, 3, 6, 7, 0, 1, 2,
+	1, 1, 2, 1, 1, 1, 1, 9, 6, 1, 1, 3, 1, 0, 2, 1,
+};
+
+const struct ClFlag clFlagTable[CL_FLAG_TABLE_SIZE] = {
+	[3] = {"FI", 2, CL_FLAG_PREPROCESSOR},
+	[4] = {"RTC1", 4, CL_FLAG_CODEGEN},
+	[5] = {"constexpr", 9, CL_FLAG_CODEGEN},
+	[7] = {"Wall", 4, CL_FLAG_CODEGEN},
+	[8] = {"RTCs", 4, CL_FLAG_CODEGEN},
+	[10] = {"u", 1, CL_FLAG_PREPROCESSOR},
+	[11] = {"PH", 2, CL_FLAG_PREPROCESSOR},
+	[13] = {"Qfast_transcendentals", 21, CL_FLAG_CODEGEN},
+	[16] = {"J", 1, CL_FLAG_CODEGEN},
+	[19] = {"V", 1, CL_FLAG_CODEGEN},
+	[20] = {"diagnostics", 11, CL_FLAG_IGNORABLE},
+	[21] = {"Oi", 2, CL_FLAG_CODEGEN},
+	[22] = {"Tp", 2, CL_FLAG_UNCACHEABLE},
+	[23] = {"Zm", 2, CL_FLAG_CODEGEN},
+	[24] = {"Ob", 2, CL_FLAG_CODEGEN},
+	[25] = {"X", 1, CL_FLAG_PREPROCESSOR},
+	[31] = {"FC", 2, CL_FLAG_CODEGEN},
+	[33] = {"MTd", 3, CL_FLAG_CODEGEN},
+	[34] = {"RTCu", 4, CL_FLAG_CODEGEN},
+	[35] = {"F", 1, CL_FLAG_LINKER},
+	[36] = {"Fm", 2, CL_FLAG_IGNORABLE},
+	[37] = {"Oy", 2, CL_FLAG_CODEGEN},
+	[38] = {"errorReport", 11, CL_FLAG_IGNORABLE},
+	[40] = {"hotpatch", 8, CL_FLAG_CODEGEN},
+	[42] = {"H", 1, CL_FLAG_CODEGEN},
+	[43] = {"analyze", 7, CL_FLAG_UNCACHEABLE},
+	[47] = {"Fx", 2, CL_FLAG_UNCACHEABLE},
+	[49] = {"JMC", 3, CL_FLAG_CODEGEN},
+	[51] = {"nologo", 6, CL_FLAG_IGNORABLE},
+	[52] = {"arch", 4, CL_FLAG_CODEGEN},
+	[53] = {"QIfist", 6, CL_FLAG_CODEGEN},
+	[55] = {"Zc", 2, CL_FLAG_CODEGEN},
+	[56] = {"external", 8, CL_FLAG_CODEGEN},
+	[57] = {"LD", 2, CL_FLAG_LINKER},
+	[58] = {"Gd", 2, CL_FLAG_CODEGEN},
+	[59] = {"openmp", 6, CL_FLAG_CODEGEN},
+	[60] = {"showIncludes", 12, CL_FLAG_UNCACHEABLE},
+	[61] = {"Za", 2, CL_FLAG_CODEGEN},
+	[62] = {"GX", 2, CL_FLAG_CODEGEN},
+	[66] = {"LN", 2, CL_FLAG_LINKER},
+	[69] = {"D", 1, CL_FLAG_PREPROCESSOR},
+	[70] = {"MDd", 3, CL_FLAG_CODEGEN},
+	[71] = {"Gz", 2, CL_FLAG_CODEGEN},
+	[72] = {"?", 1, CL_FLAG_UNCACHEABLE},
+	[73] = {"E", 1, CL_FLAG_UNCACHEABLE},
+	[74] = {"Z7", 2, CL_FLAG_CODEGEN},
+	[75] = {"Yu", 2, CL_FLAG_UNCACHEABLE},
+	[76] = {"Zp", 2, CL_FLAG_CODEGEN},
+	[79] = {"Gw", 2, CL_FLAG_CODEGEN},
+	[80] = {"validate-charset", 16, CL_FLAG_CODEGEN},
+	[82] = {"Wv", 2, CL_FLAG_CODEGEN},
+	[83] = {"GH", 2, CL_FLAG_CODEGEN},
+	[84] = {"FR", 2, CL_FLAG_UNCACHEABLE},
+	[91] = {"Os", 2, CL_FLAG_CODEGEN},
+	[94] = {"Ot", 2, CL_FLAG_CODEGEN},
+	[95] = {"Tc", 2, CL_FLAG_UNCACHEABLE},
+	[96] = {"guard", 5, CL_FLAG_CODEGEN},
+	[98] = {"Y-", 2, CL_FLAG_UNCACHEABLE},
+	[101] = {"GR", 2, CL_FLAG_CODEGEN},
+	[102] = {"GL", 2, CL_FLAG_CODEGEN},
+	[104] = {"MT", 2, CL_FLAG_CODEGEN},
+	[107] = {"Gs", 2, CL_FLAG_CODEGEN},
+	[108] = {"Fi", 2, CL_FLAG_IGNORABLE},
+	[109] = {"Fe", 2, CL_FLAG_IGNORABLE},
+	[110] = {"TC", 2, CL_FLAG_CODEGEN},
+	[113] = {"Ze", 2, CL_FLAG_CODEGEN},
+	[114] = {"fastfail", 8, CL_FLAG_CODEGEN},
+	[117] = {"Fr", 2, CL_FLAG_UNCACHEABLE},
+	[118] = {"Zs", 2, CL_FLAG_UNCACHEABLE},
+	[122] = {"Zl", 2, CL_FLAG_CODEGEN},
+	[124] = {"c", 1, CL_FLAG_CODEGEN},
+	[127] = {"wd", 2, CL_FLAG_CODEGEN},
+	[128] = {"W", 1, CL_FLAG_CODEGEN},
+	[129] = {"U", 1, CL_FLAG_PREPROCESSOR},
+	[130] = {"Fd", 2, CL_FLAG_OUTPUT},
+	[132] = {"wo", 2, CL_FLAG_CODEGEN},
+	[133] = {"permissive", 10, CL_FLAG_CODEGEN},
+	[136] = {"Yd", 2, CL_FLAG_UNCACHEABLE},
+	[137] = {"vd", 2, CL_FLAG_CODEGEN},
+	[139] = {"Qpar-report", 11, CL_FLAG_CODEGEN},
+	[142] = {"Gh", 2, CL_FLAG_CODEGEN},
+	[143] = {"Qpar", 4, CL_FLAG_CODEGEN},
+	[145] = {"Gm", 2, CL_FLAG_CODEGEN},
+	[147] = {"Gv", 2, CL_FLAG_CODEGEN},
+	[149] = {"EP", 2, CL_FLAG_UNCACHEABLE},
+	[155] = {"FA", 2, CL_FLAG_UNCACHEABLE},
+	[157] = {"Qspectre", 8, CL_FLAG_CODEGEN},
+	[158] = {"std", 3, CL_FLAG_CODEGEN},
+	[160] = {"GZ", 2, CL_FLAG_CODEGEN},
+	[163] = {"await", 5, CL_FLAG_CODEGEN},
+	[165] = {"execution-charset", 17, CL_FLAG_CODEGEN},
+	[166] = {"ZH", 2, CL_FLAG_CODEGEN},
+	[167] = {"MD", 2, CL_FLAG_CODEGEN},
+	[169] = {"Yc", 2, CL_FLAG_UNCACHEABLE},
+	[171] = {"MP", 2, CL_FLAG_IGNORABLE},
+	[172] = {"Yl", 2, CL_FLAG_UNCACHEABLE},
+	[174] = {"AI", 2, CL_FLAG_PREPROCESSOR},
+	[175] = {"help", 4, CL_FLAG_UNCACHEABLE},
+	[176] = {"Zi", 2, CL_FLAG_CODEGEN},
+	[177] = {"volatile", 8, CL_FLAG_CODEGEN},
+	[178] = {"vm", 2, CL_FLAG_CODEGEN},
+	[179] = {"Zo", 2, CL_FLAG_CODEGEN},
+	[182] = {"fp", 2, CL_FLAG_CODEGEN},
+	[183] = {"Fp", 2, CL_FLAG_UNCACHEABLE},
+	[186] = {"Ox", 2, CL_FLAG_CODEGEN},
+	[187] = {"FS", 2, CL_FLAG_IGNORABLE},
+	[188] = {"WL", 2, CL_FLAG_CODEGEN},
+	[189] = {"Gy", 2, CL_FLAG_CODEGEN},
+	[190] = {"Qvec-report", 11, CL_FLAG_CODEGEN},
+	[192] = {"WX", 2, CL_FLAG_CODEGEN},
+	[193] = {"Qsafe_fp_loads", 14, CL_FLAG_CODEGEN},
+	[194] = {"bigobj", 6, CL_FLAG_CODEGEN},
+	[198] = {"clr", 3, CL_FLAG_CODEGEN},
+	[201] = {"O1", 2, CL_FLAG_CODEGEN},
+	[202] = {"Qimprecise_fwaits", 17, CL_FLAG_CODEGEN},
+	[203] = {"GS", 2, CL_FLAG_CODEGEN},
+	[204] = {"EHr", 3, CL_FLAG_CODEGEN},
+	[205] = {"O2", 2, CL_FLAG_CODEGEN},
+	[206] = {"ZW", 2, CL_FLAG_CODEGEN},
+	[207] = {"EHa", 3, CL_FLAG_CODEGEN},
+	[208] = {"doc", 3, CL_FLAG_UNCACHEABLE},
+	[209] = {"ZI", 2, CL_FLAG_CODEGEN},
+	[210] = {"P", 1, CL_FLAG_UNCACHEABLE},
+	[212] = {"favor", 5, CL_FLAG_CODEGEN},
+	[213] = {"Ge", 2, CL_FLAG_CODEGEN},
+	[214] = {"link", 4, CL_FLAG_LINKER},
+	[215] = {"GT", 2, CL_FLAG_CODEGEN},
+	[220] = {"LDd", 3, CL_FLAG_LINKER},
+	[221] = {"GA", 2, CL_FLAG_CODEGEN},
+	[222] = {"I", 1, CL_FLAG_PREPROCESSOR},
+	[223] = {"Gr", 2, CL_FLAG_CODEGEN},
+	[224] = {"w", 1, CL_FLAG_CODEGEN},
+	[225] = {"GF", 2, CL_FLAG_CODEGEN},
+	[227] = {"source-charset", 14, CL_FLAG_CODEGEN},
+	[232] = {"we", 2, CL_FLAG_CODEGEN},
+	[233] = {"FU", 2, CL_FLAG_CODEGEN},
+	[234] = {"Od", 2, CL_FLAG_CODEGEN},
+	[235] = {"utf-8", 5, CL_FLAG_CODEGEN},
+	[240] = {"TP", 2, CL_FLAG_CODEGEN},
+	[242] = {"sdl", 3, CL_FLAG_CODEGEN},
+	[243] = {"EHc", 3, CL_FLAG_CODEGEN},
+	[244] = {"Fa", 2, CL_FLAG_UNCACHEABLE},
+	[245] = {"EHs", 3, CL_FLAG_CODEGEN},
+	[250] = {"Fo", 2, CL_FLAG_OUTPUT},
+	[251] = {"C", 1, CL_FLAG_PREPROCESSOR},
+	[252] = {"Og", 2, CL_FLAG_CODEGEN},
+	[253] = {"RTCc", 4, CL_FLAG_CODEGEN},
+	[254] = {"Gu", 2, CL_FLAG_CODEGEN},
+};
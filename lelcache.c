@@ -1,9 +1,12 @@
-#include <Windows.h>
-#include <ShlObj.h>
+#include "platform.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <wchar.h>
+#include <wctype.h>
+#include <locale.h>
 
 #pragma warning(push, 0)
 #define XXH_INLINE_ALL
@@ -12,11 +15,12 @@
 
 /*
  * TODO:
- *     - Perform cleanup if current cache size >= max cache size
- *     - Make use of GetLastError where it makes sense
+ *     - Make use of GetLastError/errno where it makes sense
  */
 
 #define DEFAULT_CACHE_SIZE_GIGABYTES 4
+#define DEFAULT_NEGATIVE_CACHE_TTL_SECONDS (10 * 60)
+#define DEFAULT_SHARED_CACHE_SIZE_GIGABYTES 32
 
 #define LEL_HASH64_STRING_LENGTH (sizeof(XXH64_hash_t) * 2) // Two characters per byte
 
@@ -42,13 +46,73 @@ void path_from_hash64_string(Hash64String str, LPWSTR buffer) {
 		++buffer;
 		*buffer = str[i + 1];
 		++buffer;
-		*buffer = L'\\';
+		*buffer = PATH_SEPARATOR;
 		++buffer;
 	}
 
 	*buffer = L'\0';
 }
 
+#define CACHE_KEY_STRING_LENGTH (LEL_HASH64_STRING_LENGTH * 2)
+
+typedef WCHAR CacheKeyString[CACHE_KEY_STRING_LENGTH + 1];
+
+struct CacheKey {
+	XXH64_hash_t contentHash; // Hash of the preprocessed source
+	XXH64_hash_t flagsHash;   // Hash of the compiler command line and everything else that affects the result
+};
+
+void cache_key_to_string(const struct CacheKey* key, CacheKeyString out) {
+	hash64_to_string(key->contentHash, out);
+	hash64_to_string(key->flagsHash, out + LEL_HASH64_STRING_LENGTH);
+}
+
+/*
+ * Inverse of hash64_to_string. Only the first LEL_HASH64_STRING_LENGTH characters of str are read.
+ */
+BOOL hash64_from_string(LPCWSTR str, XXH64_hash_t* outHash) {
+	BYTE* bytes = (BYTE*)outHash;
+
+	for(int i = 0; i < LEL_HASH64_STRING_LENGTH; ++i) {
+		WCHAR c = str[i];
+		int nibble = c >= L'0' && c <= L'9' ? c - L'0' : c >= L'a' && c <= L'f' ? c - L'a' + 10 : -1;
+
+		if(nibble == -1)
+			return FALSE;
+
+		if(i % 2 == 0)
+			bytes[i / 2] = (BYTE)nibble;
+		else
+			bytes[i / 2] |= (BYTE)(nibble << 4);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Parses a key at the start of str, e.g. the name of an entry directory.
+ */
+BOOL cache_key_from_string(LPCWSTR str, struct CacheKey* outKey) {
+	return wcslen(str) >= CACHE_KEY_STRING_LENGTH && hash64_from_string(str, &outKey->contentHash) &&
+		   hash64_from_string(str + LEL_HASH64_STRING_LENGTH, &outKey->flagsHash);
+}
+
+/*
+ * Cache entries are stored in '<root>/aa/bb/cc/dd/<key>' where the directories are the first characters of the content hash.
+ * This keeps the number of entries per directory small.
+ */
+void entry_directory(LPCWSTR cacheRoot, const struct CacheKey* key, LPWSTR buffer) {
+	Hash64String contentHashStr;
+	CacheKeyString keyStr;
+
+	hash64_to_string(key->contentHash, contentHashStr);
+	cache_key_to_string(key, keyStr);
+	wcscpy(buffer, cacheRoot);
+	wcscat(buffer, PATH_SEPARATOR_STRING);
+	path_from_hash64_string(contentHashStr, buffer + wcslen(buffer));
+	wcscat(buffer, keyStr);
+}
+
 LPWSTR file_name_from_path(LPWSTR filePath) {
 	LPWSTR tmp = filePath;
 
@@ -83,17 +147,17 @@ LPWSTR file_extension_from_path(LPWSTR filePath) {
 }
 
 int __cdecl compare_strings_for_qsort(const void* a, const void* b) {
-	return lstrcmpW((LPCWSTR)a, (LPCWSTR)b);
+	return wcscmp(*(const LPCWSTR*)a, *(const LPCWSTR*)b);
 }
 
 
-void make_cmd_line(int argc, LPCWSTR* argv, LPWSTR buffer) {
+void make_cmd_line(int argc, const LPCWSTR* argv, LPWSTR buffer) {
 	int offset = 0;
 
 	for(int i = 0; i < argc; ++i) {
 		buffer[offset++] = L'\"';
-		lstrcpyW(buffer + offset, argv[i]);
-		offset += lstrlenW(argv[i]);;
+		wcscpy(buffer + offset, argv[i]);
+		offset += (int)wcslen(argv[i]);
 		buffer[offset++] = L'\"';
 		buffer[offset++] = L' ';
 	}
@@ -101,69 +165,411 @@ void make_cmd_line(int argc, LPCWSTR* argv, LPWSTR buffer) {
 	buffer[offset - 1] = '\0';
 }
 
-// Should be more than enough for pretty much any case...
-#define MAX_PREPROCESSOR_FLAGS 128
-#define MAX_COMPILER_FLAGS 128
+// Should be more than enough for pretty much any case, large projects pass a few hundred include directories and macros
+#define MAX_PREPROCESSOR_FLAGS 512
+#define MAX_COMPILER_FLAGS 512
+
+enum CompilerKind {
+	COMPILER_UNKNOWN,
+	COMPILER_CL,
+	COMPILER_CLANG_CL,
+	COMPILER_GCC,   // Also covers clang since it understands the same options
+	COMPILER_LINKER // link.exe or lld-link, never cached but forwarded so that build systems can use lelcache for every tool
+};
+
+/*
+ * Why an invocation wasn't cached. The number of invocations per reason is stored in cache.info so new reasons must be
+ * added at the end.
+ */
+enum UncacheableReason {
+	UNCACHEABLE_NOT_A_COMPILATION, // Linking
+	UNCACHEABLE_MULTIPLE_SOURCES,
+	UNCACHEABLE_NO_SOURCE,
+	UNCACHEABLE_RESPONSE_FILE,     // Or reading the source from stdin
+	UNCACHEABLE_NO_COMPILE_FLAG,   // /c or -c is missing
+	UNCACHEABLE_PREPROCESS_ONLY,   // /E, /EP, /P, -E, -M or -MM
+	UNCACHEABLE_LINKER_FLAG,
+	UNCACHEABLE_UNSUPPORTED_FLAG,  // Flags that write additional outputs or don't compile, e.g. /showIncludes, /Yc or -S
+	UNCACHEABLE_TOO_MANY_FLAGS,
+	UNCACHEABLE_MISSING_PROFILE,
+	UNCACHEABLE_RETIRED_GENERATION,
+	UNCACHEABLE_PREPROCESSOR_FAILED,
+	UNCACHEABLE_INTERNAL_ERROR,    // E.g. the file for the preprocessed source couldn't be created
+	NUM_UNCACHEABLE_REASONS
+};
+
+#define MAX_UNCACHEABLE_REASONS 24 // Room for new reasons in cache.info
+
+struct UncacheableReasonName {
+	const char* key; // Used in JSON output
+	LPCWSTR description;
+};
+
+const struct UncacheableReasonName uncacheableReasonNames[NUM_UNCACHEABLE_REASONS] = {
+	{"not_a_compilation", L"not a compilation"},
+	{"multiple_sources", L"multiple source files"},
+	{"no_source", L"no source file"},
+	{"response_file", L"response file or stdin"},
+	{"no_compile_flag", L"missing /c or -c"},
+	{"preprocess_only", L"only preprocessing"},
+	{"linker_flag", L"linker flags"},
+	{"unsupported_flag", L"unsupported flags"},
+	{"too_many_flags", L"too many flags"},
+	{"missing_profile", L"missing profile"},
+	{"retired_generation", L"retired generation"},
+	{"preprocessor_failed", L"preprocessor failed"},
+	{"internal_error", L"internal error"}
+};
 
 struct CommandLineInfo {
 	XXH64_hash_t compilerCmdLineHash;
-	LPWSTR sourceFile;
-	LPWSTR objectFile;
-	LPWSTR pdbFile;
-	LPWSTR temporaryPreprocessedFile;
-	LPWSTR temporaryCompiledObjectFile;
-	LPWSTR temporaryDebugInformationDatabase;
+	LPCWSTR sourceFile;
+	LPCWSTR objectFile;
+	LPCWSTR pdbFile;
+	LPCWSTR dependencyFile;
+	LPCWSTR profileFile; // Profile used for profile guided optimization, its content is part of the key
+	LPCWSTR temporaryPreprocessedFile;
+	BOOL diagnosticsOnStderr;
+	enum UncacheableReason uncacheableReason; // Set if the command line can't be cached
 	SIZE_T numPreprocessorFlags;
 	SIZE_T preprocessorCmdLineLength;
 	SIZE_T numCompilerFlags;
 	SIZE_T compilerCmdLineLength;
-	LPWSTR preprocessorFlags[MAX_PREPROCESSOR_FLAGS];
-	LPWSTR compilerFlags[MAX_COMPILER_FLAGS];
+	LPCWSTR preprocessorFlags[MAX_PREPROCESSOR_FLAGS];
+	LPCWSTR compilerFlags[MAX_COMPILER_FLAGS];
+	SIZE_T numHashedFlags;
+	LPCWSTR hashedFlags[MAX_COMPILER_FLAGS]; // The flags compilerCmdLineHash was computed from, in that order
+	XXH64_hash_t profileHash;
 	WCHAR preprocessorOutputFile[MAX_PATH];
 	WCHAR compilerOutputFile[MAX_PATH];
 	WCHAR debugInformationOutputFile[MAX_PATH];
 	WCHAR objectFileBuffer[MAX_PATH];
+	WCHAR dependencyFileBuffer[MAX_PATH];
+	WCHAR profileFileBuffer[MAX_PATH];
+	WCHAR workingDirectory[MAX_PATH]; // Hashed if the object file depends on it
 };
 
-BOOL is_linker_flag(LPCWSTR flag) {
-	return (flag[0] == L'F' && iswdigit(flag[1])) ||
-		   *flag == L'l' ||
-		   *flag == L'L';
+/*
+ * Figures out how to treat a compiler based on the file name of its executable.
+ * gcc and clang are often installed with a target prefix and version suffix like 'x86_64-linux-gnu-gcc-12' so those are
+ * ignored. The same goes for clang-cl which is commonly used to cross compile for Windows e.g. as 'clang-cl-17'.
+ */
+enum CompilerKind compiler_kind_from_path(LPCWSTR compilerPath) {
+	WCHAR name[MAX_PATH];
+
+	wcsncpy(name, file_name_from_path((LPWSTR)compilerPath), MAX_PATH - 1);
+	name[MAX_PATH - 1] = L'\0';
+
+	LPWSTR end = name + wcslen(name);
+
+	if(end - name > 4 && towlower(end[-4]) == L'.' && towlower(end[-3]) == L'e' && towlower(end[-2]) == L'x' && towlower(end[-1]) == L'e')
+		end -= 4;
+
+	*end = L'\0';
+
+	if(wcscmp(name, L"cl") == 0 || wcscmp(name, L"CL") == 0)
+		return COMPILER_CL;
+
+	// Stripping version suffix
+	LPWSTR versionStart = end;
+
+	while(versionStart != name && (iswdigit(versionStart[-1]) || versionStart[-1] == L'.'))
+		--versionStart;
+
+	if(versionStart != end && versionStart != name && versionStart[-1] == L'-')
+		versionStart[-1] = L'\0';
+
+	SIZE_T nameLength = wcslen(name);
+
+	if(nameLength >= 8 && wcscmp(name + nameLength - 8, L"clang-cl") == 0)
+		return COMPILER_CLANG_CL;
+
+	if(wcscmp(name, L"link") == 0 || wcscmp(name, L"LINK") == 0 || (nameLength >= 8 && wcscmp(name + nameLength - 8, L"lld-link") == 0))
+		return COMPILER_LINKER;
+
+	static const LPCWSTR gccNames[] = {L"gcc", L"g++", L"cc", L"c++", L"clang", L"clang++"};
+
+	for(int i = 0; i < ARRAYSIZE(gccNames); ++i) {
+		SIZE_T gccNameLength = wcslen(gccNames[i]);
+
+		if(nameLength >= gccNameLength &&
+		   wcscmp(name + nameLength - gccNameLength, gccNames[i]) == 0 &&
+		   (nameLength == gccNameLength || name[nameLength - gccNameLength - 1] == L'-')) { // Target prefix
+			return COMPILER_GCC;
+		}
+	}
+
+	return COMPILER_UNKNOWN;
 }
 
-BOOL is_preprocessor_flag(LPCWSTR flag) {
-	return (flag[0] == L'A' && flag[1] == L'I') ||
-		   *flag == L'C' ||
-		   *flag == L'D' ||
-		   (flag[0] == L'E' && flag[1] != L'H') ||
-		   (flag[0] == L'F' && (flag[1] == L'I' || flag[1] == L'U' || flag[1] == L'x')) ||
-		   *flag == L'I' ||
-		   *flag == L'P' ||
-		   *flag == L'U' ||
-		   *flag == L'u' ||
-		   *flag == L'X';
+enum ClFlagRole {
+	CL_FLAG_UNKNOWN,      // Not listed by 'cl /?', treated like CL_FLAG_CODEGEN
+	CL_FLAG_PREPROCESSOR, // Its effect is visible in the preprocessed output so it isn't hashed
+	CL_FLAG_CODEGEN,      // Affects the object file, hashed and passed to the preprocessor as well since it might change predefined macros
+	CL_FLAG_OUTPUT,       // Path of an output file that is cached (/Fo, /Fd)
+	CL_FLAG_LINKER,
+	CL_FLAG_IGNORABLE,    // Has no effect on the object file, e.g. /nologo
+	CL_FLAG_UNCACHEABLE   // Produces something other than or in addition to an object file
+};
+
+struct ClFlag {
+	const char* name; // Without the leading '/' or '-'
+	BYTE length;
+	BYTE role;
+};
+
+#include "cl_flags.h"
+
+/*
+ * Must be identical to cl_flag_hash in tools/gen_cl_flags.c.
+ */
+UINT32 cl_flag_hash(const char* str, SIZE_T length, UINT32 seed) {
+	UINT32 hash = 2166136261u ^ (seed * 16777619u);
+
+	for(SIZE_T i = 0; i < length; ++i) {
+		hash ^= (BYTE)str[i];
+		hash *= 16777619u;
+	}
+
+	return hash ^ (hash >> 15);
 }
 
-void add_preprocessor_flag(struct CommandLineInfo* cmdLineInfo, LPWSTR flag) {
-	if(cmdLineInfo->numPreprocessorFlags >= MAX_PREPROCESSOR_FLAGS) {
-		wprintf(L"ERROR: More than %i preprocessor flags. WTF are you doing?\n", MAX_PREPROCESSOR_FLAGS);
-		ExitProcess(EXIT_FAILURE);
+/*
+ * Looks up the role of a flag (without its leading '/' or '-') in the table generated from cl_flags.txt.
+ * Most flags have their value appended directly (e.g. '/DNAME' or '/wd4996') so the longest known prefix of the flag is
+ * what's looked for.
+ */
+enum ClFlagRole classify_cl_flag(LPCWSTR flag) {
+	char name[CL_FLAG_MAX_LENGTH];
+	SIZE_T length = 0;
+
+	while(length < CL_FLAG_MAX_LENGTH && flag[length] > 0 && flag[length] < 128) { // All cl flags are ASCII
+		name[length] = (char)flag[length];
+		++length;
 	}
 
+	for(; length > 0; --length) {
+		UINT32 bucket = cl_flag_hash(name, length, 0) % CL_FLAG_NUM_BUCKETS;
+		const struct ClFlag* entry = &clFlagTable[cl_flag_hash(name, length, clFlagDisplacements[bucket]) % CL_FLAG_TABLE_SIZE];
+
+		if(entry->length == length && memcmp(entry->name, name, length) == 0)
+			return (enum ClFlagRole)entry->role;
+	}
+
+	return CL_FLAG_UNKNOWN;
+}
+
+/*
+ * Returns FALSE if there are MAX_PREPROCESSOR_FLAGS flags already, the parsers reject the command line in that case.
+ */
+BOOL add_preprocessor_flag(struct CommandLineInfo* cmdLineInfo, LPCWSTR flag) {
+	if(cmdLineInfo->numPreprocessorFlags >= MAX_PREPROCESSOR_FLAGS)
+		return FALSE;
+
 	cmdLineInfo->preprocessorFlags[cmdLineInfo->numPreprocessorFlags] = flag;
-	cmdLineInfo->preprocessorCmdLineLength += lstrlenW(cmdLineInfo->preprocessorFlags[cmdLineInfo->numPreprocessorFlags]);
+	cmdLineInfo->preprocessorCmdLineLength += wcslen(cmdLineInfo->preprocessorFlags[cmdLineInfo->numPreprocessorFlags]);
 	++cmdLineInfo->numPreprocessorFlags;
+
+	return TRUE;
 }
 
-void add_compiler_flag(struct CommandLineInfo* cmdLineInfo, LPWSTR flag) {
-	if(cmdLineInfo->numCompilerFlags >= MAX_COMPILER_FLAGS) {
-		wprintf(L"ERROR: More than %i compiler flags. WTF are you doing?\n", MAX_COMPILER_FLAGS);
-		ExitProcess(EXIT_FAILURE);
-	}
+/*
+ * Returns FALSE if there are MAX_COMPILER_FLAGS flags already, the parsers reject the command line in that case.
+ */
+BOOL add_compiler_flag(struct CommandLineInfo* cmdLineInfo, LPCWSTR flag) {
+	if(cmdLineInfo->numCompilerFlags >= MAX_COMPILER_FLAGS)
+		return FALSE;
 
 	cmdLineInfo->compilerFlags[cmdLineInfo->numCompilerFlags] = flag;
-	cmdLineInfo->compilerCmdLineLength += lstrlenW(cmdLineInfo->compilerFlags[cmdLineInfo->numCompilerFlags]);
+	cmdLineInfo->compilerCmdLineLength += wcslen(cmdLineInfo->compilerFlags[cmdLineInfo->numCompilerFlags]);
 	++cmdLineInfo->numCompilerFlags;
+
+	return TRUE;
+}
+
+/*
+ * Records why a command line can't be cached. Always returns FALSE so that parsers can return its result.
+ */
+BOOL reject_command_line(struct CommandLineInfo* cmdLineInfo, enum UncacheableReason reason) {
+	cmdLineInfo->uncacheableReason = reason;
+
+	return FALSE;
+}
+
+/*
+ * Returns the value of a gcc option like '-o' if arg is that option. The value is either part of arg itself ('-ofile')
+ * or the next argument ('-o file') in which case *index is advanced. Returns NULL if arg is a different option.
+ */
+LPCWSTR gcc_option_value(int argc, LPWSTR* argv, int* index, LPCWSTR option) {
+	SIZE_T optionLength = wcslen(option);
+	LPCWSTR arg = argv[*index];
+
+	if(wcsncmp(arg, option, optionLength) != 0)
+		return NULL;
+
+	if(arg[optionLength] != L'\0')
+		return arg + optionLength;
+
+	if(*index + 1 >= argc)
+		return NULL;
+
+	++*index;
+
+	return argv[*index];
+}
+
+/*
+ * Options whose effect on the compilation is fully visible in the preprocessed output and that thus don't need to be part of
+ * the hash. All of them take a value. Since a value may follow the option directly, an option that starts with another one
+ * has to come first.
+ */
+const LPCWSTR gccPreprocessorOptions[] = {
+	L"-I", L"-D", L"-U", L"-include", L"-imacros", L"-isystem", L"-iquote", L"-idirafter", L"-iprefix", L"-iwithprefixbefore",
+	L"-iwithprefix", L"-isysroot", L"--sysroot="
+};
+
+/*
+ * Other options that take their value as a separate argument.
+ */
+const LPCWSTR gccOptionsWithSeparateValue[] = {
+	L"-x", L"-Xpreprocessor", L"-Xassembler", L"-Xlinker", L"-Xclang", L"-mllvm", L"-target", L"-arch", L"-MT", L"-MQ",
+	L"-L", L"-l", L"-T", L"-u", L"-z", L"--param", L"-aux-info", L"-imultilib"
+};
+
+/*
+ * Stores the profile of a '-fprofile-instr-use' or '-fprofile-use' flag (without its leading '-' or '/') in cmdLineInfo.
+ * Just like clang, 'default.profdata' is used if no file is given or if the value is a directory.
+ * Returns FALSE if flag is a different flag.
+ */
+BOOL parse_profile_flag(LPCWSTR flag, struct CommandLineInfo* cmdLineInfo) {
+	static const LPCWSTR profileFlags[] = {L"fprofile-instr-use", L"fprofile-use"};
+
+	for(int i = 0; i < ARRAYSIZE(profileFlags); ++i) {
+		SIZE_T length = wcslen(profileFlags[i]);
+
+		if(wcsncmp(flag, profileFlags[i], length) != 0 || (flag[length] != L'\0' && flag[length] != L'='))
+			continue;
+
+		LPCWSTR value = flag[length] == L'=' ? flag + length + 1 : L"";
+
+		if(*value == L'\0' || is_directory(value))
+			swprintf(cmdLineInfo->profileFileBuffer, MAX_PATH, L"%ls%lsdefault.profdata", value, *value ? PATH_SEPARATOR_STRING : L"");
+		else
+			swprintf(cmdLineInfo->profileFileBuffer, MAX_PATH, L"%ls", value);
+
+		cmdLineInfo->profileFile = cmdLineInfo->profileFileBuffer;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * clang-cl specific options that specify system directories. Their effect is visible in the preprocessed output just like
+ * that of /I. All of them take a value which is either appended directly or the next argument.
+ */
+const LPCWSTR clangClPreprocessorOptions[] = {
+	L"imsvc", L"winsysroot", L"vctoolsdir", L"winsdkdir", L"winsdkversion"
+};
+
+enum ClangClFlagResult {
+	CLANG_CL_FLAG_UNKNOWN, // Not specific to clang-cl so it is treated like any other cl flag
+	CLANG_CL_FLAG_HANDLED,
+	CLANG_CL_FLAG_UNCACHEABLE,
+	CLANG_CL_FLAG_TOO_MANY_FLAGS
+};
+
+/*
+ * Handles the options clang-cl understands in addition to the ones of cl. *index is advanced if the option takes the next
+ * argument as its value. Flags that have no effect on the object file are stored in unhashedFlags.
+ */
+enum ClangClFlagResult parse_clang_cl_flag(int argc, LPWSTR* argv, int* index, LPCWSTR* unhashedFlags, int* numUnhashedFlags, struct CommandLineInfo* cmdLineInfo) {
+	LPCWSTR flag = argv[*index] + 1;
+
+	// '/clang:' passes a gcc style option directly to clang
+	if(wcsncmp(flag, L"clang:", 6) == 0) {
+		LPCWSTR clangFlag = flag + 6;
+
+		if(wcscmp(clangFlag, L"-E") == 0 || wcscmp(clangFlag, L"-S") == 0 || wcscmp(clangFlag, L"-M") == 0 ||
+		   wcscmp(clangFlag, L"-MM") == 0 || wcscmp(clangFlag, L"-fsyntax-only") == 0 || wcsncmp(clangFlag, L"-save-temps", 11) == 0 ||
+		   wcscmp(clangFlag, L"-include-pch") == 0) {
+			return CLANG_CL_FLAG_UNCACHEABLE;
+		}
+
+		if(*clangFlag == L'-' && parse_profile_flag(clangFlag + 1, cmdLineInfo)) {
+			unhashedFlags[(*numUnhashedFlags)++] = argv[*index];
+
+			return CLANG_CL_FLAG_HANDLED;
+		}
+
+		for(int i = 0; i < ARRAYSIZE(gccPreprocessorOptions); ++i) {
+			SIZE_T length = wcslen(gccPreprocessorOptions[i]);
+
+			if(wcsncmp(clangFlag, gccPreprocessorOptions[i], length) == 0) {
+				if(!add_preprocessor_flag(cmdLineInfo, argv[*index]))
+					return CLANG_CL_FLAG_TOO_MANY_FLAGS;
+
+				// A separate value needs to be passed with '/clang:' as well
+				if(clangFlag[length] == L'\0' && *index + 1 < argc) {
+					++*index;
+
+					if(!add_preprocessor_flag(cmdLineInfo, argv[*index]))
+						return CLANG_CL_FLAG_TOO_MANY_FLAGS;
+				}
+
+				return CLANG_CL_FLAG_HANDLED;
+			}
+		}
+
+		return add_compiler_flag(cmdLineInfo, argv[*index]) ? CLANG_CL_FLAG_HANDLED : CLANG_CL_FLAG_TOO_MANY_FLAGS;
+	}
+
+	if(wcscmp(flag, L"Xclang") == 0) {
+		if(*index + 1 >= argc)
+			return CLANG_CL_FLAG_UNCACHEABLE;
+
+		if(!add_compiler_flag(cmdLineInfo, argv[*index]))
+			return CLANG_CL_FLAG_TOO_MANY_FLAGS;
+
+		++*index;
+
+		return add_compiler_flag(cmdLineInfo, argv[*index]) ? CLANG_CL_FLAG_HANDLED : CLANG_CL_FLAG_TOO_MANY_FLAGS;
+	}
+
+	// The path of the profile is not hashed since its content is, see hash_hidden_inputs
+	if(parse_profile_flag(flag, cmdLineInfo)) {
+		unhashedFlags[(*numUnhashedFlags)++] = argv[*index];
+
+		return CLANG_CL_FLAG_HANDLED;
+	}
+
+	// The linker only matters when clang-cl links which is never cached anyway
+	if(wcsncmp(flag, L"fuse-ld=", 8) == 0) {
+		unhashedFlags[(*numUnhashedFlags)++] = argv[*index];
+
+		return CLANG_CL_FLAG_HANDLED;
+	}
+
+	for(int i = 0; i < ARRAYSIZE(clangClPreprocessorOptions); ++i) {
+		SIZE_T length = wcslen(clangClPreprocessorOptions[i]);
+
+		if(wcsncmp(flag, clangClPreprocessorOptions[i], length) == 0) {
+			if(!add_preprocessor_flag(cmdLineInfo, argv[*index]))
+				return CLANG_CL_FLAG_TOO_MANY_FLAGS;
+
+			if(flag[length] == L'\0' && *index + 1 < argc) {
+				++*index;
+
+				if(!add_preprocessor_flag(cmdLineInfo, argv[*index]))
+					return CLANG_CL_FLAG_TOO_MANY_FLAGS;
+			}
+
+			return CLANG_CL_FLAG_HANDLED;
+		}
+	}
+
+	return CLANG_CL_FLAG_UNKNOWN;
 }
 
 /*
@@ -172,61 +578,85 @@ void add_compiler_flag(struct CommandLineInfo* cmdLineInfo, LPWSTR flag) {
  * of trying to find a cached object file.
  * A command line is considered not supported if it contains more than one input file, linker flags or it does not
  * compile a single object file (/c).
+ * Every flag is classified using the table generated from cl_flags.txt, see classify_cl_flag.
  * Compiler flags are sorted alphabetically and then hashed. This is technically not correct since it could give a wrong
  * result in edge cases where a flag overwrites a previous one (e.g. /Zi and /Z7) but this is considered a usage error and
  * thus is not handled. It will probably trigger an error in the future though.
+ * clang-cl is parsed the same way with its additional options being handled by parse_clang_cl_flag.
  */
-BOOL parse_cl_command_line(int argc, LPWSTR* argv, struct CommandLineInfo* cmdLineInfo) {
+BOOL parse_cl_command_line(int argc, LPWSTR* argv, BOOL isClangCl, struct CommandLineInfo* cmdLineInfo) {
 	BOOL compilesToObj = FALSE;
 	BOOL generatesPdb = FALSE;
-	BOOL noLogo = FALSE;
+	BOOL onlyInputFiles = FALSE;
+	LPCWSTR unhashedFlags[MAX_COMPILER_FLAGS];
+	int numUnhashedFlags = 0;
+
+	cmdLineInfo->diagnosticsOnStderr = isClangCl; // Unlike cl, clang-cl prints diagnostics to stderr
 
 	// Preprocessor command line initial setup
 
-	add_preprocessor_flag(cmdLineInfo, argv[1]); // cl.exe
-	add_preprocessor_flag(cmdLineInfo, L"/EP");
-	add_preprocessor_flag(cmdLineInfo, L"/P");
-	add_preprocessor_flag(cmdLineInfo, L"/nologo");
+	if(!add_preprocessor_flag(cmdLineInfo, argv[1]) || // cl.exe
+	   !add_preprocessor_flag(cmdLineInfo, L"/EP") ||
+	   !add_preprocessor_flag(cmdLineInfo, L"/P") ||
+	   !add_preprocessor_flag(cmdLineInfo, L"/nologo")) {
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
+	}
 
 	int endAdditionalPreprocessorArgs = (int)cmdLineInfo->numPreprocessorFlags;
 
 	// Compiler command line initial setup
 
-	add_compiler_flag(cmdLineInfo, argv[1]); // cl.exe
+	if(!add_compiler_flag(cmdLineInfo, argv[1])) // cl.exe
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
 	// Parsing command line
 
 	for(int i = 2; i < argc; ++i) { // We start at 2 since the first two arguments are always lelcache.exe and cl.exe
-		if(*argv[i] == L'/' || *argv[i] == L'-') {
+		if(isClangCl && wcscmp(argv[i], L"--") == 0) { // Everything after '--' is an input file
+			onlyInputFiles = TRUE;
+
+			continue;
+		}
+
+		// On POSIX systems absolute paths start with '/' as well. clang-cl treats them as input files if they exist.
+		BOOL isAbsoluteInputFile = isClangCl && PATH_SEPARATOR == L'/' && *argv[i] == L'/' && file_exists(argv[i]) && !is_directory(argv[i]);
+
+		if(!onlyInputFiles && !isAbsoluteInputFile && (*argv[i] == L'/' || *argv[i] == L'-')) {
 			LPCWSTR flag = argv[i] + 1;
 
-			if(is_linker_flag(flag))
-				return FALSE;
+			if(numUnhashedFlags >= MAX_COMPILER_FLAGS)
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-			if(is_preprocessor_flag(flag)) {
-				if(*flag == L'E' || *flag == L'P') // Only preprocess, don't compile
-					return FALSE;
+			if(isClangCl) {
+				enum ClangClFlagResult result = parse_clang_cl_flag(argc, argv, &i, unhashedFlags, &numUnhashedFlags, cmdLineInfo);
 
-				add_preprocessor_flag(cmdLineInfo, argv[i]);
+				if(result == CLANG_CL_FLAG_UNCACHEABLE)
+					return reject_command_line(cmdLineInfo, UNCACHEABLE_UNSUPPORTED_FLAG);
 
-				continue;
+				if(result == CLANG_CL_FLAG_TOO_MANY_FLAGS)
+					return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
+
+				if(result == CLANG_CL_FLAG_HANDLED)
+					continue;
 			}
 
-			if(*flag == L'F') {
-				LPCWSTR* outputFileStr = NULL;
+			switch(classify_cl_flag(flag)) {
+			case CL_FLAG_LINKER:
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_LINKER_FLAG);
+			case CL_FLAG_UNCACHEABLE:
+				if(wcscmp(flag, L"E") == 0 || wcscmp(flag, L"EP") == 0 || wcscmp(flag, L"P") == 0)
+					return reject_command_line(cmdLineInfo, UNCACHEABLE_PREPROCESS_ONLY);
 
-				switch(flag[1]) {
-				case L'o':
-					outputFileStr = &cmdLineInfo->objectFile;
-					break;
-				// The /FS and /Fd flags are ignored as pdb files are generated individually for each object file
-				case L'd':
-				case L'S':
-					continue;
-				}
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_UNSUPPORTED_FLAG);
+			case CL_FLAG_PREPROCESSOR:
+				if(!add_preprocessor_flag(cmdLineInfo, argv[i]))
+					return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-				if(outputFileStr) {
-					flag += 2; // Skipping 'Fx'
+				continue;
+			case CL_FLAG_OUTPUT:
+				// The /Fd flag is ignored as pdb files are generated individually for each object file
+				if(flag[1] == L'o') {
+					flag += 2; // Skipping 'Fo'
 
 					if(*flag == L':') // ':' is optional
 						++flag;
@@ -234,18 +664,16 @@ BOOL parse_cl_command_line(int argc, LPWSTR* argv, struct CommandLineInfo* cmdLi
 					while(iswspace(*flag))
 						++flag;
 
-					*outputFileStr = flag;
-
-					continue;
+					cmdLineInfo->objectFile = flag;
 				}
-			}
-
-			// /nologo is a commonly used flag whose presence has no effect on the outcome of the compilation.
-			// That's why we check whether it exists and add it to the command line later after it was hashed.
-			if(lstrcmpW(flag, L"nologo") == 0) {
-				noLogo = TRUE;
 
 				continue;
+			case CL_FLAG_IGNORABLE:
+				// These are added to the command line later after it was hashed so they don't cause unnecessary misses
+				unhashedFlags[numUnhashedFlags++] = argv[i];
+				continue;
+			default:
+				break;
 			}
 
 			// Default case: adding flag to compiler command line
@@ -256,10 +684,15 @@ BOOL parse_cl_command_line(int argc, LPWSTR* argv, struct CommandLineInfo* cmdLi
 			if(flag[0] == L'Z' && (flag[1] == L'i' || flag[1] == 'I'))
 				generatesPdb = TRUE;
 
-			add_compiler_flag(cmdLineInfo, argv[i]);
+			if(!add_compiler_flag(cmdLineInfo, argv[i]))
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 		} else {
+			// Response files and multiple source files are not supported at the moment
+			if(*argv[i] == L'@')
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_RESPONSE_FILE);
+
 			if(cmdLineInfo->sourceFile)
-				return FALSE; // Multiple source files are not supported at the moment
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_MULTIPLE_SOURCES);
 
 			cmdLineInfo->sourceFile = argv[i];
 		}
@@ -269,405 +702,7117 @@ BOOL parse_cl_command_line(int argc, LPWSTR* argv, struct CommandLineInfo* cmdLi
 		// Preprocessor options
 
 		WCHAR tempFileName[MAX_PATH];
-		LPWSTR sourceFileName = file_name_from_path(cmdLineInfo->sourceFile);
+		LPWSTR sourceFileName = file_name_from_path((LPWSTR)cmdLineInfo->sourceFile);
 
-		GetTempFileNameW(L".", sourceFileName, 0, tempFileName);
+		if(!create_temporary_file(L".", sourceFileName, tempFileName))
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_INTERNAL_ERROR);
 
-		lstrcpyW(cmdLineInfo->preprocessorOutputFile, L"/Fi:");
-		lstrcatW(cmdLineInfo->preprocessorOutputFile, tempFileName);
+		wcscpy(cmdLineInfo->preprocessorOutputFile, L"/Fi:");
+		wcscat(cmdLineInfo->preprocessorOutputFile, tempFileName);
 
 		cmdLineInfo->temporaryPreprocessedFile = cmdLineInfo->preprocessorOutputFile + ARRAYSIZE(L"/Fi:") - 1;
 
-		add_preprocessor_flag(cmdLineInfo, cmdLineInfo->preprocessorOutputFile);
-		add_preprocessor_flag(cmdLineInfo, cmdLineInfo->sourceFile);
+		int endPreprocessorArgs = (int)cmdLineInfo->numPreprocessorFlags;
+
+		BOOL flagsAdded = TRUE;
+
+		// Flags like /MD or /std change predefined macros so the preprocessor needs to see them as well
+		for(int i = 1; i < cmdLineInfo->numCompilerFlags && flagsAdded; ++i)
+			flagsAdded = add_preprocessor_flag(cmdLineInfo, cmdLineInfo->compilerFlags[i]);
+
+		flagsAdded = flagsAdded && add_preprocessor_flag(cmdLineInfo, cmdLineInfo->preprocessorOutputFile);
+
+		if(isClangCl) // Makes sure clang-cl doesn't mistake an absolute path for an option
+			flagsAdded = flagsAdded && add_preprocessor_flag(cmdLineInfo, L"--");
+
+		if(!flagsAdded || !add_preprocessor_flag(cmdLineInfo, cmdLineInfo->sourceFile))
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
 		// Compiler options
 
 		if(!cmdLineInfo->objectFile) { // If object file was not specified it is assumed to be the base name of the source file with the extension '.obj'
-			lstrcpyW(cmdLineInfo->objectFileBuffer, file_name_from_path(cmdLineInfo->sourceFile));
+			wcscpy(cmdLineInfo->objectFileBuffer, file_name_from_path((LPWSTR)cmdLineInfo->sourceFile));
 
 			LPWSTR ext = file_extension_from_path(cmdLineInfo->objectFileBuffer);
 
 			*ext = L'\0';
-			lstrcatW(ext, L"obj");
+			wcscat(ext, L"obj");
 
 			cmdLineInfo->objectFile = cmdLineInfo->objectFileBuffer;
 		}
 
-		lstrcpyW(cmdLineInfo->compilerOutputFile, L"/Fo:");
-		lstrcatW(cmdLineInfo->compilerOutputFile, cmdLineInfo->objectFile);
+		wcscpy(cmdLineInfo->compilerOutputFile, L"/Fo:");
+		wcscat(cmdLineInfo->compilerOutputFile, cmdLineInfo->objectFile);
 
 		// Sort and hash compiler command line
-		LPWSTR* sortedArgv = _malloca(cmdLineInfo->numCompilerFlags * sizeof(LPWSTR));
-		LPWSTR tempCmdLine = _malloca((cmdLineInfo->compilerCmdLineLength + cmdLineInfo->numCompilerFlags * 3) * sizeof(WCHAR));
+		LPCWSTR* sortedArgv = malloc(cmdLineInfo->numCompilerFlags * sizeof(LPCWSTR));
+		LPWSTR tempCmdLine = malloc((cmdLineInfo->compilerCmdLineLength + cmdLineInfo->numCompilerFlags * 3) * sizeof(WCHAR));
 
-		memcpy(sortedArgv, cmdLineInfo->compilerFlags, cmdLineInfo->numCompilerFlags * sizeof(LPWSTR));
+		memcpy(sortedArgv, cmdLineInfo->compilerFlags, cmdLineInfo->numCompilerFlags * sizeof(LPCWSTR));
 		qsort(sortedArgv, cmdLineInfo->numCompilerFlags, sizeof(*sortedArgv), compare_strings_for_qsort);
-		make_cmd_line((int)cmdLineInfo->numCompilerFlags, cmdLineInfo->compilerFlags, tempCmdLine);
-		cmdLineInfo->compilerCmdLineHash = XXH64(tempCmdLine, lstrlenW(tempCmdLine) * sizeof(*tempCmdLine), 0);
+		memcpy(cmdLineInfo->hashedFlags, sortedArgv, cmdLineInfo->numCompilerFlags * sizeof(LPCWSTR));
+		cmdLineInfo->numHashedFlags = cmdLineInfo->numCompilerFlags;
+		make_cmd_line((int)cmdLineInfo->numCompilerFlags, sortedArgv, tempCmdLine);
+		cmdLineInfo->compilerCmdLineHash = XXH64(tempCmdLine, wcslen(tempCmdLine) * sizeof(*tempCmdLine), 0);
 
-		_freea(tempCmdLine);
-		_freea(sortedArgv);
+		free(tempCmdLine);
+		free(sortedArgv);
 
-		if(noLogo)
-			add_compiler_flag(cmdLineInfo, L"/nologo");
+		for(int i = 0; i < numUnhashedFlags && flagsAdded; ++i)
+			flagsAdded = add_compiler_flag(cmdLineInfo, unhashedFlags[i]);
 
-		for(int i = endAdditionalPreprocessorArgs; i < cmdLineInfo->numPreprocessorFlags - 2; ++i) // Adding all preprocessor flags except /P and the ones for input and output files to the compiler command line
-			add_compiler_flag(cmdLineInfo, cmdLineInfo->preprocessorFlags[i]);
+		for(int i = endAdditionalPreprocessorArgs; i < endPreprocessorArgs && flagsAdded; ++i) // Adding all preprocessor flags given on the command line to the compiler command line
+			flagsAdded = add_compiler_flag(cmdLineInfo, cmdLineInfo->preprocessorFlags[i]);
 
-		add_compiler_flag(cmdLineInfo, cmdLineInfo->compilerOutputFile);
+		flagsAdded = flagsAdded && add_compiler_flag(cmdLineInfo, cmdLineInfo->compilerOutputFile);
 
 		if(generatesPdb) {
-			lstrcpyW(cmdLineInfo->debugInformationOutputFile, L"/Fd:");
-			lstrcatW(cmdLineInfo->debugInformationOutputFile, cmdLineInfo->objectFile);
-			lstrcatW(cmdLineInfo->debugInformationOutputFile, L".pdb");
-			add_compiler_flag(cmdLineInfo, cmdLineInfo->debugInformationOutputFile);
+			wcscpy(cmdLineInfo->debugInformationOutputFile, L"/Fd:");
+			wcscat(cmdLineInfo->debugInformationOutputFile, cmdLineInfo->objectFile);
+			wcscat(cmdLineInfo->debugInformationOutputFile, L".pdb");
+			flagsAdded = flagsAdded && add_compiler_flag(cmdLineInfo, cmdLineInfo->debugInformationOutputFile);
 
 			cmdLineInfo->pdbFile = cmdLineInfo->debugInformationOutputFile + ARRAYSIZE(L"/Fd:") - 1;
 		}
 
-		add_compiler_flag(cmdLineInfo, cmdLineInfo->sourceFile);
+		if(isClangCl)
+			flagsAdded = flagsAdded && add_compiler_flag(cmdLineInfo, L"--");
+
+		if(!flagsAdded || !add_compiler_flag(cmdLineInfo, cmdLineInfo->sourceFile))
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
 		return TRUE;
 	}
 
-	return FALSE;
+	return reject_command_line(cmdLineInfo, compilesToObj ? UNCACHEABLE_NO_SOURCE : UNCACHEABLE_NO_COMPILE_FLAG);
 }
 
-BOOL launch_process(LPCWSTR executable, LPWSTR cmdLine, LPPROCESS_INFORMATION outProcessInfo, BOOL silent) {
-	STARTUPINFOW startupInfo = {0};
+/*
+ * Parses a gcc or clang command line the same way parse_cl_command_line does for cl.
+ * The preprocessor is given every option except those concerning output files since many options like '-std' or '-m32'
+ * change predefined macros. Everything that isn't purely a preprocessor option (see gccPreprocessorOptions) is hashed in
+ * the order it appears since the order matters for gcc.
+ * When a dependency file is generated (-MD/-MMD) it contains the paths of the source, object and header files which is why
+ * the whole command line is hashed in that case. Debug information contains the working directory so it is hashed with -g.
+ */
+BOOL parse_gcc_command_line(int argc, LPWSTR* argv, struct CommandLineInfo* cmdLineInfo) {
+	BOOL compilesToObj = FALSE;
+	BOOL generatesDependencies = FALSE;
+	BOOL generatesDebugInfo = FALSE;
+	LPCWSTR hashedFlags[MAX_COMPILER_FLAGS];
+	LPCWSTR preprocessorOnlyFlags[MAX_COMPILER_FLAGS];
+	int numHashedFlags = 0;
+	int numPreprocessorOnlyFlags = 0;
+	SIZE_T hashedFlagsLength = 0;
 
-	startupInfo.cb = sizeof(startupInfo);
+	cmdLineInfo->diagnosticsOnStderr = TRUE;
 
-	if(silent) {
-		startupInfo.dwFlags = STARTF_USESTDHANDLES;
-		startupInfo.hStdOutput = CreateFileW(L"nul:", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	}
+	if(!add_preprocessor_flag(cmdLineInfo, argv[1]) || !add_compiler_flag(cmdLineInfo, argv[1])) // gcc
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-	BOOL result = CreateProcessW(executable, cmdLine, NULL, NULL, FALSE, 0, 0, NULL, &startupInfo, outProcessInfo);
+	for(int i = 2; i < argc; ++i) {
+		LPCWSTR arg = argv[i];
+		LPCWSTR value;
+		int firstIndex = i;
 
-	if(!result)
-		wprintf(L"Unable to start %s\n", executable);
+		// Leaves room for this option with its value and the source file, object file, working directory and compiler that
+		// are hashed after the loop together with the preprocessor only flags
+		if(numHashedFlags + numPreprocessorOnlyFlags + 6 >= MAX_COMPILER_FLAGS)
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-	return result;
-}
+		if(!add_compiler_flag(cmdLineInfo, arg)) // The compiler is invoked with exactly the given command line
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-DWORD wait_for_process(LPPROCESS_INFORMATION processInfo) {
-	DWORD exitCode = 0;
+		if(*arg != L'-' || arg[1] == L'\0') {
+			// Response files, stdin and multiple source files are not supported
+			if(*arg == L'@' || *arg == L'-')
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_RESPONSE_FILE);
 
-	WaitForSingleObject(processInfo->hProcess, INFINITE);
-	GetExitCodeProcess(processInfo->hProcess, &exitCode);
-	CloseHandle(processInfo->hThread);
-	CloseHandle(processInfo->hProcess);
+			if(cmdLineInfo->sourceFile)
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_MULTIPLE_SOURCES);
 
-	return exitCode;
-}
+			cmdLineInfo->sourceFile = arg;
 
-XXH64_hash_t hash_file_content(LPWSTR filePath) {
-	XXH64_hash_t hash = 0;
-	// TODO: Maybe use a memory mapped file instead?
-	HANDLE file = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			continue;
+		}
 
-	if(file != INVALID_HANDLE_VALUE) {
-		LARGE_INTEGER fileSize;
+		if(wcscmp(arg, L"-c") == 0) {
+			compilesToObj = TRUE;
 
-		if(GetFileSizeEx(file, &fileSize)) {
-			HANDLE heap = GetProcessHeap();
-			LPVOID mem = HeapAlloc(heap, 0, (SIZE_T)fileSize.QuadPart);
-			DWORD numBytesRead;
+			continue;
+		}
 
-			if(!ReadFile(file, mem, (DWORD)fileSize.QuadPart, &numBytesRead, NULL))
-				wprintf(L"Unable to read file content '%s'\n", filePath);
+		if(wcscmp(arg, L"-E") == 0 || wcscmp(arg, L"-M") == 0 || wcscmp(arg, L"-MM") == 0)
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_PREPROCESS_ONLY);
 
-			hash = XXH64(mem, numBytesRead, 0);
+		if(wcscmp(arg, L"-S") == 0 || wcscmp(arg, L"-fsyntax-only") == 0 || wcsncmp(arg, L"-save-temps", 11) == 0 || wcscmp(arg, L"-###") == 0)
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_UNSUPPORTED_FLAG); // Doesn't produce an object file or produces additional outputs
 
-			HeapFree(heap, 0, mem);
-		} else {
-			wprintf(L"Unable to determine file size for '%s'\n", filePath);
-		}
+		// The precompiled header isn't part of the preprocessed output so changes to it would go unnoticed
+		if(wcscmp(arg, L"-include-pch") == 0)
+			return reject_command_line(cmdLineInfo, UNCACHEABLE_UNSUPPORTED_FLAG);
 
-		CloseHandle(file);
-	} else {
-		wprintf(L"Unable to open file '%s'\n", filePath);
-	}
+		if((value = gcc_option_value(argc, argv, &i, L"-o")) != NULL) {
+			if(i != firstIndex && !add_compiler_flag(cmdLineInfo, value))
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-	return hash;
-}
+			cmdLineInfo->objectFile = value;
 
-UINT64 file_size(LPCWSTR filePath) {
-	WIN32_FILE_ATTRIBUTE_DATA fileAttribData;
+			continue;
+		}
 
-	// This is much faster than GetFileSize
-	return GetFileAttributesExW(filePath, GetFileExInfoStandard, &fileAttribData) ?
-		(UINT64)fileAttribData.nFileSizeHigh << 32 | fileAttribData.nFileSizeLow : 0;
-}
+		if(wcsncmp(arg, L"-g", 2) == 0) // Hashed like any other option below
+			generatesDebugInfo = wcscmp(arg, L"-g0") != 0;
 
-BOOL file_exists(LPCWSTR path) {
-	return GetFileAttributesW(path) != INVALID_FILE_ATTRIBUTES;
-}
+		// The path is hashed like any other option here but the content of the profile is part of the key as well. gcc's
+		// '-fprofile-use' reads .gcda files instead of a profile, so there's no profile and the compilation isn't cached.
+		parse_profile_flag(arg + 1, cmdLineInfo);
 
-BOOL make_path(LPCWSTR path) {
-	WCHAR tempPath[MAX_PATH];
-	int index = 0;
+		// Dependency file options are only passed to the compiler, otherwise the preprocessor would overwrite the file
 
-	while(*path) {
-		do {
-			tempPath[index++] = *path;
-			++path;
-		} while(*path && *path != L'\\');
+		if(wcscmp(arg, L"-MD") == 0 || wcscmp(arg, L"-MMD") == 0) {
+			generatesDependencies = TRUE;
 
-		tempPath[index] = L'\0';
+			continue;
+		}
 
-		DWORD attributes = GetFileAttributesW(tempPath);
+		if((value = gcc_option_value(argc, argv, &i, L"-MF")) != NULL) {
+			if(i != firstIndex && !add_compiler_flag(cmdLineInfo, value))
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-		if((attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0)) { // Create directory only if it doesn't exist
-			if(!CreateDirectoryW(tempPath, NULL)) {
-				wprintf(L"Unable to create directory '%s'\n", tempPath);
+			cmdLineInfo->dependencyFile = value;
 
-				return FALSE;
-			}
+			continue;
 		}
-	}
 
-	return TRUE;
-}
-
-struct CacheConfig {
-	UINT64 maxCacheSize;
-	WCHAR cachePath[MAX_PATH];
-} globalConfig = {0};
+		if(wcscmp(arg, L"-MP") == 0 || wcscmp(arg, L"-MG") == 0 || wcsncmp(arg, L"-MT", 3) == 0 || wcsncmp(arg, L"-MQ", 3) == 0) {
+			if(arg[3] == L'\0' && (arg[2] == L'T' || arg[2] == L'Q') && i + 1 < argc && !add_compiler_flag(cmdLineInfo, argv[++i]))
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-BOOL cache_config(struct CacheConfig* config, BOOL write) {
-	PWSTR appDataLocal;
-	WCHAR cacheConfigPath[MAX_PATH];
+			for(int j = firstIndex; j <= i; ++j) {
+				hashedFlags[numHashedFlags++] = argv[j];
+				hashedFlagsLength += wcslen(argv[j]);
+			}
 
-	SHGetKnownFolderPath(&FOLDERID_LocalAppData, 0, NULL, &appDataLocal);
-	lstrcpyW(cacheConfigPath, appDataLocal);
-	CoTaskMemFree(appDataLocal);
-	lstrcatW(cacheConfigPath, L"\\lelcache");
-	make_path(cacheConfigPath);
-	lstrcatW(cacheConfigPath, L"\\cache.config");
+			continue;
+		}
 
-	if(write) {
-		HANDLE file = CreateFileW(cacheConfigPath, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		BOOL isPreprocessorOption = wcscmp(arg, L"-nostdinc") == 0 || wcscmp(arg, L"-nostdinc++") == 0;
 
-		if(file == INVALID_HANDLE_VALUE) {
-			wprintf(L"Unable to open config file at '%s' for writing\n", cacheConfigPath);
+		for(int j = 0; j < ARRAYSIZE(gccPreprocessorOptions) && !isPreprocessorOption; ++j)
+			isPreprocessorOption = gcc_option_value(argc, argv, &i, gccPreprocessorOptions[j]) != NULL;
 
-			return FALSE;
+		for(int j = 0; j < ARRAYSIZE(gccOptionsWithSeparateValue) && i == firstIndex; ++j) {
+			if(wcscmp(arg, gccOptionsWithSeparateValue[j]) == 0 && i + 1 < argc)
+				++i;
 		}
 
-		DWORD numBytesWritten;
+		for(int j = firstIndex; j <= i; ++j) {
+			if((j != firstIndex && !add_compiler_flag(cmdLineInfo, argv[j])) || !add_preprocessor_flag(cmdLineInfo, argv[j]))
+				return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
 
-		WriteFile(file, config, sizeof(*config), &numBytesWritten, NULL);
-		CloseHandle(file);
-	} else {
-		if(file_exists(cacheConfigPath)) { // If file exists read it, otherwise initialize info with default values
-			HANDLE file = CreateFileW(cacheConfigPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if(isPreprocessorOption) {
+				preprocessorOnlyFlags[numPreprocessorOnlyFlags++] = argv[j];
+			} else {
+				hashedFlags[numHashedFlags++] = argv[j];
+				hashedFlagsLength += wcslen(argv[j]);
+			}
+		}
+	}
 
-			if(file == INVALID_HANDLE_VALUE) {
-				wprintf(L"Unable to open config file at '%s' for reading\n", cacheConfigPath);
+	if(!compilesToObj)
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_NO_COMPILE_FLAG);
 
-				return FALSE;
-			}
+	if(!cmdLineInfo->sourceFile)
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_NO_SOURCE);
 
-			DWORD numBytesRead;
-			BOOL success = ReadFile(file, config, sizeof(*config), &numBytesRead, NULL);
+	if(!cmdLineInfo->objectFile) { // Without -o the object file is the base name of the source file with the extension '.o'
+		wcscpy(cmdLineInfo->objectFileBuffer, file_name_from_path((LPWSTR)cmdLineInfo->sourceFile));
 
-			CloseHandle(file);
+		LPWSTR ext = file_extension_from_path(cmdLineInfo->objectFileBuffer);
 
-			return success;
-		} else {
-			PWSTR cachePath;
+		*ext = L'\0';
+		wcscat(ext, L"o");
 
-			*config = (struct CacheConfig){0};
-			config->maxCacheSize = DEFAULT_CACHE_SIZE_GIGABYTES * 1024ll * 1024ll * 1024ll;
-			SHGetKnownFolderPath(&FOLDERID_Profile, 0, NULL, &cachePath); // Default cache path is in the user directory
-			lstrcpyW(config->cachePath, cachePath);
-			lstrcatW(config->cachePath, L"\\.lelcache");
-			CoTaskMemFree(cachePath);
-		}
+		cmdLineInfo->objectFile = cmdLineInfo->objectFileBuffer;
 	}
 
-	return TRUE;
-}
+	if(generatesDependencies) {
+		if(!cmdLineInfo->dependencyFile) { // gcc replaces the extension of the object file with '.d'
+			wcscpy(cmdLineInfo->dependencyFileBuffer, cmdLineInfo->objectFile);
 
-struct CacheInfo {
-	UINT32 numCacheHits;
-	UINT32 numCacheMisses; // Does not include cases when the command line was not understood and the compiler was called directly. TODO: should it?
-	UINT64 currentCacheSize;
+			LPWSTR ext = file_extension_from_path(cmdLineInfo->dependencyFileBuffer);
+
+			if(ext[-1] != L'.')
+				*ext++ = L'.';
+
+			wcscpy(ext, L"d");
+
+			cmdLineInfo->dependencyFile = cmdLineInfo->dependencyFileBuffer;
+		}
+
+		for(int j = 0; j < numPreprocessorOnlyFlags; ++j) {
+			hashedFlags[numHashedFlags++] = preprocessorOnlyFlags[j];
+			hashedFlagsLength += wcslen(preprocessorOnlyFlags[j]);
+		}
+
+		hashedFlags[numHashedFlags++] = cmdLineInfo->sourceFile;
+		hashedFlags[numHashedFlags++] = cmdLineInfo->objectFile;
+		hashedFlagsLength += wcslen(cmdLineInfo->sourceFile) + wcslen(cmdLineInfo->objectFile);
+	} else {
+		cmdLineInfo->dependencyFile = NULL; // -MF without -MD/-MMD has no effect
+	}
+
+	if(generatesDebugInfo && current_directory(cmdLineInfo->workingDirectory)) {
+		hashedFlags[numHashedFlags++] = cmdLineInfo->workingDirectory;
+		hashedFlagsLength += wcslen(cmdLineInfo->workingDirectory);
+	}
+
+	// Preprocessor options
+
+	WCHAR tempFileName[MAX_PATH];
+
+	if(!create_temporary_file(L".", file_name_from_path((LPWSTR)cmdLineInfo->sourceFile), tempFileName))
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_INTERNAL_ERROR);
+
+	wcscpy(cmdLineInfo->preprocessorOutputFile, tempFileName);
+	cmdLineInfo->temporaryPreprocessedFile = cmdLineInfo->preprocessorOutputFile;
+
+	// Line markers are kept since the debug information in the object file and the diagnostics name the source files and
+	// the lines in them
+	if(!add_preprocessor_flag(cmdLineInfo, L"-E") ||
+	   !add_preprocessor_flag(cmdLineInfo, L"-o") ||
+	   !add_preprocessor_flag(cmdLineInfo, cmdLineInfo->preprocessorOutputFile) ||
+	   !add_preprocessor_flag(cmdLineInfo, cmdLineInfo->sourceFile)) {
+		return reject_command_line(cmdLineInfo, UNCACHEABLE_TOO_MANY_FLAGS);
+	}
+
+	// The compiler itself is hashed as well just like with cl
+	hashedFlags[numHashedFlags++] = argv[1];
+	hashedFlagsLength += wcslen(argv[1]);
+
+	LPWSTR tempCmdLine = malloc((hashedFlagsLength + numHashedFlags * 3) * sizeof(WCHAR));
+
+	make_cmd_line(numHashedFlags, hashedFlags, tempCmdLine);
+	cmdLineInfo->compilerCmdLineHash = XXH64(tempCmdLine, wcslen(tempCmdLine) * sizeof(*tempCmdLine), 0);
+	memcpy(cmdLineInfo->hashedFlags, hashedFlags, numHashedFlags * sizeof(LPCWSTR));
+	cmdLineInfo->numHashedFlags = numHashedFlags;
+
+	free(tempCmdLine);
+
+	return TRUE;
+}
+
+/*
+ * Returns everything that was written to a file created by create_output_capture_file.
+ * The result must be freed with free.
+ */
+LPVOID read_captured_output(FileHandle file, SIZE_T* outSize) {
+	UINT64 fileSize = file_handle_size(file);
+	LPVOID mem = NULL;
+
+	*outSize = 0;
+
+	if(fileSize > 0) {
+		mem = malloc((SIZE_T)fileSize);
+
+		// The file pointer is shared with the child process and thus at the end
+		if(mem && seek_file(file, 0))
+			*outSize = read_file(file, mem, (SIZE_T)fileSize);
+	}
+
+	return mem;
+}
+
+/*
+ * Returns the whole content of a file or NULL if it can't be read. The result must be freed with free.
+ */
+LPVOID read_whole_file(LPCWSTR filePath, SIZE_T* outSize) {
+	FileHandle file = open_file(filePath, OPEN_FOR_READING);
+
+	if(file == INVALID_FILE_HANDLE)
+		return NULL;
+
+	SIZE_T fileSize = (SIZE_T)file_handle_size(file);
+	LPVOID mem = malloc(fileSize > 0 ? fileSize : 1);
+
+	if(mem && read_file(file, mem, fileSize) != fileSize) {
+		free(mem);
+		mem = NULL;
+	}
+
+	close_file(file);
+	*outSize = fileSize;
+
+	return mem;
+}
+
+XXH64_hash_t hash_file_content(LPCWSTR filePath) {
+	XXH64_hash_t hash = 0;
+	// TODO: Maybe use a memory mapped file instead?
+	FileHandle file = open_file(filePath, OPEN_FOR_READING);
+
+	if(file != INVALID_FILE_HANDLE) {
+		SIZE_T fileSize = (SIZE_T)file_handle_size(file);
+		LPVOID mem = malloc(fileSize > 0 ? fileSize : 1);
+		SIZE_T numBytesRead = read_file(file, mem, fileSize);
+
+		if(numBytesRead != fileSize)
+			wprintf(L"Unable to read file content '%ls'\n", filePath);
+
+		hash = XXH64(mem, numBytesRead, 0);
+
+		free(mem);
+		close_file(file);
+	} else {
+		wprintf(L"Unable to open file '%ls'\n", filePath);
+	}
+
+	return hash;
+}
+
+/*
+ * Mixes everything into the key that affects the result but is neither part of the preprocessed source nor of the command
+ * line: the generation of the compiler (see current_generation) and the content of the profile used for profile guided
+ * optimization. Returns FALSE if the profile doesn't exist in which case the compiler should be called directly so that
+ * it reports the error.
+ */
+BOOL hash_hidden_inputs(XXH64_hash_t generation, struct CommandLineInfo* cmdLineInfo) {
+	cmdLineInfo->compilerCmdLineHash = XXH64(&generation, sizeof(generation), cmdLineInfo->compilerCmdLineHash);
+
+	if(cmdLineInfo->profileFile) {
+		if(!file_exists(cmdLineInfo->profileFile))
+			return FALSE;
+
+		cmdLineInfo->profileHash = hash_file_content(cmdLineInfo->profileFile);
+		cmdLineInfo->compilerCmdLineHash = XXH64(&cmdLineInfo->profileHash, sizeof(cmdLineInfo->profileHash), cmdLineInfo->compilerCmdLineHash);
+	}
+
+	return TRUE;
+}
+
+BOOL make_path(LPCWSTR path) {
+	WCHAR tempPath[MAX_PATH];
+	int index = 0;
+
+	while(*path) {
+		do {
+			tempPath[index++] = *path;
+			++path;
+		} while(*path && *path != PATH_SEPARATOR);
+
+		tempPath[index] = L'\0';
+
+		if(!is_directory(tempPath)) { // Create directory only if it doesn't exist
+			if(!create_directory(tempPath)) {
+				wprintf(L"Unable to create directory '%ls'\n", tempPath);
+
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * Reads a struct that was written with write_struct_file. If the file is smaller than the struct, e.g. because it was
+ * written by an older version, the remaining fields are left untouched.
+ */
+BOOL read_struct_file(LPCWSTR path, LPVOID data, SIZE_T size) {
+	FileHandle file = open_file(path, OPEN_FOR_READING);
+
+	if(file == INVALID_FILE_HANDLE)
+		return FALSE;
+
+	read_file(file, data, size);
+	close_file(file);
+
+	return TRUE;
+}
+
+BOOL write_struct_file(LPCWSTR path, LPCVOID data, SIZE_T size) {
+	FileHandle file = open_file(path, OPEN_FOR_WRITING);
+
+	if(file == INVALID_FILE_HANDLE)
+		return FALSE;
+
+	BOOL success = write_file(file, data, size);
+
+	close_file(file);
+
+	return success;
+}
+
+/*
+ * Writes str as a quoted JSON string in UTF-8 to buffer and returns the number of bytes written. The output is cut short if
+ * buffer is too small.
+ */
+SIZE_T json_string(LPCWSTR str, char* buffer, SIZE_T bufferSize) {
+	SIZE_T length = 0;
+
+	if(bufferSize < 3)
+		return 0;
+
+	buffer[length++] = '"';
+
+	for(; *str && length + 8 < bufferSize; ++str) {
+		UINT32 c = (UINT32)*str;
+
+		if(c >= 0xD800 && c < 0xDC00 && str[1] >= 0xDC00 && str[1] < 0xE000) // UTF-16 surrogate pair
+			c = 0x10000 + ((c - 0xD800) << 10) + ((UINT32)*++str - 0xDC00);
+
+		if(c == '"' || c == '\\') {
+			buffer[length++] = '\\';
+			buffer[length++] = (char)c;
+		} else if(c < 0x20) {
+			length += snprintf(buffer + length, bufferSize - length, "\\u%04x", c);
+		} else if(c < 0x80) {
+			buffer[length++] = (char)c;
+		} else if(c < 0x800) {
+			buffer[length++] = (char)(0xC0 | c >> 6);
+			buffer[length++] = (char)(0x80 | (c & 0x3F));
+		} else if(c < 0x10000) {
+			buffer[length++] = (char)(0xE0 | c >> 12);
+			buffer[length++] = (char)(0x80 | (c >> 6 & 0x3F));
+			buffer[length++] = (char)(0x80 | (c & 0x3F));
+		} else {
+			buffer[length++] = (char)(0xF0 | c >> 18);
+			buffer[length++] = (char)(0x80 | (c >> 12 & 0x3F));
+			buffer[length++] = (char)(0x80 | (c >> 6 & 0x3F));
+			buffer[length++] = (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	buffer[length++] = '"';
+	buffer[length] = '\0';
+
+	return length;
+}
+
+/*
+ * Tracing
+ *
+ * If LELCACHE_TRACE is set to a file path, every invocation records how long each of its phases took and appends them to
+ * that file as a timeline in the Chrome trace event format, which can be opened in Perfetto or chrome://tracing. All
+ * processes of a build append to the same file so it shows where lelcache spends time across all cores. The file is an
+ * array of events that is never closed, which is allowed by the format. Delete it before the next build to start over.
+ */
+
+#define TRACE_ENVIRONMENT_VARIABLE L"LELCACHE_TRACE"
+#define TRACE_MAX_SPANS 32
+
+struct TraceSpan {
+	const char* name;
+	UINT64 start; // Same units as current_system_time
+	UINT64 end;
+};
+
+struct Trace {
+	WCHAR path[MAX_PATH]; // Empty if tracing is disabled
+	struct TraceSpan spans[TRACE_MAX_SPANS];
+	SIZE_T numSpans;
+} globalTrace = {0};
+
+void start_trace(void) {
+	WCHAR path[MAX_PATH];
+
+	if(get_environment_variable(TRACE_ENVIRONMENT_VARIABLE, path, MAX_PATH) && path[0] != L'\0' && !full_path(path, globalTrace.path))
+		globalTrace.path[0] = L'\0';
+}
+
+/*
+ * Returns the start time to pass to end_span.
+ */
+UINT64 begin_span(void) {
+	return globalTrace.path[0] != L'\0' ? current_system_time() : 0;
+}
+
+void end_span(const char* name, UINT64 start) {
+	if(globalTrace.path[0] == L'\0' || globalTrace.numSpans == TRACE_MAX_SPANS)
+		return;
+
+	globalTrace.spans[globalTrace.numSpans++] = (struct TraceSpan){name, start, current_system_time()};
+}
+
+#define UNIX_EPOCH 116444736000000000ull // In 100ns intervals since 1601
+
+/*
+ * Trace times are in microseconds. Timestamps are counted from 1970 so that they still fit into the doubles trace viewers
+ * parse them into.
+ */
+void format_trace_time(char* buffer, SIZE_T bufferSize, UINT64 time) {
+	snprintf(buffer, bufferSize, "%llu.%u", (unsigned long long)(time / 10), (unsigned)(time % 10));
+}
+
+/*
+ * Appends the spans of this process to the trace, followed by one for the whole invocation from start until now which is
+ * labeled with the source file and the result.
+ */
+void finish_trace(UINT64 start, LPCWSTR sourceFile, const char* result) {
+	if(globalTrace.path[0] == L'\0')
+		return;
+
+	UINT64 end = current_system_time();
+	SIZE_T capacity = (globalTrace.numSpans + 1) * 256 + 2 * MAX_PATH * 4;
+	char* events = malloc(capacity);
+	char source[MAX_PATH * 4 + 3];
+	char timestamp[32], duration[32];
+	DWORD pid = current_process_id();
+	SIZE_T length = 0;
+
+	json_string(sourceFile ? sourceFile : L"", source, sizeof(source));
+	length += snprintf(events + length, capacity - length, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":%s}},\n", pid, source);
+
+	struct TraceSpan invocation = {"lelcache", start, end};
+
+	for(SIZE_T i = 0; i <= globalTrace.numSpans; ++i) {
+		const struct TraceSpan* span = i < globalTrace.numSpans ? &globalTrace.spans[i] : &invocation;
+
+		format_trace_time(timestamp, sizeof(timestamp), span->start - UNIX_EPOCH);
+		format_trace_time(duration, sizeof(duration), span->end - span->start);
+		length += snprintf(events + length, capacity - length, "{\"name\":\"%s\",\"cat\":\"lelcache\",\"ph\":\"X\",\"ts\":%s,\"dur\":%s,\"pid\":%u,\"tid\":%u",
+						   span->name, timestamp, duration, pid, pid);
+
+		if(span == &invocation)
+			length += snprintf(events + length, capacity - length, ",\"args\":{\"source\":%s,\"result\":\"%s\"}", source, result);
+
+		length += snprintf(events + length, capacity - length, "},\n");
+	}
+
+	FileHandle file = lock_file(globalTrace.path);
+
+	if(file != INVALID_FILE_HANDLE) {
+		UINT64 size = file_handle_size(file);
+
+		if(size == 0)
+			write_file(file, "[\n", 2);
+		else
+			seek_file(file, size);
+
+		write_file(file, events, length);
+		unlock_file(file);
+	}
+
+	free(events);
+}
+
+struct CacheConfig {
+	UINT64 maxCacheSize;
+	WCHAR cachePath[MAX_PATH];
+	UINT32 negativeCacheTtl; // Number of seconds a failed compilation is cached, 0 means failures are not cached at all
+	WCHAR remoteUrl[MAX_PATH]; // HTTP cache server shared between machines, empty if there is none
+	WCHAR sharedCachePath[MAX_PATH]; // Second tier that is checked after the local cache, empty if there is none
+	UINT64 maxSharedCacheSize;
+	UINT32 sharedWritePolicy; // enum SharedWritePolicy
+	WCHAR bundlePath[MAX_PATH]; // Bundle that is mounted as a read-only tier, empty if there is none
+	UINT32 minAdmissionFrequency; // Number of misses before a compilation is stored, see admit_entry
+	UINT32 minAdmissionTime;      // In milliseconds
+	UINT64 maxAdmissionSize;      // In bytes, 0 means no limit
+	UINT32 keepKeyInputs;         // Whether new entries record what their key was computed from for 'lelcache explain'
+	UINT32 accessLogSize;         // In megabytes, 0 disables the access log for 'lelcache simulate'
+} globalConfig = {0};
+
+BOOL cache_config(struct CacheConfig* config, BOOL write) {
+	WCHAR cacheConfigPath[MAX_PATH];
+
+	if(!config_directory(cacheConfigPath)) {
+		wprintf(L"Unable to determine the config directory\n");
+
+		return FALSE;
+	}
+
+	make_path(cacheConfigPath);
+	wcscat(cacheConfigPath, PATH_SEPARATOR_STRING L"cache.config");
+
+	if(write) {
+		if(!write_struct_file(cacheConfigPath, config, sizeof(*config))) {
+			wprintf(L"Unable to open config file at '%ls' for writing\n", cacheConfigPath);
+
+			return FALSE;
+		}
+	} else {
+		// Default values are set first so that fields missing from config files of older versions keep their defaults
+		*config = (struct CacheConfig){0};
+		config->maxCacheSize = DEFAULT_CACHE_SIZE_GIGABYTES * 1024ll * 1024ll * 1024ll;
+		config->negativeCacheTtl = DEFAULT_NEGATIVE_CACHE_TTL_SECONDS;
+		config->maxSharedCacheSize = DEFAULT_SHARED_CACHE_SIZE_GIGABYTES * 1024ll * 1024ll * 1024ll;
+		config->minAdmissionFrequency = 1;
+		default_cache_directory(config->cachePath);
+
+		if(file_exists(cacheConfigPath)) { // If file exists read it, otherwise keep the default values
+			if(!read_struct_file(cacheConfigPath, config, sizeof(*config))) {
+				wprintf(L"Unable to open config file at '%ls' for reading\n", cacheConfigPath);
+
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+struct CacheInfo {
+	UINT32 numCacheHits;
+	UINT32 numCacheMisses; // Does not include invocations that couldn't be cached, those are counted in numUncacheable
+	UINT64 currentCacheSize;
+	UINT32 numNegativeCacheHits; // Cache hits that replayed a failed compilation, these are also included in numCacheHits
+	UINT32 numRemoteHits; // Cache hits that were downloaded from the remote cache first, also included in numCacheHits
+	UINT32 numSharedHits; // Cache hits that were found in the shared tier, also included in numCacheHits
+	UINT32 numBundleHits; // Cache hits that were found in the mounted bundle, also included in numCacheHits
+	UINT32 numNotAdmitted; // Successful misses whose result was not stored because of the admission policy
+	UINT32 numUncacheable[MAX_UNCACHEABLE_REASONS]; // Indexed by enum UncacheableReason
+	UINT64 compileTimeSaved; // In milliseconds, the compile time of the entries of all hits that have a known one
+	UINT64 compileTime;      // In milliseconds, of all misses
+	UINT64 preprocessorTime; // In milliseconds
+	UINT64 bytesRead;        // Output files copied from the cache
+	UINT64 bytesWritten;     // Files stored in the cache
+	UINT64 numEvictions;     // Entries deleted by evict_tier
+	UINT64 evictedSize;
+};
+
+/*
+ * Every tier has its own info, the statistics are only recorded in the one of the local cache.
+ */
+BOOL cache_info(LPCWSTR cacheRoot, struct CacheInfo* info, BOOL write) {
+	WCHAR cacheInfoPath[MAX_PATH];
+
+	wcscpy(cacheInfoPath, cacheRoot);
+	make_path(cacheInfoPath);
+	wcscat(cacheInfoPath, PATH_SEPARATOR_STRING L"cache.info");
+
+	if(write) {
+		if(!write_struct_file(cacheInfoPath, info, sizeof(*info))) {
+			wprintf(L"Unable to open cache info file at '%ls' for writing\n", cacheInfoPath);
+
+			return FALSE;
+		}
+	} else {
+		*info = (struct CacheInfo){0}; // Fields missing from info files of older versions are zero
+
+		if(file_exists(cacheInfoPath)) { // If file exists read it, otherwise keep the default values
+			if(!read_struct_file(cacheInfoPath, info, sizeof(*info))) {
+				wprintf(L"Unable to open cache info file at '%ls' for reading\n", cacheInfoPath);
+
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * The cache.info file is possibly being accessed by multiple processes at once which must be synchronized.
+ * This blocks until the lock is acquired and then reads the info. The returned handle must be passed to unlock_cache_info
+ * which writes the modified info back.
+ */
+FileHandle lock_cache_info(LPCWSTR cacheRoot, struct CacheInfo* info) {
+	WCHAR lockPath[MAX_PATH];
+
+	wcscpy(lockPath, cacheRoot);
+	make_path(lockPath);
+	wcscat(lockPath, PATH_SEPARATOR_STRING L"cache.lock");
+
+	FileHandle lock = lock_file(lockPath);
+
+	cache_info(cacheRoot, info, FALSE);
+
+	return lock;
+}
+
+void unlock_cache_info(LPCWSTR cacheRoot, FileHandle lock, struct CacheInfo* info) {
+	cache_info(cacheRoot, info, TRUE);
+	unlock_file(lock);
+}
+
+void count_uncacheable(enum UncacheableReason reason) {
+	struct CacheInfo info;
+	FileHandle lock = lock_cache_info(globalConfig.cachePath, &info);
+
+	++info.numUncacheable[reason];
+	unlock_cache_info(globalConfig.cachePath, lock, &info);
+}
+
+struct CompileFailureHeader {
+	UINT64 timestamp; // System time in FILETIME units at which the failure was recorded
+	DWORD exitCode;
+	XXH64_hash_t context; // See compile_failure_context
+};
+
+/*
+ * Returns a path next to 'path' that is unique to this process so that a file can be written there first and then be
+ * moved to its final location. This way other processes never see partially written cache entries.
+ */
+void temporary_path_for(LPCWSTR path, LPWSTR buffer) {
+	swprintf(buffer, MAX_PATH, L"%ls.%lu.tmp", path, (unsigned long)current_process_id());
+}
+
+BOOL publish_data(LPCWSTR cachePath, LPCVOID data, SIZE_T size) {
+	WCHAR tempPath[MAX_PATH];
+
+	temporary_path_for(cachePath, tempPath);
+
+	if(write_struct_file(tempPath, data, size) && move_file(tempPath, cachePath))
+		return TRUE;
+
+	delete_file(tempPath);
+
+	return FALSE;
+}
+
+BOOL publish_file(LPCWSTR sourcePath, LPCWSTR cachePath) {
+	WCHAR tempPath[MAX_PATH];
+
+	temporary_path_for(cachePath, tempPath);
+
+	if(copy_file(sourcePath, tempPath) && move_file(tempPath, cachePath))
+		return TRUE;
+
+	delete_file(tempPath);
+
+	return FALSE;
+}
+
+/*
+ * The key of an entry doesn't say which file was compiled and, with cl, where its lines are, but the diagnostics of a
+ * failure name both. So failures are only replayed for the same source file with the same content compiled in the same
+ * directory.
+ */
+XXH64_hash_t compile_failure_context(const struct CommandLineInfo* cmdLineInfo) {
+	WCHAR directory[MAX_PATH] = {0};
+	XXH64_hash_t hash = hash_file_content(cmdLineInfo->sourceFile);
+
+	current_directory(directory);
+	hash = XXH64(directory, wcslen(directory) * sizeof(WCHAR), hash);
+
+	return XXH64(cmdLineInfo->sourceFile, wcslen(cmdLineInfo->sourceFile) * sizeof(WCHAR), hash);
+}
+
+/*
+ * Failed compilations are cached as well so that every invocation doesn't need to pay the full compile again just to get
+ * the same error. The exit code is stored followed by the diagnostics the compiler printed.
+ */
+BOOL store_compile_failure(LPCWSTR path, DWORD exitCode, XXH64_hash_t context, LPCVOID output, SIZE_T outputSize) {
+	WCHAR tempPath[MAX_PATH];
+
+	temporary_path_for(path, tempPath);
+
+	FileHandle file = open_file(tempPath, OPEN_FOR_WRITING);
+
+	if(file == INVALID_FILE_HANDLE) {
+		wprintf(L"Unable to open '%ls' for writing\n", tempPath);
+
+		return FALSE;
+	}
+
+	struct CompileFailureHeader header = {current_system_time(), exitCode, context};
+	BOOL success = write_file(file, &header, sizeof(header)) && write_file(file, output, outputSize);
+
+	close_file(file);
+
+	if(success && move_file(tempPath, path))
+		return TRUE;
+
+	delete_file(tempPath);
+
+	return FALSE;
+}
+
+/*
+ * Prints the diagnostics of a cached compile failure and returns the exit code of the original compilation.
+ * Returns FALSE if there is no failure cached at path, if it was recorded for a different source file (see
+ * compile_failure_context) or if it is older than the configured time to live since failures can also be caused by the
+ * environment (e.g. a full disk) rather than by the source code.
+ */
+BOOL replay_compile_failure(LPCWSTR path, const struct CommandLineInfo* cmdLineInfo, DWORD* outExitCode) {
+	if(globalConfig.negativeCacheTtl == 0 || !file_exists(path))
+		return FALSE;
+
+	FileHandle file = open_file(path, OPEN_FOR_READING);
+
+	if(file == INVALID_FILE_HANDLE)
+		return FALSE;
+
+	struct CompileFailureHeader header;
+	BOOL success = read_file(file, &header, sizeof(header)) == sizeof(header) &&
+				   current_system_time() - header.timestamp < globalConfig.negativeCacheTtl * 10000000ull && // FILETIME is in 100ns units
+				   header.context == compile_failure_context(cmdLineInfo);
+
+	if(success) {
+		SIZE_T outputSize;
+		LPVOID output = read_captured_output(file, &outputSize);
+
+		// read_captured_output returns the whole file so the header needs to be skipped
+		if(output && outputSize > sizeof(header))
+			write_to_console((BYTE*)output + sizeof(header), outputSize - sizeof(header), cmdLineInfo->diagnosticsOnStderr);
+
+		free(output);
+		*outExitCode = header.exitCode;
+	}
+
+	close_file(file);
+
+	return success;
+}
+
+/*
+ * When multiple processes miss on the same key at the same time only one of them should compile while the others wait for
+ * it to publish its result. The process that compiles holds a lease which is a file in the directory of the cache entry.
+ * The owner regularly increments a heartbeat counter in that file so that leases left behind by a crashed process or an
+ * unreachable machine can be detected and taken over.
+ */
+
+#define COMPILE_LEASE_HEARTBEAT_INTERVAL_MS 1000
+#define COMPILE_LEASE_STALE_TIMEOUT_MS (15 * 1000)
+#define COMPILE_LEASE_POLL_INTERVAL_MS 50
+
+struct CompileLeaseContent {
+	DWORD ownerPid;
+	WCHAR ownerHost[HOST_NAME_LENGTH];
+	UINT64 heartbeat;
+};
+
+struct CompileLease {
+	FileHandle file;
+	ThreadHandle heartbeatThread;
+	EventHandle stopEvent;
+	WCHAR path[MAX_PATH];
+	struct CompileLeaseContent content;
+};
+
+enum CompileLeaseResult {
+	COMPILE_LEASE_ACQUIRED,
+	COMPILE_LEASE_RELEASED, // Another process held the lease and either published its result or gave up
+	COMPILE_LEASE_FAILED    // The lease could not be acquired so the caller should compile without it
+};
+
+void write_compile_lease(struct CompileLease* lease) {
+	seek_file(lease->file, 0);
+	write_file(lease->file, &lease->content, sizeof(lease->content));
+}
+
+DWORD compile_lease_heartbeat(LPVOID param) {
+	struct CompileLease* lease = param;
+
+	while(!wait_for_event(lease->stopEvent, COMPILE_LEASE_HEARTBEAT_INTERVAL_MS)) {
+		++lease->content.heartbeat;
+		write_compile_lease(lease);
+	}
+
+	return 0;
+}
+
+BOOL read_compile_lease(LPCWSTR leasePath, struct CompileLeaseContent* outContent) {
+	FileHandle file = open_file(leasePath, OPEN_FOR_READING);
+
+	if(file == INVALID_FILE_HANDLE)
+		return FALSE;
+
+	*outContent = (struct CompileLeaseContent){0}; // The owner might not have written anything yet
+
+	read_file(file, outContent, sizeof(*outContent));
+	close_file(file);
+
+	return TRUE;
+}
+
+/*
+ * A lease owned by a process on this machine that no longer exists doesn't need to time out first.
+ */
+BOOL is_compile_lease_owner_dead(const struct CompileLeaseContent* content) {
+	WCHAR hostName[HOST_NAME_LENGTH];
+
+	get_host_name(hostName, ARRAYSIZE(hostName));
+
+	return content->ownerPid != 0 &&
+		   wcsncmp(hostName, content->ownerHost, HOST_NAME_LENGTH) == 0 &&
+		   is_local_process_dead(content->ownerPid);
+}
+
+/*
+ * Tries to acquire the lease at leasePath. If another process holds it this blocks until that process releases it or
+ * until the lease is considered stale in which case it is taken over.
+ */
+enum CompileLeaseResult acquire_compile_lease(LPCWSTR leasePath, struct CompileLease* lease) {
+	BOOL tookOver = FALSE;
+
+	for(;;) {
+		BOOL alreadyExists;
+
+		lease->file = create_exclusive_file(leasePath, &alreadyExists);
+
+		if(lease->file != INVALID_FILE_HANDLE)
+			break;
+
+		// If that still happens after a takeover the previous owner is stuck with the file open so we stop waiting for it
+		if(tookOver || !alreadyExists)
+			return COMPILE_LEASE_FAILED;
+
+		struct CompileLeaseContent observed = {0};
+		struct CompileLeaseContent current;
+		UINT64 lastProgress = current_tick_count();
+
+		for(;;) {
+			sleep_ms(COMPILE_LEASE_POLL_INTERVAL_MS);
+
+			if(!read_compile_lease(leasePath, &current))
+				return COMPILE_LEASE_RELEASED;
+
+			if(memcmp(&current, &observed, sizeof(current)) != 0) {
+				observed = current;
+				lastProgress = current_tick_count();
+			} else if(current_tick_count() - lastProgress > COMPILE_LEASE_STALE_TIMEOUT_MS || is_compile_lease_owner_dead(&current)) {
+				// If two processes take over at the same time both of them compile which is wasteful but harmless
+				delete_file(leasePath);
+				tookOver = TRUE;
+
+				break;
+			}
+		}
+	}
+
+	wcscpy(lease->path, leasePath);
+	lease->content = (struct CompileLeaseContent){0};
+	lease->content.ownerPid = current_process_id();
+	get_host_name(lease->content.ownerHost, ARRAYSIZE(lease->content.ownerHost));
+	write_compile_lease(lease);
+
+	lease->stopEvent = create_event();
+	lease->heartbeatThread = start_thread(compile_lease_heartbeat, lease);
+
+	return COMPILE_LEASE_ACQUIRED;
+}
+
+void release_compile_lease(struct CompileLease* lease) {
+	if(lease->heartbeatThread) {
+		signal_event(lease->stopEvent);
+		join_thread(lease->heartbeatThread);
+	}
+
+	destroy_event(lease->stopEvent);
+
+	// Deleting before closing so that a lease another process creates in between is never deleted by accident
+	delete_file(lease->path);
+	close_file(lease->file);
+}
+
+/*
+ * Copies the cached result for a compilation to the requested output paths or replays a cached failure.
+ * hashPath is the directory of the cache entry and hashPathEnd points to its null terminator.
+ * Returns FALSE if there is nothing cached yet.
+ */
+BOOL copy_from_cache(LPWSTR hashPath, LPWSTR hashPathEnd, struct CommandLineInfo* cmdLineInfo, int* outExitCode) {
+	struct CacheInfo cacheInfo;
+	FileHandle cacheInfoLock;
+	DWORD cachedExitCode;
+
+	wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"obj");
+
+	if(file_exists(hashPath)) {
+		touch_file(hashPath); // Eviction removes the least recently used entries first
+
+		UINT64 spanStart = begin_span();
+
+		// Eviction, e.g. by the background worker, can delete the entry at any time in which case it is compiled instead
+		BOOL copied = copy_file(hashPath, cmdLineInfo->objectFile);
+
+		if(copied && cmdLineInfo->pdbFile) {
+			wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"pdb");
+			copied = copy_file(hashPath, cmdLineInfo->pdbFile);
+		}
+
+		if(copied && cmdLineInfo->dependencyFile) {
+			wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"dep");
+			copied = copy_file(hashPath, cmdLineInfo->dependencyFile);
+		}
+
+		end_span("copy outputs", spanStart);
+		*hashPathEnd = L'\0';
+
+		if(!copied)
+			return FALSE;
+
+		cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+		++cacheInfo.numCacheHits;
+		unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
+
+		return TRUE;
+	}
+
+	wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"fail");
+
+	if(replay_compile_failure(hashPath, cmdLineInfo, &cachedExitCode)) {
+		*outExitCode = (int)cachedExitCode;
+
+		cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+		++cacheInfo.numCacheHits;
+		++cacheInfo.numNegativeCacheHits;
+		unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
+
+		*hashPathEnd = L'\0';
+
+		return TRUE;
+	}
+
+	*hashPathEnd = L'\0';
+
+	return FALSE;
+}
+
+/*
+ * Files a cache entry can consist of in the order they are published. The object file comes last since its existence marks
+ * a complete entry.
+ */
+const LPCWSTR entryFileNames[] = {L"pdb", L"dep", L"fail", L"inputs", L"meta", L"obj"};
+
+/*
+ * Stored in the 'meta' file of every entry that was compiled locally so that eviction can take into account how expensive
+ * it is to rebuild an entry.
+ */
+struct EntryMetadata {
+	UINT64 compileTime; // In milliseconds
+	UINT64 size;        // Of the output files
+	XXH64_hash_t generation; // See current_generation
+	XXH64_hash_t namespaceId;
+};
+
+/*
+ * Returns the compile time stored in the metadata of the entry in entryDir or 0 if it is unknown.
+ */
+UINT64 entry_compile_time(LPCWSTR entryDir) {
+	WCHAR path[MAX_PATH];
+	struct EntryMetadata metadata = {0};
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"meta", entryDir);
+	read_struct_file(path, &metadata, sizeof(metadata));
+
+	return metadata.compileTime;
+}
+
+/*
+ * Merkle summaries
+ *
+ * A cache root can keep a summary of the keys of its complete entries so that two caches can find out which entries only
+ * one of them has without listing all of them, see 'lelcache sync'. The keys are split into MERKLE_NUM_LEAVES ranges by the
+ * first two bytes of their content hash, which are also the first two directory levels of an entry. The hash of a range
+ * is the XOR of the hashes of its keys so that it can be updated whenever a single entry is added or removed.
+ * The summary is only maintained once it exists. It is created by the first sync and repaired whenever a sync lists a range.
+ */
+
+#define MERKLE_FILE_NAME L"merkle.summary"
+#define MERKLE_NUM_LEAVES 65536
+
+UINT32 merkle_leaf_index(const struct CacheKey* key) {
+	const BYTE* bytes = (const BYTE*)&key->contentHash;
+
+	return (UINT32)bytes[0] << 8 | bytes[1];
+}
+
+UINT64 merkle_key_hash(const struct CacheKey* key) {
+	return XXH64(key, sizeof(*key), 2); // Different seed than the summaries so that the hashes are independent
+}
+
+/*
+ * Adds the key to the summary of cacheRoot if it isn't part of it yet and removes it otherwise. Must be called whenever the
+ * object file of an entry is created or deleted.
+ */
+void toggle_merkle_leaf(LPCWSTR cacheRoot, const struct CacheKey* key) {
+	WCHAR path[MAX_PATH];
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING MERKLE_FILE_NAME, cacheRoot);
+
+	if(!file_exists(path))
+		return;
+
+	FileHandle file = lock_file(path);
+	UINT64 offset = merkle_leaf_index(key) * sizeof(UINT64);
+	UINT64 leaf;
+
+	if(file == INVALID_FILE_HANDLE)
+		return;
+
+	// A summary with the wrong size is being rebuilt by a sync which replaces it completely
+	if(file_handle_size(file) == MERKLE_NUM_LEAVES * sizeof(UINT64) && seek_file(file, offset) && read_file(file, &leaf, sizeof(leaf)) == sizeof(leaf)) {
+		leaf ^= merkle_key_hash(key);
+
+		if(seek_file(file, offset))
+			write_file(file, &leaf, sizeof(leaf));
+	}
+
+	unlock_file(file);
+}
+
+#define ENTRY_PACK_MAGIC 0x4b50454c // 'LEPK'
+
+struct EntryPackHeader {
+	UINT32 magic;
+	UINT32 numFiles;
+};
+
+struct EntryPackFile {
+	char name[8]; // One of entryFileNames
+	UINT64 size;
+};
+
+/*
+ * Packs all files of the cache entry in entryDir into a single buffer so that it can be stored as one object.
+ * The files follow each other in the order of entryFileNames, each of them preceded by an EntryPackFile.
+ * Returns NULL if the entry has no files. The result must be freed with free.
+ */
+LPVOID pack_entry(LPCWSTR entryDir, SIZE_T* outSize) {
+	WCHAR path[MAX_PATH];
+	LPVOID files[ARRAYSIZE(entryFileNames)] = {0};
+	SIZE_T fileSizes[ARRAYSIZE(entryFileNames)] = {0};
+	struct EntryPackHeader header = {ENTRY_PACK_MAGIC, 0};
+	SIZE_T packSize = sizeof(header);
+	BYTE* pack = NULL;
+
+	for(int i = 0; i < ARRAYSIZE(entryFileNames); ++i) {
+		swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", entryDir, entryFileNames[i]);
+
+		if(file_exists(path) && (files[i] = read_whole_file(path, &fileSizes[i])) != NULL) {
+			++header.numFiles;
+			packSize += sizeof(struct EntryPackFile) + fileSizes[i];
+		}
+	}
+
+	if(header.numFiles > 0 && (pack = malloc(packSize)) != NULL) {
+		BYTE* cursor = pack;
+
+		memcpy(cursor, &header, sizeof(header));
+		cursor += sizeof(header);
+
+		for(int i = 0; i < ARRAYSIZE(entryFileNames); ++i) {
+			if(!files[i])
+				continue;
+
+			struct EntryPackFile file = {{0}, fileSizes[i]};
+
+			for(int j = 0; entryFileNames[i][j] != L'\0'; ++j) // The names are ASCII
+				file.name[j] = (char)entryFileNames[i][j];
+
+			memcpy(cursor, &file, sizeof(file));
+			cursor += sizeof(file);
+			memcpy(cursor, files[i], fileSizes[i]);
+			cursor += fileSizes[i];
+		}
+
+		*outSize = packSize;
+	}
+
+	for(int i = 0; i < ARRAYSIZE(entryFileNames); ++i)
+		free(files[i]);
+
+	return pack;
+}
+
+/*
+ * Writes the files of a pack created by pack_entry to the entry for key in the cache at cacheRoot the same way a
+ * compilation publishes them. The whole pack is validated first so that a corrupt download never produces a partial entry.
+ */
+BOOL unpack_entry(LPCVOID pack, SIZE_T packSize, LPCWSTR cacheRoot, const struct CacheKey* key, UINT64* outSize) {
+	const BYTE* cursor = pack;
+	const BYTE* end = cursor + packSize;
+	struct EntryPackHeader header;
+	int fileIndices[ARRAYSIZE(entryFileNames)];
+
+	if(packSize < sizeof(header))
+		return FALSE;
+
+	memcpy(&header, cursor, sizeof(header));
+	cursor += sizeof(header);
+
+	if(header.magic != ENTRY_PACK_MAGIC || header.numFiles == 0 || header.numFiles > ARRAYSIZE(entryFileNames))
+		return FALSE;
+
+	for(UINT32 i = 0; i < header.numFiles; ++i) {
+		struct EntryPackFile file;
+
+		if((SIZE_T)(end - cursor) < sizeof(file))
+			return FALSE;
+
+		memcpy(&file, cursor, sizeof(file));
+		cursor += sizeof(file);
+		fileIndices[i] = -1;
+
+		for(int j = 0; j < ARRAYSIZE(entryFileNames); ++j) {
+			WCHAR name[ARRAYSIZE(file.name) + 1] = {0};
+
+			for(int k = 0; k < ARRAYSIZE(file.name); ++k)
+				name[k] = (BYTE)file.name[k];
+
+			if(wcscmp(name, entryFileNames[j]) == 0)
+				fileIndices[i] = j;
+		}
+
+		if(fileIndices[i] == -1 || file.size > (UINT64)(end - cursor))
+			return FALSE;
+
+		cursor += file.size;
+	}
+
+	WCHAR entryDir[MAX_PATH];
+	WCHAR path[MAX_PATH];
+
+	entry_directory(cacheRoot, key, entryDir);
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", entryDir);
+
+	BOOL isNew = !file_exists(path);
+
+	if(!make_path(entryDir))
+		return FALSE;
+
+	cursor = (const BYTE*)pack + sizeof(header);
+	*outSize = 0;
+
+	for(UINT32 i = 0; i < header.numFiles; ++i) {
+		struct EntryPackFile file;
+
+		memcpy(&file, cursor, sizeof(file));
+		cursor += sizeof(file);
+		swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", entryDir, entryFileNames[fileIndices[i]]);
+
+		if(!publish_data(path, cursor, (SIZE_T)file.size))
+			return FALSE;
+
+		cursor += file.size;
+		*outSize += file.size;
+	}
+
+	if(isNew && file_exists(path)) // The object file is the last one in a pack
+		toggle_merkle_leaf(cacheRoot, key);
+
+	return TRUE;
+}
+
+/*
+ * Finds a file in a pack created by pack_entry without unpacking it. Returns FALSE if it is not there or the pack is corrupt.
+ */
+BOOL find_packed_file(LPCVOID pack, SIZE_T packSize, LPCWSTR name, LPCVOID* outData, UINT64* outSize) {
+	const BYTE* cursor = pack;
+	const BYTE* end = cursor + packSize;
+	struct EntryPackHeader header;
+
+	if(packSize < sizeof(header))
+		return FALSE;
+
+	memcpy(&header, cursor, sizeof(header));
+	cursor += sizeof(header);
+
+	if(header.magic != ENTRY_PACK_MAGIC)
+		return FALSE;
+
+	for(UINT32 i = 0; i < header.numFiles; ++i) {
+		struct EntryPackFile file;
+		int j = 0;
+
+		if((SIZE_T)(end - cursor) < sizeof(file))
+			return FALSE;
+
+		memcpy(&file, cursor, sizeof(file));
+		cursor += sizeof(file);
+
+		if(file.size > (UINT64)(end - cursor))
+			return FALSE;
+
+		while(j < ARRAYSIZE(file.name) && name[j] != L'\0' && (BYTE)file.name[j] == name[j])
+			++j;
+
+		if(name[j] == L'\0' && (j == ARRAYSIZE(file.name) || file.name[j] == '\0')) {
+			*outData = cursor;
+			*outSize = file.size;
+
+			return TRUE;
+		}
+
+		cursor += file.size;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Compression of bundles
+ *
+ * A small LZ77 compressor using the block format of LZ4: a sequence consists of a token whose upper four bits are the
+ * number of literals and whose lower four bits are the match length minus LZ_MIN_MATCH, followed by the literals, the
+ * 16 bit offset of the match and additional length bytes for lengths that don't fit into four bits. The last sequence
+ * only consists of literals.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 16
+#define LZ_MAX_OFFSET 65535
+
+SIZE_T lz_compress_bound(SIZE_T size) {
+	return size + size / 255 + 16;
+}
+
+BYTE* lz_write_length(BYTE* out, SIZE_T length) {
+	for(; length >= 255; length -= 255)
+		*out++ = 255;
+
+	*out++ = (BYTE)length;
+
+	return out;
+}
+
+BYTE* lz_write_sequence(BYTE* out, const BYTE* literals, SIZE_T numLiterals, SIZE_T offset, SIZE_T matchLength) {
+	BYTE* token = out++;
+	SIZE_T matchCode = matchLength > 0 ? matchLength - LZ_MIN_MATCH : 0;
+
+	*token = (BYTE)((numLiterals >= 15 ? 15 : numLiterals) << 4 | (matchCode >= 15 ? 15 : matchCode));
+
+	if(numLiterals >= 15)
+		out = lz_write_length(out, numLiterals - 15);
+
+	memcpy(out, literals, numLiterals);
+	out += numLiterals;
+
+	if(matchLength > 0) {
+		*out++ = (BYTE)offset;
+		*out++ = (BYTE)(offset >> 8);
+
+		if(matchCode >= 15)
+			out = lz_write_length(out, matchCode - 15);
+	}
+
+	return out;
+}
+
+/*
+ * Compresses size bytes at data into out which must hold lz_compress_bound(size) bytes. Returns the compressed size.
+ */
+SIZE_T lz_compress(const BYTE* data, SIZE_T size, BYTE* out) {
+	UINT32* table = calloc((SIZE_T)1 << LZ_HASH_BITS, sizeof(UINT32)); // Position + 1 of the last occurrence of a hash
+	const BYTE* end = data + size;
+	const BYTE* cursor = data;
+	const BYTE* literals = data;
+	BYTE* outCursor = out;
+
+	if(!table)
+		return 0;
+
+	while(end - cursor >= LZ_MIN_MATCH) {
+		UINT32 sequence;
+
+		memcpy(&sequence, cursor, sizeof(sequence));
+
+		UINT32 hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+		const BYTE* match = table[hash] > 0 ? data + table[hash] - 1 : NULL;
+
+		table[hash] = (UINT32)(cursor - data) + 1;
+
+		if(!match || cursor - match > LZ_MAX_OFFSET || memcmp(match, cursor, LZ_MIN_MATCH) != 0) {
+			++cursor;
+
+			continue;
+		}
+
+		SIZE_T matchLength = LZ_MIN_MATCH;
+
+		while(cursor + matchLength < end && match[matchLength] == cursor[matchLength])
+			++matchLength;
+
+		outCursor = lz_write_sequence(outCursor, literals, cursor - literals, cursor - match, matchLength);
+		cursor += matchLength;
+		literals = cursor;
+	}
+
+	outCursor = lz_write_sequence(outCursor, literals, end - literals, 0, 0);
+	free(table);
+
+	return outCursor - out;
+}
+
+BOOL lz_read_length(const BYTE** cursor, const BYTE* end, SIZE_T* length) {
+	BYTE byte;
+
+	do {
+		if(*cursor == end)
+			return FALSE;
+
+		byte = *(*cursor)++;
+		*length += byte;
+	} while(byte == 255);
+
+	return TRUE;
+}
+
+/*
+ * Decompresses data into out which must be exactly as large as the uncompressed data. Corrupt data is detected and returns
+ * FALSE without ever reading or writing out of bounds.
+ */
+BOOL lz_decompress(const BYTE* data, SIZE_T size, BYTE* out, SIZE_T outSize) {
+	const BYTE* end = data + size;
+	BYTE* outCursor = out;
+	BYTE* outEnd = out + outSize;
+
+	while(data < end) {
+		BYTE token = *data++;
+		SIZE_T numLiterals = token >> 4;
+
+		if(numLiterals == 15 && !lz_read_length(&data, end, &numLiterals))
+			return FALSE;
+
+		if(numLiterals > (SIZE_T)(end - data) || numLiterals > (SIZE_T)(outEnd - outCursor))
+			return FALSE;
+
+		memcpy(outCursor, data, numLiterals);
+		data += numLiterals;
+		outCursor += numLiterals;
+
+		if(data == end) // The last sequence has no match
+			break;
+
+		if(end - data < 2)
+			return FALSE;
+
+		SIZE_T offset = data[0] | (SIZE_T)data[1] << 8;
+		SIZE_T matchLength = token & 15;
+
+		data += 2;
+
+		if(matchLength == 15 && !lz_read_length(&data, end, &matchLength))
+			return FALSE;
+
+		matchLength += LZ_MIN_MATCH;
+
+		if(offset == 0 || offset > (SIZE_T)(outCursor - out) || matchLength > (SIZE_T)(outEnd - outCursor))
+			return FALSE;
+
+		for(SIZE_T i = 0; i < matchLength; ++i) // Matches can overlap the bytes they produce
+			outCursor[i] = outCursor[i - offset];
+
+		outCursor += matchLength;
+	}
+
+	return outCursor == outEnd;
+}
+
+struct StringList {
+	LPWSTR* strings;
+	int count;
+	int capacity;
+};
+
+void add_to_string_list(struct StringList* list, LPCWSTR str) {
+	if(list->count == list->capacity) {
+		list->capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+		list->strings = realloc(list->strings, list->capacity * sizeof(LPWSTR));
+	}
+
+	list->strings[list->count] = malloc((wcslen(str) + 1) * sizeof(WCHAR));
+	wcscpy(list->strings[list->count], str);
+	++list->count;
+}
+
+void free_string_list(struct StringList* list) {
+	for(int i = 0; i < list->count; ++i)
+		free(list->strings[i]);
+
+	free(list->strings);
+	*list = (struct StringList){0};
+}
+
+/*
+ * DirectoryCallback that collects the names of all files in a directory in a StringList.
+ */
+BOOL collect_file_names(LPCWSTR name, BOOL isDirectory, LPVOID context) {
+	if(!isDirectory)
+		add_to_string_list(context, name);
+
+	return TRUE;
+}
+
+BOOL collect_directory_names(LPCWSTR name, BOOL isDirectory, LPVOID context) {
+	if(isDirectory)
+		add_to_string_list(context, name);
+
+	return TRUE;
+}
+
+void cache_file_path(LPCWSTR name, LPWSTR buffer) {
+	swprintf(buffer, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", globalConfig.cachePath, name);
+}
+
+/*
+ * Turns the argument of -p, -s or sync into the path of the '.lelcache' directory inside of it.
+ */
+BOOL cache_path_from_argument(LPCWSTR arg, LPWSTR buffer) {
+	WCHAR path[MAX_PATH];
+
+	while(iswspace(*arg))
+		++arg;
+
+	if(!full_path(arg, path)) {
+		wprintf(L"Invalid path '%ls'\n", arg);
+
+		return FALSE;
+	}
+
+	LPWSTR end = path + wcslen(path);
+
+	while(end != path && (*(end - 1) == L'\\' || *(end - 1) == L'/')) { // Removing trailing path separators
+		--end;
+		*end = L'\0';
+	}
+
+	wcscat(path, PATH_SEPARATOR_STRING L".lelcache");
+	wcscpy(buffer, path);
+
+	return TRUE;
+}
+
+typedef void (*EntryCallback)(LPCWSTR entryDir, const struct CacheKey* key, LPVOID context);
+
+void for_each_entry_in(LPWSTR path, int depth, EntryCallback callback, LPVOID context) {
+	struct StringList names = {0};
+	SIZE_T pathLength = wcslen(path);
+
+	list_directory(path, collect_directory_names, &names);
+
+	for(int i = 0; i < names.count; ++i) {
+		LPCWSTR name = names.strings[i];
+		struct CacheKey key;
+
+		// The first levels are two characters of the content hash, see entry_directory
+		if(depth < LEL_HASH64_STRING_LENGTH / 4 ? wcslen(name) != 2 : wcslen(name) != CACHE_KEY_STRING_LENGTH || !cache_key_from_string(name, &key))
+			continue;
+
+		swprintf(path + pathLength, MAX_PATH - pathLength, PATH_SEPARATOR_STRING L"%ls", name);
+
+		if(depth < LEL_HASH64_STRING_LENGTH / 4)
+			for_each_entry_in(path, depth + 1, callback, context);
+		else
+			callback(path, &key, context);
+
+		path[pathLength] = L'\0';
+	}
+
+	free_string_list(&names);
+}
+
+/*
+ * Calls callback for every entry in the cache at cacheRoot.
+ */
+void for_each_entry(LPCWSTR cacheRoot, EntryCallback callback, LPVOID context) {
+	WCHAR path[MAX_PATH];
+
+	wcscpy(path, cacheRoot);
+	for_each_entry_in(path, 0, callback, context);
+}
+
+/*
+ * Background jobs
+ *
+ * Work that doesn't need to be finished before the compiler call returns is written to a queue directory in the cache and
+ * done by a detached worker process, see run_background_worker. Jobs are files named after the key of the entry they
+ * belong to. Each queue is bounded. If it is full because the worker can't keep up, new jobs are dropped.
+ */
+
+#define MAX_QUEUED_JOBS 256
+
+/*
+ * Starts the worker unless it is running already. The running worker holds the lock.
+ */
+void start_background_worker(void) {
+	WCHAR lockPath[MAX_PATH];
+	WCHAR executablePath[MAX_PATH];
+
+	cache_file_path(L"worker.lock", lockPath);
+
+	FileHandle lock = try_lock_file(lockPath);
+
+	if(lock == INVALID_FILE_HANDLE)
+		return; // The running worker picks up the new job
+
+	unlock_file(lock);
+
+	if(current_executable_path(executablePath)) {
+		LPCWSTR args[] = {executablePath, L"--background-worker"};
+
+		launch_detached_process(ARRAYSIZE(args), args);
+	}
+}
+
+BOOL queue_job(LPCWSTR queueName, LPCWSTR jobName, LPCVOID data, SIZE_T size) {
+	WCHAR queuePath[MAX_PATH];
+	WCHAR jobPath[MAX_PATH];
+	struct StringList queued = {0};
+
+	cache_file_path(queueName, queuePath);
+	swprintf(jobPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", queuePath, jobName);
+
+	if(file_exists(jobPath))
+		return TRUE;
+
+	if(!make_path(queuePath))
+		return FALSE;
+
+	list_directory(queuePath, collect_file_names, &queued);
+
+	int numQueued = queued.count;
+
+	free_string_list(&queued);
+
+	if(numQueued >= MAX_QUEUED_JOBS || !publish_data(jobPath, data, size))
+		return FALSE;
+
+	start_background_worker();
+
+	return TRUE;
+}
+
+enum JobResult {
+	JOB_DONE,     // The job is removed from the queue
+	JOB_POSTPONED // The job stays in the queue and the rest of the queue is left for the next time the worker is started
+};
+
+typedef enum JobResult (*JobFunction)(const struct CacheKey* key, LPCWSTR jobPath);
+
+/*
+ * Runs function for every job in the queue. Returns FALSE if a job was postponed.
+ */
+BOOL process_queue(LPCWSTR queueName, JobFunction function, int* outNumProcessed) {
+	WCHAR queuePath[MAX_PATH];
+	struct StringList queued = {0};
+	BOOL postponed = FALSE;
+
+	cache_file_path(queueName, queuePath);
+	list_directory(queuePath, collect_file_names, &queued);
+
+	for(int i = 0; i < queued.count && !postponed; ++i) {
+		LPCWSTR name = queued.strings[i];
+		WCHAR jobPath[MAX_PATH];
+		struct CacheKey key;
+
+		// Skipping temporary files of jobs that are still being queued
+		if(!cache_key_from_string(name, &key) || (name[CACHE_KEY_STRING_LENGTH] != L'\0' && name[CACHE_KEY_STRING_LENGTH] != L'.') ||
+		   wcsstr(name, L".tmp"))
+			continue;
+
+		swprintf(jobPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", queuePath, name);
+
+		if(function(&key, jobPath) == JOB_DONE) {
+			delete_file(jobPath);
+			++*outNumProcessed;
+		} else {
+			postponed = TRUE;
+		}
+	}
+
+	free_string_list(&queued);
+
+	return !postponed;
+}
+
+/*
+ * Summaries
+ *
+ * After a local miss the shared tier and the remote usually don't have the entry either, but finding that out costs a
+ * round trip over the network every time. A summary is a Bloom filter of all keys in a tier or on the remote that is
+ * published next to the entries, see publish_summary. Clients keep a copy in their local cache which is refreshed by the
+ * background worker and don't ask for keys the filter doesn't contain.
+ * Keys that were added after a summary was created are missing from it, which is why old summaries are ignored.
+ */
+
+#define SUMMARY_MAGIC 0x4d55534c // 'LSUM'
+#define SUMMARY_FILE_NAME L"summary.bloom"
+#define SUMMARY_BITS_PER_KEY 10 // About 1% false positives with SUMMARY_NUM_HASHES
+#define SUMMARY_NUM_HASHES 7
+#define SUMMARY_REFRESH_INTERVAL_SECONDS (5 * 60) // Local copies and the summary of the shared tier are updated this often
+#define SUMMARY_MAX_AGE_SECONDS (30 * 60)
+
+struct SummaryHeader {
+	UINT32 magic;
+	UINT32 numHashes;
+	UINT64 numBits;      // Always a power of two
+	UINT64 numKeys;
+	UINT64 creationTime; // System time
+};
+
+/*
+ * Bits are selected with double hashing, i.e. the positions are h1 + i * h2 for i < numHashes.
+ */
+void summary_hashes(const struct CacheKey* key, UINT64* outHash1, UINT64* outHash2) {
+	*outHash1 = XXH64(key, sizeof(*key), 0);
+	*outHash2 = XXH64(key, sizeof(*key), 1) | 1; // Odd so that all positions differ
+}
+
+struct KeyList {
+	struct CacheKey* keys;
+	SIZE_T count;
+	SIZE_T capacity;
+};
+
+void add_to_key_list(struct KeyList* list, const struct CacheKey* key) {
+	if(list->count == list->capacity) {
+		list->capacity = list->capacity > 0 ? list->capacity * 2 : 1024;
+		list->keys = realloc(list->keys, list->capacity * sizeof(*list->keys));
+	}
+
+	list->keys[list->count++] = *key;
+}
+
+void collect_entry_key(LPCWSTR entryDir, const struct CacheKey* key, LPVOID context) {
+	UNREFERENCED_PARAMETER(entryDir);
+	add_to_key_list(context, key);
+}
+
+/*
+ * HTTP servers store the packs uploaded to the remote as files named after their key.
+ */
+BOOL collect_remote_key(LPCWSTR name, BOOL isDirectory, LPVOID context) {
+	struct CacheKey key;
+
+	if(!isDirectory && wcslen(name) == CACHE_KEY_STRING_LENGTH && cache_key_from_string(name, &key))
+		add_to_key_list(context, &key);
+
+	return TRUE;
+}
+
+/*
+ * Writes the summary of all entries in directory to directory/summary.bloom. directory can be a cache tier or the
+ * directory an HTTP server stores the remote cache in.
+ */
+BOOL publish_summary(LPCWSTR directory) {
+	struct KeyList keys = {0};
+	struct SummaryHeader header = {SUMMARY_MAGIC, SUMMARY_NUM_HASHES, 1024, 0, current_system_time()};
+	WCHAR summaryPath[MAX_PATH];
+
+	for_each_entry(directory, collect_entry_key, &keys);
+	list_directory(directory, collect_remote_key, &keys);
+	header.numKeys = keys.count;
+
+	while(header.numBits < header.numKeys * SUMMARY_BITS_PER_KEY)
+		header.numBits *= 2;
+
+	SIZE_T summarySize = sizeof(header) + (SIZE_T)(header.numBits / 8);
+	BYTE* summary = calloc(summarySize, 1);
+	BYTE* bits = summary + sizeof(header);
+
+	if(!summary) {
+		free(keys.keys);
+
+		return FALSE;
+	}
+
+	memcpy(summary, &header, sizeof(header));
+
+	for(SIZE_T i = 0; i < keys.count; ++i) {
+		UINT64 hash1, hash2;
+
+		summary_hashes(&keys.keys[i], &hash1, &hash2);
+
+		for(UINT32 j = 0; j < header.numHashes; ++j) {
+			UINT64 bit = (hash1 + j * hash2) & (header.numBits - 1);
+
+			bits[bit / 8] |= (BYTE)(1 << (bit % 8));
+		}
+	}
+
+	swprintf(summaryPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING SUMMARY_FILE_NAME, directory);
+
+	BOOL published = publish_data(summaryPath, summary, summarySize);
+
+	free(summary);
+	free(keys.keys);
+
+	return published;
+}
+
+/*
+ * Returns TRUE if the local copy of a summary proves that key is not there. copyName is the name of the copy in the cache.
+ */
+BOOL summary_excludes(LPCWSTR copyName, const struct CacheKey* key) {
+	WCHAR copyPath[MAX_PATH];
+	UINT64 now = current_system_time();
+
+	cache_file_path(copyName, copyPath);
+
+	if(now - file_modification_time(copyPath) > SUMMARY_REFRESH_INTERVAL_SECONDS * 10000000ull)
+		start_background_worker(); // Refreshes the copy
+
+	LPCVOID data;
+	UINT64 size;
+	FileMappingHandle mapping = map_file(copyPath, &data, &size);
+	struct SummaryHeader header;
+	BOOL excluded = FALSE;
+
+	if(!mapping)
+		return FALSE;
+
+	if(size >= sizeof(header)) {
+		memcpy(&header, data, sizeof(header));
+
+		if(header.magic == SUMMARY_MAGIC && header.numBits >= 8 && (header.numBits & (header.numBits - 1)) == 0 &&
+		   size == sizeof(header) + header.numBits / 8 && now - header.creationTime <= SUMMARY_MAX_AGE_SECONDS * 10000000ull) {
+			const BYTE* bits = (const BYTE*)data + sizeof(header);
+			UINT64 hash1, hash2;
+
+			summary_hashes(key, &hash1, &hash2);
+
+			for(UINT32 i = 0; i < header.numHashes && !excluded; ++i) {
+				UINT64 bit = (hash1 + i * hash2) & (header.numBits - 1);
+
+				excluded = (bits[bit / 8] & (1 << (bit % 8))) == 0;
+			}
+		}
+	}
+
+	unmap_file(mapping);
+
+	return excluded;
+}
+
+/*
+ * History
+ *
+ * Every cacheable compilation appends a record to the history of the local cache, and entries written to the shared tier
+ * are also recorded in its history. 'lelcache prefetch' uses both to find the entries the next build will most likely
+ * need, i.e. the latest one of every target, and copies those that are missing to the local cache ahead of time.
+ * A target is identified by the object file path as it was given on the command line.
+ */
+
+#define HISTORY_FILE_NAME L"history.log"
+#define HISTORY_MAX_SIZE (4 * 1024 * 1024) // The history is compacted when it grows larger than this
+
+struct HistoryRecord {
+	UINT64 time; // System time of the compilation
+	XXH64_hash_t targetHash;
+	struct CacheKey key;
+};
+
+/*
+ * The history of the shared tier is locked while appending since appends of different machines to a file on a network
+ * share can overwrite each other. Locally a record is appended with a single write which doesn't need that.
+ */
+void append_history(LPCWSTR cacheRoot, const struct HistoryRecord* record) {
+	WCHAR historyPath[MAX_PATH];
+	WCHAR lockPath[MAX_PATH];
+	FileHandle lock = INVALID_FILE_HANDLE;
+
+	swprintf(historyPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING HISTORY_FILE_NAME, cacheRoot);
+
+	if(wcscmp(cacheRoot, globalConfig.sharedCachePath) == 0) {
+		swprintf(lockPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"history.lock", cacheRoot);
+
+		if((lock = lock_file(lockPath)) == INVALID_FILE_HANDLE)
+			return;
+	}
+
+	FileHandle file = open_file(historyPath, OPEN_FOR_APPENDING);
+
+	if(file != INVALID_FILE_HANDLE) {
+		write_file(file, record, sizeof(*record));
+
+		if(file_handle_size(file) > HISTORY_MAX_SIZE)
+			start_background_worker(); // Compacts the history
+
+		close_file(file);
+	}
+
+	if(lock != INVALID_FILE_HANDLE)
+		unlock_file(lock);
+}
+
+struct HistoryRecord* read_history(LPCWSTR cacheRoot, SIZE_T* outCount) {
+	WCHAR historyPath[MAX_PATH];
+	SIZE_T size = 0;
+
+	swprintf(historyPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING HISTORY_FILE_NAME, cacheRoot);
+
+	struct HistoryRecord* records = file_exists(historyPath) ? read_whole_file(historyPath, &size) : NULL;
+
+	*outCount = records ? size / sizeof(*records) : 0;
+
+	return records;
+}
+
+int __cdecl compare_history_records_for_qsort(const void* a, const void* b) {
+	const struct HistoryRecord* recordA = a;
+	const struct HistoryRecord* recordB = b;
+
+	if(recordA->targetHash != recordB->targetHash)
+		return recordA->targetHash < recordB->targetHash ? -1 : 1;
+
+	return recordA->time > recordB->time ? -1 : recordA->time < recordB->time; // Newest first
+}
+
+int __cdecl compare_history_records_by_time_for_qsort(const void* a, const void* b) {
+	UINT64 timeA = ((const struct HistoryRecord*)a)->time;
+	UINT64 timeB = ((const struct HistoryRecord*)b)->time;
+
+	return timeA > timeB ? -1 : timeA < timeB; // Newest first
+}
+
+/*
+ * Reduces records to the latest one of every target and returns their number.
+ */
+SIZE_T latest_history_records(struct HistoryRecord* records, SIZE_T count) {
+	SIZE_T numLatest = 0;
+
+	qsort(records, count, sizeof(*records), compare_history_records_for_qsort);
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		if(numLatest == 0 || records[numLatest - 1].targetHash != records[i].targetHash)
+			records[numLatest++] = records[i];
+	}
+
+	return numLatest;
+}
+
+/*
+ * Finds the latest record of the target with the given hash. Returns FALSE if it hasn't been built yet.
+ */
+BOOL latest_history_record(LPCWSTR cacheRoot, XXH64_hash_t targetHash, struct HistoryRecord* outRecord) {
+	SIZE_T count;
+	struct HistoryRecord* records = read_history(cacheRoot, &count);
+	BOOL found = FALSE;
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		if(records[i].targetHash == targetHash && (!found || records[i].time > outRecord->time)) {
+			*outRecord = records[i];
+			found = TRUE;
+		}
+	}
+
+	free(records);
+
+	return found;
+}
+
+/*
+ * Only the latest record of each target is needed for prefetching, so older ones are dropped once the history gets large.
+ * Records appended to a local history while it is being compacted are lost which is fine since it's only a hint.
+ */
+void compact_history(LPCWSTR cacheRoot) {
+	WCHAR historyPath[MAX_PATH];
+	WCHAR lockPath[MAX_PATH];
+
+	swprintf(historyPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING HISTORY_FILE_NAME, cacheRoot);
+	swprintf(lockPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"history.lock", cacheRoot);
+
+	if(file_size(historyPath) <= HISTORY_MAX_SIZE)
+		return;
+
+	FileHandle lock = try_lock_file(lockPath);
+
+	if(lock == INVALID_FILE_HANDLE)
+		return;
+
+	SIZE_T count;
+	struct HistoryRecord* records = read_history(cacheRoot, &count);
+
+	if(records) {
+		SIZE_T numLatest = latest_history_records(records, count);
+		SIZE_T maxRecords = HISTORY_MAX_SIZE / 2 / sizeof(*records);
+
+		// If there are too many targets the ones that haven't been built for the longest time are dropped
+		if(numLatest > maxRecords) {
+			qsort(records, numLatest, sizeof(*records), compare_history_records_by_time_for_qsort);
+			numLatest = maxRecords;
+		}
+
+		publish_data(historyPath, records, numLatest * sizeof(*records));
+		free(records);
+	}
+
+	unlock_file(lock);
+}
+
+/*
+ * Admission
+ *
+ * Not every compilation is worth storing. Compilations that are only done once, e.g. while experimenting, or that are
+ * cheaper to redo than the entry is to keep push valuable entries out of the cache. A successful compilation is only stored
+ * if it took at least minAdmissionTime, its output is not larger than maxAdmissionSize and the same compilation has missed
+ * at least minAdmissionFrequency times recently. How often a compilation missed is estimated with a count-min sketch like
+ * in TinyLFU: a few rows of small saturating counters which are all halved after SKETCH_SAMPLE_SIZE misses so that old
+ * compilations are forgotten.
+ */
+
+#define SKETCH_FILE_NAME L"admission.sketch"
+#define SKETCH_MAGIC 0x4b54534c // 'LSTK'
+#define SKETCH_WIDTH 65536
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX_COUNT 15
+#define SKETCH_SAMPLE_SIZE (SKETCH_WIDTH * 10)
+
+struct SketchHeader {
+	UINT32 magic;
+	UINT32 numMisses; // Since the counters were last halved
+};
+
+/*
+ * Halves all counters of the sketch whose file is locked by file.
+ */
+void age_sketch(FileHandle file) {
+	BYTE* counters = malloc(SKETCH_DEPTH * SKETCH_WIDTH);
+
+	if(counters && seek_file(file, sizeof(struct SketchHeader)) && read_file(file, counters, SKETCH_DEPTH * SKETCH_WIDTH) == SKETCH_DEPTH * SKETCH_WIDTH) {
+		for(SIZE_T i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; ++i)
+			counters[i] >>= 1;
+
+		if(seek_file(file, sizeof(struct SketchHeader)))
+			write_file(file, counters, SKETCH_DEPTH * SKETCH_WIDTH);
+	}
+
+	free(counters);
+}
+
+/*
+ * Counts a miss of key in the sketch of the local cache and returns how often it missed recently, including this time.
+ */
+UINT32 count_miss(const struct CacheKey* key) {
+	WCHAR path[MAX_PATH];
+	struct SketchHeader header;
+	UINT64 offsets[SKETCH_DEPTH];
+	BYTE counters[SKETCH_DEPTH];
+	UINT64 hash1, hash2;
+	BYTE frequency = SKETCH_MAX_COUNT;
+
+	cache_file_path(SKETCH_FILE_NAME, path);
+
+	FileHandle file = lock_file(path);
+
+	if(file == INVALID_FILE_HANDLE)
+		return 1;
+
+	if(file_handle_size(file) != sizeof(header) + SKETCH_DEPTH * SKETCH_WIDTH || !seek_file(file, 0) ||
+	   read_file(file, &header, sizeof(header)) != sizeof(header) || header.magic != SKETCH_MAGIC) {
+		BYTE* emptySketch = calloc(1, sizeof(header) + SKETCH_DEPTH * SKETCH_WIDTH);
+
+		header = (struct SketchHeader){SKETCH_MAGIC, 0};
+
+		if(emptySketch) {
+			memcpy(emptySketch, &header, sizeof(header));
+
+			if(seek_file(file, 0))
+				write_file(file, emptySketch, sizeof(header) + SKETCH_DEPTH * SKETCH_WIDTH);
+		}
+
+		free(emptySketch);
+	}
+
+	if(header.numMisses >= SKETCH_SAMPLE_SIZE) {
+		age_sketch(file);
+		header.numMisses /= 2;
+	}
+
+	summary_hashes(key, &hash1, &hash2);
+
+	for(int i = 0; i < SKETCH_DEPTH; ++i) {
+		offsets[i] = sizeof(header) + i * SKETCH_WIDTH + (hash1 + i * hash2) % SKETCH_WIDTH;
+
+		if(!seek_file(file, offsets[i]) || read_file(file, &counters[i], 1) != 1)
+			counters[i] = 0;
+
+		if(counters[i] < frequency)
+			frequency = counters[i];
+	}
+
+	// Conservative update: only the counters that are at the minimum are incremented, which keeps overestimation low
+	if(frequency < SKETCH_MAX_COUNT) {
+		++frequency;
+
+		for(int i = 0; i < SKETCH_DEPTH; ++i) {
+			if(counters[i] < frequency && seek_file(file, offsets[i]))
+				write_file(file, &frequency, 1);
+		}
+	}
+
+	++header.numMisses;
+
+	if(seek_file(file, 0))
+		write_file(file, &header, sizeof(header));
+
+	unlock_file(file);
+
+	return frequency;
+}
+
+/*
+ * Decides whether the result of a successful compilation is stored. duration is in milliseconds, size is the size of all
+ * output files.
+ */
+BOOL admit_entry(const struct CacheKey* key, UINT64 duration, UINT64 size) {
+	if(duration < globalConfig.minAdmissionTime || (globalConfig.maxAdmissionSize > 0 && size > globalConfig.maxAdmissionSize))
+		return FALSE;
+
+	return globalConfig.minAdmissionFrequency <= 1 || count_miss(key) >= globalConfig.minAdmissionFrequency;
+}
+
+/*
+ * Namespaces
+ *
+ * Several projects can share a cache without one of them pushing out the entries of all the others. Every compilation
+ * belongs to a namespace which is taken from the LELCACHE_NAMESPACE environment variable or else from the first line of a
+ * '.lelcache-namespace' file in the current directory or one of its parents. Compilations without one belong to the
+ * default namespace. The namespace is recorded in the metadata of every entry. Each namespace has its own statistics and
+ * can have a quota, see evict_tier for how it is enforced.
+ */
+
+#define NAMESPACE_ENVIRONMENT_VARIABLE L"LELCACHE_NAMESPACE"
+#define NAMESPACE_CONFIG_FILE_NAME L".lelcache-namespace"
+#define NAMESPACES_FILE_NAME L"namespaces"
+#define NAMESPACE_NAME_LENGTH 64
+
+struct Namespace {
+	XXH64_hash_t id; // 0 for the default namespace
+	UINT64 quota;    // In bytes, 0 means no quota
+	UINT64 size;
+	UINT32 numHits;
+	UINT32 numMisses;
+	WCHAR name[NAMESPACE_NAME_LENGTH]; // Empty for the default namespace
+};
+
+/*
+ * Names are restricted to ASCII so that a namespace has the same id on all platforms.
+ */
+XXH64_hash_t namespace_id(LPCWSTR name) {
+	char bytes[NAMESPACE_NAME_LENGTH];
+	SIZE_T length = 0;
+
+	for(; name[length] != L'\0' && length < NAMESPACE_NAME_LENGTH; ++length)
+		bytes[length] = (char)name[length];
+
+	return length > 0 ? XXH64(bytes, length, 0) : 0;
+}
+
+/*
+ * Turns the first line of str into a namespace name in buffer, replacing everything except letters, digits, '.', '-' and '_'.
+ */
+void namespace_name_from_string(LPCWSTR str, LPWSTR buffer) {
+	SIZE_T length = 0;
+
+	while(iswspace(*str))
+		++str;
+
+	for(; str[length] != L'\0' && str[length] != L'\r' && str[length] != L'\n' && length < NAMESPACE_NAME_LENGTH - 1; ++length)
+		buffer[length] = str[length] < 128 && (iswalnum(str[length]) || wcschr(L".-_", str[length])) ? str[length] : L'_';
+
+	while(length > 0 && buffer[length - 1] == L'_' && iswspace(str[length - 1])) // Trailing whitespace
+		--length;
+
+	buffer[length] = L'\0';
+
+	if(wcscmp(buffer, L"default") == 0)
+		*buffer = L'\0';
+}
+
+/*
+ * buffer must hold NAMESPACE_NAME_LENGTH characters.
+ */
+void current_namespace(LPWSTR buffer) {
+	WCHAR value[MAX_PATH];
+	WCHAR path[MAX_PATH];
+
+	*buffer = L'\0';
+
+	if(get_environment_variable(NAMESPACE_ENVIRONMENT_VARIABLE, value, MAX_PATH)) {
+		namespace_name_from_string(value, buffer);
+
+		return;
+	}
+
+	if(!current_directory(path))
+		return;
+
+	for(;;) {
+		SIZE_T length = wcslen(path);
+
+		swprintf(path + length, MAX_PATH - length, PATH_SEPARATOR_STRING NAMESPACE_CONFIG_FILE_NAME);
+
+		if(file_exists(path)) {
+			SIZE_T size;
+			char* content = read_whole_file(path, &size);
+
+			for(SIZE_T i = 0; content && i < size && i < MAX_PATH - 1; ++i)
+				value[i] = (BYTE)content[i];
+
+			value[content ? (size < MAX_PATH - 1 ? size : MAX_PATH - 1) : 0] = L'\0';
+			namespace_name_from_string(value, buffer);
+			free(content);
+
+			return;
+		}
+
+		path[length] = L'\0';
+
+		LPWSTR name = file_name_from_path(path);
+
+		if(name == path) // Reached the root
+			break;
+
+		*(name - 1) = L'\0';
+	}
+}
+
+LPCWSTR namespace_display_name(const struct Namespace* ns) {
+	return ns->name[0] != L'\0' ? ns->name : L"default";
+}
+
+/*
+ * Locks the namespaces file of cacheRoot and reads the namespace called name, which is initialized if it isn't in there
+ * yet. The changes are written by unlock_namespace.
+ */
+FileHandle lock_namespace(LPCWSTR cacheRoot, LPCWSTR name, struct Namespace* outNamespace, UINT64* outOffset) {
+	WCHAR path[MAX_PATH];
+	XXH64_hash_t id = namespace_id(name);
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING NAMESPACES_FILE_NAME, cacheRoot);
+
+	FileHandle file = lock_file(path);
+	UINT64 count = file != INVALID_FILE_HANDLE ? file_handle_size(file) / sizeof(*outNamespace) : 0;
+
+	*outOffset = count * sizeof(*outNamespace); // Namespaces are never removed so new ones are appended
+
+	for(UINT64 i = 0; i < count && seek_file(file, i * sizeof(*outNamespace)); ++i) {
+		if(read_file(file, outNamespace, sizeof(*outNamespace)) == sizeof(*outNamespace) && outNamespace->id == id) {
+			*outOffset = i * sizeof(*outNamespace);
+
+			return file;
+		}
+	}
+
+	*outNamespace = (struct Namespace){id, 0, 0, 0, 0, {0}};
+	wcsncpy(outNamespace->name, name, NAMESPACE_NAME_LENGTH - 1);
+
+	return file;
+}
+
+void unlock_namespace(FileHandle file, const struct Namespace* ns, UINT64 offset) {
+	if(file == INVALID_FILE_HANDLE)
+		return;
+
+	if(seek_file(file, offset))
+		write_file(file, ns, sizeof(*ns));
+
+	unlock_file(file);
+}
+
+/*
+ * Returns all namespaces of the cache at cacheRoot, which must be freed with free.
+ */
+struct Namespace* read_namespaces(LPCWSTR cacheRoot, SIZE_T* outCount) {
+	WCHAR path[MAX_PATH];
+	SIZE_T size = 0;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING NAMESPACES_FILE_NAME, cacheRoot);
+
+	struct Namespace* namespaces = read_whole_file(path, &size);
+
+	*outCount = namespaces ? size / sizeof(*namespaces) : 0;
+
+	return namespaces;
+}
+
+BOOL is_any_namespace_over_quota(LPCWSTR cacheRoot) {
+	SIZE_T count;
+	struct Namespace* namespaces = read_namespaces(cacheRoot, &count);
+	BOOL overQuota = FALSE;
+
+	for(SIZE_T i = 0; i < count; ++i)
+		overQuota = overQuota || (namespaces[i].quota > 0 && namespaces[i].size > namespaces[i].quota);
+
+	free(namespaces);
+
+	return overQuota;
+}
+
+/*
+ * Parses '<name>=<megabytes>' and sets the quota of that namespace in the local cache.
+ */
+BOOL set_namespace_quota(LPCWSTR arg) {
+	WCHAR name[NAMESPACE_NAME_LENGTH];
+	WCHAR buffer[MAX_PATH];
+	LPCWSTR separator = wcschr(arg, L'=');
+
+	if(!separator || separator == arg || separator - arg >= MAX_PATH) {
+		wprintf(L"The -q option expects '<namespace>=<megabytes>'\n");
+
+		return FALSE;
+	}
+
+	wcsncpy(buffer, arg, separator - arg);
+	buffer[separator - arg] = L'\0';
+	namespace_name_from_string(buffer, name);
+
+	if(!make_path(globalConfig.cachePath))
+		return FALSE;
+
+	struct Namespace ns;
+	UINT64 offset;
+	FileHandle file = lock_namespace(globalConfig.cachePath, name, &ns, &offset);
+
+	if(file == INVALID_FILE_HANDLE) {
+		wprintf(L"Unable to set the quota of namespace '%ls'\n", namespace_display_name(&ns));
+
+		return FALSE;
+	}
+
+	ns.quota = (UINT64)wcstoull(separator + 1, NULL, 0) * 1024ll * 1024ll;
+	unlock_namespace(file, &ns, offset);
+
+	if(ns.quota > 0) {
+		wprintf(L"Quota of namespace '%ls' set to %llu MB\n", namespace_display_name(&ns), (unsigned long long)(ns.quota / (1024ll * 1024ll)));
+
+		if(ns.size > ns.quota)
+			start_background_worker(); // Evicts entries
+	} else {
+		wprintf(L"Namespace '%ls' has no quota\n", namespace_display_name(&ns));
+	}
+
+	return TRUE;
+}
+
+/*
+ * lelcache namespaces
+ */
+int run_namespaces(void) {
+	WCHAR current[NAMESPACE_NAME_LENGTH];
+	SIZE_T count;
+	struct Namespace* namespaces = read_namespaces(globalConfig.cachePath, &count);
+
+	current_namespace(current);
+	wprintf(L"current namespace: %ls\n", current[0] != L'\0' ? current : L"default");
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		struct Namespace* ns = &namespaces[i];
+		UINT32 numRequests = ns->numHits + ns->numMisses;
+
+		wprintf(L"%-24ls  %6llu MB", namespace_display_name(ns), (unsigned long long)(ns->size / (1024ll * 1024ll)));
+
+		if(ns->quota > 0)
+			wprintf(L" of %6llu MB", (unsigned long long)(ns->quota / (1024ll * 1024ll)));
+		else
+			wprintf(L"            ");
+
+		wprintf(L"  %8u hits  %8u misses  %6.2f%%\n", ns->numHits, ns->numMisses, numRequests > 0 ? ns->numHits * 100.0 / numRequests : 0.0);
+	}
+
+	free(namespaces);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Tiers
+ *
+ * Besides the local cache there can be a shared tier, usually a directory on a network share that is used by several
+ * machines. Accessing it is much slower than accessing the local cache, which is why it is only checked after a local miss
+ * and entries found there are promoted to the local cache in the background. How new entries end up in the shared tier
+ * depends on the write policy. Each tier has its own size limit.
+ */
+
+enum SharedWritePolicy {
+	SHARED_WRITE_BACK,    // New entries are copied to the shared tier by the background worker
+	SHARED_WRITE_THROUGH, // New entries are copied to the shared tier right after compiling
+	SHARED_READ_ONLY      // Nothing is written to the shared tier
+};
+
+const LPCWSTR sharedWritePolicyNames[] = {L"back", L"through", L"none"};
+
+#define EVICTION_TARGET_PERCENT 90 // Eviction removes entries until the size of the tier is below this percentage of its limit
+
+BOOL has_shared_tier(void) {
+	return globalConfig.sharedCachePath[0] != L'\0';
+}
+
+/*
+ * Copies all files of the entry for key from the cache at sourceRoot to the one at destinationRoot. Returns FALSE if there
+ * was nothing to copy.
+ */
+BOOL copy_entry(LPCWSTR sourceRoot, LPCWSTR destinationRoot, const struct CacheKey* key, UINT64* outSize) {
+	WCHAR sourceDir[MAX_PATH];
+	WCHAR destinationDir[MAX_PATH];
+	WCHAR sourcePath[MAX_PATH];
+	WCHAR destinationPath[MAX_PATH];
+	BOOL copied = FALSE;
+
+	entry_directory(sourceRoot, key, sourceDir);
+	entry_directory(destinationRoot, key, destinationDir);
+	swprintf(destinationPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", destinationDir);
+
+	BOOL isNew = !file_exists(destinationPath);
+
+	*outSize = 0;
+
+	if(!make_path(destinationDir))
+		return FALSE;
+
+	for(int i = 0; i < ARRAYSIZE(entryFileNames); ++i) {
+		swprintf(sourcePath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", sourceDir, entryFileNames[i]);
+		swprintf(destinationPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", destinationDir, entryFileNames[i]);
+
+		if(file_exists(sourcePath)) {
+			if(!publish_file(sourcePath, destinationPath))
+				return FALSE;
+
+			*outSize += file_size(destinationPath);
+			copied = TRUE;
+		}
+	}
+
+	if(isNew && file_exists(destinationPath)) // destinationPath is the object file after the loop
+		toggle_merkle_leaf(destinationRoot, key);
+
+	return copied;
+}
+
+/*
+ * Removes a cache entry, starting with the object file so that it doesn't look complete while it is being deleted.
+ */
+UINT64 delete_entry(LPCWSTR cacheRoot, const struct CacheKey* key) {
+	WCHAR entryDir[MAX_PATH];
+	WCHAR path[MAX_PATH];
+	UINT64 deletedSize = 0;
+
+	entry_directory(cacheRoot, key, entryDir);
+
+	for(int i = ARRAYSIZE(entryFileNames) - 1; i >= 0; --i) {
+		swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", entryDir, entryFileNames[i]);
+
+		UINT64 size = file_size(path);
+
+		if(delete_file(path)) {
+			deletedSize += size;
+
+			if(i == ARRAYSIZE(entryFileNames) - 1)
+				toggle_merkle_leaf(cacheRoot, key);
+		}
+	}
+
+	remove_directory(entryDir); // Fails if a compilation holds a lease in there which is fine
+
+	return deletedSize;
+}
+
+struct EvictionCandidate {
+	struct CacheKey key;
+	UINT64 lastUse; // Modification time of the newest file, hits touch the object file
+	UINT64 size;
+	UINT64 compileTime; // In milliseconds, 0 if it is unknown
+	double priority;    // See evict_tier
+	XXH64_hash_t namespaceId;
+};
+
+struct EvictionCandidates {
+	struct EvictionCandidate* entries;
+	SIZE_T count;
+	SIZE_T capacity;
+	UINT64 totalSize;
+};
+
+void collect_eviction_candidate(LPCWSTR entryDir, const struct CacheKey* key, LPVOID context) {
+	struct EvictionCandidates* candidates = context;
+	struct EvictionCandidate candidate = {*key, 0, 0, 0, 0.0, 0};
+	struct EntryMetadata metadata = {0};
+	WCHAR path[MAX_PATH];
+
+	for(int i = 0; i < ARRAYSIZE(entryFileNames); ++i) {
+		swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"%ls", entryDir, entryFileNames[i]);
+
+		UINT64 modificationTime = file_modification_time(path);
+
+		if(modificationTime > 0) {
+			candidate.size += file_size(path);
+
+			if(modificationTime > candidate.lastUse)
+				candidate.lastUse = modificationTime;
+		}
+	}
+
+	if(candidate.lastUse == 0) // Nothing has been published yet
+		return;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"meta", entryDir);
+
+	if(read_struct_file(path, &metadata, sizeof(metadata))) {
+		candidate.compileTime = metadata.compileTime;
+		candidate.namespaceId = metadata.namespaceId;
+	}
+
+	if(candidates->count == candidates->capacity) {
+		candidates->capacity = candidates->capacity > 0 ? candidates->capacity * 2 : 1024;
+		candidates->entries = realloc(candidates->entries, candidates->capacity * sizeof(*candidates->entries));
+	}
+
+	candidates->entries[candidates->count++] = candidate;
+	candidates->totalSize += candidate.size;
+}
+
+int __cdecl compare_eviction_candidates_for_qsort(const void* a, const void* b) {
+	UINT64 lastUseA = ((const struct EvictionCandidate*)a)->lastUse;
+	UINT64 lastUseB = ((const struct EvictionCandidate*)b)->lastUse;
+
+	return lastUseA < lastUseB ? -1 : lastUseA > lastUseB;
+}
+
+int __cdecl compare_eviction_candidates_by_priority_for_qsort(const void* a, const void* b) {
+	double priorityA = ((const struct EvictionCandidate*)a)->priority;
+	double priorityB = ((const struct EvictionCandidate*)b)->priority;
+
+	if(priorityA != priorityB)
+		return priorityA < priorityB ? -1 : 1;
+
+	return compare_eviction_candidates_for_qsort(a, b);
+}
+
+#define INFLATION_FILE_NAME L"inflation.log"
+#define INFLATION_MAX_RECORDS 256
+
+/*
+ * The inflation value of GreedyDual-Size after an eviction, see evict_tier.
+ */
+struct InflationRecord {
+	UINT64 time;
+	double value;
+};
+
+/*
+ * Returns the inflation value at the given time. The records are sorted by time.
+ */
+double inflation_at(const struct InflationRecord* records, SIZE_T count, UINT64 time) {
+	double value = 0.0;
+
+	for(SIZE_T i = 0; i < count && records[i].time <= time; ++i)
+		value = records[i].value;
+
+	return value;
+}
+
+/*
+ * The entries of a namespace during eviction.
+ */
+struct NamespaceEviction {
+	XXH64_hash_t id;
+	UINT64 quota;
+	UINT64 size;
+	double weight; // Share of the tier the namespace gets when all namespaces need space
+	SIZE_T next;   // Index of the candidate to look at next when evicting from this namespace
+};
+
+/*
+ * Evicts the candidate of the namespace with the lowest priority. Returns FALSE if the namespace has none left.
+ */
+BOOL evict_from_namespace(LPCWSTR cacheRoot, const struct EvictionCandidates* candidates, struct NamespaceEviction* ns, double* inflation) {
+	for(; ns->next < candidates->count; ++ns->next) {
+		const struct EvictionCandidate* candidate = &candidates->entries[ns->next];
+
+		if(candidate->namespaceId != ns->id)
+			continue;
+
+		delete_entry(cacheRoot, &candidate->key);
+		ns->size -= candidate->size;
+		++ns->next;
+
+		if(candidate->priority > *inflation)
+			*inflation = candidate->priority;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Replaces the recorded sizes of the namespaces of cacheRoot with the actual ones. Namespaces that aren't in the list have
+ * no entries.
+ */
+void update_namespace_sizes(LPCWSTR cacheRoot, const struct NamespaceEviction* namespaces, SIZE_T count) {
+	WCHAR path[MAX_PATH];
+	struct Namespace ns;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING NAMESPACES_FILE_NAME, cacheRoot);
+
+	if(!file_exists(path))
+		return;
+
+	FileHandle file = lock_file(path);
+
+	if(file == INVALID_FILE_HANDLE)
+		return;
+
+	UINT64 numRecords = file_handle_size(file) / sizeof(ns);
+
+	for(UINT64 i = 0; i < numRecords && seek_file(file, i * sizeof(ns)); ++i) {
+		if(read_file(file, &ns, sizeof(ns)) != sizeof(ns))
+			break;
+
+		ns.size = 0;
+
+		for(SIZE_T n = 0; n < count; ++n) {
+			if(namespaces[n].id == ns.id)
+				ns.size = namespaces[n].size;
+		}
+
+		if(seek_file(file, i * sizeof(ns)))
+			write_file(file, &ns, sizeof(ns));
+	}
+
+	unlock_file(file);
+}
+
+/*
+ * Deletes the entries of the tier at cacheRoot that are cheapest to lose if it is larger than maxSize.
+ * This works like GreedyDual-Size: the priority of an entry is its compile time per byte plus the inflation value at the
+ * time it was last used. Entries with the lowest priority are evicted first and the inflation value is raised to the
+ * priority of the last evicted entry. This way entries that are expensive to rebuild for their size are kept longer while
+ * entries that aren't used anymore still age out. Entries without a compile time (e.g. from older versions) are assumed to
+ * cost the average of the others per byte.
+ * Namespaces are treated fairly: first every namespace that exceeds its quota is shrunk below it. If the tier is still too
+ * large, entries are taken from the namespace that uses the most space relative to its share, which is its quota or an
+ * equal part of the space not reserved by quotas. This way a project with many new entries can't push out all the others.
+ * Since all entries are visited anyway the size recorded in the tier's info is corrected by the difference between the
+ * actual size and the size recorded before the scan. This fixes any drift, e.g. from entries that were deleted by hand,
+ * without losing what other processes added in the meantime. The sizes of the namespaces are replaced by the actual ones.
+ */
+void evict_tier(LPCWSTR cacheRoot, UINT64 maxSize) {
+	WCHAR lockPath[MAX_PATH];
+	struct CacheInfo info;
+
+	cache_info(cacheRoot, &info, FALSE);
+
+	UINT64 recordedSize = info.currentCacheSize;
+
+	if(recordedSize <= maxSize && !is_any_namespace_over_quota(cacheRoot))
+		return;
+
+	// The shared tier can be evicted by several machines at the same time
+	swprintf(lockPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"eviction.lock", cacheRoot);
+
+	FileHandle evictionLock = try_lock_file(lockPath);
+
+	if(evictionLock == INVALID_FILE_HANDLE)
+		return;
+
+	WCHAR inflationPath[MAX_PATH];
+	struct EvictionCandidates candidates = {0};
+	UINT64 targetSize = maxSize / 100 * EVICTION_TARGET_PERCENT;
+	UINT64 remainingSize, collectedSize = 0;
+	UINT64 knownCompileTime = 0, knownSize = 0, numEvicted = 0;
+	SIZE_T inflationSize = 0;
+
+	swprintf(inflationPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING INFLATION_FILE_NAME, cacheRoot);
+
+	struct InflationRecord* inflation = read_whole_file(inflationPath, &inflationSize);
+	SIZE_T numInflationRecords = inflation ? inflationSize / sizeof(*inflation) : 0;
+	double currentInflation = inflation_at(inflation, numInflationRecords, UINT64_MAX);
+
+	for_each_entry(cacheRoot, collect_eviction_candidate, &candidates);
+
+	for(SIZE_T i = 0; i < candidates.count; ++i) {
+		if(candidates.entries[i].compileTime > 0) {
+			knownCompileTime += candidates.entries[i].compileTime;
+			knownSize += candidates.entries[i].size;
+		}
+	}
+
+	double defaultCostPerByte = knownSize > 0 ? (double)knownCompileTime / knownSize : 1.0;
+
+	for(SIZE_T i = 0; i < candidates.count; ++i) {
+		struct EvictionCandidate* candidate = &candidates.entries[i];
+		double costPerByte = candidate->compileTime > 0 && candidate->size > 0 ? (double)candidate->compileTime / candidate->size : defaultCostPerByte;
+
+		candidate->priority = inflation_at(inflation, numInflationRecords, candidate->lastUse) + costPerByte;
+	}
+
+	qsort(candidates.entries, candidates.count, sizeof(*candidates.entries), compare_eviction_candidates_by_priority_for_qsort);
+
+	SIZE_T numRecords;
+	struct Namespace* records = read_namespaces(cacheRoot, &numRecords);
+	struct NamespaceEviction* namespaces = NULL;
+	SIZE_T numNamespaces = 0, numWithoutQuota = 0;
+	UINT64 quotaSum = 0;
+
+	for(SIZE_T i = 0; i < candidates.count; ++i) {
+		SIZE_T n = 0;
+
+		while(n < numNamespaces && namespaces[n].id != candidates.entries[i].namespaceId)
+			++n;
+
+		if(n == numNamespaces) {
+			namespaces = realloc(namespaces, (numNamespaces + 1) * sizeof(*namespaces));
+			namespaces[numNamespaces++] = (struct NamespaceEviction){candidates.entries[i].namespaceId, 0, 0, 0.0, i};
+		}
+
+		namespaces[n].size += candidates.entries[i].size;
+		collectedSize += candidates.entries[i].size;
+	}
+
+	for(SIZE_T n = 0; n < numNamespaces; ++n) {
+		for(SIZE_T r = 0; r < numRecords; ++r) {
+			if(records[r].id == namespaces[n].id)
+				namespaces[n].quota = records[r].quota;
+		}
+
+		quotaSum += namespaces[n].quota;
+		numWithoutQuota += namespaces[n].quota == 0;
+	}
+
+	UINT64 unreserved = quotaSum < maxSize ? maxSize - quotaSum : 0;
+
+	if(numNamespaces > 0 && unreserved < maxSize / numNamespaces) // Quotas are larger than the tier
+		unreserved = maxSize / numNamespaces;
+
+	for(SIZE_T n = 0; n < numNamespaces; ++n) {
+		namespaces[n].weight = namespaces[n].quota > 0 ? (double)namespaces[n].quota : (double)unreserved / numWithoutQuota;
+
+		while(namespaces[n].quota > 0 && namespaces[n].size > namespaces[n].quota / 100 * EVICTION_TARGET_PERCENT &&
+			  evict_from_namespace(cacheRoot, &candidates, &namespaces[n], &currentInflation))
+			++numEvicted;
+	}
+
+	remainingSize = 0;
+
+	for(SIZE_T n = 0; n < numNamespaces; ++n)
+		remainingSize += namespaces[n].size;
+
+	// Eviction might only have been started for a namespace over its quota, the tier as a whole is only shrunk if it is full
+	BOOL overLimit = remainingSize > maxSize;
+
+	while(overLimit && remainingSize > targetSize) {
+		struct NamespaceEviction* largest = NULL;
+
+		for(SIZE_T n = 0; n < numNamespaces; ++n) {
+			if(namespaces[n].next < candidates.count && (!largest || namespaces[n].size / namespaces[n].weight > largest->size / largest->weight))
+				largest = &namespaces[n];
+		}
+
+		if(!largest)
+			break;
+
+		UINT64 size = largest->size;
+
+		if(evict_from_namespace(cacheRoot, &candidates, largest, &currentInflation)) { // Otherwise it is skipped from now on
+			remainingSize -= size - largest->size;
+			++numEvicted;
+		}
+	}
+
+	update_namespace_sizes(cacheRoot, namespaces, numNamespaces);
+	free(namespaces);
+	free(records);
+
+	// Only the latest records are kept, entries that were last used before the oldest one are treated as if the value was 0
+	if(inflation && numInflationRecords >= INFLATION_MAX_RECORDS) {
+		memmove(inflation, inflation + numInflationRecords - INFLATION_MAX_RECORDS + 1, (INFLATION_MAX_RECORDS - 1) * sizeof(*inflation));
+		numInflationRecords = INFLATION_MAX_RECORDS - 1;
+	}
+
+	inflation = realloc(inflation, (numInflationRecords + 1) * sizeof(*inflation));
+	inflation[numInflationRecords++] = (struct InflationRecord){current_system_time(), currentInflation};
+	publish_data(inflationPath, inflation, numInflationRecords * sizeof(*inflation));
+	free(inflation);
+	free(candidates.entries);
+
+	FileHandle cacheInfoLock = lock_cache_info(cacheRoot, &info);
+
+	INT64 correctedSize = (INT64)info.currentCacheSize + (INT64)remainingSize - (INT64)recordedSize;
+
+	info.currentCacheSize = correctedSize > 0 ? (UINT64)correctedSize : 0;
+	info.numEvictions += numEvicted;
+	info.evictedSize += collectedSize - remainingSize;
+	unlock_cache_info(cacheRoot, cacheInfoLock, &info);
+	unlock_file(evictionLock);
+}
+
+/*
+ * Adds size to the recorded size of a tier and starts the worker to evict entries if the tier has become too large.
+ */
+void grow_tier(LPCWSTR cacheRoot, UINT64 maxSize, INT64 size) {
+	struct CacheInfo info;
+	FileHandle cacheInfoLock = lock_cache_info(cacheRoot, &info);
+
+	info.currentCacheSize += size;
+	unlock_cache_info(cacheRoot, cacheInfoLock, &info);
+
+	if(info.currentCacheSize > maxSize)
+		start_background_worker();
+}
+
+enum JobResult promote_entry(const struct CacheKey* key, LPCWSTR jobPath) {
+	WCHAR localDir[MAX_PATH];
+	WCHAR objPath[MAX_PATH];
+	UINT64 size;
+
+	UNREFERENCED_PARAMETER(jobPath);
+
+	if(!has_shared_tier())
+		return JOB_DONE;
+
+	entry_directory(globalConfig.cachePath, key, localDir);
+	swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", localDir);
+
+	if(!file_exists(objPath) && copy_entry(globalConfig.sharedCachePath, globalConfig.cachePath, key, &size))
+		grow_tier(globalConfig.cachePath, globalConfig.maxCacheSize, size);
+
+	return JOB_DONE;
+}
+
+/*
+ * The job contains the history record of the compilation which is added to the history of the shared tier.
+ */
+enum JobResult write_back_entry(const struct CacheKey* key, LPCWSTR jobPath) {
+	WCHAR sharedDir[MAX_PATH];
+	WCHAR objPath[MAX_PATH];
+	UINT64 size;
+	SIZE_T recordSize = 0;
+
+	if(!has_shared_tier() || globalConfig.sharedWritePolicy == SHARED_READ_ONLY)
+		return JOB_DONE;
+
+	if(!is_directory(globalConfig.sharedCachePath))
+		return JOB_POSTPONED; // The share is not reachable right now
+
+	entry_directory(globalConfig.sharedCachePath, key, sharedDir);
+	swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", sharedDir);
+
+	if(!file_exists(objPath) && copy_entry(globalConfig.cachePath, globalConfig.sharedCachePath, key, &size)) {
+		grow_tier(globalConfig.sharedCachePath, globalConfig.maxSharedCacheSize, size);
+
+		struct HistoryRecord* record = read_whole_file(jobPath, &recordSize);
+
+		if(record && recordSize == sizeof(*record))
+			append_history(globalConfig.sharedCachePath, record);
+
+		free(record);
+	}
+
+	return JOB_DONE;
+}
+
+/*
+ * Serves a local miss from the shared tier. The entry is copied to the local cache later by the background worker.
+ */
+BOOL copy_from_shared_tier(const struct CacheKey* key, struct CommandLineInfo* cmdLineInfo, int* outExitCode) {
+	WCHAR sharedDir[MAX_PATH];
+	CacheKeyString keyStr;
+
+	if(!has_shared_tier() || summary_excludes(L"shared.summary", key))
+		return FALSE;
+
+	entry_directory(globalConfig.sharedCachePath, key, sharedDir);
+
+	if(!copy_from_cache(sharedDir, sharedDir + wcslen(sharedDir), cmdLineInfo, outExitCode))
+		return FALSE;
+
+	struct CacheInfo cacheInfo;
+	FileHandle cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+
+	++cacheInfo.numSharedHits;
+	unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
+	cache_key_to_string(key, keyStr);
+	queue_job(L"promotions", keyStr, NULL, 0);
+
+	return TRUE;
+}
+
+/*
+ * Writes a freshly compiled entry to the shared tier according to the write policy.
+ */
+void write_to_shared_tier(const struct HistoryRecord* record) {
+	CacheKeyString keyStr;
+
+	if(!has_shared_tier())
+		return;
+
+	switch(globalConfig.sharedWritePolicy) {
+	case SHARED_WRITE_BACK:
+		cache_key_to_string(&record->key, keyStr);
+		queue_job(L"writebacks", keyStr, record, sizeof(*record));
+		break;
+	case SHARED_WRITE_THROUGH:
+		{
+			UINT64 size;
+
+			if(copy_entry(globalConfig.cachePath, globalConfig.sharedCachePath, &record->key, &size)) {
+				grow_tier(globalConfig.sharedCachePath, globalConfig.maxSharedCacheSize, size);
+				append_history(globalConfig.sharedCachePath, record);
+			}
+		}
+
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Remote cache
+ *
+ * The remote cache is an HTTP server that supports GET, PUT and HEAD, like nginx with WebDAV enabled or bazel-remote.
+ * Every entry is stored as a single pack (see pack_entry) at '<url>/<key>'. The local cache is always checked first and
+ * entries downloaded from the remote are stored in the local cache.
+ */
+
+#define REMOTE_TIMEOUT_MS (10 * 1000)
+#define REMOTE_RETRY_INTERVAL_SECONDS 60 // After the remote couldn't be reached it is not contacted again for this long
+
+BOOL has_remote(void) {
+	return globalConfig.remoteUrl[0] != L'\0';
+}
+
+/*
+ * If the remote can't be reached every compilation would have to wait for the timeout. That's why a marker file is written
+ * after a failed connection which disables the remote for a while.
+ */
+BOOL is_remote_reachable(void) {
+	WCHAR markerPath[MAX_PATH];
+
+	cache_file_path(L"remote.unreachable", markerPath);
+
+	UINT64 markedAt = file_modification_time(markerPath);
+
+	return markedAt == 0 || current_system_time() - markedAt > REMOTE_RETRY_INTERVAL_SECONDS * 10000000ull;
+}
+
+void mark_remote_unreachable(void) {
+	WCHAR markerPath[MAX_PATH];
+
+	cache_file_path(L"remote.unreachable", markerPath);
+	write_struct_file(markerPath, NULL, 0);
+}
+
+void remote_url_for(const struct CacheKey* key, LPWSTR buffer) {
+	CacheKeyString keyStr;
+
+	cache_key_to_string(key, keyStr);
+	swprintf(buffer, MAX_PATH + CACHE_KEY_STRING_LENGTH + 2, L"%ls/%ls", globalConfig.remoteUrl, keyStr);
+}
+
+/*
+ * Downloads an entry from the remote cache into the local cache. Returns FALSE if the remote doesn't have it.
+ */
+BOOL fetch_from_remote(const struct CacheKey* key) {
+	if(!has_remote() || !is_remote_reachable() || summary_excludes(L"remote.summary", key))
+		return FALSE;
+
+	WCHAR url[MAX_PATH + CACHE_KEY_STRING_LENGTH + 2];
+	DWORD status;
+	LPVOID pack = NULL;
+	SIZE_T packSize = 0;
+	UINT64 unpackedSize = 0;
+
+	remote_url_for(key, url);
+
+	if(!http_request(L"GET", url, NULL, 0, REMOTE_TIMEOUT_MS, &status, &pack, &packSize)) {
+		mark_remote_unreachable();
+
+		return FALSE;
+	}
+
+	BOOL fetched = status == 200 && unpack_entry(pack, packSize, globalConfig.cachePath, key, &unpackedSize);
+
+	free(pack);
+
+	if(fetched)
+		grow_tier(globalConfig.cachePath, globalConfig.maxCacheSize, unpackedSize);
+
+	return fetched;
+}
+
+/*
+ * Uploads a queued pack unless the remote already has the entry, which is checked with a HEAD request first.
+ */
+enum JobResult upload_entry(const struct CacheKey* key, LPCWSTR jobPath) {
+	WCHAR url[MAX_PATH + CACHE_KEY_STRING_LENGTH + 2];
+	DWORD status;
+
+	if(!has_remote())
+		return JOB_DONE;
+
+	remote_url_for(key, url);
+
+	if(!http_request(L"HEAD", url, NULL, 0, REMOTE_TIMEOUT_MS, &status, NULL, NULL)) {
+		mark_remote_unreachable();
+
+		return JOB_POSTPONED;
+	}
+
+	if(status != 200) {
+		SIZE_T packSize;
+		LPVOID pack = read_whole_file(jobPath, &packSize);
+		BOOL reachable = !pack || http_request(L"PUT", url, pack, packSize, REMOTE_TIMEOUT_MS, &status, NULL, NULL);
+
+		free(pack);
+
+		if(!reachable) {
+			mark_remote_unreachable();
+
+			return JOB_POSTPONED;
+		}
+	}
+
+	// Entries the server rejects (e.g. because they are too large) are dropped as well so they aren't retried forever
+	return JOB_DONE;
+}
+
+/*
+ * Uploads happen in the background so that the compilation doesn't need to wait for the network.
+ */
+void queue_upload(const struct CacheKey* key, LPCWSTR entryDir) {
+	if(!has_remote())
+		return;
+
+	SIZE_T packSize;
+	LPVOID pack = pack_entry(entryDir, &packSize);
+	CacheKeyString keyStr;
+	WCHAR jobName[CACHE_KEY_STRING_LENGTH + 6];
+
+	if(!pack)
+		return;
+
+	cache_key_to_string(key, keyStr);
+	swprintf(jobName, ARRAYSIZE(jobName), L"%ls.pack", keyStr);
+	queue_job(L"uploads", jobName, pack, packSize);
+	free(pack);
+}
+
+/*
+ * Updates the local copies of the summaries of the shared tier and the remote. The summary of the shared tier itself is
+ * published by whichever client notices first that it is outdated.
+ * If a summary can't be fetched the old copy is kept, it is ignored once it gets too old.
+ */
+void refresh_summaries(void) {
+	WCHAR copyPath[MAX_PATH];
+	UINT64 now = current_system_time();
+	UINT64 refreshInterval = SUMMARY_REFRESH_INTERVAL_SECONDS * 10000000ull;
+
+	if(has_shared_tier() && is_directory(globalConfig.sharedCachePath)) {
+		WCHAR summaryPath[MAX_PATH];
+		WCHAR lockPath[MAX_PATH];
+
+		swprintf(summaryPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING SUMMARY_FILE_NAME, globalConfig.sharedCachePath);
+		swprintf(lockPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"summary.lock", globalConfig.sharedCachePath);
+
+		if(globalConfig.sharedWritePolicy != SHARED_READ_ONLY && now - file_modification_time(summaryPath) > refreshInterval) {
+			FileHandle lock = try_lock_file(lockPath);
+
+			if(lock != INVALID_FILE_HANDLE) {
+				publish_summary(globalConfig.sharedCachePath);
+				unlock_file(lock);
+			}
+		}
+
+		cache_file_path(L"shared.summary", copyPath);
+
+		if(now - file_modification_time(copyPath) > refreshInterval && !publish_file(summaryPath, copyPath) && !touch_file(copyPath))
+			write_struct_file(copyPath, NULL, 0);
+	}
+
+	cache_file_path(L"remote.summary", copyPath);
+
+	if(has_remote() && now - file_modification_time(copyPath) > refreshInterval) {
+		WCHAR url[MAX_PATH + 16];
+		DWORD status;
+		LPVOID summary = NULL;
+		SIZE_T summarySize = 0;
+		BOOL fetched = FALSE;
+
+		swprintf(url, ARRAYSIZE(url), L"%ls/" SUMMARY_FILE_NAME, globalConfig.remoteUrl);
+
+		if(is_remote_reachable() && http_request(L"GET", url, NULL, 0, REMOTE_TIMEOUT_MS, &status, &summary, &summarySize))
+			fetched = status == 200 && publish_data(copyPath, summary, summarySize);
+
+		free(summary);
+
+		if(!fetched && !touch_file(copyPath))
+			write_struct_file(copyPath, NULL, 0);
+	}
+}
+
+/*
+ * Prefetching
+ */
+
+#define PREFETCH_NUM_THREADS 8
+#define DEFAULT_PREFETCH_HOURS (7 * 24) // Targets that haven't been built for longer are not prefetched
+
+struct PrefetchWork {
+	const struct HistoryRecord* records;
+	SIZE_T count;
+	UINT32 numFetched;
+};
+
+/*
+ * Copies missing entries to the local cache, from the shared tier if it has them and from the remote otherwise.
+ */
+DWORD prefetch_entries(LPVOID param) {
+	struct PrefetchWork* work = param;
+
+	for(SIZE_T i = 0; i < work->count; ++i) {
+		const struct CacheKey* key = &work->records[i].key;
+		WCHAR localDir[MAX_PATH];
+		WCHAR objPath[MAX_PATH];
+		UINT64 size;
+
+		entry_directory(globalConfig.cachePath, key, localDir);
+		swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", localDir);
+
+		if(file_exists(objPath))
+			continue;
+
+		// The summary isn't checked here since the history of the shared tier only contains keys that were written to it
+		if(has_shared_tier()) {
+			WCHAR sharedDir[MAX_PATH];
+
+			entry_directory(globalConfig.sharedCachePath, key, sharedDir);
+			swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", sharedDir);
+
+			if(file_exists(objPath) && copy_entry(globalConfig.sharedCachePath, globalConfig.cachePath, key, &size)) {
+				grow_tier(globalConfig.cachePath, globalConfig.maxCacheSize, size);
+				++work->numFetched;
+
+				continue;
+			}
+		}
+
+		if(fetch_from_remote(key))
+			++work->numFetched;
+	}
+
+	return 0;
+}
+
+/*
+ * lelcache prefetch [<hours>]
+ * Copies the latest entry of every target built in the last <hours> to the local cache unless it is already there. This is
+ * meant to be run right before a build, e.g. after pulling changes that somebody else has built already.
+ */
+int run_prefetch(int argc, LPWSTR* argv) {
+	UINT64 hours = argc > 2 ? wcstoull(argv[2], NULL, 0) : DEFAULT_PREFETCH_HOURS;
+	UINT64 minTime = current_system_time() - hours * 60 * 60 * 10000000ull;
+	SIZE_T numLocalRecords, numSharedRecords = 0;
+	struct HistoryRecord* localRecords = read_history(globalConfig.cachePath, &numLocalRecords);
+	struct HistoryRecord* sharedRecords = has_shared_tier() ? read_history(globalConfig.sharedCachePath, &numSharedRecords) : NULL;
+	struct HistoryRecord* records = malloc((numLocalRecords + numSharedRecords + 1) * sizeof(*records));
+	SIZE_T count = 0;
+
+	if(localRecords)
+		memcpy(records, localRecords, numLocalRecords * sizeof(*records));
+
+	if(sharedRecords)
+		memcpy(records + numLocalRecords, sharedRecords, numSharedRecords * sizeof(*records));
+
+	free(localRecords);
+	free(sharedRecords);
+
+	SIZE_T numLatest = latest_history_records(records, numLocalRecords + numSharedRecords);
+
+	for(SIZE_T i = 0; i < numLatest; ++i) {
+		if(records[i].time >= minTime)
+			records[count++] = records[i];
+	}
+
+	struct PrefetchWork work[PREFETCH_NUM_THREADS] = {0};
+	ThreadHandle threads[PREFETCH_NUM_THREADS] = {0};
+	UINT32 numFetched = 0;
+
+	for(int i = 0; i < PREFETCH_NUM_THREADS; ++i) {
+		SIZE_T begin = count * i / PREFETCH_NUM_THREADS;
+
+		work[i].records = records + begin;
+		work[i].count = count * (i + 1) / PREFETCH_NUM_THREADS - begin;
+
+		if(work[i].count > 0)
+			threads[i] = start_thread(prefetch_entries, &work[i]);
+	}
+
+	for(int i = 0; i < PREFETCH_NUM_THREADS; ++i) {
+		if(threads[i])
+			join_thread(threads[i]);
+		else if(work[i].count > 0)
+			prefetch_entries(&work[i]); // Falling back to this thread if a thread couldn't be started
+
+		numFetched += work[i].numFetched;
+	}
+
+	wprintf(L"Prefetched %u entries for %llu targets\n", numFetched, (unsigned long long)count);
+	free(records);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Bundles
+ *
+ * A bundle is a single file with the packs of many entries, e.g. to seed the caches of CI machines. It consists of the
+ * compressed packs one after another, followed by an index sorted by key and a BundleTrailer. Since the index comes last
+ * a bundle can be written in one go, and every pack can be read on its own.
+ * Bundles can be imported into the local cache or mounted as a read-only tier that is checked after the local cache.
+ */
+
+#define BUNDLE_MAGIC 0x314c444e424c454cull // 'LELBNDL1'
+#define IMPORT_NUM_THREADS 8
+
+struct BundleIndexEntry {
+	struct CacheKey key;
+	UINT64 offset;     // Of the pack from the start of the bundle
+	UINT64 storedSize; // Equal to size if the pack is stored uncompressed
+	UINT64 size;
+	XXH64_hash_t checksum; // Of the uncompressed pack
+};
+
+struct BundleTrailer {
+	UINT64 indexOffset; // Always a multiple of eight
+	UINT64 numEntries;
+	UINT64 magic;
+};
+
+int compare_cache_keys(const struct CacheKey* a, const struct CacheKey* b) {
+	if(a->contentHash != b->contentHash)
+		return a->contentHash < b->contentHash ? -1 : 1;
+
+	return a->flagsHash < b->flagsHash ? -1 : a->flagsHash > b->flagsHash;
+}
+
+int __cdecl compare_bundle_index_entries_for_qsort(const void* a, const void* b) {
+	return compare_cache_keys(&((const struct BundleIndexEntry*)a)->key, &((const struct BundleIndexEntry*)b)->key);
+}
+
+int __cdecl compare_eviction_candidates_by_recency_for_qsort(const void* a, const void* b) {
+	return compare_eviction_candidates_for_qsort(b, a); // Most recently used first
+}
+
+/*
+ * lelcache --export <file> [<megabytes> [<hours>]]
+ * Writes the most recently used entries of the local cache to a bundle, at most <megabytes> of them and only those that
+ * were used in the last <hours>. 0 means no limit. Cached failures are not exported.
+ */
+int run_export(int argc, LPWSTR* argv) {
+	if(argc < 3) {
+		wprintf(L"--export expects a file name as an argument\n");
+
+		return EXIT_FAILURE;
+	}
+
+	UINT64 maxSize = argc > 3 ? wcstoull(argv[3], NULL, 0) * 1024 * 1024 : 0;
+	UINT64 hours = argc > 4 ? wcstoull(argv[4], NULL, 0) : 0;
+	UINT64 minLastUse = hours > 0 ? current_system_time() - hours * 60 * 60 * 10000000ull : 0;
+	FileHandle file = open_file(argv[2], OPEN_FOR_WRITING);
+
+	if(file == INVALID_FILE_HANDLE) {
+		wprintf(L"Unable to open '%ls' for writing\n", argv[2]);
+
+		return EXIT_FAILURE;
+	}
+
+	struct EvictionCandidates candidates = {0};
+
+	for_each_entry(globalConfig.cachePath, collect_eviction_candidate, &candidates);
+	qsort(candidates.entries, candidates.count, sizeof(*candidates.entries), compare_eviction_candidates_by_recency_for_qsort);
+
+	struct BundleIndexEntry* index = malloc((candidates.count + 1) * sizeof(*index));
+	struct BundleTrailer trailer = {0, 0, BUNDLE_MAGIC};
+	UINT64 exportedSize = 0;
+	BOOL success = index != NULL;
+
+	for(SIZE_T i = 0; i < candidates.count && success; ++i) {
+		const struct EvictionCandidate* candidate = &candidates.entries[i];
+		WCHAR entryDir[MAX_PATH];
+		WCHAR objPath[MAX_PATH];
+
+		if(candidate->lastUse < minLastUse || (maxSize > 0 && exportedSize + candidate->size > maxSize))
+			break;
+
+		entry_directory(globalConfig.cachePath, &candidate->key, entryDir);
+		swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", entryDir);
+
+		SIZE_T packSize;
+		LPVOID pack = file_exists(objPath) ? pack_entry(entryDir, &packSize) : NULL;
+
+		if(!pack)
+			continue;
+
+		BYTE* compressed = malloc(lz_compress_bound(packSize));
+		SIZE_T compressedSize = compressed ? lz_compress(pack, packSize, compressed) : 0;
+		BOOL isCompressed = compressedSize > 0 && compressedSize < packSize;
+		struct BundleIndexEntry* indexEntry = &index[trailer.numEntries++];
+
+		indexEntry->key = candidate->key;
+		indexEntry->offset = trailer.indexOffset;
+		indexEntry->storedSize = isCompressed ? compressedSize : packSize;
+		indexEntry->size = packSize;
+		indexEntry->checksum = XXH64(pack, packSize, 0);
+		success = write_file(file, isCompressed ? (LPCVOID)compressed : pack, (SIZE_T)indexEntry->storedSize);
+		trailer.indexOffset += indexEntry->storedSize;
+		exportedSize += candidate->size;
+		free(compressed);
+		free(pack);
+	}
+
+	// The index is aligned so that it can be used in place when the bundle is mapped
+	BYTE padding[8] = {0};
+	SIZE_T paddingSize = (SIZE_T)((8 - trailer.indexOffset % 8) % 8);
+
+	trailer.indexOffset += paddingSize;
+
+	if(success) {
+		qsort(index, (SIZE_T)trailer.numEntries, sizeof(*index), compare_bundle_index_entries_for_qsort);
+		success = write_file(file, padding, paddingSize) && write_file(file, index, (SIZE_T)trailer.numEntries * sizeof(*index)) &&
+				  write_file(file, &trailer, sizeof(trailer));
+	}
+
+	close_file(file);
+	free(index);
+	free(candidates.entries);
+
+	if(!success) {
+		wprintf(L"Unable to write to '%ls'\n", argv[2]);
+		delete_file(argv[2]);
+
+		return EXIT_FAILURE;
+	}
+
+	wprintf(L"Exported %llu entries (%llu MB) to '%ls'\n",
+			(unsigned long long)trailer.numEntries,
+			(unsigned long long)(exportedSize / (1024 * 1024)),
+			argv[2]);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Returns the index of a mapped bundle or NULL if it is not a valid bundle.
+ */
+const struct BundleIndexEntry* bundle_index(LPCVOID bundle, UINT64 bundleSize, UINT64* outNumEntries) {
+	struct BundleTrailer trailer;
+
+	if(bundleSize < sizeof(trailer))
+		return NULL;
+
+	memcpy(&trailer, (const BYTE*)bundle + bundleSize - sizeof(trailer), sizeof(trailer));
+
+	if(trailer.magic != BUNDLE_MAGIC || trailer.indexOffset % 8 != 0 || trailer.indexOffset > bundleSize - sizeof(trailer) ||
+	   trailer.numEntries != (bundleSize - sizeof(trailer) - trailer.indexOffset) / sizeof(struct BundleIndexEntry))
+		return NULL;
+
+	*outNumEntries = trailer.numEntries;
+
+	return (const struct BundleIndexEntry*)((const BYTE*)bundle + trailer.indexOffset);
+}
+
+/*
+ * Returns the pack of an entry of a mapped bundle which must be freed with free, or NULL if the entry is corrupt.
+ */
+LPVOID read_bundle_entry(LPCVOID bundle, UINT64 bundleSize, const struct BundleIndexEntry* entry) {
+	if(entry->offset > bundleSize || entry->storedSize > bundleSize - entry->offset || entry->storedSize > entry->size ||
+	   entry->size > (SIZE_T)-1)
+		return NULL;
+
+	BYTE* pack = malloc(entry->size > 0 ? (SIZE_T)entry->size : 1);
+	const BYTE* stored = (const BYTE*)bundle + entry->offset;
+
+	if(!pack)
+		return NULL;
+
+	if(entry->storedSize == entry->size) {
+		memcpy(pack, stored, (SIZE_T)entry->size);
+	} else if(!lz_decompress(stored, (SIZE_T)entry->storedSize, pack, (SIZE_T)entry->size)) {
+		free(pack);
+
+		return NULL;
+	}
+
+	if(XXH64(pack, (SIZE_T)entry->size, 0) != entry->checksum) {
+		free(pack);
+
+		return NULL;
+	}
+
+	return pack;
+}
+
+struct ImportWork {
+	LPCVOID bundle;
+	UINT64 bundleSize;
+	const struct BundleIndexEntry* entries;
+	SIZE_T count;
+	UINT64 numImported;
+	UINT64 importedSize;
+};
+
+DWORD import_entries(LPVOID param) {
+	struct ImportWork* work = param;
+
+	for(SIZE_T i = 0; i < work->count; ++i) {
+		WCHAR entryDir[MAX_PATH];
+		WCHAR objPath[MAX_PATH];
+		UINT64 size;
+
+		entry_directory(globalConfig.cachePath, &work->entries[i].key, entryDir);
+		swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", entryDir);
+
+		if(file_exists(objPath))
+			continue;
+
+		LPVOID pack = read_bundle_entry(work->bundle, work->bundleSize, &work->entries[i]);
+
+		if(pack && unpack_entry(pack, (SIZE_T)work->entries[i].size, globalConfig.cachePath, &work->entries[i].key, &size)) {
+			++work->numImported;
+			work->importedSize += size;
+		}
+
+		free(pack);
+	}
+
+	return 0;
+}
+
+/*
+ * lelcache --import <file>
+ * Adds all entries of a bundle that are missing from the local cache.
+ */
+int run_import(int argc, LPWSTR* argv) {
+	if(argc != 3) {
+		wprintf(L"--import expects a file name as an argument\n");
+
+		return EXIT_FAILURE;
+	}
+
+	LPCVOID bundle;
+	UINT64 bundleSize, numEntries;
+	FileMappingHandle mapping = map_file(argv[2], &bundle, &bundleSize);
+	const struct BundleIndexEntry* index = mapping ? bundle_index(bundle, bundleSize, &numEntries) : NULL;
+
+	if(!index) {
+		wprintf(L"'%ls' is not a valid bundle\n", argv[2]);
+		unmap_file(mapping);
+
+		return EXIT_FAILURE;
+	}
+
+	struct ImportWork work[IMPORT_NUM_THREADS] = {0};
+	ThreadHandle threads[IMPORT_NUM_THREADS] = {0};
+	UINT64 numImported = 0;
+	UINT64 importedSize = 0;
+
+	for(int i = 0; i < IMPORT_NUM_THREADS; ++i) {
+		SIZE_T begin = (SIZE_T)(numEntries * i / IMPORT_NUM_THREADS);
+
+		work[i].bundle = bundle;
+		work[i].bundleSize = bundleSize;
+		work[i].entries = index + begin;
+		work[i].count = (SIZE_T)(numEntries * (i + 1) / IMPORT_NUM_THREADS) - begin;
+
+		if(work[i].count > 0)
+			threads[i] = start_thread(import_entries, &work[i]);
+	}
+
+	for(int i = 0; i < IMPORT_NUM_THREADS; ++i) {
+		if(threads[i])
+			join_thread(threads[i]);
+		else if(work[i].count > 0)
+			import_entries(&work[i]);
+
+		numImported += work[i].numImported;
+		importedSize += work[i].importedSize;
+	}
+
+	unmap_file(mapping);
+	grow_tier(globalConfig.cachePath, globalConfig.maxCacheSize, importedSize);
+	wprintf(L"Imported %llu of %llu entries (%llu MB)\n",
+			(unsigned long long)numImported,
+			(unsigned long long)numEntries,
+			(unsigned long long)(importedSize / (1024 * 1024)));
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Serves a local miss from the mounted bundle by writing the files of the entry directly to the output paths.
+ */
+BOOL copy_from_bundle(const struct CacheKey* key, struct CommandLineInfo* cmdLineInfo) {
+	if(globalConfig.bundlePath[0] == L'\0')
+		return FALSE;
+
+	LPCVOID bundle;
+	UINT64 bundleSize, numEntries;
+	FileMappingHandle mapping = map_file(globalConfig.bundlePath, &bundle, &bundleSize);
+	const struct BundleIndexEntry* index = mapping ? bundle_index(bundle, bundleSize, &numEntries) : NULL;
+	const struct BundleIndexEntry* entry = NULL;
+
+	// Binary search in the sorted index
+	for(UINT64 begin = 0, end = index ? numEntries : 0; begin < end && !entry;) {
+		UINT64 middle = begin + (end - begin) / 2;
+		int comparison = compare_cache_keys(key, &index[middle].key);
+
+		if(comparison == 0)
+			entry = &index[middle];
+		else if(comparison < 0)
+			end = middle;
+		else
+			begin = middle + 1;
+	}
+
+	LPVOID pack = entry ? read_bundle_entry(bundle, bundleSize, entry) : NULL;
+	LPCVOID obj, pdb = NULL, dep = NULL;
+	UINT64 objSize, pdbSize = 0, depSize = 0;
+	BOOL copied = pack && find_packed_file(pack, (SIZE_T)entry->size, L"obj", &obj, &objSize) &&
+				  (!cmdLineInfo->pdbFile || find_packed_file(pack, (SIZE_T)entry->size, L"pdb", &pdb, &pdbSize)) &&
+				  (!cmdLineInfo->dependencyFile || find_packed_file(pack, (SIZE_T)entry->size, L"dep", &dep, &depSize));
+
+	copied = copied && write_struct_file(cmdLineInfo->objectFile, obj, (SIZE_T)objSize) &&
+			 (!pdb || write_struct_file(cmdLineInfo->pdbFile, pdb, (SIZE_T)pdbSize)) &&
+			 (!dep || write_struct_file(cmdLineInfo->dependencyFile, dep, (SIZE_T)depSize));
+
+	free(pack);
+	unmap_file(mapping);
+
+	if(copied) {
+		struct CacheInfo cacheInfo;
+		FileHandle cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+
+		++cacheInfo.numCacheHits;
+		++cacheInfo.numBundleHits;
+		unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
+	}
+
+	return copied;
+}
+
+/*
+ * Sync
+ *
+ * 'lelcache sync' makes two caches contain the union of their entries as far as their size limits allow. The other cache
+ * is either a directory or a lelcache process that serves its cache over its stdin and stdout, e.g. started through ssh.
+ * Both sides compare their Merkle summaries from the root downwards, so only the ranges of keys that differ are listed and
+ * only the entries missing on one side are transferred. This way the time a sync takes grows with the difference between
+ * the caches rather than with their size.
+ */
+
+#define MERKLE_FANOUT 16
+#define MERKLE_NUM_LEVELS 5 // MERKLE_NUM_LEAVES is MERKLE_FANOUT to the power of MERKLE_NUM_LEVELS - 1
+#define MERKLE_NUM_NODES (MERKLE_NUM_LEAVES + MERKLE_NUM_LEAVES / 16 + MERKLE_NUM_LEAVES / 256 + MERKLE_NUM_LEAVES / 4096 + 1)
+#define SYNC_MAGIC 0x434e59534c454cull // 'LELSYNC'
+#define SYNC_PROTOCOL_VERSION 1
+#define SYNC_LEAVES_PER_BATCH 1024
+#define SYNC_MAX_MESSAGE_SIZE (1024 * 1024 * 1024)
+
+/*
+ * The leaves of a tree are level 0, the root is the only node of level MERKLE_NUM_LEVELS - 1. The levels are stored one after
+ * another, starting with the leaves.
+ */
+SIZE_T merkle_level_size(int level) {
+	SIZE_T size = MERKLE_NUM_LEAVES;
+
+	for(int i = 0; i < level; ++i)
+		size /= MERKLE_FANOUT;
+
+	return size;
+}
+
+SIZE_T merkle_level_offset(int level) {
+	SIZE_T offset = 0;
+
+	for(int i = 0; i < level; ++i)
+		offset += merkle_level_size(i);
+
+	return offset;
+}
+
+void collect_complete_entry_key(LPCWSTR entryDir, const struct CacheKey* key, LPVOID context) {
+	WCHAR objPath[MAX_PATH];
+
+	swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", entryDir);
+
+	if(file_exists(objPath))
+		add_to_key_list(context, key);
+}
+
+/*
+ * Reads the leaves of the summary of cacheRoot and computes the rest of the tree. Every inner node is the hash of its
+ * children. If there is no summary yet it is created from all entries of the cache.
+ */
+UINT64* load_merkle_tree(LPCWSTR cacheRoot) {
+	WCHAR path[MAX_PATH];
+	UINT64* tree = calloc(MERKLE_NUM_NODES, sizeof(UINT64));
+	SIZE_T leavesSize = MERKLE_NUM_LEAVES * sizeof(UINT64);
+	BOOL loaded = FALSE;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING MERKLE_FILE_NAME, cacheRoot);
+
+	if(file_exists(path)) {
+		FileHandle file = lock_file(path);
+
+		if(file != INVALID_FILE_HANDLE) {
+			loaded = file_handle_size(file) == leavesSize && seek_file(file, 0) && read_file(file, tree, leavesSize) == leavesSize;
+			unlock_file(file);
+		}
+	}
+
+	if(!loaded) {
+		struct KeyList keys = {0};
+
+		memset(tree, 0, leavesSize);
+		for_each_entry(cacheRoot, collect_complete_entry_key, &keys);
+
+		for(SIZE_T i = 0; i < keys.count; ++i)
+			tree[merkle_leaf_index(&keys.keys[i])] ^= merkle_key_hash(&keys.keys[i]);
+
+		free(keys.keys);
+
+		// Entries added while the cache was visited are missing, the leaves they belong to are repaired by the next sync
+		if(!make_path(cacheRoot) || !publish_data(path, tree, leavesSize))
+			wprintf(L"Unable to write the summary of '%ls'\n", cacheRoot);
+	}
+
+	for(int level = 1; level < MERKLE_NUM_LEVELS; ++level) {
+		const UINT64* children = tree + merkle_level_offset(level - 1);
+		UINT64* nodes = tree + merkle_level_offset(level);
+
+		for(SIZE_T i = 0; i < merkle_level_size(level); ++i)
+			nodes[i] = XXH64(children + i * MERKLE_FANOUT, MERKLE_FANOUT * sizeof(UINT64), 0);
+	}
+
+	return tree;
+}
+
+/*
+ * Adds the keys of the complete entries in the given leaves to keys. Leaves of the stored summary that don't match the
+ * entries, e.g. because two processes added the same entry at once, are corrected.
+ */
+void list_merkle_leaves(LPCWSTR cacheRoot, const UINT64* tree, const UINT32* leaves, SIZE_T count, struct KeyList* keys) {
+	WCHAR path[MAX_PATH];
+	UINT32* repairedLeaves = malloc(count * sizeof(UINT32) + 1);
+	UINT64* repairedValues = malloc(count * sizeof(UINT64) + 1);
+	SIZE_T numRepaired = 0;
+	SIZE_T rootLength = wcslen(cacheRoot);
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		XXH64_hash_t prefix = 0;
+		Hash64String prefixStr;
+		SIZE_T first = keys->count;
+		UINT64 leaf = 0;
+
+		((BYTE*)&prefix)[0] = (BYTE)(leaves[i] >> 8);
+		((BYTE*)&prefix)[1] = (BYTE)leaves[i];
+		hash64_to_string(prefix, prefixStr);
+		swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING, cacheRoot);
+		path_from_hash64_string(prefixStr, path + rootLength + 1);
+		path[rootLength + 6] = L'\0'; // Only the first two levels, without the trailing separator
+		for_each_entry_in(path, 2, collect_complete_entry_key, keys);
+
+		for(SIZE_T j = first; j < keys->count; ++j)
+			leaf ^= merkle_key_hash(&keys->keys[j]);
+
+		if(leaf != tree[leaves[i]]) {
+			repairedLeaves[numRepaired] = leaves[i];
+			repairedValues[numRepaired++] = leaf;
+		}
+	}
+
+	if(numRepaired > 0) {
+		swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING MERKLE_FILE_NAME, cacheRoot);
+
+		FileHandle file = lock_file(path);
+
+		if(file != INVALID_FILE_HANDLE) {
+			for(SIZE_T i = 0; i < numRepaired && file_handle_size(file) == MERKLE_NUM_LEAVES * sizeof(UINT64); ++i) {
+				if(seek_file(file, repairedLeaves[i] * sizeof(UINT64)))
+					write_file(file, &repairedValues[i], sizeof(UINT64));
+			}
+
+			unlock_file(file);
+		}
+	}
+
+	free(repairedLeaves);
+	free(repairedValues);
+}
+
+enum SyncStoreResult {
+	SYNC_STORED,
+	SYNC_REJECTED, // The cache is full
+	SYNC_FAILED
+};
+
+/*
+ * Adds an entry received from the other cache unless that would make the cache larger than maxSize.
+ */
+enum SyncStoreResult store_synced_entry(LPCWSTR cacheRoot, UINT64 maxSize, const struct CacheKey* key, LPCVOID pack, SIZE_T packSize) {
+	WCHAR objPath[MAX_PATH];
+	struct CacheInfo info;
+	UINT64 size;
+
+	entry_directory(cacheRoot, key, objPath);
+	wcscat(objPath, PATH_SEPARATOR_STRING L"obj");
+
+	if(file_exists(objPath)) // Added by a compilation in the meantime
+		return SYNC_STORED;
+
+	// The size of a pack is a little larger than the size of the entry
+	if(!cache_info(cacheRoot, &info, FALSE) || info.currentCacheSize + packSize > maxSize)
+		return SYNC_REJECTED;
+
+	if(!unpack_entry(pack, packSize, cacheRoot, key, &size))
+		return SYNC_FAILED;
+
+	FileHandle cacheInfoLock = lock_cache_info(cacheRoot, &info);
+
+	info.currentCacheSize += size;
+	unlock_cache_info(cacheRoot, cacheInfoLock, &info);
+
+	return SYNC_STORED;
+}
+
+enum SyncMessageType {
+	SYNC_HELLO,       // The payload is SYNC_MAGIC, the argument of the reply is SYNC_PROTOCOL_VERSION
+	SYNC_NODES,       // Nodes of the level in argument, the payload is their indices and the reply their hashes
+	SYNC_LIST_LEAVES, // The payload is the indices of leaves and the reply the keys of their entries
+	SYNC_GET_PACK,    // The payload is a key and the reply the pack of the entry, which is empty if it doesn't exist
+	SYNC_PUT_PACK,    // The payload is a key followed by a pack, the argument of the reply is a SyncStoreResult
+	SYNC_DONE         // Not replied to
+};
+
+struct SyncMessage {
+	UINT32 type;
+	UINT32 argument;
+	UINT64 size; // Of the payload that follows
+};
+
+BOOL send_sync_message(FileHandle file, enum SyncMessageType type, UINT32 argument, LPCVOID payload, UINT64 size) {
+	struct SyncMessage message = {type, argument, size};
+
+	return write_file(file, &message, sizeof(message)) && (size == 0 || write_file(file, payload, (SIZE_T)size));
+}
+
+/*
+ * Reads the next message. The payload must be freed with free.
+ */
+BOOL receive_sync_message(FileHandle file, struct SyncMessage* outMessage, LPVOID* outPayload) {
+	if(read_file(file, outMessage, sizeof(*outMessage)) != sizeof(*outMessage) || outMessage->size > SYNC_MAX_MESSAGE_SIZE)
+		return FALSE;
+
+	*outPayload = malloc((SIZE_T)outMessage->size + 1);
+
+	if(*outPayload && read_file(file, *outPayload, (SIZE_T)outMessage->size) == outMessage->size)
+		return TRUE;
+
+	free(*outPayload);
+
+	return FALSE;
+}
+
+struct SyncPeer {
+	LPCWSTR cacheRoot; // NULL if the cache is served by another process
+	UINT64 maxSize;
+	UINT64* tree;
+	FileHandle requests; // Written to the stdin of the other process
+	FileHandle replies;  // Read from its stdout
+	BOOL isFull;         // Set once the cache rejected an entry
+	UINT64 numCopied;    // Entries copied to this cache
+	UINT64 copiedSize;
+	UINT64 numSkipped;   // Entries not copied because the cache is full
+};
+
+/*
+ * Sends a request to the process serving the cache of peer and waits for the reply. The payload of the reply must be
+ * freed with free.
+ */
+BOOL sync_request(struct SyncPeer* peer, enum SyncMessageType type, UINT32 argument, LPCVOID payload, UINT64 size,
+				  struct SyncMessage* outReply, LPVOID* outReplyPayload) {
+	if(!send_sync_message(peer->requests, type, argument, payload, size) || !receive_sync_message(peer->replies, outReply, outReplyPayload))
+		return FALSE;
+
+	if(outReply->type == type)
+		return TRUE;
+
+	free(*outReplyPayload);
+
+	return FALSE;
+}
+
+BOOL peer_nodes(struct SyncPeer* peer, int level, const UINT32* indices, SIZE_T count, UINT64* outNodes) {
+	if(peer->cacheRoot) {
+		for(SIZE_T i = 0; i < count; ++i)
+			outNodes[i] = peer->tree[merkle_level_offset(level) + indices[i]];
+
+		return TRUE;
+	}
+
+	struct SyncMessage reply;
+	LPVOID nodes;
+
+	if(!sync_request(peer, SYNC_NODES, level, indices, count * sizeof(UINT32), &reply, &nodes))
+		return FALSE;
+
+	BOOL valid = reply.size == count * sizeof(UINT64);
+
+	if(valid)
+		memcpy(outNodes, nodes, (SIZE_T)reply.size);
+
+	free(nodes);
+
+	return valid;
+}
+
+BOOL peer_list_leaves(struct SyncPeer* peer, const UINT32* leaves, SIZE_T count, struct KeyList* keys) {
+	if(peer->cacheRoot) {
+		list_merkle_leaves(peer->cacheRoot, peer->tree, leaves, count, keys);
+
+		return TRUE;
+	}
+
+	struct SyncMessage reply;
+	LPVOID listedKeys;
+
+	if(!sync_request(peer, SYNC_LIST_LEAVES, 0, leaves, count * sizeof(UINT32), &reply, &listedKeys))
+		return FALSE;
+
+	BOOL valid = reply.size % sizeof(struct CacheKey) == 0;
+
+	for(SIZE_T i = 0; valid && i < reply.size / sizeof(struct CacheKey); ++i)
+		add_to_key_list(keys, (const struct CacheKey*)listedKeys + i);
+
+	free(listedKeys);
+
+	return valid;
+}
+
+/*
+ * outPack is set to NULL if the cache doesn't have the entry (anymore).
+ */
+BOOL peer_get_pack(struct SyncPeer* peer, const struct CacheKey* key, LPVOID* outPack, SIZE_T* outSize) {
+	*outPack = NULL;
+
+	if(peer->cacheRoot) {
+		WCHAR entryDir[MAX_PATH];
+		WCHAR objPath[MAX_PATH];
+
+		entry_directory(peer->cacheRoot, key, entryDir);
+		swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", entryDir);
+
+		if(file_exists(objPath))
+			*outPack = pack_entry(entryDir, outSize);
+
+		return TRUE;
+	}
+
+	struct SyncMessage reply;
+
+	if(!sync_request(peer, SYNC_GET_PACK, 0, key, sizeof(*key), &reply, outPack))
+		return FALSE;
+
+	*outSize = (SIZE_T)reply.size;
+
+	if(reply.size == 0) {
+		free(*outPack);
+		*outPack = NULL;
+	}
+
+	return TRUE;
+}
+
+BOOL peer_put_pack(struct SyncPeer* peer, const struct CacheKey* key, LPCVOID pack, SIZE_T size, enum SyncStoreResult* outResult) {
+	if(peer->cacheRoot) {
+		*outResult = store_synced_entry(peer->cacheRoot, peer->maxSize, key, pack, size);
+
+		return TRUE;
+	}
+
+	BYTE* payload = malloc(sizeof(*key) + size);
+	struct SyncMessage reply;
+	LPVOID replyPayload;
+
+	if(!payload)
+		return FALSE;
+
+	memcpy(payload, key, sizeof(*key));
+	memcpy(payload + sizeof(*key), pack, size);
+
+	BOOL sent = sync_request(peer, SYNC_PUT_PACK, 0, payload, sizeof(*key) + size, &reply, &replyPayload);
+
+	free(payload);
+
+	if(!sent)
+		return FALSE;
+
+	free(replyPayload);
+	*outResult = reply.argument;
+
+	return TRUE;
+}
+
+int __cdecl compare_cache_keys_for_qsort(const void* a, const void* b) {
+	return compare_cache_keys(a, b);
+}
+
+/*
+ * Copies an entry that only source has to destination unless destination is full already.
+ */
+BOOL transfer_entry(struct SyncPeer* source, struct SyncPeer* destination, const struct CacheKey* key) {
+	LPVOID pack;
+	SIZE_T packSize;
+	enum SyncStoreResult result = SYNC_FAILED;
+
+	if(destination->isFull) {
+		++destination->numSkipped;
+
+		return TRUE;
+	}
+
+	if(!peer_get_pack(source, key, &pack, &packSize))
+		return FALSE;
+
+	if(!pack) // Evicted since it was listed
+		return TRUE;
+
+	BOOL transferred = peer_put_pack(destination, key, pack, packSize, &result);
+
+	free(pack);
+
+	if(result == SYNC_STORED) {
+		++destination->numCopied;
+		destination->copiedSize += packSize;
+	} else if(result == SYNC_REJECTED) {
+		destination->isFull = TRUE;
+		++destination->numSkipped;
+	}
+
+	return transferred;
+}
+
+/*
+ * Finds the leaves that differ between the two caches and copies the entries only one of them has to the other one.
+ */
+BOOL sync_peers(struct SyncPeer* peers) {
+	UINT32* indices = malloc(MERKLE_NUM_LEAVES * sizeof(UINT32));
+	UINT32* differing = malloc(MERKLE_NUM_LEAVES * sizeof(UINT32));
+	UINT64* nodes[2] = {malloc(MERKLE_NUM_LEAVES * sizeof(UINT64)), malloc(MERKLE_NUM_LEAVES * sizeof(UINT64))};
+	SIZE_T count = 1;
+	BOOL success = TRUE;
+
+	indices[0] = 0;
+
+	// Descending from the root, only the children of nodes that differ are compared
+	for(int level = MERKLE_NUM_LEVELS - 1; level >= 0 && count > 0 && success; --level) {
+		SIZE_T numDiffering = 0;
+
+		success = peer_nodes(&peers[0], level, indices, count, nodes[0]) && peer_nodes(&peers[1], level, indices, count, nodes[1]);
+
+		for(SIZE_T i = 0; success && i < count; ++i) {
+			if(nodes[0][i] == nodes[1][i])
+				continue;
+
+			if(level == 0) {
+				differing[numDiffering++] = indices[i];
+			} else {
+				for(UINT32 child = 0; child < MERKLE_FANOUT; ++child)
+					differing[numDiffering++] = indices[i] * MERKLE_FANOUT + child;
+			}
+		}
+
+		UINT32* swap = indices;
+
+		indices = differing;
+		differing = swap;
+		count = numDiffering;
+	}
+
+	for(SIZE_T begin = 0; success && begin < count; begin += SYNC_LEAVES_PER_BATCH) {
+		SIZE_T batchSize = count - begin < SYNC_LEAVES_PER_BATCH ? count - begin : SYNC_LEAVES_PER_BATCH;
+		struct KeyList keys[2] = {{0}, {0}};
+
+		for(int i = 0; i < 2 && success; ++i) {
+			success = peer_list_leaves(&peers[i], indices + begin, batchSize, &keys[i]);
+			qsort(keys[i].keys, keys[i].count, sizeof(struct CacheKey), compare_cache_keys_for_qsort);
+		}
+
+		// Merging the sorted lists, a key that is only in one of them is copied to the other cache
+		for(SIZE_T a = 0, b = 0; success && (a < keys[0].count || b < keys[1].count);) {
+			int comparison = a == keys[0].count ? 1 : b == keys[1].count ? -1 : compare_cache_keys(&keys[0].keys[a], &keys[1].keys[b]);
+
+			if(comparison < 0) {
+				success = transfer_entry(&peers[0], &peers[1], &keys[0].keys[a++]);
+			} else if(comparison > 0) {
+				success = transfer_entry(&peers[1], &peers[0], &keys[1].keys[b++]);
+			} else {
+				++a;
+				++b;
+			}
+		}
+
+		free(keys[0].keys);
+		free(keys[1].keys);
+	}
+
+	free(indices);
+	free(differing);
+	free(nodes[0]);
+	free(nodes[1]);
+
+	return success;
+}
+
+/*
+ * lelcache sync --serve
+ * Serves the local cache to a 'lelcache sync --command' on the other end of stdin and stdout.
+ */
+int run_sync_server(void) {
+	FileHandle requests = standard_input();
+	FileHandle replies = take_standard_output();
+	struct SyncPeer self = {0};
+	struct SyncMessage message;
+	LPVOID payload;
+	BOOL success = TRUE;
+
+	self.cacheRoot = globalConfig.cachePath;
+	self.maxSize = globalConfig.maxCacheSize;
+
+	while(success && receive_sync_message(requests, &message, &payload)) {
+		SIZE_T numIndices = (SIZE_T)message.size / sizeof(UINT32);
+		const UINT32* indices = payload;
+
+		switch(message.type) {
+		case SYNC_HELLO:
+			{
+				UINT64 magic = SYNC_MAGIC;
+
+				if(!self.tree)
+					self.tree = load_merkle_tree(self.cacheRoot);
+
+				success = send_sync_message(replies, SYNC_HELLO, SYNC_PROTOCOL_VERSION, &magic, sizeof(magic));
+			}
+
+			break;
+		case SYNC_NODES:
+		case SYNC_LIST_LEAVES:
+			{
+				int level = message.type == SYNC_NODES ? (int)message.argument : 0;
+				struct KeyList keys = {0};
+				UINT64* nodes = malloc(numIndices * sizeof(UINT64) + 1);
+
+				success = self.tree && level < MERKLE_NUM_LEVELS;
+
+				for(SIZE_T i = 0; success && i < numIndices; ++i)
+					success = indices[i] < merkle_level_size(level);
+
+				if(success && message.type == SYNC_NODES) {
+					peer_nodes(&self, level, indices, numIndices, nodes);
+					success = send_sync_message(replies, SYNC_NODES, 0, nodes, numIndices * sizeof(UINT64));
+				} else if(success) {
+					peer_list_leaves(&self, indices, numIndices, &keys);
+					success = send_sync_message(replies, SYNC_LIST_LEAVES, 0, keys.keys, keys.count * sizeof(struct CacheKey));
+				}
+
+				free(nodes);
+				free(keys.keys);
+			}
+
+			break;
+		case SYNC_GET_PACK:
+			{
+				LPVOID pack = NULL;
+				SIZE_T packSize = 0;
+
+				success = message.size == sizeof(struct CacheKey) && peer_get_pack(&self, payload, &pack, &packSize) &&
+						  send_sync_message(replies, SYNC_GET_PACK, 0, pack, pack ? packSize : 0);
+				free(pack);
+			}
+
+			break;
+		case SYNC_PUT_PACK:
+			{
+				enum SyncStoreResult result = SYNC_FAILED;
+
+				success = message.size > sizeof(struct CacheKey) &&
+						  peer_put_pack(&self, payload, (const BYTE*)payload + sizeof(struct CacheKey), (SIZE_T)message.size - sizeof(struct CacheKey), &result) &&
+						  send_sync_message(replies, SYNC_PUT_PACK, result, NULL, 0);
+			}
+
+			break;
+		default:
+			success = FALSE; // SYNC_DONE or garbage
+			break;
+		}
+
+		free(payload);
+	}
+
+	close_file(replies);
+	free(self.tree);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * lelcache sync <dir> [<megabytes>]
+ * lelcache sync --command <program> [<args>...]
+ * Syncs the local cache with the cache in <dir>/.lelcache, whose size is limited to <megabytes> (default: the limit of the
+ * local cache), or with the cache served by a 'lelcache sync --serve' started by <program>.
+ */
+int run_sync(int argc, LPWSTR* argv) {
+	WCHAR otherRoot[MAX_PATH];
+	WCHAR programPath[MAX_PATH];
+	struct SyncPeer peers[2] = {{0}, {0}};
+	ProcessHandle process;
+	BOOL isStream = argc > 2 && wcscmp(argv[2], L"--command") == 0;
+
+	if(argc > 2 && wcscmp(argv[2], L"--serve") == 0)
+		return run_sync_server();
+
+	if(argc < 3 || (isStream && argc < 4) || (!isStream && argc > 4)) {
+		wprintf(L"sync expects a directory or '--command' followed by a command line as arguments\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if(isStream) {
+		LPCWSTR* args = (LPCWSTR*)argv + 3;
+
+		if(!find_executable(args[0], programPath)) {
+			wprintf(L"Unable to find '%ls'\n", args[0]);
+
+			return EXIT_FAILURE;
+		}
+
+		args[0] = programPath;
+
+		if(!launch_process_with_pipes(argc - 3, args, &peers[1].requests, &peers[1].replies, &process))
+			return EXIT_FAILURE;
+	} else {
+		if(!cache_path_from_argument(argv[2], otherRoot))
+			return EXIT_FAILURE;
+
+		peers[1].cacheRoot = otherRoot;
+		peers[1].maxSize = argc > 3 ? wcstoull(argv[3], NULL, 0) * 1024 * 1024 : globalConfig.maxCacheSize;
+		peers[1].tree = load_merkle_tree(otherRoot);
+	}
+
+	peers[0].cacheRoot = globalConfig.cachePath;
+	peers[0].maxSize = globalConfig.maxCacheSize;
+	peers[0].tree = load_merkle_tree(globalConfig.cachePath);
+
+	UINT64 magic = SYNC_MAGIC;
+	struct SyncMessage reply;
+	LPVOID replyPayload;
+	BOOL success = peers[1].cacheRoot != NULL;
+
+	if(isStream && sync_request(&peers[1], SYNC_HELLO, 0, &magic, sizeof(magic), &reply, &replyPayload)) {
+		success = reply.argument == SYNC_PROTOCOL_VERSION && reply.size == sizeof(magic) && memcmp(replyPayload, &magic, sizeof(magic)) == 0;
+		free(replyPayload);
+	}
+
+	if(!success)
+		wprintf(L"'%ls' is not a 'lelcache sync --serve'\n", argv[3]);
+
+	success = success && sync_peers(peers);
+
+	if(isStream) {
+		send_sync_message(peers[1].requests, SYNC_DONE, 0, NULL, 0);
+		close_file(peers[1].requests);
+		close_file(peers[1].replies);
+		wait_for_process(&process);
+	}
+
+	free(peers[0].tree);
+	free(peers[1].tree);
+
+	if(!success) {
+		wprintf(L"Sync failed\n");
+
+		return EXIT_FAILURE;
+	}
+
+	wprintf(L"Copied %llu entries (%llu MB) to the other cache and %llu entries (%llu MB) from it\n",
+			(unsigned long long)peers[1].numCopied,
+			(unsigned long long)(peers[1].copiedSize / (1024 * 1024)),
+			(unsigned long long)peers[0].numCopied,
+			(unsigned long long)(peers[0].copiedSize / (1024 * 1024)));
+
+	for(int i = 0; i < 2; ++i) {
+		if(peers[i].numSkipped > 0)
+			wprintf(L"%llu entries were not copied to the %ls cache since it is full\n", (unsigned long long)peers[i].numSkipped, i == 0 ? L"local" : L"other");
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Generations
+ *
+ * Entries are partitioned into generations. A generation is identified by the fingerprint of a compiler and the epoch of
+ * the cache, which can be bumped to invalidate everything at once. The id of the generation is mixed into every key so
+ * that entries of other generations can never be hit, and it is recorded in the metadata of every entry. Retiring a
+ * generation only marks it in the generations file, its entries are deleted later by the background worker. Until then
+ * the compiler of a retired generation is called without caching.
+ * The ids only depend on the compiler and the epoch so that entries can still be shared with other machines.
+ */
+
+#define GENERATIONS_FILE_NAME L"generations"
+#define GENERATIONS_MAGIC 0x4e45474c // 'LGEN'
+#define GENERATION_PATH_LENGTH 260
+
+enum GenerationState {
+	GENERATION_LIVE,
+	GENERATION_RETIRED // Its entries are about to be deleted
+};
+
+const LPCWSTR generationStateNames[] = {L"live", L"retired"};
+
+struct GenerationsHeader {
+	UINT32 magic;
+	UINT32 epoch;
+};
+
+struct Generation {
+	XXH64_hash_t id;
+	UINT64 created;
+	UINT32 epoch;
+	UINT32 state; // enum GenerationState
+	WCHAR compilerPath[GENERATION_PATH_LENGTH]; // Only for display
+};
+
+/*
+ * Returns the generations known to the cache at cacheRoot, which must be freed with free. outHeader is set to the default
+ * values if there are none yet.
+ */
+struct Generation* read_generations(LPCWSTR cacheRoot, struct GenerationsHeader* outHeader, SIZE_T* outCount) {
+	WCHAR path[MAX_PATH];
+	SIZE_T size = 0;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING GENERATIONS_FILE_NAME, cacheRoot);
+
+	BYTE* data = read_whole_file(path, &size);
+	struct Generation* generations = NULL;
+
+	*outHeader = (struct GenerationsHeader){GENERATIONS_MAGIC, 0};
+	*outCount = 0;
+
+	if(data && size >= sizeof(*outHeader) && ((struct GenerationsHeader*)data)->magic == GENERATIONS_MAGIC) {
+		memcpy(outHeader, data, sizeof(*outHeader));
+		*outCount = (size - sizeof(*outHeader)) / sizeof(struct Generation);
+		generations = malloc(*outCount * sizeof(struct Generation) + 1);
+		memcpy(generations, data + sizeof(*outHeader), *outCount * sizeof(struct Generation));
+	}
+
+	free(data);
+
+	return generations;
+}
+
+BOOL write_generations(LPCWSTR cacheRoot, const struct GenerationsHeader* header, const struct Generation* generations, SIZE_T count) {
+	WCHAR path[MAX_PATH];
+	SIZE_T size = sizeof(*header) + count * sizeof(*generations);
+	BYTE* data = malloc(size);
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING GENERATIONS_FILE_NAME, cacheRoot);
+	memcpy(data, header, sizeof(*header));
+	memcpy(data + sizeof(*header), generations, count * sizeof(*generations));
+
+	BOOL success = publish_data(path, data, size);
+
+	free(data);
+
+	return success;
+}
+
+/*
+ * The generations file is replaced by every change so the lock is a separate file.
+ */
+FileHandle lock_generations(LPCWSTR cacheRoot) {
+	WCHAR path[MAX_PATH];
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"generations.lock", cacheRoot);
+
+	return lock_file(path);
+}
+
+/*
+ * Determines the generation a compilation with the compiler at compilerPath belongs to and adds it to the generations of
+ * the local cache if it is new. Returns FALSE if the compiler doesn't exist or its generation is retired, in which case
+ * the compiler should be called directly.
+ * Hashing the whole compiler would be way too slow (clang alone is over 100 MB) so its size and modification time serve
+ * as its fingerprint instead.
+ */
+BOOL current_generation(LPCWSTR compilerPath, XXH64_hash_t* outId) {
+	WCHAR executablePath[MAX_PATH];
+	struct GenerationsHeader header;
+	SIZE_T count;
+
+	if(!find_executable(compilerPath, executablePath))
+		return FALSE;
+
+	struct Generation* generations = read_generations(globalConfig.cachePath, &header, &count);
+	UINT64 fingerprint[3] = {file_size(executablePath), file_modification_time(executablePath), header.epoch};
+	BOOL found = FALSE;
+	BOOL live = TRUE;
+
+	*outId = XXH64(fingerprint, sizeof(fingerprint), 0);
+
+	for(SIZE_T i = 0; i < count && !found; ++i) {
+		found = generations[i].id == *outId;
+		live = !found || generations[i].state == GENERATION_LIVE;
+	}
+
+	free(generations);
+
+	if(found || !make_path(globalConfig.cachePath))
+		return live;
+
+	FileHandle lock = lock_generations(globalConfig.cachePath);
+
+	// Another process might have added it in the meantime, or bumped the epoch in which case the old id is used anyway
+	generations = read_generations(globalConfig.cachePath, &header, &count);
+
+	for(SIZE_T i = 0; i < count && !found; ++i)
+		found = generations[i].id == *outId;
+
+	if(!found) {
+		struct Generation generation = {*outId, current_system_time(), (UINT32)fingerprint[2], GENERATION_LIVE, {0}};
+
+		wcsncpy(generation.compilerPath, executablePath, GENERATION_PATH_LENGTH - 1);
+		generations = realloc(generations, (count + 1) * sizeof(*generations));
+		generations[count++] = generation;
+		write_generations(globalConfig.cachePath, &header, generations, count);
+	}
+
+	free(generations);
+	unlock_file(lock);
+
+	return TRUE;
+}
+
+struct RetiredGenerations {
+	LPCWSTR cacheRoot;
+	XXH64_hash_t* ids;
+	SIZE_T count;
+	UINT64 deletedSize;
+};
+
+void delete_retired_entry(LPCWSTR entryDir, const struct CacheKey* key, LPVOID context) {
+	struct RetiredGenerations* retired = context;
+	struct EntryMetadata metadata = {0};
+	WCHAR path[MAX_PATH];
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"meta", entryDir);
+
+	if(!read_struct_file(path, &metadata, sizeof(metadata)))
+		return;
+
+	for(SIZE_T i = 0; i < retired->count; ++i) {
+		if(metadata.generation == retired->ids[i]) {
+			retired->deletedSize += delete_entry(retired->cacheRoot, key);
+
+			break;
+		}
+	}
+}
+
+/*
+ * Deletes the entries of all retired generations of the cache at cacheRoot and removes the generations afterwards.
+ */
+void drop_retired_generations(LPCWSTR cacheRoot) {
+	struct GenerationsHeader header;
+	SIZE_T count;
+	struct Generation* generations = read_generations(cacheRoot, &header, &count);
+	struct RetiredGenerations retired = {cacheRoot, malloc(count * sizeof(XXH64_hash_t) + 1), 0, 0};
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		if(generations[i].state == GENERATION_RETIRED)
+			retired.ids[retired.count++] = generations[i].id;
+	}
+
+	free(generations);
+
+	if(retired.count > 0) {
+		for_each_entry(cacheRoot, delete_retired_entry, &retired);
+
+		FileHandle lock = lock_generations(cacheRoot);
+		SIZE_T numKept = 0;
+
+		generations = read_generations(cacheRoot, &header, &count);
+
+		for(SIZE_T i = 0; i < count; ++i) {
+			BOOL dropped = FALSE;
+
+			for(SIZE_T j = 0; j < retired.count && generations[i].state == GENERATION_RETIRED; ++j)
+				dropped = dropped || generations[i].id == retired.ids[j];
+
+			if(!dropped)
+				generations[numKept++] = generations[i];
+		}
+
+		write_generations(cacheRoot, &header, generations, numKept);
+		free(generations);
+		unlock_file(lock);
+
+		struct CacheInfo info;
+		FileHandle cacheInfoLock = lock_cache_info(cacheRoot, &info);
+
+		info.currentCacheSize -= retired.deletedSize < info.currentCacheSize ? retired.deletedSize : info.currentCacheSize;
+		unlock_cache_info(cacheRoot, cacheInfoLock, &info);
+	}
+
+	free(retired.ids);
+}
+
+/*
+ * Marks the generation with the given id as retired, or all live generations if id is NULL in which case the epoch is
+ * bumped as well. The entries are deleted by the background worker.
+ */
+BOOL retire_generations(const XXH64_hash_t* id) {
+	struct GenerationsHeader header;
+	SIZE_T count;
+
+	if(!make_path(globalConfig.cachePath))
+		return FALSE;
+
+	FileHandle lock = lock_generations(globalConfig.cachePath);
+	struct Generation* generations = read_generations(globalConfig.cachePath, &header, &count);
+	BOOL found = id == NULL;
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		if(!id || generations[i].id == *id) {
+			generations[i].state = GENERATION_RETIRED;
+			found = TRUE;
+		}
+	}
+
+	if(!id)
+		++header.epoch;
+
+	BOOL success = found && write_generations(globalConfig.cachePath, &header, generations, count);
+
+	free(generations);
+	unlock_file(lock);
+
+	if(success)
+		start_background_worker();
+
+	return success;
+}
+
+/*
+ * lelcache generations
+ * lelcache --retire <id>
+ * lelcache --new-epoch
+ */
+int run_generations(int argc, LPWSTR* argv) {
+	if(wcscmp(argv[1], L"--new-epoch") == 0) {
+		if(!retire_generations(NULL)) {
+			wprintf(L"Unable to start a new epoch\n");
+
+			return EXIT_FAILURE;
+		}
+
+		wprintf(L"Started a new epoch, all entries of previous ones will be deleted\n");
+
+		return EXIT_SUCCESS;
+	}
+
+	if(wcscmp(argv[1], L"--retire") == 0) {
+		XXH64_hash_t id;
+
+		if(argc != 3 || wcslen(argv[2]) != LEL_HASH64_STRING_LENGTH || !hash64_from_string(argv[2], &id)) {
+			wprintf(L"--retire expects the id of a generation as an argument, see 'lelcache generations'\n");
+
+			return EXIT_FAILURE;
+		}
+
+		if(!retire_generations(&id)) {
+			wprintf(L"Unknown generation '%ls'\n", argv[2]);
+
+			return EXIT_FAILURE;
+		}
+
+		wprintf(L"Generation '%ls' retired, its entries will be deleted\n", argv[2]);
+
+		return EXIT_SUCCESS;
+	}
+
+	struct GenerationsHeader header;
+	SIZE_T count;
+	struct Generation* generations = read_generations(globalConfig.cachePath, &header, &count);
+	UINT64 now = current_system_time();
+
+	wprintf(L"epoch: %u\n", header.epoch);
+
+	for(SIZE_T i = 0; i < count; ++i) {
+		Hash64String idStr;
+
+		hash64_to_string(generations[i].id, idStr);
+		wprintf(L"%ls  %-7ls  epoch %-4u  %4llu days old  %ls\n",
+				idStr,
+				generationStateNames[generations[i].state == GENERATION_RETIRED],
+				generations[i].epoch,
+				(unsigned long long)((now - generations[i].created) / (24 * 60 * 60 * 10000000ull)),
+				generations[i].compilerPath);
+	}
+
+	free(generations);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Explaining misses
+ *
+ * With -k1 every new entry keeps what its key was computed from in its 'inputs' file: the flags that were hashed, the
+ * generation of the compiler, the profile and the hashes of the preprocessed source, the source file and, if the
+ * compiler wrote a dependency file, of every header. 'lelcache explain' computes the key of a command line and compares it
+ * with the inputs of the most recent entry for the same object file to tell which of them changed.
+ */
+
+#define KEY_INPUTS_FILE_NAME L"inputs"
+
+/*
+ * Header of an 'inputs' file. It is followed by numFlags strings and then numHeaders pairs of an XXH64_hash_t and a string.
+ * Every string is stored as a UINT32 length in characters followed by that many WCHARs.
+ */
+struct KeyInputs {
+	XXH64_hash_t generation;
+	XXH64_hash_t profileHash; // 0 without a profile
+	XXH64_hash_t contentHash; // Of the preprocessed source
+	XXH64_hash_t sourceHash;
+	UINT32 numFlags;
+	UINT32 numHeaders;
+};
+
+/*
+ * Adds the prerequisites of the first rule of a dependency file written by -MD to paths. -MP adds empty rules for the
+ * headers after it which are ignored.
+ */
+void read_dependency_file(LPCWSTR path, struct StringList* paths) {
+	SIZE_T size;
+	char* data = read_whole_file(path, &size);
+
+	if(!data)
+		return;
+
+	data = realloc(data, size + 1);
+	data[size] = '\0';
+
+	char* read = data;
+	char* prerequisite = malloc(size + 1);
+	WCHAR widePath[MAX_PATH];
+
+	// The target ends at the first ':' followed by whitespace since paths on Windows contain ':' as well
+	while(*read && !(read[0] == ':' && (read[1] == '\0' || strchr(" \t\r\n", read[1]))))
+		++read;
+
+	if(*read)
+		++read;
+
+	for(;;) {
+		if(*read == '\\' && read[1] == '\r' && read[2] == '\n') {
+			read += 3;
+		} else if(*read == '\\' && read[1] == '\n') {
+			read += 2;
+		} else if(*read == ' ' || *read == '\t' || *read == '\r') {
+			++read;
+		} else if(*read == '\0' || *read == '\n') {
+			break;
+		} else {
+			SIZE_T length = 0;
+
+			while(*read && !strchr(" \t\r\n", *read) && !(*read == '\\' && (read[1] == '\r' || read[1] == '\n'))) {
+				if((*read == '\\' && (read[1] == ' ' || read[1] == '#')) || (*read == '$' && read[1] == '$'))
+					++read; // Escaped by make
+
+				prerequisite[length++] = *read++;
+			}
+
+			prerequisite[length] = '\0';
+
+			if(mbstowcs(widePath, prerequisite, MAX_PATH) < MAX_PATH)
+				add_to_string_list(paths, widePath);
+		}
+	}
+
+	free(prerequisite);
+	free(data);
+}
+
+void append_key_inputs_data(BYTE** data, SIZE_T* size, LPCVOID bytes, SIZE_T numBytes) {
+	*data = realloc(*data, *size + numBytes);
+	memcpy(*data + *size, bytes, numBytes);
+	*size += numBytes;
+}
+
+void append_key_inputs_string(BYTE** data, SIZE_T* size, LPCWSTR str) {
+	UINT32 length = (UINT32)wcslen(str);
+
+	append_key_inputs_data(data, size, &length, sizeof(length));
+	append_key_inputs_data(data, size, str, length * sizeof(WCHAR));
+}
+
+/*
+ * Writes the inputs of the key of an entry that was just compiled to path, see struct KeyInputs.
+ */
+BOOL store_key_inputs(LPCWSTR path, const struct CommandLineInfo* cmdLineInfo, XXH64_hash_t generation, XXH64_hash_t contentHash) {
+	struct StringList headers = {0};
+	BYTE* data = NULL;
+	SIZE_T size = 0;
+
+	if(cmdLineInfo->dependencyFile)
+		read_dependency_file(cmdLineInfo->dependencyFile, &headers);
+
+	struct KeyInputs inputs = {
+		generation,
+		cmdLineInfo->profileHash,
+		contentHash,
+		hash_file_content(cmdLineInfo->sourceFile),
+		(UINT32)cmdLineInfo->numHashedFlags,
+		0
+	};
+
+	append_key_inputs_data(&data, &size, &inputs, sizeof(inputs));
+
+	for(SIZE_T i = 0; i < cmdLineInfo->numHashedFlags; ++i)
+		append_key_inputs_string(&data, &size, cmdLineInfo->hashedFlags[i]);
+
+	for(int i = 0; i < headers.count; ++i) {
+		if(wcscmp(headers.strings[i], cmdLineInfo->sourceFile) == 0 || !file_exists(headers.strings[i]))
+			continue;
+
+		XXH64_hash_t hash = hash_file_content(headers.strings[i]);
+
+		append_key_inputs_data(&data, &size, &hash, sizeof(hash));
+		append_key_inputs_string(&data, &size, headers.strings[i]);
+		++inputs.numHeaders;
+	}
+
+	memcpy(data, &inputs, sizeof(inputs)); // With the actual number of headers
+
+	BOOL success = publish_data(path, data, size);
+
+	free(data);
+	free_string_list(&headers);
+
+	return success;
+}
+
+BOOL read_key_inputs_string(const BYTE** read, const BYTE* end, struct StringList* list) {
+	UINT32 length;
+
+	if(end - *read < (ptrdiff_t)sizeof(length))
+		return FALSE;
+
+	memcpy(&length, *read, sizeof(length));
+	*read += sizeof(length);
+
+	if(length >= MAX_PATH * 4 || (SIZE_T)(end - *read) < length * sizeof(WCHAR))
+		return FALSE;
+
+	LPWSTR str = malloc((length + 1) * sizeof(WCHAR));
+
+	memcpy(str, *read, length * sizeof(WCHAR));
+	str[length] = L'\0';
+	*read += length * sizeof(WCHAR);
+	add_to_string_list(list, str);
+	free(str);
+
+	return TRUE;
+}
+
+/*
+ * Reads the 'inputs' file of the entry in entryDir. outHeaderHashes receives the hashes of the headers in the same order
+ * as outHeaders and must be freed with free, just like the string lists with free_string_list.
+ */
+BOOL read_key_inputs(LPCWSTR entryDir, struct KeyInputs* outInputs, struct StringList* outFlags, struct StringList* outHeaders, XXH64_hash_t** outHeaderHashes) {
+	WCHAR path[MAX_PATH];
+	SIZE_T size;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING KEY_INPUTS_FILE_NAME, entryDir);
+
+	BYTE* data = file_exists(path) ? read_whole_file(path, &size) : NULL;
+	BOOL success = data && size >= sizeof(*outInputs);
+	const BYTE* read = success ? data + sizeof(*outInputs) : NULL;
+	const BYTE* end = success ? data + size : NULL;
+
+	*outHeaderHashes = NULL;
+
+	if(success) {
+		memcpy(outInputs, data, sizeof(*outInputs));
+		*outHeaderHashes = malloc((outInputs->numHeaders + 1) * sizeof(XXH64_hash_t));
+	}
+
+	for(UINT32 i = 0; success && i < outInputs->numFlags; ++i)
+		success = read_key_inputs_string(&read, end, outFlags);
+
+	for(UINT32 i = 0; success && i < outInputs->numHeaders; ++i) {
+		success = end - read >= (ptrdiff_t)sizeof(XXH64_hash_t);
+
+		if(success) {
+			memcpy(&(*outHeaderHashes)[i], read, sizeof(XXH64_hash_t));
+			read += sizeof(XXH64_hash_t);
+			success = read_key_inputs_string(&read, end, outHeaders);
+		}
+	}
+
+	free(data);
+
+	return success;
+}
+
+/*
+ * Prints the flags that only one of the two lists contains. Returns FALSE if they contain the same flags.
+ */
+BOOL print_flag_differences(const struct StringList* previous, LPCWSTR const* current, SIZE_T numCurrent) {
+	BOOL* matched = calloc(numCurrent + 1, sizeof(BOOL));
+	BOOL differ = FALSE;
+
+	for(int i = 0; i < previous->count; ++i) {
+		SIZE_T j = 0;
+
+		while(j < numCurrent && (matched[j] || wcscmp(previous->strings[i], current[j]) != 0))
+			++j;
+
+		if(j < numCurrent) {
+			matched[j] = TRUE;
+		} else {
+			wprintf(L"    - %ls\n", previous->strings[i]);
+			differ = TRUE;
+		}
+	}
+
+	for(SIZE_T j = 0; j < numCurrent; ++j) {
+		if(!matched[j]) {
+			wprintf(L"    + %ls\n", current[j]);
+			differ = TRUE;
+		}
+	}
+
+	free(matched);
+
+	return differ;
+}
+
+LPCWSTR generation_compiler_path(const struct Generation* generations, SIZE_T count, XXH64_hash_t id) {
+	for(SIZE_T i = 0; i < count; ++i) {
+		if(generations[i].id == id)
+			return generations[i].compilerPath;
+	}
+
+	return L"unknown compiler";
+}
+
+/*
+ * Compares the key of a command line with the inputs of the previous entry for its object file.
+ */
+void explain_key(const struct CommandLineInfo* cmdLineInfo, XXH64_hash_t generation, const struct CacheKey* key, const struct HistoryRecord* previous) {
+	WCHAR entryDir[MAX_PATH];
+	struct KeyInputs inputs;
+	struct StringList flags = {0}, headers = {0};
+	XXH64_hash_t* headerHashes;
+
+	entry_directory(globalConfig.cachePath, &previous->key, entryDir);
+
+	if(!read_key_inputs(entryDir, &inputs, &flags, &headers, &headerHashes)) {
+		wprintf(L"The inputs of the previous entry weren't recorded (see -k), only the parts of the key can be compared:\n");
+
+		if(previous->key.flagsHash != key->flagsHash)
+			wprintf(L"  the compiler flags, the compiler or the profile changed\n");
+
+		if(previous->key.contentHash != key->contentHash)
+			wprintf(L"  the preprocessed source changed\n");
+
+		free(headerHashes);
+		free_string_list(&flags);
+		free_string_list(&headers);
+
+		return;
+	}
+
+	wprintf(L"Changes since the previous entry:\n");
+
+	if(print_flag_differences(&flags, cmdLineInfo->hashedFlags, cmdLineInfo->numHashedFlags)) {
+		wprintf(L"  compiler flags changed, see above\n");
+	} else if(inputs.numFlags == cmdLineInfo->numHashedFlags) {
+		for(SIZE_T i = 0; i < cmdLineInfo->numHashedFlags; ++i) {
+			if(wcscmp(flags.strings[i], cmdLineInfo->hashedFlags[i]) != 0) {
+				wprintf(L"  the order of the compiler flags changed\n");
+
+				break;
+			}
+		}
+	}
+
+	if(inputs.generation != generation) {
+		struct GenerationsHeader generationsHeader;
+		SIZE_T numGenerations;
+		struct Generation* generations = read_generations(globalConfig.cachePath, &generationsHeader, &numGenerations);
+
+		wprintf(L"  the compiler or the epoch of the cache changed: '%ls' before, '%ls' now\n",
+				generation_compiler_path(generations, numGenerations, inputs.generation),
+				generation_compiler_path(generations, numGenerations, generation));
+		free(generations);
+	}
+
+	if(inputs.profileHash != cmdLineInfo->profileHash)
+		wprintf(L"  the profile '%ls' changed\n", cmdLineInfo->profileFile ? cmdLineInfo->profileFile : L"");
+
+	if(inputs.contentHash != key->contentHash) {
+		BOOL found = FALSE;
+
+		wprintf(L"  the preprocessed source changed\n");
+
+		if(inputs.sourceHash != hash_file_content(cmdLineInfo->sourceFile)) {
+			wprintf(L"    source file '%ls' changed\n", cmdLineInfo->sourceFile);
+			found = TRUE;
+		}
+
+		for(int i = 0; i < headers.count; ++i) {
+			if(!file_exists(headers.strings[i])) {
+				wprintf(L"    header '%ls' doesn't exist anymore\n", headers.strings[i]);
+				found = TRUE;
+			} else if(hash_file_content(headers.strings[i]) != headerHashes[i]) {
+				wprintf(L"    header '%ls' changed\n", headers.strings[i]);
+				found = TRUE;
+			}
+		}
+
+		if(!found && headers.count == 0)
+			wprintf(L"    the source file didn't change, so a header or a macro did (headers are only recorded with -MD)\n");
+		else if(!found)
+			wprintf(L"    no recorded file changed, so a macro, an include path or a new header made the difference\n");
+	}
+
+	free(headerHashes);
+	free_string_list(&flags);
+	free_string_list(&headers);
+}
+
+/*
+ * lelcache explain <path_to_compiler> <compiler_args>
+ * Computes the key of a compilation without compiling it and explains why it differs from the key of the most recent
+ * entry for the same object file.
+ */
+int run_explain(int argc, LPWSTR* argv) {
+	struct CommandLineInfo cmdLineInfo = {0};
+	enum CompilerKind compilerKind = argc >= 3 ? compiler_kind_from_path(argv[2]) : COMPILER_UNKNOWN;
+	BOOL cacheable = FALSE;
+	XXH64_hash_t generation = 0;
+	ProcessHandle process;
+
+	// The command line is parsed as if it was given to lelcache itself
+	--argc;
+	++argv;
+
+	switch(compilerKind) {
+	case COMPILER_CL:
+	case COMPILER_CLANG_CL:
+		cacheable = parse_cl_command_line(argc, argv, compilerKind == COMPILER_CLANG_CL, &cmdLineInfo);
+		break;
+	case COMPILER_GCC:
+		cacheable = parse_gcc_command_line(argc, argv, &cmdLineInfo);
+		break;
+	case COMPILER_UNKNOWN:
+		wprintf(L"Usage: lelcache explain <path_to_compiler> <compiler_args>\n");
+
+		return EXIT_FAILURE;
+	default:
+		cmdLineInfo.uncacheableReason = UNCACHEABLE_NOT_A_COMPILATION;
+		break;
+	}
+
+	if(cacheable && !current_generation(argv[1], &generation))
+		cacheable = reject_command_line(&cmdLineInfo, UNCACHEABLE_RETIRED_GENERATION);
+
+	if(cacheable && !hash_hidden_inputs(generation, &cmdLineInfo))
+		cacheable = reject_command_line(&cmdLineInfo, UNCACHEABLE_MISSING_PROFILE);
+
+	if(cacheable) {
+		FileHandle nullOutput = open_null_output();
+
+		cacheable = launch_process((int)cmdLineInfo.numPreprocessorFlags, cmdLineInfo.preprocessorFlags, nullOutput, &process) &&
+					wait_for_process(&process) == 0;
+
+		if(!cacheable)
+			reject_command_line(&cmdLineInfo, UNCACHEABLE_PREPROCESSOR_FAILED);
+
+		close_file(nullOutput);
+	}
+
+	if(!cacheable) {
+		if(cmdLineInfo.temporaryPreprocessedFile)
+			delete_file(cmdLineInfo.temporaryPreprocessedFile);
+
+		wprintf(L"The compilation is never cached: %ls\n", uncacheableReasonNames[cmdLineInfo.uncacheableReason].description);
+
+		return EXIT_FAILURE;
+	}
+
+	struct CacheKey key = {hash_file_content(cmdLineInfo.temporaryPreprocessedFile), cmdLineInfo.compilerCmdLineHash};
+	XXH64_hash_t targetHash = XXH64(cmdLineInfo.objectFile, wcslen(cmdLineInfo.objectFile) * sizeof(WCHAR), 0);
+	WCHAR entryDir[MAX_PATH], objPath[MAX_PATH];
+	CacheKeyString keyStr;
+	struct HistoryRecord previous;
+
+	delete_file(cmdLineInfo.temporaryPreprocessedFile);
+	cache_key_to_string(&key, keyStr);
+	entry_directory(globalConfig.cachePath, &key, entryDir);
+	swprintf(objPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"obj", entryDir);
+	wprintf(L"Key of '%ls': %ls (%ls)\n", cmdLineInfo.objectFile, keyStr, file_exists(objPath) ? L"in the local cache" : L"not in the local cache");
+
+	if(!latest_history_record(globalConfig.cachePath, targetHash, &previous)) {
+		wprintf(L"'%ls' hasn't been compiled with lelcache before\n", cmdLineInfo.objectFile);
+
+		return EXIT_SUCCESS;
+	}
+
+	cache_key_to_string(&previous.key, keyStr);
+	wprintf(L"Previous key:  %ls (%.1f hours ago)\n", keyStr, (current_system_time() - previous.time) / (60 * 60 * 10000000.0));
+
+	if(memcmp(&previous.key, &key, sizeof(key)) == 0)
+		wprintf(L"The key didn't change%ls\n", file_exists(objPath) ? L"" : L", the entry was evicted");
+	else
+		explain_key(&cmdLineInfo, generation, &key, &previous);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Header churn
+ *
+ * When a compilation misses and both its entry and the previous entry of the same object file recorded their inputs, the
+ * headers whose content differs between them are what invalidated the previous entry. Every such header is appended to a
+ * log together with the compile time of the miss, in the shared tier if there is one so that the whole team's misses end
+ * up in one place. 'lelcache report' ranks the headers by the compile time their changes cost.
+ */
+
+#define CHURN_FILE_NAME L"churn.log"
+#define CHURN_MAX_SIZE (8 * 1024 * 1024) // The oldest half of the log is dropped when it grows larger than this
+#define REPORT_NUM_HEADERS 25
+
+/*
+ * Followed by pathLength WCHARs and zeros up to the next multiple of 8 bytes.
+ */
+struct ChurnRecord {
+	UINT64 time;
+	UINT64 compileTime;       // In milliseconds, of the whole miss
+	XXH64_hash_t headerHash;  // New content of the header, tells apart misses caused by the same change
+	UINT32 numChangedHeaders; // The compile time is split evenly between the headers that changed together
+	UINT32 pathLength;
+};
+
+SIZE_T churn_record_size(const struct ChurnRecord* record) {
+	return (sizeof(*record) + record->pathLength * sizeof(WCHAR) + 7) / 8 * 8;
+}
+
+void churn_log_path(LPWSTR buffer, LPWSTR lockBuffer) {
+	LPCWSTR cacheRoot = has_shared_tier() && is_directory(globalConfig.sharedCachePath) ? globalConfig.sharedCachePath : globalConfig.cachePath;
+
+	swprintf(buffer, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING CHURN_FILE_NAME, cacheRoot);
+	swprintf(lockBuffer, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"churn.lock", cacheRoot);
+}
+
+/*
+ * Called for a miss whose entry in entryDir was just stored including its inputs.
+ */
+void record_header_churn(const struct CommandLineInfo* cmdLineInfo, LPCWSTR entryDir, UINT64 compileTime) {
+	struct HistoryRecord previous;
+	XXH64_hash_t targetHash = XXH64(cmdLineInfo->objectFile, wcslen(cmdLineInfo->objectFile) * sizeof(WCHAR), 0);
+	WCHAR previousDir[MAX_PATH];
+	struct KeyInputs inputs, previousInputs;
+	struct StringList flags = {0}, headers = {0}, previousFlags = {0}, previousHeaders = {0};
+	XXH64_hash_t *hashes = NULL, *previousHashes = NULL;
+	SIZE_T* changed = NULL;
+	UINT32 numChanged = 0;
+
+	if(!latest_history_record(globalConfig.cachePath, targetHash, &previous))
+		return;
+
+	entry_directory(globalConfig.cachePath, &previous.key, previousDir);
+
+	if(read_key_inputs(entryDir, &inputs, &flags, &headers, &hashes) &&
+	   read_key_inputs(previousDir, &previousInputs, &previousFlags, &previousHeaders, &previousHashes)) {
+		changed = malloc((headers.count + 1) * sizeof(SIZE_T));
+
+		// Headers that are only included by one of them don't count, those are changes of the including file
+		for(int i = 0; i < headers.count; ++i) {
+			for(int j = 0; j < previousHeaders.count; ++j) {
+				if(wcscmp(headers.strings[i], previousHeaders.strings[j]) == 0) {
+					if(hashes[i] != previousHashes[j])
+						changed[numChanged++] = i;
+
+					break;
+				}
+			}
+		}
+	}
+
+	if(numChanged > 0) {
+		WCHAR logPath[MAX_PATH];
+		WCHAR lockPath[MAX_PATH];
+
+		churn_log_path(logPath, lockPath);
+
+		// The log is usually on a network share where appends of different machines can overlap, and a single broken record
+		// would hide all records after it from read_churn_log
+		FileHandle lock = lock_file(lockPath);
+		FileHandle file = lock != INVALID_FILE_HANDLE ? open_file(logPath, OPEN_FOR_APPENDING) : INVALID_FILE_HANDLE;
+
+		for(UINT32 i = 0; i < numChanged && file != INVALID_FILE_HANDLE; ++i) {
+			LPCWSTR header = headers.strings[changed[i]];
+			struct ChurnRecord record = {current_system_time(), compileTime, hashes[changed[i]], numChanged, (UINT32)wcslen(header)};
+			SIZE_T size = churn_record_size(&record);
+			BYTE* data = calloc(size, 1);
+
+			memcpy(data, &record, sizeof(record));
+			memcpy(data + sizeof(record), header, record.pathLength * sizeof(WCHAR));
+			write_file(file, data, size);
+			free(data);
+		}
+
+		if(file != INVALID_FILE_HANDLE) {
+			if(file_handle_size(file) > CHURN_MAX_SIZE)
+				start_background_worker(); // Compacts the log
+
+			close_file(file);
+		}
+
+		if(lock != INVALID_FILE_HANDLE)
+			unlock_file(lock);
+	}
+
+	free(changed);
+	free(hashes);
+	free(previousHashes);
+	free_string_list(&flags);
+	free_string_list(&headers);
+	free_string_list(&previousFlags);
+	free_string_list(&previousHeaders);
+}
+
+/*
+ * Returns pointers to the records in the churn log of cacheRoot, which are stored in *outData. Both must be freed with free.
+ */
+const struct ChurnRecord** read_churn_log(LPCWSTR cacheRoot, BYTE** outData, SIZE_T* outCount) {
+	WCHAR path[MAX_PATH];
+	SIZE_T size = 0;
+	const struct ChurnRecord** records = NULL;
+	SIZE_T count = 0;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING CHURN_FILE_NAME, cacheRoot);
+	*outData = file_exists(path) ? read_whole_file(path, &size) : NULL;
+
+	for(SIZE_T offset = 0; *outData && size - offset >= sizeof(struct ChurnRecord);) {
+		const struct ChurnRecord* record = (const struct ChurnRecord*)(*outData + offset);
+
+		if(record->pathLength >= MAX_PATH || size - offset < churn_record_size(record))
+			break; // Cut off by a crash
+
+		if(count % 1024 == 0)
+			records = realloc(records, (count + 1024) * sizeof(*records));
+
+		records[count++] = record;
+		offset += churn_record_size(record);
+	}
+
+	*outCount = count;
+
+	return records;
+}
+
+/*
+ * Drops the oldest half of the churn log once it gets too large.
+ */
+void compact_churn_log(LPCWSTR cacheRoot) {
+	WCHAR logPath[MAX_PATH];
+	WCHAR lockPath[MAX_PATH];
+
+	swprintf(logPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING CHURN_FILE_NAME, cacheRoot);
+	swprintf(lockPath, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING L"churn.lock", cacheRoot);
+
+	if(file_size(logPath) <= CHURN_MAX_SIZE)
+		return;
+
+	FileHandle lock = try_lock_file(lockPath);
+
+	if(lock == INVALID_FILE_HANDLE)
+		return;
+
+	BYTE* data;
+	SIZE_T count;
+	const struct ChurnRecord** records = read_churn_log(cacheRoot, &data, &count);
+
+	if(count > 0) {
+		const BYTE* start = (const BYTE*)records[count / 2];
+		const BYTE* end = (const BYTE*)records[count - 1] + churn_record_size(records[count - 1]);
+
+		publish_data(logPath, start, end - start);
+	}
+
+	free(records);
+	free(data);
+	unlock_file(lock);
+}
+
+int compare_churn_paths(const struct ChurnRecord* a, const struct ChurnRecord* b) {
+	if(a->pathLength != b->pathLength)
+		return a->pathLength < b->pathLength ? -1 : 1;
+
+	return wmemcmp((LPCWSTR)(a + 1), (LPCWSTR)(b + 1), a->pathLength);
+}
+
+int __cdecl compare_churn_records_for_qsort(const void* a, const void* b) {
+	const struct ChurnRecord* recordA = *(const struct ChurnRecord* const*)a;
+	const struct ChurnRecord* recordB = *(const struct ChurnRecord* const*)b;
+	int result = compare_churn_paths(recordA, recordB);
+
+	if(result != 0)
+		return result;
+
+	return recordA->headerHash < recordB->headerHash ? -1 : recordA->headerHash > recordB->headerHash;
+}
+
+struct HeaderChurn {
+	const struct ChurnRecord* record; // Any of the header's records, for its path
+	double compileTime;               // In milliseconds
+	UINT32 numMisses;
+	UINT32 numChanges;
+};
+
+int __cdecl compare_header_churn_for_qsort(const void* a, const void* b) {
+	double timeA = ((const struct HeaderChurn*)a)->compileTime;
+	double timeB = ((const struct HeaderChurn*)b)->compileTime;
+
+	return timeA > timeB ? -1 : timeA < timeB; // Most expensive first
+}
+
+/*
+ * lelcache report [<days>]
+ * Ranks the headers by the compile time of the misses their changes caused in the last <days> (default: 30).
+ */
+int run_report(int argc, LPWSTR* argv) {
+	double days = argc >= 3 ? wcstod(argv[2], NULL) : 30.0;
+	UINT64 since = current_system_time() - (UINT64)(days * 24 * 60 * 60 * 10000000.0);
+	BYTE *localData, *sharedData = NULL;
+	SIZE_T numLocal, numShared = 0;
+	const struct ChurnRecord** localRecords = read_churn_log(globalConfig.cachePath, &localData, &numLocal);
+	const struct ChurnRecord** sharedRecords = has_shared_tier() ? read_churn_log(globalConfig.sharedCachePath, &sharedData, &numShared) : NULL;
+	const struct ChurnRecord** records = malloc((numLocal + numShared + 1) * sizeof(*records));
+	struct HeaderChurn* headers = malloc((numLocal + numShared + 1) * sizeof(*headers));
+	SIZE_T numRecords = 0, numHeaders = 0;
+	double totalTime = 0.0;
+
+	for(SIZE_T i = 0; i < numLocal + numShared; ++i) {
+		const struct ChurnRecord* record = i < numLocal ? localRecords[i] : sharedRecords[i - numLocal];
+
+		if(record->time >= since)
+			records[numRecords++] = record;
+	}
+
+	qsort(records, numRecords, sizeof(*records), compare_churn_records_for_qsort);
+
+	for(SIZE_T i = 0; i < numRecords; ++i) {
+		double share = (double)records[i]->compileTime / records[i]->numChangedHeaders;
+
+		if(numHeaders == 0 || compare_churn_paths(headers[numHeaders - 1].record, records[i]) != 0)
+			headers[numHeaders++] = (struct HeaderChurn){records[i], 0.0, 0, 0};
+
+		struct HeaderChurn* header = &headers[numHeaders - 1];
+
+		header->compileTime += share;
+		header->numMisses += 1;
+		header->numChanges += i == 0 || compare_churn_records_for_qsort(&records[i - 1], &records[i]) != 0;
+		totalTime += share;
+	}
+
+	qsort(headers, numHeaders, sizeof(*headers), compare_header_churn_for_qsort);
+
+	wprintf(L"Compile time invalidated by changed headers in the last %g days: %.1f s\n", days, totalTime / 1000.0);
+
+	if(numHeaders == 0)
+		wprintf(L"No header changes were recorded, they need -k1 and compilations that write dependency files (-MD)\n");
+	else
+		wprintf(L"\n%12ls %6ls %8ls %8ls  %ls\n", L"time", L"share", L"misses", L"changes", L"header");
+
+	for(SIZE_T i = 0; i < numHeaders && i < REPORT_NUM_HEADERS; ++i) {
+		wprintf(L"%10.1f s %5.1f%% %8u %8u  %.*ls\n",
+				headers[i].compileTime / 1000.0,
+				headers[i].compileTime * 100.0 / totalTime,
+				headers[i].numMisses,
+				headers[i].numChanges,
+				(int)headers[i].record->pathLength,
+				(LPCWSTR)(headers[i].record + 1));
+	}
+
+	free(headers);
+	free(records);
+	free(localRecords);
+	free(localData);
+	free(sharedRecords);
+	free(sharedData);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Monitoring
+ *
+ * Every invocation reports what it did to a file in the local cache that all processes map into memory, see
+ * map_shared_memory. It holds counters, a ring buffer of the most recent events, the compilations that are running right
+ * now and latency histograms. All of it is updated with atomics so that invocations never wait for each other.
+ * 'lelcache top' shows it while a build is running.
+ */
+
+#define MONITOR_FILE_NAME L"monitor.shm"
+#define MONITOR_MAGIC 0x314e4f4d4c454cull // "LELMON1", needs to be changed whenever the layout of struct Monitor changes
+#define MONITOR_NUM_EVENTS 1024
+#define MONITOR_MAX_COMPILES 128
+#define MONITOR_SOURCE_LENGTH 48
+
+// Latencies are recorded in microseconds with HISTOGRAM_SUB_BUCKETS buckets per power of two like in an HDR histogram.
+// This keeps the error of every percentile below 1 / HISTOGRAM_SUB_BUCKETS no matter how large the values are.
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_NUM_BUCKETS 608 // Values up to 2^41 microseconds
+#define HISTOGRAM_MAX_VALUE ((1ull << 41) - 1)
+
+enum MonitorEventKind {
+	MONITOR_HIT,
+	MONITOR_MISS,
+	MONITOR_UNCACHEABLE,
+	NUM_MONITOR_EVENT_KINDS
+};
+
+const LPCWSTR monitorEventKindNames[NUM_MONITOR_EVENT_KINDS] = {L"hit", L"miss", L"uncached"};
+
+enum Histogram {
+	HISTOGRAM_HIT,  // Whole invocations that were served from the cache
+	HISTOGRAM_MISS, // Whole invocations that compiled
+	HISTOGRAM_PREPROCESSOR,
+	NUM_HISTOGRAMS
+};
+
+const LPCWSTR histogramNames[NUM_HISTOGRAMS] = {L"hit path", L"miss path", L"preprocessor"};
+
+struct MonitorEvent {
+	volatile UINT64 sequence; // Number of the event plus one once it has been written completely, 0 while it is written
+	UINT64 time;              // System time at which the invocation finished
+	UINT64 duration;          // In microseconds
+	UINT64 bytes;             // Read from or written to the cache
+	UINT32 kind;              // enum MonitorEventKind
+	UINT32 pid;
+	WCHAR source[MONITOR_SOURCE_LENGTH]; // File name of the source file
+};
+
+struct MonitorCompile {
+	volatile UINT64 pid;   // 0 if the slot is free
+	volatile UINT64 start; // System time, 0 while the slot is being filled
+	WCHAR source[MONITOR_SOURCE_LENGTH];
+};
+
+struct Monitor {
+	volatile UINT64 magic;
+	volatile UINT64 numEvents; // Number of events ever recorded, the next one is stored at numEvents % MONITOR_NUM_EVENTS
+	volatile UINT64 counts[NUM_MONITOR_EVENT_KINDS];
+	volatile UINT64 bytesRead;
+	volatile UINT64 bytesWritten;
+	volatile UINT64 histograms[NUM_HISTOGRAMS][HISTOGRAM_NUM_BUCKETS];
+	struct MonitorCompile compiles[MONITOR_MAX_COMPILES];
+	struct MonitorEvent events[MONITOR_NUM_EVENTS];
+};
+
+/*
+ * Returns NULL if the monitor can't be mapped, in which case nothing is recorded.
+ */
+struct Monitor* open_monitor(FileMappingHandle* outMapping) {
+	WCHAR path[MAX_PATH];
+	struct Monitor* monitor = NULL;
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING MONITOR_FILE_NAME, globalConfig.cachePath);
+	*outMapping = make_path(globalConfig.cachePath) ? map_shared_memory(path, sizeof(*monitor), (LPVOID*)&monitor) : NULL;
+
+	if(!*outMapping)
+		return NULL;
+
+	// A new file is all zeros which is a valid empty monitor, one written by a different version is ignored
+	if(!atomic_compare_exchange64(&monitor->magic, 0, MONITOR_MAGIC) && atomic_load64(&monitor->magic) != MONITOR_MAGIC) {
+		unmap_file(*outMapping);
+		*outMapping = NULL;
+
+		return NULL;
+	}
+
+	return monitor;
+}
+
+void copy_source_name(LPCWSTR sourceFile, LPWSTR buffer) {
+	wcsncpy(buffer, sourceFile ? file_name_from_path((LPWSTR)sourceFile) : L"", MONITOR_SOURCE_LENGTH - 1);
+	buffer[MONITOR_SOURCE_LENGTH - 1] = L'\0';
+}
+
+SIZE_T histogram_bucket(UINT64 value) {
+	if(value > HISTOGRAM_MAX_VALUE)
+		value = HISTOGRAM_MAX_VALUE;
+
+	if(value < 2 * HISTOGRAM_SUB_BUCKETS)
+		return (SIZE_T)value;
+
+	int exponent = 0;
+
+	while((value >> exponent) >= 2 * HISTOGRAM_SUB_BUCKETS)
+		++exponent;
+
+	return (SIZE_T)(exponent * HISTOGRAM_SUB_BUCKETS + (value >> exponent));
+}
+
+/*
+ * Returns the middle of the range of values counted in a bucket.
+ */
+UINT64 histogram_bucket_value(SIZE_T bucket) {
+	if(bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	int exponent = (int)(bucket / HISTOGRAM_SUB_BUCKETS) - 1;
+	UINT64 low = (UINT64)(bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS) << exponent;
+
+	return low + (1ull << exponent) / 2;
+}
+
+/*
+ * Returns the value in microseconds below which fraction of the values in buckets lie, 0 if there are none.
+ */
+UINT64 histogram_percentile(const UINT64* buckets, double fraction) {
+	UINT64 total = 0, count = 0;
+
+	for(SIZE_T i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i)
+		total += buckets[i];
+
+	for(SIZE_T i = 0; i < HISTOGRAM_NUM_BUCKETS && total > 0; ++i) {
+		count += buckets[i];
+
+		if(count >= fraction * total)
+			return histogram_bucket_value(i);
+	}
+
+	return 0;
+}
+
+void record_latency(struct Monitor* monitor, enum Histogram histogram, UINT64 microseconds) {
+	if(monitor)
+		atomic_add64(&monitor->histograms[histogram][histogram_bucket(microseconds)], 1);
+}
+
+/*
+ * Records a finished invocation that started at start (system time).
+ */
+void record_event(struct Monitor* monitor, enum MonitorEventKind kind, UINT64 start, UINT64 bytes, LPCWSTR sourceFile) {
+	if(!monitor)
+		return;
+
+	UINT64 number = atomic_add64(&monitor->numEvents, 1);
+	struct MonitorEvent* event = &monitor->events[number % MONITOR_NUM_EVENTS];
+	UINT64 now = current_system_time();
+
+	atomic_add64(&monitor->counts[kind], 1);
+
+	if(kind == MONITOR_HIT)
+		atomic_add64(&monitor->bytesRead, bytes);
+	else if(kind == MONITOR_MISS)
+		atomic_add64(&monitor->bytesWritten, bytes);
+
+	// Readers skip the event while it is written, if it is overwritten again in the meantime they skip it as well
+	atomic_store64(&event->sequence, 0);
+	event->time = now;
+	event->duration = (now - start) / 10;
+	event->bytes = bytes;
+	event->kind = kind;
+	event->pid = current_process_id();
+	copy_source_name(sourceFile, event->source);
+	atomic_store64(&event->sequence, number + 1);
+
+	if(kind == MONITOR_HIT)
+		record_latency(monitor, HISTOGRAM_HIT, event->duration);
+	else if(kind == MONITOR_MISS)
+		record_latency(monitor, HISTOGRAM_MISS, event->duration);
+}
+
+/*
+ * Makes a running compilation visible to 'lelcache top'. Returns NULL if all slots are taken.
+ */
+struct MonitorCompile* monitor_compile_started(struct Monitor* monitor, LPCWSTR sourceFile) {
+	UINT64 pid = current_process_id();
+
+	for(SIZE_T i = 0; monitor && i < MONITOR_MAX_COMPILES; ++i) {
+		struct MonitorCompile* compile = &monitor->compiles[(pid + i) % MONITOR_MAX_COMPILES];
+		UINT64 owner = atomic_load64(&compile->pid);
+
+		// Slots of processes that crashed are taken over
+		if((owner == 0 || is_local_process_dead((DWORD)owner)) && atomic_compare_exchange64(&compile->pid, owner, pid)) {
+			copy_source_name(sourceFile, compile->source);
+			atomic_store64(&compile->start, current_system_time());
+
+			return compile;
+		}
+	}
+
+	return NULL;
+}
+
+void monitor_compile_finished(struct MonitorCompile* compile) {
+	if(compile) {
+		atomic_store64(&compile->start, 0);
+		atomic_store64(&compile->pid, 0);
+	}
+}
+
+struct MonitorSnapshot {
+	UINT64 tickCount;
+	UINT64 counts[NUM_MONITOR_EVENT_KINDS];
+	UINT64 bytesRead;
+	UINT64 bytesWritten;
+	UINT64 histograms[NUM_HISTOGRAMS][HISTOGRAM_NUM_BUCKETS];
+};
+
+void take_monitor_snapshot(struct Monitor* monitor, struct MonitorSnapshot* snapshot) {
+	snapshot->tickCount = current_tick_count();
+
+	for(int k = 0; k < NUM_MONITOR_EVENT_KINDS; ++k)
+		snapshot->counts[k] = atomic_load64(&monitor->counts[k]);
+
+	snapshot->bytesRead = atomic_load64(&monitor->bytesRead);
+	snapshot->bytesWritten = atomic_load64(&monitor->bytesWritten);
+
+	for(int h = 0; h < NUM_HISTOGRAMS; ++h) {
+		for(SIZE_T b = 0; b < HISTOGRAM_NUM_BUCKETS; ++b)
+			snapshot->histograms[h][b] = monitor->histograms[h][b];
+	}
+}
+
+void format_microseconds(UINT64 microseconds, LPWSTR buffer, SIZE_T bufferLength) {
+	if(microseconds < 1000)
+		swprintf(buffer, bufferLength, L"%llu us", (unsigned long long)microseconds);
+	else if(microseconds < 1000000)
+		swprintf(buffer, bufferLength, L"%.1f ms", microseconds / 1000.0);
+	else
+		swprintf(buffer, bufferLength, L"%.2f s", microseconds / 1000000.0);
+}
+
+int __cdecl compare_monitor_compiles_for_qsort(const void* a, const void* b) {
+	UINT64 startA = ((const struct MonitorCompile*)a)->start;
+	UINT64 startB = ((const struct MonitorCompile*)b)->start;
+
+	return startA < startB ? -1 : startA > startB;
+}
+
+#define TOP_NUM_LINES 10
+
+/*
+ * Shows what happened between two snapshots as well as the running compilations and the most recent events.
+ */
+void print_top(struct Monitor* monitor, const struct MonitorSnapshot* previous, const struct MonitorSnapshot* current) {
+	double seconds = current->tickCount > previous->tickCount ? (current->tickCount - previous->tickCount) / 1000.0 : 1.0;
+	UINT64 numHits = current->counts[MONITOR_HIT] - previous->counts[MONITOR_HIT];
+	UINT64 numMisses = current->counts[MONITOR_MISS] - previous->counts[MONITOR_MISS];
+	UINT64 numUncacheable = current->counts[MONITOR_UNCACHEABLE] - previous->counts[MONITOR_UNCACHEABLE];
+	UINT64 now = current_system_time();
+	WCHAR p50[16], p99[16], max[16];
+
+	clear_console();
+	wprintf(L"lelcache top - %ls\n\n", globalConfig.cachePath);
+	wprintf(L"hits/s %8.1f   misses/s %8.1f   uncached/s %8.1f   hit rate %6.2f%%\n",
+			numHits / seconds,
+			numMisses / seconds,
+			numUncacheable / seconds,
+			numHits + numMisses > 0 ? numHits * 100.0 / (numHits + numMisses) : 0.0);
+	wprintf(L"store  read %8.2f MB/s   written %8.2f MB/s\n\n",
+			(current->bytesRead - previous->bytesRead) / (1024.0 * 1024.0) / seconds,
+			(current->bytesWritten - previous->bytesWritten) / (1024.0 * 1024.0) / seconds);
+
+	wprintf(L"%-14ls %8ls %10ls %10ls %10ls\n", L"latency", L"count", L"p50", L"p99", L"max");
+
+	for(int h = 0; h < NUM_HISTOGRAMS; ++h) {
+		UINT64 buckets[HISTOGRAM_NUM_BUCKETS];
+		UINT64 count = 0;
+		SIZE_T largest = 0;
+
+		for(SIZE_T b = 0; b < HISTOGRAM_NUM_BUCKETS; ++b) {
+			buckets[b] = current->histograms[h][b] - previous->histograms[h][b];
+			count += buckets[b];
+
+			if(buckets[b] > 0)
+				largest = b;
+		}
+
+		format_microseconds(histogram_percentile(buckets, 0.5), p50, ARRAYSIZE(p50));
+		format_microseconds(histogram_percentile(buckets, 0.99), p99, ARRAYSIZE(p99));
+		format_microseconds(histogram_bucket_value(largest), max, ARRAYSIZE(max));
+
+		if(count > 0)
+			wprintf(L"%-14ls %8llu %10ls %10ls %10ls\n", histogramNames[h], (unsigned long long)count, p50, p99, max);
+		else
+			wprintf(L"%-14ls %8llu %10ls %10ls %10ls\n", histogramNames[h], 0ull, L"-", L"-", L"-");
+	}
+
+	struct MonitorCompile compiles[MONITOR_MAX_COMPILES];
+	SIZE_T numCompiles = 0;
+
+	for(SIZE_T i = 0; i < MONITOR_MAX_COMPILES; ++i) {
+		struct MonitorCompile* compile = &monitor->compiles[i];
+		UINT64 pid = atomic_load64(&compile->pid);
+		UINT64 start = atomic_load64(&compile->start);
+
+		if(pid != 0 && start != 0 && !is_local_process_dead((DWORD)pid)) {
+			compiles[numCompiles] = *compile;
+			compiles[numCompiles].pid = pid;
+			compiles[numCompiles++].start = start;
+		}
+	}
+
+	qsort(compiles, numCompiles, sizeof(*compiles), compare_monitor_compiles_for_qsort);
+	wprintf(L"\ncompiling now: %u\n", (unsigned)numCompiles);
+
+	for(SIZE_T i = 0; i < numCompiles && i < TOP_NUM_LINES; ++i) {
+		format_microseconds(now > compiles[i].start ? (now - compiles[i].start) / 10 : 0, max, ARRAYSIZE(max));
+		wprintf(L"  %10ls  %-48ls pid %llu\n", max, compiles[i].source, (unsigned long long)compiles[i].pid);
+	}
+
+	UINT64 numEvents = atomic_load64(&monitor->numEvents);
+
+	wprintf(L"\nrecent:\n");
+
+	for(UINT64 number = numEvents, numShown = 0; number > 0 && numEvents - number < MONITOR_NUM_EVENTS && numShown < TOP_NUM_LINES; --number) {
+		struct MonitorEvent* slot = &monitor->events[(number - 1) % MONITOR_NUM_EVENTS];
+		struct MonitorEvent event;
+
+		if(atomic_load64(&slot->sequence) != number)
+			continue;
+
+		event = *slot;
+
+		if(atomic_load64(&slot->sequence) != number || event.kind >= NUM_MONITOR_EVENT_KINDS) // Overwritten while copying
+			continue;
+
+		event.source[MONITOR_SOURCE_LENGTH - 1] = L'\0';
+		format_microseconds(event.duration, max, ARRAYSIZE(max));
+		wprintf(L"  %-8ls %10ls  %-48ls %5.0fs ago\n", monitorEventKindNames[event.kind], max, event.source, (now - event.time) / 10000000.0);
+		++numShown;
+	}
+
+	fflush(stdout);
+}
+
+/*
+ * lelcache top [<seconds>]
+ */
+int run_top(int argc, LPWSTR* argv) {
+	double seconds = argc >= 3 ? wcstod(argv[2], NULL) : 1.0;
+	FileMappingHandle mapping;
+	struct Monitor* monitor = open_monitor(&mapping);
+
+	if(!monitor) {
+		wprintf(L"Unable to open the monitor of '%ls'\n", globalConfig.cachePath);
+
+		return EXIT_FAILURE;
+	}
+
+	if(seconds < 0.1)
+		seconds = 0.1;
+
+	struct MonitorSnapshot* snapshots = malloc(2 * sizeof(*snapshots));
+
+	take_monitor_snapshot(monitor, &snapshots[0]);
+
+	for(UINT64 round = 1;; ++round) { // Runs until it is interrupted
+		sleep_ms((DWORD)(seconds * 1000));
+		take_monitor_snapshot(monitor, &snapshots[round % 2]);
+		print_top(monitor, &snapshots[(round - 1) % 2], &snapshots[round % 2]);
+	}
+}
+
+/*
+ * Metrics
+ *
+ * 'lelcache metrics' exports the statistics of the cache and the latency histograms of the monitor for Prometheus and
+ * other systems that read the OpenMetrics text format, either by serving them over HTTP or by replacing a file that is
+ * picked up by the textfile collector of node_exporter. That collector only understands the older Prometheus text format
+ * which differs in the names of the counter families and has no '# EOF' line.
+ */
+
+#define METRICS_BUFFER_SIZE (64 * 1024)
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+#define METRICS_DEFAULT_PORT 9767
+
+// Upper bounds of the exported latency buckets in seconds, the monitor's buckets are summed up into these
+const double metricsLatencyBuckets[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0, 300.0};
+const char* const metricsHistogramLabels[NUM_HISTOGRAMS] = {"hit", "miss", "preprocessor"};
+
+struct MetricsText {
+	char* data;
+	SIZE_T length;
+	BOOL openMetrics;
+};
+
+void append_metrics_line(struct MetricsText* text, const char* line) {
+	SIZE_T length = strlen(line);
+
+	if(text->length + length < METRICS_BUFFER_SIZE) {
+		memcpy(text->data + text->length, line, length + 1);
+		text->length += length;
+	}
+}
+
+/*
+ * Counter families are named without the '_total' suffix of their samples in OpenMetrics but with it in the older format.
+ */
+void append_metric_family(struct MetricsText* text, const char* name, const char* type, const char* help) {
+	char line[256];
+	const char* suffix = strcmp(type, "counter") == 0 && !text->openMetrics ? "_total" : "";
+
+	snprintf(line, sizeof(line), "# TYPE %s%s %s\n# HELP %s%s %s\n", name, suffix, type, name, suffix, help);
+	append_metrics_line(text, line);
+}
+
+void append_metric_sample(struct MetricsText* text, const char* name, const char* labels, double value) {
+	char line[256];
+
+	snprintf(line, sizeof(line), "%s%s%s%s %.15g\n", name, labels ? "{" : "", labels ? labels : "", labels ? "}" : "", value);
+	append_metrics_line(text, line);
+}
+
+void append_metric_counter(struct MetricsText* text, const char* name, const char* help, double value) {
+	char sample[128];
+
+	snprintf(sample, sizeof(sample), "%s_total", name);
+	append_metric_family(text, name, "counter", help);
+	append_metric_sample(text, sample, NULL, value);
+}
+
+/*
+ * The monitor counts latencies in much finer buckets than Prometheus needs. Exported buckets are cumulative, so each fine
+ * bucket is added to every exported bucket whose 'le' bound is at or above its middle value. The exported counts and the
+ * sum are accurate to within 1 / HISTOGRAM_SUB_BUCKETS.
+ */
+void append_latency_histograms(struct MetricsText* text, struct Monitor* monitor) {
+	char labels[128];
+
+	append_metric_family(text, "lelcache_latency_seconds", "histogram", "Duration of the invocations that hit or missed and of preprocessing.");
+
+	for(int h = 0; h < NUM_HISTOGRAMS; ++h) {
+		UINT64 counts[ARRAYSIZE(metricsLatencyBuckets)] = {0};
+		UINT64 count = 0;
+		double sum = 0.0;
+
+		for(SIZE_T b = 0; b < HISTOGRAM_NUM_BUCKETS; ++b) {
+			UINT64 bucketCount = monitor->histograms[h][b];
+			double seconds = histogram_bucket_value(b) / 1000000.0;
+
+			if(bucketCount == 0)
+				continue;
+
+			for(SIZE_T i = 0; i < ARRAYSIZE(metricsLatencyBuckets); ++i) {
+				if(seconds <= metricsLatencyBuckets[i])
+					counts[i] += bucketCount;
+			}
+
+			count += bucketCount;
+			sum += seconds * bucketCount;
+		}
+
+		for(SIZE_T i = 0; i < ARRAYSIZE(metricsLatencyBuckets); ++i) {
+			snprintf(labels, sizeof(labels), "path=\"%s\",le=\"%g\"", metricsHistogramLabels[h], metricsLatencyBuckets[i]);
+			append_metric_sample(text, "lelcache_latency_seconds_bucket", labels, (double)counts[i]);
+		}
+
+		snprintf(labels, sizeof(labels), "path=\"%s\",le=\"+Inf\"", metricsHistogramLabels[h]);
+		append_metric_sample(text, "lelcache_latency_seconds_bucket", labels, (double)count);
+		snprintf(labels, sizeof(labels), "path=\"%s\"", metricsHistogramLabels[h]);
+		append_metric_sample(text, "lelcache_latency_seconds_count", labels, (double)count);
+		append_metric_sample(text, "lelcache_latency_seconds_sum", labels, sum);
+	}
+}
+
+/*
+ * Returns the metrics as text that must be freed with free, NULL if the statistics can't be read.
+ */
+char* format_metrics(BOOL openMetrics, SIZE_T* outSize) {
+	struct CacheInfo info, sharedInfo;
+	struct MetricsText text = {malloc(METRICS_BUFFER_SIZE), 0, openMetrics};
+	BOOL hasSharedTier = has_shared_tier() && is_directory(globalConfig.sharedCachePath) && cache_info(globalConfig.sharedCachePath, &sharedInfo, FALSE);
+	char labels[128];
+
+	if(!cache_info(globalConfig.cachePath, &info, FALSE)) {
+		free(text.data);
+
+		return NULL;
+	}
+
+	text.data[0] = '\0';
+	append_metric_counter(&text, "lelcache_hits", "Compilations served from the cache.", info.numCacheHits);
+	append_metric_counter(&text, "lelcache_misses", "Compilations that weren't in the cache.", info.numCacheMisses);
+	append_metric_counter(&text, "lelcache_failure_hits", "Hits that replayed a failed compilation.", info.numNegativeCacheHits);
+	append_metric_counter(&text, "lelcache_remote_hits", "Hits that were downloaded from the remote cache.", info.numRemoteHits);
+	append_metric_counter(&text, "lelcache_shared_tier_hits", "Hits that were found in the shared tier.", info.numSharedHits);
+	append_metric_counter(&text, "lelcache_bundle_hits", "Hits that were found in the mounted bundle.", info.numBundleHits);
+	append_metric_counter(&text, "lelcache_not_admitted", "Misses that weren't stored because of the admission policy.", info.numNotAdmitted);
+	append_metric_family(&text, "lelcache_uncacheable", "counter", "Invocations that couldn't be cached.");
+
+	for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r) {
+		snprintf(labels, sizeof(labels), "reason=\"%s\"", uncacheableReasonNames[r].key);
+		append_metric_sample(&text, "lelcache_uncacheable_total", labels, info.numUncacheable[r]);
+	}
+
+	append_metric_family(&text, "lelcache_evictions", "counter", "Entries evicted to keep a tier within its limits.");
+	append_metric_sample(&text, "lelcache_evictions_total", "tier=\"local\"", (double)info.numEvictions);
+
+	if(hasSharedTier)
+		append_metric_sample(&text, "lelcache_evictions_total", "tier=\"shared\"", (double)sharedInfo.numEvictions);
+
+	append_metric_family(&text, "lelcache_evicted_bytes", "counter", "Size of the evicted entries.");
+	append_metric_sample(&text, "lelcache_evicted_bytes_total", "tier=\"local\"", (double)info.evictedSize);
+
+	if(hasSharedTier)
+		append_metric_sample(&text, "lelcache_evicted_bytes_total", "tier=\"shared\"", (double)sharedInfo.evictedSize);
+
+	append_metric_family(&text, "lelcache_size_bytes", "gauge", "Size of the entries in a tier.");
+	append_metric_sample(&text, "lelcache_size_bytes", "tier=\"local\"", (double)info.currentCacheSize);
+
+	if(hasSharedTier)
+		append_metric_sample(&text, "lelcache_size_bytes", "tier=\"shared\"", (double)sharedInfo.currentCacheSize);
+
+	append_metric_family(&text, "lelcache_max_size_bytes", "gauge", "Size a tier is evicted down from.");
+	append_metric_sample(&text, "lelcache_max_size_bytes", "tier=\"local\"", (double)globalConfig.maxCacheSize);
+
+	if(hasSharedTier)
+		append_metric_sample(&text, "lelcache_max_size_bytes", "tier=\"shared\"", (double)globalConfig.maxSharedCacheSize);
+
+	append_metric_counter(&text, "lelcache_compile_time_saved_seconds", "Compile time of the entries of all hits.", info.compileTimeSaved / 1000.0);
+	append_metric_counter(&text, "lelcache_compile_seconds", "Time spent compiling misses.", info.compileTime / 1000.0);
+	append_metric_counter(&text, "lelcache_preprocessor_seconds", "Time spent preprocessing.", info.preprocessorTime / 1000.0);
+	append_metric_counter(&text, "lelcache_read_bytes", "Size of the outputs copied from the cache.", (double)info.bytesRead);
+	append_metric_counter(&text, "lelcache_written_bytes", "Size of the files stored in the cache.", (double)info.bytesWritten);
+
+	FileMappingHandle mapping;
+	struct Monitor* monitor = open_monitor(&mapping);
+
+	if(monitor) {
+		append_latency_histograms(&text, monitor);
+		unmap_file(mapping);
+	}
+
+	if(openMetrics)
+		append_metrics_line(&text, "# EOF\n");
+
+	*outSize = text.length;
+
+	return text.data;
+}
+
+LPVOID serve_metrics(const char* path, SIZE_T* outSize, LPVOID context) {
+	UNREFERENCED_PARAMETER(context);
+
+	return strcmp(path, "/metrics") == 0 || strcmp(path, "/") == 0 ? format_metrics(TRUE, outSize) : NULL;
+}
+
+/*
+ * lelcache metrics
+ * lelcache metrics --textfile <file> [<seconds>]
+ * lelcache metrics --serve [[<address>:]<port>]
+ */
+int run_metrics(int argc, LPWSTR* argv) {
+	SIZE_T size;
+
+	if(argc >= 4 && wcscmp(argv[2], L"--textfile") == 0) {
+		double seconds = argc >= 5 ? wcstod(argv[4], NULL) : 0.0;
+
+		for(;;) { // Runs until it is interrupted if <seconds> is given
+			char* text = format_metrics(FALSE, &size);
+
+			// Replacing the file at once makes sure the collector never reads half of it
+			if(!text || !publish_data(argv[3], text, size)) {
+				wprintf(L"Unable to write the metrics to '%ls'\n", argv[3]);
+				free(text);
+
+				return EXIT_FAILURE;
+			}
+
+			free(text);
+
+			if(seconds <= 0.0)
+				return EXIT_SUCCESS;
+
+			sleep_ms((DWORD)(seconds * 1000));
+		}
+	}
+
+	if(argc >= 3 && wcscmp(argv[2], L"--serve") == 0) {
+		WCHAR address[64] = L"";
+		LPCWSTR separator = argc >= 4 ? wcsrchr(argv[3], L':') : NULL;
+		DWORD port = argc >= 4 ? (DWORD)wcstoul(separator ? separator + 1 : argv[3], NULL, 10) : METRICS_DEFAULT_PORT;
+
+		if(separator && separator - argv[3] < (ptrdiff_t)ARRAYSIZE(address)) {
+			wcsncpy(address, argv[3], separator - argv[3]);
+			address[separator - argv[3]] = L'\0';
+		}
+
+		wprintf(L"Serving metrics on http://%ls:%lu/metrics\n", address[0] ? address : L"127.0.0.1", (unsigned long)port);
+		fflush(stdout);
+
+		if(!serve_http(address[0] ? address : NULL, port, METRICS_CONTENT_TYPE, serve_metrics, NULL)) {
+			wprintf(L"Unable to listen on port %lu\n", (unsigned long)port);
+
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	char* text = argc == 2 ? format_metrics(TRUE, &size) : NULL;
+
+	if(!text) {
+		wprintf(L"Usage: lelcache metrics [--textfile <file> [<seconds>] | --serve [[<address>:]<port>]]\n");
+
+		return EXIT_FAILURE;
+	}
+
+	fflush(stdout);
+	write_to_console(text, size, FALSE);
+	free(text);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Sessions
+ *
+ * The statistics in cache.info cover the whole lifetime of the cache. A session collects the same numbers for a shorter
+ * span like a CI job: it starts with --session-begin <id> and every invocation adds its result to it until --session-end
+ * writes a summary. Invocations belong to the session named by the LELCACHE_SESSION environment variable, or else to the
+ * one started last. The variable allows concurrent jobs on the same machine to keep their sessions apart.
+ */
+
+#define SESSION_ENVIRONMENT_VARIABLE L"LELCACHE_SESSION"
+#define SESSIONS_DIRECTORY_NAME L"sessions"
+#define ACTIVE_SESSION_FILE_NAME L"active"
+#define SESSION_ID_LENGTH 64
+
+struct Session {
+	UINT64 started; // System time
+	UINT64 ended;   // 0 while the session is running
+	UINT32 numHits;
+	UINT32 numMisses;
+	UINT32 numUncacheable[MAX_UNCACHEABLE_REASONS]; // Indexed by enum UncacheableReason
+	UINT64 duration;         // In milliseconds, of all invocations together
+	UINT64 compileTimeSaved; // In milliseconds
+	UINT64 compileTime;      // In milliseconds
+	UINT64 preprocessorTime; // In milliseconds
+	UINT64 bytesRead;
+	UINT64 bytesWritten;
+};
+
+BOOL is_valid_session_id(LPCWSTR id) {
+	SIZE_T length = wcslen(id);
+
+	for(SIZE_T i = 0; i < length; ++i) {
+		if(id[i] >= 128 || !(iswalnum(id[i]) || wcschr(L".-_", id[i])))
+			return FALSE;
+	}
+
+	return length > 0 && length < SESSION_ID_LENGTH;
+}
+
+BOOL make_sessions_directory(void) {
+	WCHAR path[MAX_PATH];
+
+	swprintf(path, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING SESSIONS_DIRECTORY_NAME, globalConfig.cachePath);
+
+	return make_path(path);
+}
+
+void session_path(LPCWSTR id, LPCWSTR extension, LPWSTR buffer) {
+	swprintf(buffer, MAX_PATH, L"%ls" PATH_SEPARATOR_STRING SESSIONS_DIRECTORY_NAME PATH_SEPARATOR_STRING L"%ls%ls", globalConfig.cachePath, id, extension);
+}
+
+/*
+ * buffer must hold SESSION_ID_LENGTH characters. Returns FALSE if there is no session.
+ */
+BOOL current_session(LPWSTR buffer) {
+	WCHAR path[MAX_PATH];
+
+	if(get_environment_variable(SESSION_ENVIRONMENT_VARIABLE, buffer, SESSION_ID_LENGTH))
+		return is_valid_session_id(buffer);
+
+	*buffer = L'\0';
+	session_path(ACTIVE_SESSION_FILE_NAME, L"", path);
+
+	if(!file_exists(path) || !read_struct_file(path, buffer, SESSION_ID_LENGTH * sizeof(WCHAR)))
+		return FALSE;
+
+	buffer[SESSION_ID_LENGTH - 1] = L'\0';
+
+	return is_valid_session_id(buffer);
+}
+
+/*
+ * Adds the result of an invocation that started at startTime to the current session. The other numbers are already in
+ * invocation.
+ */
+void add_to_session(struct Session* invocation, enum MonitorEventKind kind, enum UncacheableReason reason, UINT64 startTime) {
+	WCHAR id[SESSION_ID_LENGTH];
+	WCHAR path[MAX_PATH];
+	struct Session session = {0};
+
+	if(!current_session(id))
+		return;
+
+	session_path(id, L".session", path);
+
+	FileHandle file = make_sessions_directory() ? lock_file(path) : INVALID_FILE_HANDLE;
+
+	if(file == INVALID_FILE_HANDLE)
+		return;
+
+	// A session that is only named by the environment variable starts with its first invocation
+	if(read_file(file, &session, sizeof(session)) == 0)
+		session.started = startTime;
+
+	if(session.ended == 0) {
+		session.numHits += kind == MONITOR_HIT;
+		session.numMisses += kind == MONITOR_MISS;
+		session.numUncacheable[reason] += kind == MONITOR_UNCACHEABLE;
+		session.duration += (current_system_time() - startTime) / 10000;
+		session.compileTimeSaved += invocation->compileTimeSaved;
+		session.compileTime += invocation->compileTime;
+		session.preprocessorTime += invocation->preprocessorTime;
+		session.bytesRead += invocation->bytesRead;
+		session.bytesWritten += invocation->bytesWritten;
+
+		if(seek_file(file, 0))
+			write_file(file, &session, sizeof(session));
+	}
+
+	unlock_file(file);
+}
+
+/*
+ * lelcache --session-begin <id>
+ */
+int run_session_begin(int argc, LPWSTR* argv) {
+	WCHAR path[MAX_PATH];
+	WCHAR id[SESSION_ID_LENGTH] = {0};
+	struct Session session = {0};
+
+	if(argc != 3 || !is_valid_session_id(argv[2])) {
+		wprintf(L"--session-begin expects an id of at most %d letters, digits, '.', '-' or '_' as an argument\n", SESSION_ID_LENGTH - 1);
+
+		return EXIT_FAILURE;
+	}
+
+	wcscpy(id, argv[2]);
+	session_path(id, L".session", path);
+	session.started = current_system_time();
+
+	if(!make_sessions_directory() || !publish_data(path, &session, sizeof(session))) {
+		wprintf(L"Unable to start session '%ls'\n", id);
+
+		return EXIT_FAILURE;
+	}
+
+	session_path(ACTIVE_SESSION_FILE_NAME, L"", path);
+	publish_data(path, id, sizeof(id));
+	wprintf(L"Session '%ls' started\n", id);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * lelcache --session-end [<file>]
+ * Ends the current session, prints its summary and writes it as JSON to <file> (default: <id>.json next to the session).
+ */
+int run_session_end(int argc, LPWSTR* argv) {
+	WCHAR id[SESSION_ID_LENGTH];
+	WCHAR path[MAX_PATH];
+	WCHAR jsonPath[MAX_PATH];
+	struct Session session = {0};
+
+	if(!current_session(id)) {
+		wprintf(L"No session was started, see --session-begin\n");
+
+		return EXIT_FAILURE;
+	}
+
+	session_path(id, L".session", path);
+
+	FileHandle file = file_exists(path) ? lock_file(path) : INVALID_FILE_HANDLE;
+
+	if(file == INVALID_FILE_HANDLE || read_file(file, &session, sizeof(session)) == 0) {
+		wprintf(L"Session '%ls' has no invocations\n", id);
+
+		if(file != INVALID_FILE_HANDLE)
+			unlock_file(file);
+
+		return EXIT_FAILURE;
+	}
+
+	if(session.ended == 0) {
+		session.ended = current_system_time();
+
+		if(seek_file(file, 0))
+			write_file(file, &session, sizeof(session));
+	}
+
+	unlock_file(file);
+
+	WCHAR activeId[SESSION_ID_LENGTH] = {0};
+
+	session_path(ACTIVE_SESSION_FILE_NAME, L"", path);
+
+	if(file_exists(path) && read_struct_file(path, activeId, sizeof(activeId)) && wcsncmp(activeId, id, SESSION_ID_LENGTH) == 0)
+		delete_file(path);
+
+	UINT32 numUncacheable = 0;
+	UINT32 numCacheable = session.numHits + session.numMisses;
+	double wallTime = (session.ended - session.started) / 10000000.0;
+
+	for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r)
+		numUncacheable += session.numUncacheable[r];
+
+	wprintf(L"session:            %ls\n"
+			L"duration:           %.1f s\n"
+			L"cache hits:         %u\n"
+			L"cache misses:       %u\n"
+			L"cache hit rate:     %.2f%%\n"
+			L"uncacheable:        %u\n",
+			id,
+			wallTime,
+			session.numHits,
+			session.numMisses,
+			numCacheable > 0 ? session.numHits * 100.0 / numCacheable : 0.0,
+			numUncacheable);
+
+	for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r) {
+		if(session.numUncacheable[r] > 0)
+			wprintf(L"  %-24ls%u\n", uncacheableReasonNames[r].description, session.numUncacheable[r]);
+	}
+
+	wprintf(L"invocation time:    %.1f s\n"
+			L"compile time saved: %.1f s\n"
+			L"compile time:       %.1f s\n"
+			L"preprocessor time:  %.1f s\n"
+			L"read from cache:    %.1f MB\n"
+			L"written to cache:   %.1f MB\n",
+			session.duration / 1000.0,
+			session.compileTimeSaved / 1000.0,
+			session.compileTime / 1000.0,
+			session.preprocessorTime / 1000.0,
+			session.bytesRead / (1024.0 * 1024.0),
+			session.bytesWritten / (1024.0 * 1024.0));
+
+	char json[4096 + SESSION_ID_LENGTH * 4];
+	char idJson[SESSION_ID_LENGTH * 4 + 3];
+	int length = 0;
+
+	json_string(id, idJson, sizeof(idJson));
+	length += snprintf(json + length, sizeof(json) - length,
+					   "{\n"
+					   "  \"session\": %s,\n"
+					   "  \"started\": %llu,\n"
+					   "  \"ended\": %llu,\n"
+					   "  \"duration_ms\": %llu,\n"
+					   "  \"cache_hits\": %u,\n"
+					   "  \"cache_misses\": %u,\n"
+					   "  \"uncacheable\": %u,\n"
+					   "  \"uncacheable_reasons\": {",
+					   idJson,
+					   (unsigned long long)((session.started - UNIX_EPOCH) / 10000000),
+					   (unsigned long long)((session.ended - UNIX_EPOCH) / 10000000),
+					   (unsigned long long)((session.ended - session.started) / 10000),
+					   session.numHits,
+					   session.numMisses,
+					   numUncacheable);
+
+	for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r)
+		length += snprintf(json + length, sizeof(json) - length, "%s\n    \"%s\": %u", r > 0 ? "," : "", uncacheableReasonNames[r].key, session.numUncacheable[r]);
+
+	length += snprintf(json + length, sizeof(json) - length,
+					   "\n  },\n"
+					   "  \"invocation_time_ms\": %llu,\n"
+					   "  \"compile_time_saved_ms\": %llu,\n"
+					   "  \"compile_time_ms\": %llu,\n"
+					   "  \"preprocessor_time_ms\": %llu,\n"
+					   "  \"bytes_read\": %llu,\n"
+					   "  \"bytes_written\": %llu\n"
+					   "}\n",
+					   (unsigned long long)session.duration,
+					   (unsigned long long)session.compileTimeSaved,
+					   (unsigned long long)session.compileTime,
+					   (unsigned long long)session.preprocessorTime,
+					   (unsigned long long)session.bytesRead,
+					   (unsigned long long)session.bytesWritten);
+
+	if(argc >= 3)
+		swprintf(jsonPath, MAX_PATH, L"%ls", argv[2]);
+	else
+		session_path(id, L".json", jsonPath);
+
+	if(!write_struct_file(jsonPath, json, length)) {
+		wprintf(L"Unable to write the summary to '%ls'\n", jsonPath);
+
+		return EXIT_FAILURE;
+	}
+
+	wprintf(L"summary written to: %ls\n", jsonPath);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Simulation
+ *
+ * With -l every cacheable invocation appends the key, size and compile time of its entry to an access log. 'lelcache
+ * simulate' replays the log against several eviction policies and cache sizes to show how the miss ratio and the saved
+ * compile time depend on the size limit. Large logs are sampled like in SHARDS: only the accesses to keys whose hash falls
+ * below a threshold are replayed, against a cache that is scaled down by the same rate. Since every key is either sampled
+ * with all of its accesses or not at all, the miss ratio of the sample is a good estimate of the miss ratio of the log.
+ */
+
+#define ACCESS_LOG_FILE_NAME L"access.log"
+#define SIMULATE_MAX_SAMPLES (256 * 1024) // Accesses that are replayed at most, more lead to sampling
+#define SIMULATE_SAMPLING_MODULUS (1 << 24)
+#define SIMULATE_NUM_SIZES 12
+
+struct AccessRecord {
+	UINT64 time;
+	struct CacheKey key;
+	UINT64 size;        // Of the entry's files
+	UINT64 compileTime; // In milliseconds, what a miss of the entry costs
 };
 
-BOOL cache_info(struct CacheInfo* info, BOOL write) {
-	WCHAR cacheInfoPath[MAX_PATH];
+void append_access_record(const struct CacheKey* key, UINT64 size, UINT64 compileTime) {
+	WCHAR path[MAX_PATH];
+	struct AccessRecord record = {current_system_time(), *key, size, compileTime};
 
-	lstrcpyW(cacheInfoPath, globalConfig.cachePath);
-	make_path(cacheInfoPath);
-	lstrcatW(cacheInfoPath, L"\\cache.info");
+	cache_file_path(ACCESS_LOG_FILE_NAME, path);
 
-	if(write) {
-		HANDLE file = CreateFileW(cacheInfoPath, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	FileHandle file = open_file(path, OPEN_FOR_APPENDING);
 
-		if(file == INVALID_HANDLE_VALUE) {
-			wprintf(L"Unable to open cache info file at '%s' for writing\n", cacheInfoPath);
+	if(file != INVALID_FILE_HANDLE) {
+		write_file(file, &record, sizeof(record)); // The log is local and fixed size records don't interleave
 
-			return FALSE;
+		if(file_handle_size(file) > (UINT64)globalConfig.accessLogSize * 1024 * 1024)
+			start_background_worker(); // Compacts the log
+
+		close_file(file);
+	}
+}
+
+/*
+ * Drops the oldest half of the access log once it is larger than its limit. Records appended in the meantime are lost.
+ */
+void compact_access_log(void) {
+	WCHAR logPath[MAX_PATH];
+	WCHAR lockPath[MAX_PATH];
+	SIZE_T size;
+
+	cache_file_path(ACCESS_LOG_FILE_NAME, logPath);
+	cache_file_path(L"access.lock", lockPath);
+
+	if(file_size(logPath) <= (UINT64)globalConfig.accessLogSize * 1024 * 1024)
+		return;
+
+	FileHandle lock = try_lock_file(lockPath);
+
+	if(lock == INVALID_FILE_HANDLE)
+		return;
+
+	struct AccessRecord* records = read_whole_file(logPath, &size);
+	SIZE_T count = records ? size / sizeof(*records) : 0;
+
+	if(globalConfig.accessLogSize == 0)
+		delete_file(logPath);
+	else if(count > 0)
+		publish_data(logPath, records + count / 2, (count - count / 2) * sizeof(*records));
+
+	free(records);
+	unlock_file(lock);
+}
+
+enum SimulatedPolicy {
+	SIMULATE_LRU,
+	SIMULATE_FIFO,
+	SIMULATE_LFU,
+	SIMULATE_GDS,  // GreedyDual-Size, what evict_tier does
+	SIMULATE_GDSF, // GreedyDual-Size-Frequency
+	NUM_SIMULATED_POLICIES
+};
+
+const LPCWSTR simulatedPolicyNames[NUM_SIMULATED_POLICIES] = {L"LRU", L"FIFO", L"LFU", L"GDS", L"GDSF"};
+
+/*
+ * The sampled accesses with the keys replaced by dense ids.
+ */
+struct SimulatedAccess {
+	UINT32 id;
+	UINT32 compileTime; // In milliseconds
+	UINT64 size;
+};
+
+/*
+ * Binary min-heap of the ids of the entries in the simulated cache, ordered by their priority. position[id] is the index
+ * of an entry in the heap or -1 if it isn't cached.
+ */
+struct SimulatedCache {
+	UINT32* heap;
+	INT64* position;
+	double* priority;
+	UINT64* size;
+	UINT64* frequency;
+	SIZE_T count;
+	UINT64 usedSize;
+};
+
+void simulated_cache_swap(struct SimulatedCache* cache, SIZE_T a, SIZE_T b) {
+	UINT32 id = cache->heap[a];
+
+	cache->heap[a] = cache->heap[b];
+	cache->heap[b] = id;
+	cache->position[cache->heap[a]] = (INT64)a;
+	cache->position[cache->heap[b]] = (INT64)b;
+}
+
+void simulated_cache_sift(struct SimulatedCache* cache, SIZE_T index) {
+	while(index > 0 && cache->priority[cache->heap[index]] < cache->priority[cache->heap[(index - 1) / 2]]) {
+		simulated_cache_swap(cache, index, (index - 1) / 2);
+		index = (index - 1) / 2;
+	}
+
+	for(;;) {
+		SIZE_T smallest = index;
+
+		for(SIZE_T child = 2 * index + 1; child <= 2 * index + 2 && child < cache->count; ++child) {
+			if(cache->priority[cache->heap[child]] < cache->priority[cache->heap[smallest]])
+				smallest = child;
 		}
 
-		DWORD numBytesWritten;
+		if(smallest == index)
+			break;
 
-		WriteFile(file, info, sizeof(*info), &numBytesWritten, NULL);
-		CloseHandle(file);
-	} else {
-		if(file_exists(cacheInfoPath)) { // If file exists read it, otherwise initialize info with default values
-			HANDLE file = CreateFileW(cacheInfoPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		simulated_cache_swap(cache, index, smallest);
+		index = smallest;
+	}
+}
+
+/*
+ * Replays the accesses against a cache of capacity bytes. Returns the number of misses and adds the compile time of the
+ * hits to *outSavedTime.
+ */
+UINT64 simulate_policy(const struct SimulatedAccess* accesses, SIZE_T numAccesses, UINT32 numIds, enum SimulatedPolicy policy, UINT64 capacity, UINT64* outSavedTime) {
+	struct SimulatedCache cache = {
+		malloc((numIds + 1) * sizeof(UINT32)),
+		malloc((numIds + 1) * sizeof(INT64)),
+		malloc((numIds + 1) * sizeof(double)),
+		malloc((numIds + 1) * sizeof(UINT64)),
+		calloc(numIds + 1, sizeof(UINT64)),
+		0,
+		0
+	};
+	double inflation = 0.0;
+	UINT64 numMisses = 0;
+
+	for(UINT32 id = 0; id < numIds; ++id)
+		cache.position[id] = -1;
+
+	for(SIZE_T i = 0; i < numAccesses; ++i) {
+		const struct SimulatedAccess* access = &accesses[i];
+		UINT32 id = access->id;
+		double costPerByte = (access->compileTime > 0 ? access->compileTime : 1) / (double)access->size;
+		BOOL cached = cache.position[id] >= 0;
+
+		if(cached) {
+			*outSavedTime += access->compileTime;
+		} else {
+			++numMisses;
+
+			if(access->size > capacity)
+				continue;
 
-			if(file == INVALID_HANDLE_VALUE) {
-				wprintf(L"Unable to open cache info file at '%s' for reading\n", cacheInfoPath);
+			while(cache.usedSize + access->size > capacity) {
+				UINT32 victim = cache.heap[0];
 
-				return FALSE;
+				inflation = cache.priority[victim];
+				cache.usedSize -= cache.size[victim];
+				cache.position[victim] = -1;
+				cache.frequency[victim] = 0; // Frequencies are only counted while an entry is cached
+
+				if(--cache.count > 0) {
+					cache.heap[0] = cache.heap[cache.count];
+					cache.position[cache.heap[0]] = 0;
+					simulated_cache_sift(&cache, 0);
+				}
 			}
 
-			DWORD numBytesRead;
-			BOOL success = ReadFile(file, info, sizeof(*info), &numBytesRead, NULL);
+			cache.heap[cache.count] = id;
+			cache.position[id] = (INT64)cache.count++;
+			cache.size[id] = access->size;
+			cache.usedSize += access->size;
+		}
 
-			CloseHandle(file);
+		++cache.frequency[id];
 
-			return success;
-		} else {
-			*info = (struct CacheInfo){0};
+		switch(policy) {
+		case SIMULATE_LRU:
+			cache.priority[id] = (double)i;
+			break;
+		case SIMULATE_FIFO:
+			if(!cached)
+				cache.priority[id] = (double)i;
+			break;
+		case SIMULATE_LFU: // Ties are broken by recency
+			cache.priority[id] = (double)cache.frequency[id] * (numAccesses + 1) + i;
+			break;
+		case SIMULATE_GDS:
+			cache.priority[id] = inflation + costPerByte;
+			break;
+		default:
+			cache.priority[id] = inflation + cache.frequency[id] * costPerByte;
+			break;
 		}
+
+		simulated_cache_sift(&cache, (SIZE_T)cache.position[id]);
 	}
 
-	return TRUE;
+	free(cache.heap);
+	free(cache.position);
+	free(cache.priority);
+	free(cache.size);
+	free(cache.frequency);
+
+	return numMisses;
+}
+
+/*
+ * lelcache simulate [<megabytes>...]
+ * Replays the access log against all policies for the given cache sizes, by default for sizes from 1/1024 of the working
+ * set up to all of it.
+ */
+int run_simulate(int argc, LPWSTR* argv) {
+	WCHAR logPath[MAX_PATH];
+	SIZE_T size = 0;
+
+	cache_file_path(ACCESS_LOG_FILE_NAME, logPath);
+
+	struct AccessRecord* records = file_exists(logPath) ? read_whole_file(logPath, &size) : NULL;
+	SIZE_T numRecords = records ? size / sizeof(*records) : 0;
+
+	if(numRecords == 0) {
+		wprintf(L"The access log is empty, enable it with -l<megabytes> and run some builds first\n");
+		free(records);
+
+		return EXIT_FAILURE;
+	}
+
+	// Fixed rate sampling with a rate that leaves about SIMULATE_MAX_SAMPLES accesses
+	double rate = numRecords > SIMULATE_MAX_SAMPLES ? (double)SIMULATE_MAX_SAMPLES / numRecords : 1.0;
+	UINT64 threshold = (UINT64)(rate * SIMULATE_SAMPLING_MODULUS);
+	struct SimulatedAccess* accesses = malloc(numRecords * sizeof(*accesses));
+	SIZE_T numAccesses = 0;
+	UINT32 numIds = 0;
+	SIZE_T tableSize = 1;
+	UINT64 workingSetSize = 0, totalCompileTime = 0;
+
+	while(tableSize < 2 * numRecords)
+		tableSize *= 2;
+
+	// Open addressing table from the keys to their ids
+	struct CacheKey* tableKeys = malloc(tableSize * sizeof(*tableKeys));
+	UINT32* tableIds = malloc(tableSize * sizeof(*tableIds));
+
+	memset(tableIds, 0xff, tableSize * sizeof(*tableIds));
+
+	for(SIZE_T i = 0; i < numRecords; ++i) {
+		XXH64_hash_t hash = XXH64(&records[i].key, sizeof(records[i].key), 0);
+
+		if(hash % SIMULATE_SAMPLING_MODULUS >= threshold)
+			continue;
+
+		SIZE_T slot = (SIZE_T)(hash >> 24) & (tableSize - 1);
+
+		while(tableIds[slot] != UINT32_MAX && memcmp(&tableKeys[slot], &records[i].key, sizeof(records[i].key)) != 0)
+			slot = (slot + 1) & (tableSize - 1);
+
+		if(tableIds[slot] == UINT32_MAX) {
+			tableKeys[slot] = records[i].key;
+			tableIds[slot] = numIds++;
+			workingSetSize += records[i].size > 0 ? records[i].size : 1;
+		}
+
+		accesses[numAccesses++] = (struct SimulatedAccess){
+			tableIds[slot],
+			(UINT32)(records[i].compileTime < UINT32_MAX ? records[i].compileTime : UINT32_MAX),
+			records[i].size > 0 ? records[i].size : 1 // Failed compilations are stored without output files
+		};
+		totalCompileTime += records[i].compileTime;
+	}
+
+	free(tableKeys);
+	free(tableIds);
+
+	UINT64 sizes[SIMULATE_NUM_SIZES]; // Of the full cache, in bytes
+	int numSizes = 0;
+
+	for(int i = 2; i < argc && numSizes < SIMULATE_NUM_SIZES; ++i)
+		sizes[numSizes++] = (UINT64)(wcstod(argv[i], NULL) * 1024 * 1024);
+
+	for(int i = 0; numSizes == 0 && i < SIMULATE_NUM_SIZES - 1; ++i)
+		sizes[i] = (UINT64)(workingSetSize / rate) >> (SIMULATE_NUM_SIZES - 2 - i);
+
+	if(numSizes == 0) {
+		sizes[SIMULATE_NUM_SIZES - 1] = globalConfig.maxCacheSize;
+		numSizes = SIMULATE_NUM_SIZES;
+	}
+
+	double missRatios[SIMULATE_NUM_SIZES][NUM_SIMULATED_POLICIES];
+	double savedHours[SIMULATE_NUM_SIZES][NUM_SIMULATED_POLICIES];
+
+	for(int s = 0; s < numSizes; ++s) {
+		for(int p = 0; p < NUM_SIMULATED_POLICIES; ++p) {
+			UINT64 savedTime = 0;
+			UINT64 numMisses = simulate_policy(accesses, numAccesses, numIds, (enum SimulatedPolicy)p, (UINT64)(sizes[s] * rate), &savedTime);
+
+			missRatios[s][p] = numAccesses > 0 ? (double)numMisses / numAccesses : 0.0;
+			savedHours[s][p] = savedTime / rate / (60.0 * 60.0 * 1000.0);
+		}
+	}
+
+	wprintf(L"%llu accesses to %llu entries over %.1f days, %.1f%% of them sampled\n"
+			L"working set: %.1f MB, compile time of all accesses: %.1f hours\n",
+			(unsigned long long)numRecords,
+			(unsigned long long)(numIds / rate),
+			(records[numRecords - 1].time - records[0].time) / (24.0 * 60 * 60 * 10000000),
+			rate * 100.0,
+			workingSetSize / rate / (1024.0 * 1024.0),
+			totalCompileTime / rate / (60.0 * 60.0 * 1000.0));
+
+	for(int table = 0; table < 2; ++table) {
+		wprintf(table == 0 ? L"\nmiss ratio\n%12ls" : L"\ncompile time saved (hours)\n%12ls", L"size (MB)");
+
+		for(int p = 0; p < NUM_SIMULATED_POLICIES; ++p)
+			wprintf(L" %9ls", simulatedPolicyNames[p]);
+
+		wprintf(L"\n");
+
+		for(int s = 0; s < numSizes; ++s) {
+			wprintf(L"%12.2f", sizes[s] / (1024.0 * 1024.0));
+
+			for(int p = 0; p < NUM_SIMULATED_POLICIES; ++p)
+				wprintf(L" %9.3f", table == 0 ? missRatios[s][p] : savedHours[s][p]);
+
+			wprintf(sizes[s] == globalConfig.maxCacheSize ? L"   <- current limit\n" : L"\n");
+		}
+	}
+
+	free(accesses);
+	free(records);
+
+	return EXIT_SUCCESS;
+}
+
+struct Queue {
+	LPCWSTR name;
+	JobFunction function;
+};
+
+const struct Queue backgroundQueues[] = {
+	{L"promotions", promote_entry},
+	{L"writebacks", write_back_entry},
+	{L"uploads", upload_entry}
+};
+
+/*
+ * Entry point of the detached process started by start_background_worker. Works through all queues and evicts entries
+ * from tiers that have grown too large.
+ */
+int run_background_worker(void) {
+	WCHAR lockPath[MAX_PATH];
+
+	cache_file_path(L"worker.lock", lockPath);
+
+	for(;;) {
+		FileHandle lock = try_lock_file(lockPath);
+
+		if(lock == INVALID_FILE_HANDLE)
+			break; // Another worker is running
+
+		BOOL postponed = FALSE;
+		int numProcessed;
+
+		do {
+			numProcessed = 0;
+
+			for(int i = 0; i < ARRAYSIZE(backgroundQueues); ++i) {
+				if(!process_queue(backgroundQueues[i].name, backgroundQueues[i].function, &numProcessed))
+					postponed = TRUE;
+			}
+		} while(numProcessed > 0 && !postponed);
+
+		refresh_summaries();
+		drop_retired_generations(globalConfig.cachePath);
+		compact_history(globalConfig.cachePath);
+		compact_churn_log(globalConfig.cachePath);
+		compact_access_log();
+
+		if(has_shared_tier() && is_directory(globalConfig.sharedCachePath)) {
+			compact_history(globalConfig.sharedCachePath);
+			compact_churn_log(globalConfig.sharedCachePath);
+		}
+
+		evict_tier(globalConfig.cachePath, globalConfig.maxCacheSize);
+
+		if(has_shared_tier() && is_directory(globalConfig.sharedCachePath))
+			evict_tier(globalConfig.sharedCachePath, globalConfig.maxSharedCacheSize);
+
+		unlock_file(lock);
+
+		if(postponed)
+			break;
+
+		// Jobs queued while the lock was about to be released didn't start another worker so they are checked for here
+		int numQueued = 0;
+
+		for(int i = 0; i < ARRAYSIZE(backgroundQueues); ++i) {
+			WCHAR queuePath[MAX_PATH];
+			struct StringList queued = {0};
+
+			cache_file_path(backgroundQueues[i].name, queuePath);
+			list_directory(queuePath, collect_file_names, &queued);
+			numQueued += queued.count;
+			free_string_list(&queued);
+		}
+
+		if(numQueued == 0)
+			break;
+	}
+
+	return EXIT_SUCCESS;
 }
 
 int lelcache_main(int argc, LPWSTR* argv) {
-	if(lstrcmpW(file_name_from_path(argv[1]), L"cl.exe") != 0) {
-		wprintf(L"First argument is expected to be the path to cl.exe\n");
+	enum CompilerKind compilerKind = compiler_kind_from_path(argv[1]);
+
+	if(compilerKind == COMPILER_UNKNOWN) {
+		wprintf(L"First argument is expected to be the path to cl.exe, clang-cl, gcc or clang\n");
 
 		return EXIT_FAILURE;
 	}
 
 	int exitCode = EXIT_SUCCESS;
 	struct CommandLineInfo cmdLineInfo = {0};
-	PROCESS_INFORMATION processInfo = {0};
+	ProcessHandle process;
+	BOOL cacheable = FALSE;
+	const char* result = "uncacheable"; // For the trace
+	enum MonitorEventKind eventKind = MONITOR_UNCACHEABLE;
+	UINT64 bytesMoved = 0; // Read from or written to the cache
+	UINT64 startTime = current_system_time();
+	struct Session sessionInvocation = {0}; // What this invocation adds to the current session
+	FileMappingHandle monitorMapping;
+	struct Monitor* monitor = open_monitor(&monitorMapping);
+
+	start_trace();
+
+	UINT64 invocationStart = begin_span();
+	UINT64 spanStart = invocationStart;
+
+	switch(compilerKind) {
+	case COMPILER_CL:
+	case COMPILER_CLANG_CL:
+		cacheable = parse_cl_command_line(argc, argv, compilerKind == COMPILER_CLANG_CL, &cmdLineInfo);
+		break;
+	case COMPILER_GCC:
+		cacheable = parse_gcc_command_line(argc, argv, &cmdLineInfo);
+		break;
+	default: // Linking is never cached
+		break;
+	}
+
+	end_span("parse command line", spanStart);
+
+	XXH64_hash_t generation = 0;
+
+	spanStart = begin_span();
+
+	if(cacheable && !current_generation(argv[1], &generation))
+		cacheable = reject_command_line(&cmdLineInfo, UNCACHEABLE_RETIRED_GENERATION);
 
-	if(parse_cl_command_line(argc, argv, &cmdLineInfo)) {
-		LPWSTR cmdLineBuffer = _malloca((max(cmdLineInfo.preprocessorCmdLineLength, cmdLineInfo.compilerCmdLineLength) +
-										 max(cmdLineInfo.numPreprocessorFlags, cmdLineInfo.numCompilerFlags) * 3) *
-										sizeof(WCHAR));
+	if(cacheable && !hash_hidden_inputs(generation, &cmdLineInfo))
+		cacheable = reject_command_line(&cmdLineInfo, UNCACHEABLE_MISSING_PROFILE);
 
-		make_cmd_line((int)cmdLineInfo.numPreprocessorFlags, cmdLineInfo.preprocessorFlags, cmdLineBuffer);
+	end_span("hash hidden inputs", spanStart);
 
-		if(launch_process(argv[1], cmdLineBuffer, &processInfo, TRUE) && wait_for_process(&processInfo) == 0) {
-			HANDLE cacheInfoMutex = CreateMutexW(NULL, FALSE, L"lelcacheinfofile"); // The cache.info file is possibly being accessed by multiple processes at once which must be synchronized
+	if(cacheable) {
+		FileHandle nullOutput = open_null_output();
+
+		UINT64 preprocessStart = current_system_time();
+
+		spanStart = begin_span();
+
+		BOOL preprocessed = launch_process((int)cmdLineInfo.numPreprocessorFlags, cmdLineInfo.preprocessorFlags, nullOutput, &process) &&
+							wait_for_process(&process) == 0;
+
+		UINT64 preprocessDuration = (current_system_time() - preprocessStart) / 10; // In microseconds
+
+		record_latency(monitor, HISTOGRAM_PREPROCESSOR, preprocessDuration);
+
+		end_span("preprocess", spanStart);
+		close_file(nullOutput);
+
+		if(preprocessed) {
 			struct CacheInfo cacheInfo;
 			WCHAR hashPath[MAX_PATH];
-			XXH64_hash_t hash = hash_file_content(cmdLineInfo.temporaryPreprocessedFile);
-			Hash64String hashStr;
 
-			lstrcpyW(hashPath, globalConfig.cachePath);
-			lstrcatW(hashPath, L"\\");
-			hash64_to_string(hash, hashStr);
-			path_from_hash64_string(hashStr, hashPath + lstrlenW(hashPath));
-			hash64_to_string(cmdLineInfo.compilerCmdLineHash, hashStr);
-			lstrcatW(hashPath, hashStr);
+			spanStart = begin_span();
 
-			LPWSTR hashPathEnd = hashPath + lstrlenW(hashPath);
+			struct CacheKey key = {hash_file_content(cmdLineInfo.temporaryPreprocessedFile), cmdLineInfo.compilerCmdLineHash};
 
-			lstrcpyW(hashPathEnd, L"\\obj");
+			end_span("hash preprocessed source", spanStart);
 
-			if(file_exists(hashPath)) {
-				WaitForSingleObject(cacheInfoMutex, INFINITE);
-				cache_info(&cacheInfo, FALSE);
-				++cacheInfo.numCacheHits;
-				cache_info(&cacheInfo, TRUE);
-				ReleaseMutex(cacheInfoMutex);
-				CopyFileW(hashPath, cmdLineInfo.objectFile, FALSE);
+			struct HistoryRecord historyRecord = {
+				current_system_time(),
+				XXH64(cmdLineInfo.objectFile, wcslen(cmdLineInfo.objectFile) * sizeof(WCHAR), 0),
+				key
+			};
 
-				if(cmdLineInfo.pdbFile) {
-					lstrcpyW(hashPathEnd, L"\\pdb");
+			entry_directory(globalConfig.cachePath, &key, hashPath);
 
-					if(file_exists(hashPath))
-						CopyFileW(hashPath, cmdLineInfo.pdbFile, FALSE);
-					else
-						wprintf(L"Cached pdb file not found for '%s', at '%s'\n", cmdLineInfo.sourceFile, hashPath); // This should never happen unless somebody deletes it on purpose
+			LPWSTR hashPathEnd = hashPath + wcslen(hashPath);
+			WCHAR namespaceName[NAMESPACE_NAME_LENGTH];
+			INT64 additionalHashSize = 0; // Of the entry if it is compiled
+			struct CompileLease lease;
+			enum CompileLeaseResult leaseResult = COMPILE_LEASE_FAILED;
+			BOOL servedFromCache;
+
+			current_namespace(namespaceName);
+			spanStart = begin_span();
+
+			// Only one process compiles a missing entry, the others wait for it and then use its result
+			while(!(servedFromCache = copy_from_cache(hashPath, hashPathEnd, &cmdLineInfo, &exitCode))) {
+				if(!make_path(hashPath))
+					break;
+
+				wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"lease");
+				leaseResult = acquire_compile_lease(hashPath, &lease);
+				*hashPathEnd = L'\0';
+
+				if(leaseResult != COMPILE_LEASE_RELEASED)
+					break;
+			}
+
+			end_span("local lookup", spanStart);
+
+			// The slower tiers are only asked by the process that would otherwise compile the entry
+			if(!servedFromCache && globalConfig.bundlePath[0] != L'\0') {
+				spanStart = begin_span();
+				servedFromCache = copy_from_bundle(&key, &cmdLineInfo);
+				end_span("bundle lookup", spanStart);
+			}
+
+			if(!servedFromCache && has_shared_tier()) {
+				spanStart = begin_span();
+				servedFromCache = copy_from_shared_tier(&key, &cmdLineInfo, &exitCode);
+				end_span("shared tier lookup", spanStart);
+			}
+
+			if(!servedFromCache && has_remote()) {
+				spanStart = begin_span();
+
+				if(fetch_from_remote(&key) && (servedFromCache = copy_from_cache(hashPath, hashPathEnd, &cmdLineInfo, &exitCode))) {
+					FileHandle cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+
+					++cacheInfo.numRemoteHits;
+					unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
 				}
-			} else {
-				make_cmd_line((int)cmdLineInfo.numCompilerFlags, cmdLineInfo.compilerFlags, cmdLineBuffer);
 
-				*hashPathEnd = L'\0'; // Stripping '\obj' since it is a file and not part of the path
+				end_span("remote lookup", spanStart);
+			}
+
+			result = servedFromCache ? "hit" : "miss";
+			eventKind = servedFromCache ? MONITOR_HIT : MONITOR_MISS;
+
+			UINT64 accessSize = 0; // Of the entry, whether it is stored or not, for the access log
+
+			if(!servedFromCache) {
+				// The compiler output is captured so that it can be cached in case the compilation fails
+				FileHandle outputFile = create_output_capture_file();
+
+				UINT64 compileStart = current_tick_count();
+
+				struct MonitorCompile* monitorCompile = monitor_compile_started(monitor, cmdLineInfo.sourceFile);
+
+				spanStart = begin_span();
+
+				if(make_path(hashPath) && launch_process((int)cmdLineInfo.numCompilerFlags, cmdLineInfo.compilerFlags, outputFile, &process)) {
+					exitCode = (int)wait_for_process(&process);
+					end_span("compile", spanStart);
+					spanStart = begin_span();
+
+					UINT64 compileDuration = current_tick_count() - compileStart;
+					UINT64 entrySize = 0;
+					UINT64 bytesWritten = 0;
+					BOOL admitted = TRUE;
+
+					SIZE_T outputSize = 0;
+					LPVOID output = outputFile != INVALID_FILE_HANDLE ? read_captured_output(outputFile, &outputSize) : NULL;
+
+					write_to_console(output, outputSize, cmdLineInfo.diagnosticsOnStderr);
+					wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"fail");
+
+					if(exitCode == 0) {
+						if(file_exists(hashPath)) { // Removing an expired failure in case the compilation succeeds now
+							additionalHashSize -= file_size(hashPath);
+							delete_file(hashPath);
+						}
+
+						entrySize = file_size(cmdLineInfo.objectFile) + (cmdLineInfo.pdbFile ? file_size(cmdLineInfo.pdbFile) : 0) +
+									(cmdLineInfo.dependencyFile ? file_size(cmdLineInfo.dependencyFile) : 0);
+
+						admitted = admit_entry(&key, compileDuration, entrySize);
+					} else {
+						entrySize = sizeof(struct CompileFailureHeader) + outputSize; // What store_compile_failure writes
+					}
+
+					accessSize = entrySize;
+
+					if(exitCode == 0 && admitted) {
+						// The pdb is published first since other processes only look for it once the object file exists
+						if(cmdLineInfo.pdbFile) {
+							wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"pdb");
+							publish_file(cmdLineInfo.pdbFile, hashPath);
+
+							additionalHashSize += file_size(hashPath);
+						}
+
+						if(cmdLineInfo.dependencyFile) {
+							wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"dep");
+							publish_file(cmdLineInfo.dependencyFile, hashPath);
+
+							additionalHashSize += file_size(hashPath);
+						}
+
+						if(globalConfig.keepKeyInputs) {
+							wcscpy(hashPathEnd, PATH_SEPARATOR_STRING KEY_INPUTS_FILE_NAME);
+
+							if(store_key_inputs(hashPath, &cmdLineInfo, generation, key.contentHash)) {
+								additionalHashSize += file_size(hashPath);
+								*hashPathEnd = L'\0';
+								record_header_churn(&cmdLineInfo, hashPath, compileDuration);
+							}
+						}
+
+						struct EntryMetadata metadata = {compileDuration, entrySize, generation, namespace_id(namespaceName)};
+
+						wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"meta");
+
+						if(publish_data(hashPath, &metadata, sizeof(metadata)))
+							additionalHashSize += sizeof(metadata);
+
+						wcscpy(hashPathEnd, PATH_SEPARATOR_STRING L"obj");
+
+						BOOL published = publish_file(cmdLineInfo.objectFile, hashPath);
+
+						additionalHashSize += file_size(hashPath);
+						bytesWritten = entrySize + sizeof(metadata);
+						*hashPathEnd = L'\0';
+
+						if(published) {
+							toggle_merkle_leaf(globalConfig.cachePath, &key);
+							write_to_shared_tier(&historyRecord);
+							queue_upload(&key, hashPath);
+						}
+					} else if(exitCode != 0 && outputFile != INVALID_FILE_HANDLE && globalConfig.negativeCacheTtl > 0) {
+						additionalHashSize -= file_size(hashPath); // An expired failure is overwritten
+
+						if(store_compile_failure(hashPath, exitCode, compile_failure_context(&cmdLineInfo), output, outputSize)) {
+							bytesWritten = file_size(hashPath);
+							additionalHashSize += bytesWritten;
+						}
+					}
+
+					free(output);
+
+					FileHandle cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+
+					++cacheInfo.numCacheMisses;
+					cacheInfo.numNotAdmitted += !admitted;
+					cacheInfo.currentCacheSize += additionalHashSize;
+					cacheInfo.compileTime += compileDuration;
+					cacheInfo.bytesWritten += bytesWritten;
+					sessionInvocation.compileTime = compileDuration;
+					sessionInvocation.bytesWritten = bytesWritten;
+					bytesMoved = bytesWritten;
+					unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
+
+					if(cacheInfo.currentCacheSize > globalConfig.maxCacheSize)
+						start_background_worker(); // Evicts entries
+
+					end_span("store", spanStart);
+				}
+
+				monitor_compile_finished(monitorCompile);
+
+				if(outputFile != INVALID_FILE_HANDLE)
+					close_file(outputFile);
+			}
+
+			if(leaseResult == COMPILE_LEASE_ACQUIRED)
+				release_compile_lease(&lease);
+
+			spanStart = begin_span();
+
+			FileHandle cacheInfoLock = lock_cache_info(globalConfig.cachePath, &cacheInfo);
+
+			cacheInfo.preprocessorTime += preprocessDuration / 1000;
+			sessionInvocation.preprocessorTime = preprocessDuration / 1000;
 
-				if(make_path(hashPath) && launch_process(argv[1], cmdLineBuffer, &processInfo, FALSE)) {
-					exitCode = wait_for_process(&processInfo);
+			if(servedFromCache && exitCode == 0) {
+				UINT64 savedTime = entry_compile_time(hashPath);
 
-					if(exitCode == 0) {
-						UINT64 additionalHashSize = 0;
+				if(savedTime == 0 && has_shared_tier()) {
+					WCHAR sharedDir[MAX_PATH];
 
-						lstrcpyW(hashPathEnd, L"\\obj");
-						CopyFileW(cmdLineInfo.objectFile, hashPath, FALSE);
+					entry_directory(globalConfig.sharedCachePath, &key, sharedDir);
+					savedTime = entry_compile_time(sharedDir);
+				}
 
-						additionalHashSize += file_size(hashPath);
+				bytesMoved = file_size(cmdLineInfo.objectFile) + (cmdLineInfo.pdbFile ? file_size(cmdLineInfo.pdbFile) : 0) +
+							 (cmdLineInfo.dependencyFile ? file_size(cmdLineInfo.dependencyFile) : 0);
+				cacheInfo.compileTimeSaved += savedTime;
+				cacheInfo.bytesRead += bytesMoved;
+				sessionInvocation.compileTimeSaved = savedTime;
+				sessionInvocation.bytesRead = bytesMoved;
+				accessSize = bytesMoved;
+			}
 
-						if(cmdLineInfo.pdbFile) {
-							lstrcpyW(hashPathEnd, L"\\pdb");
-							CopyFileW(cmdLineInfo.pdbFile, hashPath, FALSE);
+			unlock_cache_info(globalConfig.cachePath, cacheInfoLock, &cacheInfo);
 
-							additionalHashSize += file_size(hashPath);
-						}
+			struct Namespace ns;
+			UINT64 namespaceOffset;
+			FileHandle namespaceLock = lock_namespace(globalConfig.cachePath, namespaceName, &ns, &namespaceOffset);
 
-						WaitForSingleObject(cacheInfoMutex, INFINITE);
-						cache_info(&cacheInfo, FALSE);
-						++cacheInfo.numCacheMisses;
-						cacheInfo.currentCacheSize += additionalHashSize;
-						cache_info(&cacheInfo, TRUE);
-						ReleaseMutex(cacheInfoMutex);
-					}
-				}
+			if(servedFromCache) {
+				++ns.numHits;
+			} else {
+				++ns.numMisses;
+				ns.size = additionalHashSize > 0 || ns.size > (UINT64)-additionalHashSize ? ns.size + additionalHashSize : 0;
 			}
 
-			DeleteFileW(cmdLineInfo.temporaryPreprocessedFile);
-			CloseHandle(cacheInfoMutex);
-		} else {
-			exitCode = EXIT_FAILURE;
-		}
+			unlock_namespace(namespaceLock, &ns, namespaceOffset);
 
-		_freea(cmdLineBuffer);
-	} else {
-		int cmdLineLen = (argc - 1) * 3; // Enough for surrounding quotes and separating space
+			if(ns.quota > 0 && ns.size > ns.quota)
+				start_background_worker(); // Evicts entries of this namespace
 
-		for(int i = 1; i < argc; ++i)
-			cmdLineLen += lstrlenW(argv[i]);
+			append_history(globalConfig.cachePath, &historyRecord);
 
-		LPWSTR cmdLine = _malloca(cmdLineLen * sizeof(WCHAR));
+			if(globalConfig.accessLogSize > 0)
+				append_access_record(&key, accessSize, servedFromCache ? sessionInvocation.compileTimeSaved : sessionInvocation.compileTime);
 
-		make_cmd_line(argc - 1, argv + 1, cmdLine);
+			end_span("record statistics", spanStart);
+		} else {
+			result = "preprocessing failed";
+			reject_command_line(&cmdLineInfo, UNCACHEABLE_PREPROCESSOR_FAILED);
+			count_uncacheable(UNCACHEABLE_PREPROCESSOR_FAILED);
+
+			// The output of the preprocessor is discarded so the compiler runs again to show the user what went wrong
+			spanStart = begin_span();
+			exitCode = launch_process(argc - 1, (LPCWSTR*)argv + 1, INVALID_FILE_HANDLE, &process) ? (int)wait_for_process(&process) : EXIT_FAILURE;
+			end_span("compile", spanStart);
+		}
 
-		exitCode = launch_process(argv[1], cmdLine, &processInfo, FALSE) ? wait_for_process(&processInfo) : EXIT_FAILURE;
+		delete_file(cmdLineInfo.temporaryPreprocessedFile);
+	} else {
+		if(cmdLineInfo.temporaryPreprocessedFile)
+			delete_file(cmdLineInfo.temporaryPreprocessedFile);
 
-		_freea(cmdLine);
+		spanStart = begin_span();
+		exitCode = launch_process(argc - 1, (LPCWSTR*)argv + 1, INVALID_FILE_HANDLE, &process) ? (int)wait_for_process(&process) : EXIT_FAILURE;
+		end_span("compile", spanStart);
+		count_uncacheable(cmdLineInfo.uncacheableReason);
 	}
 
+	finish_trace(invocationStart, cmdLineInfo.sourceFile, result);
+	record_event(monitor, eventKind, startTime, bytesMoved, cmdLineInfo.sourceFile);
+	unmap_file(monitorMapping);
+	add_to_session(&sessionInvocation, eventKind, cmdLineInfo.uncacheableReason, startTime);
+
 	return exitCode;
 }
 
 void print_help() {
 	wprintf(L"Usage:\n"
-			L"    lelcache.exe <path_to_cl.exe> <cl_args>"
+			L"    lelcache <path_to_compiler> <compiler_args>\n"
 			L"  or\n"
-			L"    lelcache.exe <options>\n"
+			L"    lelcache <options>\n"
+			L"\n"
+			L"Supported compilers are cl.exe, clang-cl, gcc and clang. Linkers (link.exe, lld-link) are forwarded without caching.\n"
 			L"\n"
 			L"Available options:\n"
 			L" -h      show this help\n"
-			L" -i      show info\n"
+			L" -i      show info ('-i json' prints it as JSON)\n"
 			L" -m<n>   set maximum cache size to n megabytes\n"
-			L" -p<dir> set cache path to <dir>\\.lelcache\n");
+			L" -n<n>   cache failed compilations for n seconds (0 disables caching them)\n"
+			L" -p<dir> set cache path to <dir>" PATH_SEPARATOR_STRING L".lelcache\n"
+			L" -r<url> use the HTTP server at <url> as a remote cache ('-r-' disables it)\n"
+			L" -s<dir> use <dir>" PATH_SEPARATOR_STRING L".lelcache as a shared tier that is checked after the local cache ('-s-' disables it)\n"
+			L" -S<n>   set maximum size of the shared tier to n megabytes\n"
+			L" -w<p>   set how new entries are written to the shared tier: 'back' (in the background), 'through' or 'none'\n"
+			L" -a<n>   only store a compilation once it missed n times recently (default: 1, at most %d)\n"
+			L" -t<n>   don't store compilations that take less than n milliseconds\n"
+			L" -z<n>   don't store compilations with more than n kilobytes of output (0 means no limit)\n"
+			L" -k<n>   record the inputs of the key of new entries for 'lelcache explain' (1) or don't (0)\n"
+			L" -l<n>   record every invocation in an access log of at most n megabytes for 'lelcache simulate' (0 disables it)\n"
+			L" -q<ns>=<n> limit the entries of namespace <ns> to n megabytes (0 removes the limit)\n"
+			L"\n"
+			L"    lelcache explain <path_to_compiler> <compiler_args>\n"
+			L"\n"
+			L"computes the key of a compilation without compiling it and shows what changed since the most recent entry for the\n"
+			L"same object file: compiler flags, the compiler, the profile, the source file or, for entries compiled with -MD,\n"
+			L"the headers. This needs -k1 to have been set when the entry was stored.\n"
+			L"\n"
+			L"    lelcache report [<days>]\n"
+			L"\n"
+			L"ranks the headers by the compile time of the misses their changes caused in the last <days> (default: 30), for the\n"
+			L"whole team if there is a shared tier. Changed headers are recorded for compilations with -k1 and -MD.\n"
+			L"\n"
+			L"    lelcache simulate [<megabytes>...]\n"
+			L"\n"
+			L"replays the access log recorded with -l against the eviction policies LRU, FIFO, LFU, GDS (GreedyDual-Size, what\n"
+			L"lelcache uses) and GDSF (GDS weighted by frequency) and prints the miss ratio and the compile time saved for\n"
+			L"caches of <megabytes> each, by default from 1/1024 of the working set up to all of it and the current limit.\n"
+			L"Large logs are sampled by key.\n"
+			L"\n"
+			L"    lelcache top [<seconds>]\n"
+			L"\n"
+			L"shows hits and misses per second, latencies, the running compilations and the most recent invocations of all\n"
+			L"processes using the local cache, refreshed every <seconds> (default: 1) until it is interrupted.\n"
+			L"\n"
+			L"    lelcache metrics\n"
+			L"    lelcache metrics --textfile <file> [<seconds>]\n"
+			L"    lelcache metrics --serve [[<address>:]<port>]\n"
+			L"\n"
+			L"prints the statistics, sizes and latency histograms of the cache in the OpenMetrics format. --textfile replaces\n"
+			L"<file> with them for the textfile collector of node_exporter, every <seconds> if given. --serve answers\n"
+			L"Prometheus at http://<address>:<port>/metrics, by default only on 127.0.0.1 and port %d.\n"
+			L"\n"
+			L"    lelcache namespaces\n"
+			L"\n"
+			L"lists the size, quota and hit rate of every namespace. Compilations belong to the namespace named by the\n"
+			L"LELCACHE_NAMESPACE environment variable, or else by the first line of a '.lelcache-namespace' file in the current\n"
+			L"directory or one of its parents, or to the namespace 'default'. When the cache is full, entries are evicted from the\n"
+			L"namespace that uses the most space relative to its quota or, without one, its share of the rest of the cache.\n"
+			L"\n"
+			L"    lelcache prefetch [<hours>]\n"
+			L"\n"
+			L"copies the entries of all targets built in the last <hours> (default: one week) that are missing from the local\n"
+			L"cache from the shared tier or the remote, e.g. right before building changes somebody else has built already.\n"
+			L"\n"
+			L"    lelcache --export <file> [<megabytes> [<hours>]]\n"
+			L"    lelcache --import <file>\n"
+			L"    lelcache --mount <file>\n"
+			L"\n"
+			L"--export writes the most recently used entries to a compressed bundle, at most <megabytes> of them and only those\n"
+			L"used in the last <hours> (0 means no limit). --import adds the entries of a bundle to the local cache and --mount\n"
+			L"uses a bundle as a read-only tier without unpacking it ('--mount -' unmounts it).\n"
+			L"\n"
+			L"    lelcache sync <dir> [<megabytes>]\n"
+			L"    lelcache sync --command <program> [<args>...]\n"
+			L"\n"
+			L"copies the entries missing from either cache between the local cache and <dir>" PATH_SEPARATOR_STRING L".lelcache, which may hold at\n"
+			L"most <megabytes> (default: the limit of the local cache), or the cache of a 'lelcache sync --serve' started by\n"
+			L"<program>, e.g. 'lelcache sync --command ssh host lelcache sync --serve'. Entries that would exceed a cache's limit\n"
+			L"are skipped.\n"
+			L"\n"
+			L"    lelcache generations\n"
+			L"    lelcache --retire <id>\n"
+			L"    lelcache --new-epoch\n"
+			L"\n"
+			L"entries are grouped into generations by the compiler that produced them and the epoch of the cache. 'generations'\n"
+			L"lists them, --retire drops the entries of one of them and --new-epoch those of all current ones. The entries are\n"
+			L"deleted in the background, the compiler of a retired generation is not cached until that has finished.\n"
+			L"\n"
+			L"    lelcache --session-begin <id>\n"
+			L"    lelcache --session-end [<file>]\n"
+			L"\n"
+			L"--session-begin starts a session, e.g. for a CI job, that collects the hits, misses, uncacheable invocations and\n"
+			L"durations of all following invocations. --session-end prints them and writes them as JSON to <file> (default:\n"
+			L"'<id>.json' in the 'sessions' directory of the cache). Invocations and --session-end use the session named by\n"
+			L"the LELCACHE_SESSION environment variable if it is set, which also starts it implicitly.\n"
+			L"\n"
+			L"    lelcache --publish-summary <dir>\n"
+			L"\n"
+			L"writes a summary of the cache entries in <dir> that clients use to skip requests for entries that aren't there.\n"
+			L"Run it periodically in the directory an HTTP server stores the remote cache in. Summaries of the shared tier are\n"
+			L"published automatically.\n"
+			L"\n"
+			L"If the LELCACHE_TRACE environment variable is set to a file path, every invocation appends how long each of its\n"
+			L"phases took to that file in the Chrome trace event format, which can be opened in Perfetto or chrome://tracing.\n",
+			SKETCH_MAX_COUNT,
+			METRICS_DEFAULT_PORT);
 }
 
-int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
-	UNREFERENCED_PARAMETER(envp);
+/*
+ * Prints the statistics of the local cache as a JSON object so that scripts can evaluate them.
+ */
+void print_cache_info_json(const struct CacheInfo* info) {
+	char json[4096 + MAX_PATH * 4];
+	char cachePath[MAX_PATH * 4 + 3];
+	int length = 0;
+	UINT32 numUncacheable = 0;
+
+	json_string(globalConfig.cachePath, cachePath, sizeof(cachePath));
+
+	for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r)
+		numUncacheable += info->numUncacheable[r];
+
+	length += snprintf(json + length, sizeof(json) - length,
+					   "{\n"
+					   "  \"cache_hits\": %u,\n"
+					   "  \"cached_failures\": %u,\n"
+					   "  \"cache_misses\": %u,\n"
+					   "  \"remote_hits\": %u,\n"
+					   "  \"shared_tier_hits\": %u,\n"
+					   "  \"bundle_hits\": %u,\n"
+					   "  \"not_admitted\": %u,\n"
+					   "  \"uncacheable\": %u,\n"
+					   "  \"uncacheable_reasons\": {",
+					   info->numCacheHits,
+					   info->numNegativeCacheHits,
+					   info->numCacheMisses,
+					   info->numRemoteHits,
+					   info->numSharedHits,
+					   info->numBundleHits,
+					   info->numNotAdmitted,
+					   numUncacheable);
+
+	for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r)
+		length += snprintf(json + length, sizeof(json) - length, "%s\n    \"%s\": %u", r > 0 ? "," : "", uncacheableReasonNames[r].key, info->numUncacheable[r]);
+
+	length += snprintf(json + length, sizeof(json) - length,
+					   "\n  },\n"
+					   "  \"compile_time_saved_ms\": %llu,\n"
+					   "  \"compile_time_ms\": %llu,\n"
+					   "  \"preprocessor_time_ms\": %llu,\n"
+					   "  \"bytes_read\": %llu,\n"
+					   "  \"bytes_written\": %llu,\n"
+					   "  \"evictions\": %llu,\n"
+					   "  \"evicted_bytes\": %llu,\n"
+					   "  \"current_cache_size\": %llu,\n"
+					   "  \"maximum_cache_size\": %llu,\n"
+					   "  \"cache_location\": %s\n"
+					   "}\n",
+					   (unsigned long long)info->compileTimeSaved,
+					   (unsigned long long)info->compileTime,
+					   (unsigned long long)info->preprocessorTime,
+					   (unsigned long long)info->bytesRead,
+					   (unsigned long long)info->bytesWritten,
+					   (unsigned long long)info->numEvictions,
+					   (unsigned long long)info->evictedSize,
+					   (unsigned long long)info->currentCacheSize,
+					   (unsigned long long)globalConfig.maxCacheSize,
+					   cachePath);
+
+	fflush(stdout);
+	write_to_console(json, length, FALSE);
+}
 
+int run_lelcache(int argc, LPWSTR* argv) {
 	if(argc <= 1) {
 		print_help();
 
@@ -677,10 +7822,89 @@ int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
 	if(!cache_config(&globalConfig, FALSE))
 		return EXIT_FAILURE;
 
+	if(wcscmp(argv[1], L"--background-worker") == 0) // Started by start_background_worker
+		return run_background_worker();
+
+	if(wcscmp(argv[1], L"prefetch") == 0)
+		return run_prefetch(argc, argv);
+
+	if(wcscmp(argv[1], L"--export") == 0)
+		return run_export(argc, argv);
+
+	if(wcscmp(argv[1], L"--import") == 0)
+		return run_import(argc, argv);
+
+	if(wcscmp(argv[1], L"--mount") == 0) {
+		if(argc != 3) {
+			wprintf(L"--mount expects a file name or '-' as an argument\n");
+
+			return EXIT_FAILURE;
+		}
+
+		if(wcscmp(argv[2], L"-") == 0) {
+			globalConfig.bundlePath[0] = L'\0';
+			wprintf(L"Bundle unmounted\n");
+		} else if(full_path(argv[2], globalConfig.bundlePath) && file_exists(globalConfig.bundlePath)) {
+			wprintf(L"Bundle '%ls' mounted\n", globalConfig.bundlePath);
+		} else {
+			wprintf(L"Invalid path '%ls'\n", argv[2]);
+
+			return EXIT_FAILURE;
+		}
+
+		return cache_config(&globalConfig, TRUE) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if(wcscmp(argv[1], L"sync") == 0)
+		return run_sync(argc, argv);
+
+	if(wcscmp(argv[1], L"namespaces") == 0)
+		return run_namespaces();
+
+	if(wcscmp(argv[1], L"top") == 0)
+		return run_top(argc, argv);
+
+	if(wcscmp(argv[1], L"metrics") == 0)
+		return run_metrics(argc, argv);
+
+	if(wcscmp(argv[1], L"explain") == 0)
+		return run_explain(argc, argv);
+
+	if(wcscmp(argv[1], L"report") == 0)
+		return run_report(argc, argv);
+
+	if(wcscmp(argv[1], L"simulate") == 0)
+		return run_simulate(argc, argv);
+
+	if(wcscmp(argv[1], L"generations") == 0 || wcscmp(argv[1], L"--retire") == 0 || wcscmp(argv[1], L"--new-epoch") == 0)
+		return run_generations(argc, argv);
+
+	if(wcscmp(argv[1], L"--session-begin") == 0)
+		return run_session_begin(argc, argv);
+
+	if(wcscmp(argv[1], L"--session-end") == 0)
+		return run_session_end(argc, argv);
+
+	if(wcscmp(argv[1], L"--publish-summary") == 0) {
+		if(argc != 3) {
+			wprintf(L"--publish-summary expects a directory as an argument\n");
+
+			return EXIT_FAILURE;
+		}
+
+		if(!publish_summary(argv[2])) {
+			wprintf(L"Unable to publish the summary of '%ls'\n", argv[2]);
+
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	if(*argv[1] == L'-') {
 		for(int i = 1; i < argc; ++i) {
 			if(*argv[i] != L'-') {
-				wprintf(L"Unknown option '%s'\n", argv[i]);
+				wprintf(L"Unknown option '%ls'\n", argv[i]);
 
 				return EXIT_FAILURE;
 			}
@@ -693,19 +7917,86 @@ int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
 				print_help();
 				break;
 			case L'i':
-				if(cache_info(&info, FALSE)) {
-					wprintf(L"cache hits:         %lu\n"
-							L"cache misses:       %lu\n"
+				if(wcscmp(arg + 1, L"json") == 0 || (arg[1] == L'\0' && i + 1 < argc && wcscmp(argv[i + 1], L"json") == 0)) {
+					i += arg[1] == L'\0';
+
+					if(!cache_info(globalConfig.cachePath, &info, FALSE))
+						return EXIT_FAILURE;
+
+					print_cache_info_json(&info);
+				} else if(cache_info(globalConfig.cachePath, &info, FALSE)) {
+					wprintf(L"cache hits:         %u\n"
+							L"cached failures:    %u\n"
+							L"cache misses:       %u\n"
+							L"remote hits:        %u\n"
+							L"shared tier hits:   %u\n"
+							L"bundle hits:        %u\n"
+							L"not admitted:       %u\n"
 							L"cache hit rate:     %.2f%%\n"
 							L"current cache size: %llu MB\n"
 							L"maximum cache size: %llu MB\n"
-							L"cache location:     %s\n",
+							L"cache location:     %ls\n",
 							info.numCacheHits,
+							info.numNegativeCacheHits,
 							info.numCacheMisses,
+							info.numRemoteHits,
+							info.numSharedHits,
+							info.numBundleHits,
+							info.numNotAdmitted,
 							info.numCacheHits / ((double)info.numCacheHits + info.numCacheMisses) * 100.0,
-							info.currentCacheSize / (1024ll * 1024ll),
-							globalConfig.maxCacheSize / (1024ll * 1024ll),
+							(unsigned long long)(info.currentCacheSize / (1024ll * 1024ll)),
+							(unsigned long long)(globalConfig.maxCacheSize / (1024ll * 1024ll)),
 							globalConfig.cachePath);
+
+					struct CacheInfo sharedInfo;
+
+					if(has_shared_tier() && cache_info(globalConfig.sharedCachePath, &sharedInfo, FALSE)) {
+						wprintf(L"shared tier size:   %llu MB\n"
+								L"maximum tier size:  %llu MB\n"
+								L"shared tier:        %ls (write %ls)\n",
+								(unsigned long long)(sharedInfo.currentCacheSize / (1024ll * 1024ll)),
+								(unsigned long long)(globalConfig.maxSharedCacheSize / (1024ll * 1024ll)),
+								globalConfig.sharedCachePath,
+								sharedWritePolicyNames[globalConfig.sharedWritePolicy]);
+					}
+
+					if(globalConfig.bundlePath[0] != L'\0')
+						wprintf(L"mounted bundle:     %ls\n", globalConfig.bundlePath);
+
+					if(globalConfig.minAdmissionFrequency > 1 || globalConfig.minAdmissionTime > 0 || globalConfig.maxAdmissionSize > 0) {
+						wprintf(L"admission:          after %u misses, at least %u ms", globalConfig.minAdmissionFrequency, globalConfig.minAdmissionTime);
+
+						if(globalConfig.maxAdmissionSize > 0)
+							wprintf(L", at most %llu KB of output", (unsigned long long)(globalConfig.maxAdmissionSize / 1024));
+
+						wprintf(L"\n");
+					}
+
+					UINT32 numUncacheable = 0;
+
+					for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r)
+						numUncacheable += info.numUncacheable[r];
+
+					wprintf(L"uncacheable:        %u\n", numUncacheable);
+
+					for(int r = 0; r < NUM_UNCACHEABLE_REASONS; ++r) {
+						if(info.numUncacheable[r] > 0)
+							wprintf(L"  %-24ls%u\n", uncacheableReasonNames[r].description, info.numUncacheable[r]);
+					}
+
+					wprintf(L"compile time saved: %.1f s\n"
+							L"compile time:       %.1f s\n"
+							L"preprocessor time:  %.1f s\n"
+							L"read from cache:    %.1f MB\n"
+							L"written to cache:   %.1f MB\n"
+							L"evicted:            %llu entries, %.1f MB\n",
+							info.compileTimeSaved / 1000.0,
+							info.compileTime / 1000.0,
+							info.preprocessorTime / 1000.0,
+							info.bytesRead / (1024.0 * 1024.0),
+							info.bytesWritten / (1024.0 * 1024.0),
+							(unsigned long long)info.numEvictions,
+							info.evictedSize / (1024.0 * 1024.0));
 				}
 
 				break;
@@ -726,9 +8017,10 @@ int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
 					UINT64 newCacheSize = (UINT64)wcstoull(arg, NULL, 0);
 
 					if(newCacheSize >= 32) { // Arbitrary number but such small values don't make sense anyway...
-						globalConfig.maxCacheSize = newCacheSize * 1024ll * 1024ll; // TODO: Clean up the cache if necessary
+						globalConfig.maxCacheSize = newCacheSize * 1024ll * 1024ll;
 						cache_config(&globalConfig, TRUE);
-						wprintf(L"Maximum cache size set to %lli MB\n", newCacheSize);
+						start_background_worker(); // Evicts entries if the cache is larger than the new limit
+						wprintf(L"Maximum cache size set to %llu MB\n", (unsigned long long)newCacheSize);
 					} else {
 						wprintf(L"Cache size must be at least 32 megabytes\n");
 
@@ -736,6 +8028,47 @@ int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
 					}
 				}
 
+				break;
+			case L'n':
+				{
+					++arg;
+
+					if(*arg == L'\0') {
+						if(i != argc - 1) {
+							arg = argv[++i];
+						} else {
+							wprintf(L"The -n option expects a number in seconds\n");
+
+							return EXIT_FAILURE;
+						}
+					}
+
+					globalConfig.negativeCacheTtl = (UINT32)wcstoul(arg, NULL, 0);
+					cache_config(&globalConfig, TRUE);
+
+					if(globalConfig.negativeCacheTtl > 0)
+						wprintf(L"Failed compilations are cached for %u seconds\n", globalConfig.negativeCacheTtl);
+					else
+						wprintf(L"Failed compilations are not cached\n");
+				}
+
+				break;
+			case L'q':
+				++arg;
+
+				if(*arg == L'\0') {
+					if(i != argc - 1) {
+						arg = argv[++i];
+					} else {
+						wprintf(L"The -q option expects '<namespace>=<megabytes>'\n");
+
+						return EXIT_FAILURE;
+					}
+				}
+
+				if(!set_namespace_quota(arg))
+					return EXIT_FAILURE;
+
 				break;
 			case L'p':
 				{
@@ -751,29 +8084,214 @@ int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
 						}
 					}
 
-					WCHAR buffer[MAX_PATH];
+					if(!cache_path_from_argument(arg, globalConfig.cachePath))
+						return EXIT_FAILURE;
+
+					cache_config(&globalConfig, TRUE);
+					wprintf(L"Cache path set to '%ls'\n", globalConfig.cachePath);
+				}
+
+				break;
+			case L's':
+				{
+					++arg;
+
+					if(*arg == L'\0') {
+						if(i != argc - 1) {
+							arg = argv[++i];
+						} else {
+							wprintf(L"The -s option expects a path as an argument\n");
+
+							return EXIT_FAILURE;
+						}
+					}
+
+					if(wcscmp(arg, L"-") == 0) {
+						globalConfig.sharedCachePath[0] = L'\0';
+						cache_config(&globalConfig, TRUE);
+						wprintf(L"Shared tier disabled\n");
+
+						break;
+					}
+
+					if(!cache_path_from_argument(arg, globalConfig.sharedCachePath))
+						return EXIT_FAILURE;
+
+					if(!make_path(globalConfig.sharedCachePath)) {
+						wprintf(L"Unable to create directory '%ls'\n", globalConfig.sharedCachePath);
+
+						return EXIT_FAILURE;
+					}
+
+					cache_config(&globalConfig, TRUE);
+					wprintf(L"Shared tier set to '%ls'\n", globalConfig.sharedCachePath);
+				}
+
+				break;
+			case L'S':
+				{
+					++arg;
+
+					if(*arg == L'\0') {
+						if(i != argc - 1) {
+							arg = argv[++i];
+						} else {
+							wprintf(L"The -S option expects a number in megabytes\n");
+
+							return EXIT_FAILURE;
+						}
+					}
+
+					UINT64 newCacheSize = (UINT64)wcstoull(arg, NULL, 0);
+
+					if(newCacheSize >= 32) {
+						globalConfig.maxSharedCacheSize = newCacheSize * 1024ll * 1024ll;
+						cache_config(&globalConfig, TRUE);
+						start_background_worker();
+						wprintf(L"Maximum shared tier size set to %llu MB\n", (unsigned long long)newCacheSize);
+					} else {
+						wprintf(L"Shared tier size must be at least 32 megabytes\n");
+
+						return EXIT_FAILURE;
+					}
+				}
+
+				break;
+			case L'w':
+				{
+					++arg;
+
+					if(*arg == L'\0' && i != argc - 1)
+						arg = argv[++i];
+
+					int policy = -1;
+
+					for(int j = 0; j < ARRAYSIZE(sharedWritePolicyNames); ++j) {
+						if(wcscmp(arg, sharedWritePolicyNames[j]) == 0)
+							policy = j;
+					}
+
+					if(policy == -1) {
+						wprintf(L"The -w option expects 'back', 'through' or 'none'\n");
+
+						return EXIT_FAILURE;
+					}
+
+					globalConfig.sharedWritePolicy = (UINT32)policy;
+					cache_config(&globalConfig, TRUE);
+					wprintf(L"Shared tier write policy set to '%ls'\n", sharedWritePolicyNames[policy]);
+				}
+
+				break;
+			case L'a':
+			case L'k':
+			case L'l':
+			case L't':
+			case L'z':
+				{
+					WCHAR option = *arg;
+
+					++arg;
+
+					if(*arg == L'\0') {
+						if(i != argc - 1) {
+							arg = argv[++i];
+						} else {
+							wprintf(L"The -%lc option expects a number\n", option);
+
+							return EXIT_FAILURE;
+						}
+					}
+
+					UINT64 value = (UINT64)wcstoull(arg, NULL, 0);
+
+					if(option == L'a') {
+						globalConfig.minAdmissionFrequency = value > SKETCH_MAX_COUNT ? SKETCH_MAX_COUNT : (UINT32)value;
+
+						if(globalConfig.minAdmissionFrequency > 1)
+							wprintf(L"Compilations are stored once they missed %u times\n", globalConfig.minAdmissionFrequency);
+						else
+							wprintf(L"Compilations are stored the first time they miss\n");
+					} else if(option == L'k') {
+						globalConfig.keepKeyInputs = value != 0;
+
+						if(value != 0)
+							wprintf(L"New entries record the inputs of their key for 'lelcache explain'\n");
+						else
+							wprintf(L"New entries don't record the inputs of their key\n");
+					} else if(option == L'l') {
+						globalConfig.accessLogSize = (UINT32)value;
+
+						if(value > 0)
+							wprintf(L"Invocations are recorded in an access log of at most %u MB for 'lelcache simulate'\n", globalConfig.accessLogSize);
+						else
+							wprintf(L"Invocations are not recorded in the access log\n");
+					} else if(option == L't') {
+						globalConfig.minAdmissionTime = (UINT32)value;
+
+						if(value > 0)
+							wprintf(L"Compilations faster than %u ms are not stored\n", globalConfig.minAdmissionTime);
+						else
+							wprintf(L"Compilations are stored regardless of how long they take\n");
+					} else {
+						globalConfig.maxAdmissionSize = value * 1024;
+
+						if(value > 0)
+							wprintf(L"Compilations with more than %llu KB of output are not stored\n", (unsigned long long)value);
+						else
+							wprintf(L"Compilations are stored regardless of the size of their output\n");
+					}
+
+					cache_config(&globalConfig, TRUE);
+				}
+
+				break;
+			case L'r':
+				{
+					++arg;
+
+					if(*arg == L'\0') {
+						if(i != argc - 1) {
+							arg = argv[++i];
+						} else {
+							wprintf(L"The -r option expects a URL as an argument\n");
+
+							return EXIT_FAILURE;
+						}
+					}
+
+					if(wcscmp(arg, L"-") == 0) {
+						globalConfig.remoteUrl[0] = L'\0';
+						cache_config(&globalConfig, TRUE);
+						wprintf(L"Remote cache disabled\n");
+
+						break;
+					}
 
-					while(iswspace(*arg))
-						++arg;
+					if(wcsncmp(arg, L"http://", 7) != 0 && wcsncmp(arg, L"https://", 8) != 0) {
+						wprintf(L"Invalid URL '%ls', expected 'http://' or 'https://'\n", arg);
 
-					GetFullPathNameW(arg, MAX_PATH, buffer, NULL);
+						return EXIT_FAILURE;
+					}
 
-					arg = buffer + lstrlenW(buffer);
+					if(wcslen(arg) >= ARRAYSIZE(globalConfig.remoteUrl)) {
+						wprintf(L"URL is too long\n");
 
-					while(arg != buffer && (*(arg - 1) == L'\\' || *(arg - 1) == L'/')) { // Removing trailing path separators
-						--arg;
-						*arg = L'\0';
+						return EXIT_FAILURE;
 					}
 
-					lstrcatW(buffer, L"\\.lelcache");
-					lstrcpyW(globalConfig.cachePath, buffer);
+					wcscpy(globalConfig.remoteUrl, arg);
+
+					for(SIZE_T length = wcslen(globalConfig.remoteUrl); length > 0 && globalConfig.remoteUrl[length - 1] == L'/'; --length)
+						globalConfig.remoteUrl[length - 1] = L'\0';
+
 					cache_config(&globalConfig, TRUE);
-					wprintf(L"Cache path set to '%s'\n", globalConfig.cachePath);
+					wprintf(L"Remote cache set to '%ls'\n", globalConfig.remoteUrl);
 				}
 
 				break;
 			default:
-				wprintf(L"Unknown option '%s'\n", argv[i]);
+				wprintf(L"Unknown option '%ls'\n", argv[i]);
 
 				return EXIT_FAILURE;
 			}
@@ -783,4 +8301,44 @@ int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
 	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+// bench/microbench.c includes this file to call its functions directly
+#ifndef LELCACHE_NO_MAIN
+
+#ifdef _WIN32
+
+int wmain(int argc, LPWSTR* argv, LPWSTR* envp) {
+	UNREFERENCED_PARAMETER(envp);
+
+	return run_lelcache(argc, argv);
+}
+
+#else
+
+int main(int argc, char** argv) {
+	setlocale(LC_ALL, ""); // Arguments and paths are converted using the encoding of the user's locale
+
+	LPWSTR* wideArgv = malloc((argc + 1) * sizeof(LPWSTR));
+
+	for(int i = 0; i < argc; ++i) {
+		SIZE_T length = mbstowcs(NULL, argv[i], 0);
+
+		if(length == (SIZE_T)-1) {
+			fprintf(stderr, "Argument '%s' is not valid in the current locale\n", argv[i]);
+
+			return EXIT_FAILURE;
+		}
+
+		wideArgv[i] = malloc((length + 1) * sizeof(WCHAR));
+		mbstowcs(wideArgv[i], argv[i], length + 1);
+	}
+
+	wideArgv[argc] = NULL;
+
+	return run_lelcache(argc, wideArgv);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,242 @@
+#pragma once
+
+/*
+ * Everything that depends on the operating system is implemented behind the functions declared here, see platform_win32.c
+ * and platform_posix.c. The cache itself works with wide character strings on all platforms. On POSIX systems they are
+ * converted to the multibyte encoding of the current locale whenever they are passed to the operating system.
+ */
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#define PATH_SEPARATOR L'\\'
+#define PATH_SEPARATOR_STRING L"\\"
+
+typedef HANDLE FileHandle;
+typedef PROCESS_INFORMATION ProcessHandle;
+
+#define INVALID_FILE_HANDLE INVALID_HANDLE_VALUE
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+// The cache was originally written against the Win32 API so the types it uses are provided here for other platforms
+
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef size_t SIZE_T;
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+typedef void* LPVOID;
+typedef const void* LPCVOID;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH PATH_MAX
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(*(a)))
+#define UNREFERENCED_PARAMETER(p) ((void)(p))
+#define __cdecl
+
+#define PATH_SEPARATOR L'/'
+#define PATH_SEPARATOR_STRING L"/"
+
+typedef int FileHandle;
+typedef pid_t ProcessHandle;
+
+#define INVALID_FILE_HANDLE (-1)
+
+#endif
+
+#define HOST_NAME_LENGTH 64
+
+typedef struct PlatformThread* ThreadHandle;
+typedef struct PlatformEvent* EventHandle;
+typedef struct PlatformFileMapping* FileMappingHandle;
+typedef DWORD (*ThreadFunction)(LPVOID param);
+
+/*
+ * Processes
+ */
+
+/*
+ * Starts argv[0] with the arguments argv[1] to argv[argc - 1].
+ * If outputFile is INVALID_FILE_HANDLE the process writes to the console, otherwise stdout and stderr are redirected to it.
+ */
+BOOL launch_process(int argc, LPCWSTR* argv, FileHandle outputFile, ProcessHandle* outProcess);
+DWORD wait_for_process(ProcessHandle* process); // Returns the exit code
+
+/*
+ * Starts a process whose stdin and stdout are pipes. Data written to outInput is read by the process from its stdin and
+ * what it writes to stdout can be read from outOutput. Both must be closed with close_file.
+ */
+BOOL launch_process_with_pipes(int argc, LPCWSTR* argv, FileHandle* outInput, FileHandle* outOutput, ProcessHandle* outProcess);
+
+/*
+ * Starts a process that keeps running in the background without being attached to the console or any of our handles so that
+ * build systems don't wait for it.
+ */
+BOOL launch_detached_process(int argc, LPCWSTR* argv);
+BOOL current_executable_path(LPWSTR buffer); // buffer must hold MAX_PATH characters
+DWORD current_process_id(void);
+BOOL is_local_process_dead(DWORD pid); // Returns FALSE if it is not known for sure that the process doesn't exist anymore
+void get_host_name(LPWSTR buffer, SIZE_T bufferLength);
+BOOL get_environment_variable(LPCWSTR name, LPWSTR buffer, SIZE_T bufferLength); // FALSE if it isn't set or too long
+
+/*
+ * Files
+ */
+
+enum OpenMode {
+	OPEN_FOR_READING,
+	OPEN_FOR_WRITING,  // Creates the file or truncates it if it already exists
+	OPEN_FOR_APPENDING // Creates the file if it doesn't exist yet
+};
+
+FileHandle open_file(LPCWSTR path, enum OpenMode mode);
+SIZE_T read_file(FileHandle file, LPVOID buffer, SIZE_T size); // Returns the number of bytes read
+BOOL write_file(FileHandle file, LPCVOID data, SIZE_T size);
+BOOL seek_file(FileHandle file, UINT64 offset);
+UINT64 file_handle_size(FileHandle file);
+void close_file(FileHandle file);
+
+/*
+ * Creates a file at path if there is none yet. On Windows the file is deleted automatically once it is closed, even if the
+ * process crashes. Everywhere else it needs to be deleted explicitly.
+ * outAlreadyExists is set to TRUE if creation failed because somebody else holds the file.
+ */
+FileHandle create_exclusive_file(LPCWSTR path, BOOL* outAlreadyExists);
+
+UINT64 file_size(LPCWSTR filePath);
+UINT64 file_modification_time(LPCWSTR filePath); // Same units as current_system_time, 0 if the file doesn't exist
+BOOL file_exists(LPCWSTR path);
+BOOL is_directory(LPCWSTR path);
+BOOL create_directory(LPCWSTR path); // Also succeeds if the directory already exists
+BOOL copy_file(LPCWSTR sourcePath, LPCWSTR destinationPath);
+BOOL move_file(LPCWSTR sourcePath, LPCWSTR destinationPath); // Replaces the destination if it exists
+BOOL delete_file(LPCWSTR path);
+BOOL remove_directory(LPCWSTR path); // Only succeeds if the directory is empty
+BOOL touch_file(LPCWSTR path);       // Sets the modification time to the current time
+BOOL current_directory(LPWSTR buffer);       // buffer must hold MAX_PATH characters
+BOOL full_path(LPCWSTR path, LPWSTR buffer); // buffer must hold MAX_PATH characters
+
+/*
+ * Calls callback for every entry in the directory at path except '.' and '..'. Listing stops if callback returns FALSE.
+ */
+typedef BOOL (*DirectoryCallback)(LPCWSTR name, BOOL isDirectory, LPVOID context);
+
+BOOL list_directory(LPCWSTR path, DirectoryCallback callback, LPVOID context);
+
+/*
+ * Maps the file at path into memory for reading. Returns NULL if it can't be opened or is empty.
+ * The data stays valid until unmap_file is called, even if the file is replaced in the meantime.
+ */
+FileMappingHandle map_file(LPCWSTR path, LPCVOID* outData, UINT64* outSize);
+void unmap_file(FileMappingHandle mapping);
+
+/*
+ * Maps the first size bytes of the file at path into memory for reading and writing. The file is created or grown with
+ * zeros if necessary. Every process that maps the same file sees the changes of the others immediately.
+ * Must be unmapped with unmap_file.
+ */
+FileMappingHandle map_shared_memory(LPCWSTR path, SIZE_T size, LPVOID* outData);
+
+/*
+ * Finds the executable that would be started for name, searching the PATH if name doesn't contain a directory.
+ */
+BOOL find_executable(LPCWSTR name, LPWSTR outPath);
+
+/*
+ * Creates an empty file with a unique name starting with prefix in directory and stores its path in outPath.
+ */
+BOOL create_temporary_file(LPCWSTR directory, LPCWSTR prefix, LPWSTR outPath);
+
+/*
+ * Opens a file that child processes can write their output to. It is deleted automatically once it is closed.
+ */
+FileHandle create_output_capture_file(void);
+FileHandle open_null_output(void);
+FileHandle standard_input(void);
+
+/*
+ * Returns a handle to the original stdout and redirects stdout to stderr from then on so that text printed with wprintf
+ * doesn't end up between the data written to the handle.
+ */
+FileHandle take_standard_output(void);
+void write_to_console(LPCVOID data, SIZE_T size, BOOL errorStream);
+void clear_console(void); // Also moves the cursor to the top left corner
+
+/*
+ * Blocks until this process holds an exclusive lock on the file at path which is created if necessary.
+ * The lock also works between machines if the file is on a network share. The returned handle can be used to read and
+ * write the file.
+ */
+FileHandle lock_file(LPCWSTR path);
+FileHandle try_lock_file(LPCWSTR path); // Returns INVALID_FILE_HANDLE instead of blocking if somebody else holds the lock
+void unlock_file(FileHandle file);
+
+/*
+ * Directory for lelcache's own config and the default location of the cache.
+ */
+BOOL config_directory(LPWSTR buffer);
+BOOL default_cache_directory(LPWSTR buffer);
+
+/*
+ * Network
+ */
+
+/*
+ * Sends a single HTTP request and waits for the response. outStatus receives the HTTP status code.
+ * If outResponse is not NULL it receives the response body which must be freed with free.
+ * Windows supports 'https://' URLs, everywhere else only 'http://' is supported.
+ */
+BOOL http_request(LPCWSTR method, LPCWSTR url, LPCVOID body, SIZE_T bodySize, DWORD timeoutMs, DWORD* outStatus, LPVOID* outResponse, SIZE_T* outResponseSize);
+
+/*
+ * Answers HTTP GET requests on a TCP port one at a time until the process is terminated. handler receives the path of each
+ * request and returns the body of the response which is freed with free, or NULL to answer with 404.
+ * address is a numeric IPv4 address, NULL only accepts connections from this machine. Returns FALSE if the port can't be
+ * opened.
+ */
+typedef LPVOID (*HttpHandler)(const char* path, SIZE_T* outSize, LPVOID context);
+
+BOOL serve_http(LPCWSTR address, DWORD port, const char* contentType, HttpHandler handler, LPVOID context);
+
+/*
+ * Time
+ */
+
+UINT64 current_system_time(void); // 100 nanosecond intervals since January 1, 1601 (UTC) on all platforms, just like FILETIME
+UINT64 current_tick_count(void);  // Monotonic time in milliseconds
+void sleep_ms(DWORD milliseconds);
+
+/*
+ * Threads
+ */
+
+ThreadHandle start_thread(ThreadFunction function, LPVOID param);
+void join_thread(ThreadHandle thread);
+
+// Manual reset event used to wake up threads that wait for something
+EventHandle create_event(void);
+BOOL wait_for_event(EventHandle event, DWORD timeoutMs); // Returns TRUE if the event was signaled and FALSE on timeout
+void signal_event(EventHandle event);
+void destroy_event(EventHandle event);
+
+/*
+ * Atomics, these are full memory barriers
+ */
+
+UINT64 atomic_add64(volatile UINT64* value, UINT64 addend); // Returns the previous value
+UINT64 atomic_load64(volatile UINT64* value);
+void atomic_store64(volatile UINT64* value, UINT64 newValue);
+BOOL atomic_compare_exchange64(volatile UINT64* value, UINT64 expected, UINT64 newValue); // FALSE if value wasn't expected
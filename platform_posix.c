@@ -0,0 +1,1196 @@
+#define _GNU_SOURCE // mkostemps
+
+#include "platform.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+extern char** environ;
+
+/*
+ * Converts a wide string to the multibyte encoding of the current locale. The result must be freed with free.
+ */
+static char* to_multibyte(LPCWSTR str) {
+	size_t length = wcstombs(NULL, str, 0);
+
+	if(length == (size_t)-1)
+		return NULL;
+
+	char* result = malloc(length + 1);
+
+	wcstombs(result, str, length + 1);
+
+	return result;
+}
+
+static BOOL from_multibyte(const char* str, LPWSTR buffer, SIZE_T bufferLength) {
+	size_t length = mbstowcs(buffer, str, bufferLength);
+
+	if(length == (size_t)-1 || length >= bufferLength) {
+		*buffer = L'\0';
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL launch_process(int argc, LPCWSTR* argv, FileHandle outputFile, ProcessHandle* outProcess) {
+	char** args = calloc(argc + 1, sizeof(char*));
+	posix_spawn_file_actions_t fileActions;
+	BOOL result = TRUE;
+
+	for(int i = 0; i < argc; ++i) {
+		args[i] = to_multibyte(argv[i]);
+
+		if(!args[i])
+			result = FALSE;
+	}
+
+	posix_spawn_file_actions_init(&fileActions);
+
+	if(outputFile != INVALID_FILE_HANDLE) {
+		posix_spawn_file_actions_adddup2(&fileActions, outputFile, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&fileActions, outputFile, STDERR_FILENO);
+	}
+
+	fflush(stdout); // Otherwise the child's output might overtake ours
+
+	if(result && posix_spawnp(outProcess, args[0], &fileActions, NULL, args, environ) != 0)
+		result = FALSE;
+
+	if(!result)
+		wprintf(L"Unable to start %ls\n", argv[0]);
+
+	posix_spawn_file_actions_destroy(&fileActions);
+
+	for(int i = 0; i < argc; ++i)
+		free(args[i]);
+
+	free(args);
+
+	return result;
+}
+
+DWORD wait_for_process(ProcessHandle* process) {
+	int status;
+
+	while(waitpid(*process, &status, 0) == -1) {
+		if(errno != EINTR)
+			return EXIT_FAILURE;
+	}
+
+	if(WIFEXITED(status))
+		return (DWORD)WEXITSTATUS(status);
+
+	return 128 + WTERMSIG(status); // Same convention as the shell
+}
+
+BOOL launch_process_with_pipes(int argc, LPCWSTR* argv, FileHandle* outInput, FileHandle* outOutput, ProcessHandle* outProcess) {
+	int inputPipe[2];
+	int outputPipe[2];
+
+	if(pipe(inputPipe) != 0)
+		return FALSE;
+
+	if(pipe(outputPipe) != 0) {
+		close(inputPipe[0]);
+		close(inputPipe[1]);
+
+		return FALSE;
+	}
+
+	// Only the duplicated descriptors are inherited by the child
+	for(int i = 0; i < 2; ++i) {
+		fcntl(inputPipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(outputPipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	signal(SIGPIPE, SIG_IGN); // Writing to the pipe after the process has exited should fail instead of terminating us
+
+	char** args = calloc(argc + 1, sizeof(char*));
+	posix_spawn_file_actions_t fileActions;
+	BOOL result = TRUE;
+
+	for(int i = 0; i < argc; ++i) {
+		args[i] = to_multibyte(argv[i]);
+
+		if(!args[i])
+			result = FALSE;
+	}
+
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_adddup2(&fileActions, inputPipe[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&fileActions, outputPipe[1], STDOUT_FILENO);
+
+	if(result && posix_spawnp(outProcess, args[0], &fileActions, NULL, args, environ) != 0)
+		result = FALSE;
+
+	posix_spawn_file_actions_destroy(&fileActions);
+
+	for(int i = 0; i < argc; ++i)
+		free(args[i]);
+
+	free(args);
+	close(inputPipe[0]);
+	close(outputPipe[1]);
+
+	if(!result) {
+		wprintf(L"Unable to start %ls\n", argv[0]);
+		close(inputPipe[1]);
+		close(outputPipe[0]);
+
+		return FALSE;
+	}
+
+	*outInput = inputPipe[1];
+	*outOutput = outputPipe[0];
+
+	return TRUE;
+}
+
+BOOL launch_detached_process(int argc, LPCWSTR* argv) {
+	char** args = calloc(argc + 1, sizeof(char*));
+	posix_spawn_file_actions_t fileActions;
+	posix_spawnattr_t attributes;
+	pid_t pid;
+	BOOL result = TRUE;
+
+	for(int i = 0; i < argc; ++i) {
+		args[i] = to_multibyte(argv[i]);
+
+		if(!args[i])
+			result = FALSE;
+	}
+
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_addopen(&fileActions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&fileActions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&fileActions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawnattr_init(&attributes);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSID); // Not killed together with the build by Ctrl+C
+
+	if(result && posix_spawn(&pid, args[0], &fileActions, &attributes, args, environ) != 0)
+		result = FALSE;
+
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&fileActions);
+
+	for(int i = 0; i < argc; ++i)
+		free(args[i]);
+
+	free(args);
+
+	return result;
+}
+
+BOOL current_executable_path(LPWSTR buffer) {
+	char path[MAX_PATH];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+	if(length <= 0)
+		return FALSE;
+
+	path[length] = '\0';
+
+	return from_multibyte(path, buffer, MAX_PATH);
+}
+
+DWORD current_process_id(void) {
+	return (DWORD)getpid();
+}
+
+BOOL is_local_process_dead(DWORD pid) {
+	return kill((pid_t)pid, 0) == -1 && errno == ESRCH;
+}
+
+void get_host_name(LPWSTR buffer, SIZE_T bufferLength) {
+	char hostName[HOST_NAME_LENGTH * 4];
+
+	if(gethostname(hostName, sizeof(hostName)) != 0)
+		*hostName = '\0';
+
+	hostName[sizeof(hostName) - 1] = '\0';
+	from_multibyte(hostName, buffer, bufferLength);
+}
+
+BOOL get_environment_variable(LPCWSTR name, LPWSTR buffer, SIZE_T bufferLength) {
+	char* mbName = to_multibyte(name);
+	const char* value = mbName ? getenv(mbName) : NULL;
+
+	free(mbName);
+
+	return value && from_multibyte(value, buffer, bufferLength);
+}
+
+FileHandle open_file(LPCWSTR path, enum OpenMode mode) {
+	char* mbPath = to_multibyte(path);
+	int fd = -1;
+
+	if(mbPath) {
+		switch(mode) {
+		case OPEN_FOR_READING:
+			fd = open(mbPath, O_RDONLY | O_CLOEXEC);
+			break;
+		case OPEN_FOR_WRITING:
+			fd = open(mbPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			break;
+		case OPEN_FOR_APPENDING:
+			fd = open(mbPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+			break;
+		}
+
+		free(mbPath);
+	}
+
+	return fd;
+}
+
+SIZE_T read_file(FileHandle file, LPVOID buffer, SIZE_T size) {
+	SIZE_T totalBytesRead = 0;
+
+	while(totalBytesRead < size) {
+		ssize_t numBytesRead = read(file, (BYTE*)buffer + totalBytesRead, size - totalBytesRead);
+
+		if(numBytesRead < 0 && errno == EINTR)
+			continue;
+
+		if(numBytesRead <= 0)
+			break;
+
+		totalBytesRead += (SIZE_T)numBytesRead;
+	}
+
+	return totalBytesRead;
+}
+
+BOOL write_file(FileHandle file, LPCVOID data, SIZE_T size) {
+	SIZE_T totalBytesWritten = 0;
+
+	while(totalBytesWritten < size) {
+		ssize_t numBytesWritten = write(file, (const BYTE*)data + totalBytesWritten, size - totalBytesWritten);
+
+		if(numBytesWritten < 0 && errno == EINTR)
+			continue;
+
+		if(numBytesWritten <= 0)
+			return FALSE;
+
+		totalBytesWritten += (SIZE_T)numBytesWritten;
+	}
+
+	return TRUE;
+}
+
+BOOL seek_file(FileHandle file, UINT64 offset) {
+	return lseek(file, (off_t)offset, SEEK_SET) != (off_t)-1;
+}
+
+UINT64 file_handle_size(FileHandle file) {
+	struct stat fileStat;
+
+	return fstat(file, &fileStat) == 0 ? (UINT64)fileStat.st_size : 0;
+}
+
+void close_file(FileHandle file) {
+	close(file);
+}
+
+FileHandle create_exclusive_file(LPCWSTR path, BOOL* outAlreadyExists) {
+	char* mbPath = to_multibyte(path);
+	int fd = -1;
+
+	*outAlreadyExists = FALSE;
+
+	if(mbPath) {
+		fd = open(mbPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		*outAlreadyExists = fd == -1 && errno == EEXIST;
+		free(mbPath);
+	}
+
+	return fd;
+}
+
+static BOOL stat_path(LPCWSTR path, struct stat* outStat) {
+	char* mbPath = to_multibyte(path);
+	BOOL result = mbPath && stat(mbPath, outStat) == 0;
+
+	free(mbPath);
+
+	return result;
+}
+
+UINT64 file_size(LPCWSTR filePath) {
+	struct stat fileStat;
+
+	return stat_path(filePath, &fileStat) ? (UINT64)fileStat.st_size : 0;
+}
+
+UINT64 file_modification_time(LPCWSTR filePath) {
+	struct stat fileStat;
+
+	if(!stat_path(filePath, &fileStat))
+		return 0;
+
+	return ((UINT64)fileStat.st_mtim.tv_sec + 11644473600ull) * 10000000ull + (UINT64)fileStat.st_mtim.tv_nsec / 100;
+}
+
+BOOL file_exists(LPCWSTR path) {
+	struct stat fileStat;
+
+	return stat_path(path, &fileStat);
+}
+
+BOOL is_directory(LPCWSTR path) {
+	struct stat fileStat;
+
+	return stat_path(path, &fileStat) && S_ISDIR(fileStat.st_mode);
+}
+
+BOOL create_directory(LPCWSTR path) {
+	char* mbPath = to_multibyte(path);
+	BOOL result = mbPath && (mkdir(mbPath, 0755) == 0 || errno == EEXIST);
+
+	free(mbPath);
+
+	return result;
+}
+
+BOOL copy_file(LPCWSTR sourcePath, LPCWSTR destinationPath) {
+	FileHandle source = open_file(sourcePath, OPEN_FOR_READING);
+
+	if(source == INVALID_FILE_HANDLE)
+		return FALSE;
+
+	FileHandle destination = open_file(destinationPath, OPEN_FOR_WRITING);
+	BOOL result = destination != INVALID_FILE_HANDLE;
+
+	if(result) {
+		BYTE buffer[64 * 1024];
+		SIZE_T numBytesRead;
+
+		while(result && (numBytesRead = read_file(source, buffer, sizeof(buffer))) > 0)
+			result = write_file(destination, buffer, numBytesRead);
+
+		close_file(destination);
+	}
+
+	close_file(source);
+
+	return result;
+}
+
+BOOL move_file(LPCWSTR sourcePath, LPCWSTR destinationPath) {
+	char* mbSourcePath = to_multibyte(sourcePath);
+	char* mbDestinationPath = to_multibyte(destinationPath);
+	BOOL result = mbSourcePath && mbDestinationPath && rename(mbSourcePath, mbDestinationPath) == 0;
+
+	free(mbSourcePath);
+	free(mbDestinationPath);
+
+	return result;
+}
+
+BOOL delete_file(LPCWSTR path) {
+	char* mbPath = to_multibyte(path);
+	BOOL result = mbPath && unlink(mbPath) == 0;
+
+	free(mbPath);
+
+	return result;
+}
+
+BOOL remove_directory(LPCWSTR path) {
+	char* mbPath = to_multibyte(path);
+	BOOL result = mbPath && rmdir(mbPath) == 0;
+
+	free(mbPath);
+
+	return result;
+}
+
+BOOL touch_file(LPCWSTR path) {
+	char* mbPath = to_multibyte(path);
+	BOOL result = mbPath && utimensat(AT_FDCWD, mbPath, NULL, 0) == 0;
+
+	free(mbPath);
+
+	return result;
+}
+
+BOOL current_directory(LPWSTR buffer) {
+	char cwd[MAX_PATH];
+
+	return getcwd(cwd, sizeof(cwd)) && from_multibyte(cwd, buffer, MAX_PATH);
+}
+
+BOOL full_path(LPCWSTR path, LPWSTR buffer) {
+	if(*path == L'/') {
+		if(wcslen(path) >= MAX_PATH)
+			return FALSE;
+
+		wcscpy(buffer, path);
+
+		return TRUE;
+	}
+
+	char cwd[MAX_PATH];
+
+	if(!getcwd(cwd, sizeof(cwd)) || !from_multibyte(cwd, buffer, MAX_PATH))
+		return FALSE;
+
+	size_t length = wcslen(buffer);
+
+	if(length + 1 + wcslen(path) >= MAX_PATH)
+		return FALSE;
+
+	buffer[length] = L'/';
+	wcscpy(buffer + length + 1, path);
+
+	return TRUE;
+}
+
+BOOL list_directory(LPCWSTR path, DirectoryCallback callback, LPVOID context) {
+	char* mbPath = to_multibyte(path);
+	DIR* directory = mbPath ? opendir(mbPath) : NULL;
+
+	if(!directory) {
+		free(mbPath);
+
+		return FALSE;
+	}
+
+	struct dirent* entry;
+	WCHAR name[MAX_PATH];
+
+	while((entry = readdir(directory)) != NULL) {
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || !from_multibyte(entry->d_name, name, MAX_PATH))
+			continue;
+
+		BOOL isDirectory = entry->d_type == DT_DIR;
+
+		if(entry->d_type == DT_UNKNOWN) { // Some file systems don't report the type
+			char* entryPath = malloc(strlen(mbPath) + strlen(entry->d_name) + 2);
+			struct stat entryStat;
+
+			sprintf(entryPath, "%s/%s", mbPath, entry->d_name);
+			isDirectory = stat(entryPath, &entryStat) == 0 && S_ISDIR(entryStat.st_mode);
+			free(entryPath);
+		}
+
+		if(!callback(name, isDirectory, context))
+			break;
+	}
+
+	closedir(directory);
+	free(mbPath);
+
+	return TRUE;
+}
+
+struct PlatformFileMapping {
+	void* data;
+	size_t size;
+};
+
+FileMappingHandle map_file(LPCWSTR path, LPCVOID* outData, UINT64* outSize) {
+	FileHandle file = open_file(path, OPEN_FOR_READING);
+
+	if(file == INVALID_FILE_HANDLE)
+		return NULL;
+
+	struct stat fileStat;
+	void* data = fstat(file, &fileStat) == 0 && fileStat.st_size > 0 ? mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+
+	close(file); // The mapping keeps the file alive
+
+	if(data == MAP_FAILED)
+		return NULL;
+
+	struct PlatformFileMapping* mapping = malloc(sizeof(*mapping));
+
+	mapping->data = data;
+	mapping->size = (size_t)fileStat.st_size;
+	*outData = data;
+	*outSize = (UINT64)fileStat.st_size;
+
+	return mapping;
+}
+
+void unmap_file(FileMappingHandle mapping) {
+	if(mapping) {
+		munmap(mapping->data, mapping->size);
+		free(mapping);
+	}
+}
+
+FileMappingHandle map_shared_memory(LPCWSTR path, SIZE_T size, LPVOID* outData) {
+	char* mbPath = to_multibyte(path);
+	int fd = mbPath ? open(mbPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+
+	free(mbPath);
+
+	if(fd == -1)
+		return NULL;
+
+	// The file is never shrunk since other processes might have mapped more of it
+	struct stat fileStat;
+	BOOL largeEnough = fstat(fd, &fileStat) == 0 && ((size_t)fileStat.st_size >= size || ftruncate(fd, (off_t)size) == 0);
+	void* data = largeEnough ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+	close(fd);
+
+	if(data == MAP_FAILED)
+		return NULL;
+
+	struct PlatformFileMapping* mapping = malloc(sizeof(*mapping));
+
+	mapping->data = data;
+	mapping->size = size;
+	*outData = data;
+
+	return mapping;
+}
+
+BOOL find_executable(LPCWSTR name, LPWSTR outPath) {
+	if(wcschr(name, L'/'))
+		return full_path(name, outPath) && file_exists(outPath);
+
+	const char* path = getenv("PATH");
+	char* mbName = to_multibyte(name);
+	BOOL found = FALSE;
+
+	if(!path || !mbName) {
+		free(mbName);
+
+		return FALSE;
+	}
+
+	while(!found && *path) {
+		const char* end = strchr(path, ':');
+		size_t directoryLength = end ? (size_t)(end - path) : strlen(path);
+		char candidate[MAX_PATH];
+
+		// An empty entry stands for the current directory
+		if(snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)directoryLength, directoryLength > 0 ? path : ".", mbName) < (int)sizeof(candidate) &&
+		   access(candidate, X_OK) == 0) {
+			found = from_multibyte(candidate, outPath, MAX_PATH);
+		}
+
+		path += directoryLength;
+
+		if(*path == ':')
+			++path;
+	}
+
+	free(mbName);
+
+	return found;
+}
+
+BOOL create_temporary_file(LPCWSTR directory, LPCWSTR prefix, LPWSTR outPath) {
+	WCHAR pattern[MAX_PATH];
+
+	swprintf(pattern, MAX_PATH, L"%ls/%.3lsXXXXXX.tmp", directory, prefix); // Three characters of the prefix just like on Windows
+
+	char* mbPattern = to_multibyte(pattern);
+
+	if(!mbPattern)
+		return FALSE;
+
+	int fd = mkostemps(mbPattern, 4, O_CLOEXEC);
+	BOOL result = fd != -1 && from_multibyte(mbPattern, outPath, MAX_PATH);
+
+	if(fd != -1)
+		close(fd);
+
+	free(mbPattern);
+
+	return result;
+}
+
+FileHandle create_output_capture_file(void) {
+	const char* tempDir = getenv("TMPDIR");
+	char path[MAX_PATH];
+
+	snprintf(path, sizeof(path), "%s/lelXXXXXX", tempDir && *tempDir ? tempDir : "/tmp");
+
+	int fd = mkostemp(path, O_CLOEXEC); // The child process gets its own copy through dup2 which doesn't inherit O_CLOEXEC
+
+	if(fd != -1)
+		unlink(path); // The file disappears once the last descriptor is closed
+
+	return fd;
+}
+
+FileHandle open_null_output(void) {
+	return open("/dev/null", O_WRONLY | O_CLOEXEC);
+}
+
+FileHandle standard_input(void) {
+	return STDIN_FILENO;
+}
+
+FileHandle take_standard_output(void) {
+	fflush(stdout);
+
+	int file = dup(STDOUT_FILENO);
+
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	return file;
+}
+
+void write_to_console(LPCVOID data, SIZE_T size, BOOL errorStream) {
+	fflush(stdout); // Anything printed with wprintf should still appear before the data
+
+	if(size > 0)
+		write_file(errorStream ? STDERR_FILENO : STDOUT_FILENO, data, size);
+}
+
+void clear_console(void) {
+	wprintf(L"\x1b[H\x1b[2J");
+	fflush(stdout);
+}
+
+FileHandle lock_file(LPCWSTR path) {
+	char* mbPath = to_multibyte(path);
+	int fd = mbPath ? open(mbPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+
+	free(mbPath);
+
+	if(fd != -1) {
+		int result;
+
+		while((result = flock(fd, LOCK_EX)) == -1 && errno == EINTR)
+			;
+
+		if(result == -1) {
+			close(fd);
+
+			return INVALID_FILE_HANDLE;
+		}
+	}
+
+	return fd;
+}
+
+FileHandle try_lock_file(LPCWSTR path) {
+	char* mbPath = to_multibyte(path);
+	int fd = mbPath ? open(mbPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+
+	free(mbPath);
+
+	if(fd != -1 && flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+
+		return INVALID_FILE_HANDLE;
+	}
+
+	return fd;
+}
+
+void unlock_file(FileHandle file) {
+	if(file != INVALID_FILE_HANDLE) {
+		flock(file, LOCK_UN);
+		close(file);
+	}
+}
+
+/*
+ * Follows the XDG base directory specification, falling back to the given directory in $HOME.
+ */
+static BOOL xdg_directory(const char* variable, const char* fallback, LPWSTR buffer) {
+	const char* base = getenv(variable);
+	char path[MAX_PATH];
+
+	if(base && *base == '/') {
+		snprintf(path, sizeof(path), "%s/lelcache", base);
+	} else {
+		const char* home = getenv("HOME");
+
+		if(!home || !*home)
+			return FALSE;
+
+		snprintf(path, sizeof(path), "%s/%s/lelcache", home, fallback);
+	}
+
+	return from_multibyte(path, buffer, MAX_PATH);
+}
+
+BOOL config_directory(LPWSTR buffer) {
+	return xdg_directory("XDG_CONFIG_HOME", ".config", buffer);
+}
+
+BOOL default_cache_directory(LPWSTR buffer) {
+	return xdg_directory("XDG_CACHE_HOME", ".cache", buffer);
+}
+
+/*
+ * MSG_NOSIGNAL prevents SIGPIPE from killing the process if the server closes the connection early.
+ */
+static BOOL send_all(int sock, const char* data, SIZE_T size) {
+	while(size > 0) {
+		ssize_t numSent = send(sock, data, size, MSG_NOSIGNAL);
+
+		if(numSent < 0) {
+			if(errno == EINTR)
+				continue;
+
+			return FALSE;
+		}
+
+		data += numSent;
+		size -= numSent;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Reads everything until the server closes the connection since requests are sent with 'Connection: close'.
+ */
+static char* receive_all(int sock, SIZE_T* outSize) {
+	SIZE_T capacity = 64 * 1024;
+	SIZE_T size = 0;
+	char* data = malloc(capacity + 1);
+
+	for(;;) {
+		if(size == capacity) {
+			capacity *= 2;
+			data = realloc(data, capacity + 1);
+		}
+
+		ssize_t numReceived = recv(sock, data + size, capacity - size, 0);
+
+		if(numReceived == 0)
+			break;
+
+		if(numReceived < 0) {
+			if(errno == EINTR)
+				continue;
+
+			free(data);
+
+			return NULL;
+		}
+
+		size += numReceived;
+	}
+
+	data[size] = '\0';
+	*outSize = size;
+
+	return data;
+}
+
+/*
+ * Decodes a body sent with 'Transfer-Encoding: chunked' in place. Returns the decoded size or -1 if the body is malformed.
+ */
+static ssize_t decode_chunked_body(char* body, SIZE_T size) {
+	char* read = body;
+	char* write = body;
+	char* end = body + size;
+
+	for(;;) {
+		char* lineEnd = memchr(read, '\n', end - read);
+
+		if(!lineEnd)
+			return -1;
+
+		SIZE_T chunkSize = strtoul(read, NULL, 16);
+
+		read = lineEnd + 1;
+
+		if(chunkSize == 0)
+			return write - body;
+
+		if(chunkSize > (SIZE_T)(end - read))
+			return -1;
+
+		memmove(write, read, chunkSize);
+		write += chunkSize;
+		read += chunkSize;
+
+		if(read < end && *read == '\r')
+			++read;
+
+		if(read < end && *read == '\n')
+			++read;
+	}
+}
+
+BOOL http_request(LPCWSTR method, LPCWSTR url, LPCVOID body, SIZE_T bodySize, DWORD timeoutMs, DWORD* outStatus, LPVOID* outResponse, SIZE_T* outResponseSize) {
+	char* mbUrl = to_multibyte(url);
+	char* mbMethod = to_multibyte(method);
+	char host[256];
+	char port[16] = "80";
+	const char* path;
+	BOOL result = FALSE;
+	int sock = -1;
+	struct addrinfo* addresses = NULL;
+	char* response = NULL;
+
+	if(!mbUrl || !mbMethod)
+		goto done;
+
+	if(strncmp(mbUrl, "http://", 7) != 0) {
+		wprintf(L"Only http:// URLs are supported on this platform: '%ls'\n", url);
+
+		goto done;
+	}
+
+	const char* hostStart = mbUrl + 7;
+	SIZE_T hostLength = strcspn(hostStart, ":/");
+
+	if(hostLength == 0 || hostLength >= sizeof(host))
+		goto done;
+
+	memcpy(host, hostStart, hostLength);
+	host[hostLength] = '\0';
+	path = hostStart + hostLength;
+
+	if(*path == ':') {
+		SIZE_T portLength = strcspn(path + 1, "/");
+
+		if(portLength == 0 || portLength >= sizeof(port))
+			goto done;
+
+		memcpy(port, path + 1, portLength);
+		port[portLength] = '\0';
+		path += 1 + portLength;
+	}
+
+	if(*path == '\0')
+		path = "/";
+
+	struct addrinfo hints = {0};
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if(getaddrinfo(host, port, &hints, &addresses) != 0)
+		goto done;
+
+	struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+
+	for(struct addrinfo* address = addresses; address; address = address->ai_next) {
+		sock = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+
+		if(sock == -1)
+			continue;
+
+		// On Linux the send timeout applies to connect as well
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		if(connect(sock, address->ai_addr, address->ai_addrlen) == 0)
+			break;
+
+		close(sock);
+		sock = -1;
+	}
+
+	if(sock == -1)
+		goto done;
+
+	char header[1024 + MAX_PATH];
+	int headerLength = snprintf(header, sizeof(header),
+								"%s %s HTTP/1.1\r\n"
+								"Host: %s\r\n"
+								"Content-Length: %zu\r\n"
+								"Content-Type: application/octet-stream\r\n"
+								"Connection: close\r\n"
+								"\r\n",
+								mbMethod, path, host, bodySize);
+
+	if(headerLength >= (int)sizeof(header) || !send_all(sock, header, headerLength) || !send_all(sock, body, bodySize))
+		goto done;
+
+	SIZE_T responseSize;
+
+	response = receive_all(sock, &responseSize);
+
+	unsigned int status;
+
+	if(!response || sscanf(response, "HTTP/%*u.%*u %u", &status) != 1)
+		goto done;
+
+	char* bodyStart = strstr(response, "\r\n\r\n");
+
+	if(!bodyStart)
+		goto done;
+
+	*bodyStart = '\0'; // Terminating the headers so that they can be searched
+	bodyStart += 4;
+	*outStatus = status;
+
+	if(outResponse) {
+		SIZE_T responseBodySize = responseSize - (bodyStart - response);
+		ssize_t decodedSize = strcasestr(response, "Transfer-Encoding: chunked") ? decode_chunked_body(bodyStart, responseBodySize) : (ssize_t)responseBodySize;
+
+		if(decodedSize < 0)
+			goto done;
+
+		*outResponse = malloc(decodedSize > 0 ? decodedSize : 1);
+		memcpy(*outResponse, bodyStart, decodedSize);
+		*outResponseSize = decodedSize;
+	}
+
+	result = TRUE;
+
+done:
+	if(sock != -1)
+		close(sock);
+
+	if(addresses)
+		freeaddrinfo(addresses);
+
+	free(response);
+	free(mbMethod);
+	free(mbUrl);
+
+	return result;
+}
+
+/*
+ * Reads the request line of an HTTP request, the headers and a body are ignored.
+ */
+static BOOL receive_request_line(int sock, char* buffer, SIZE_T bufferSize) {
+	SIZE_T length = 0;
+
+	while(length < bufferSize - 1) {
+		ssize_t numReceived = recv(sock, buffer + length, bufferSize - 1 - length, 0);
+
+		if(numReceived < 0 && errno == EINTR)
+			continue;
+
+		if(numReceived <= 0)
+			break;
+
+		length += numReceived;
+		buffer[length] = '\0';
+
+		if(strstr(buffer, "\r\n"))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL serve_http(LPCWSTR address, DWORD port, const char* contentType, HttpHandler handler, LPVOID context) {
+	struct sockaddr_in bindAddress = {0};
+	char* mbAddress = address ? to_multibyte(address) : NULL;
+
+	bindAddress.sin_family = AF_INET;
+	bindAddress.sin_port = htons((uint16_t)port);
+
+	BOOL isValidAddress = inet_pton(AF_INET, mbAddress ? mbAddress : "127.0.0.1", &bindAddress.sin_addr) == 1;
+
+	free(mbAddress);
+
+	if(!isValidAddress || port == 0 || port > 65535)
+		return FALSE;
+
+	int server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int reuseAddress = 1;
+
+	if(server == -1)
+		return FALSE;
+
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+
+	if(bind(server, (struct sockaddr*)&bindAddress, sizeof(bindAddress)) != 0 || listen(server, 16) != 0) {
+		close(server);
+
+		return FALSE;
+	}
+
+	for(;;) {
+		int client = accept4(server, NULL, NULL, SOCK_CLOEXEC);
+
+		if(client == -1)
+			continue;
+
+		// A client that stops talking mustn't block everybody else
+		struct timeval timeout = {5, 0};
+		char request[2048];
+		char method[16];
+		char path[1024];
+
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		if(receive_request_line(client, request, sizeof(request)) && sscanf(request, "%15s %1023s", method, path) == 2) {
+			BOOL isHead = strcmp(method, "HEAD") == 0;
+			SIZE_T bodySize = 0;
+			LPVOID body = isHead || strcmp(method, "GET") == 0 ? handler(path, &bodySize, context) : NULL;
+			char header[512];
+			int headerLength = body ? snprintf(header, sizeof(header),
+											   "HTTP/1.1 200 OK\r\n"
+											   "Content-Type: %s\r\n"
+											   "Content-Length: %zu\r\n"
+											   "Connection: close\r\n"
+											   "\r\n",
+											   contentType, bodySize)
+									: snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+			if(headerLength < (int)sizeof(header) && send_all(client, header, headerLength) && body && !isHead)
+				send_all(client, body, bodySize);
+
+			free(body);
+		}
+
+		close(client);
+	}
+}
+
+UINT64 current_system_time(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	return ((UINT64)now.tv_sec + 11644473600ull) * 10000000ull + (UINT64)now.tv_nsec / 100; // Seconds between 1601 and 1970
+}
+
+UINT64 current_tick_count(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (UINT64)now.tv_sec * 1000ull + (UINT64)now.tv_nsec / 1000000ull;
+}
+
+void sleep_ms(DWORD milliseconds) {
+	struct timespec duration = {milliseconds / 1000, (long)(milliseconds % 1000) * 1000000l};
+
+	while(nanosleep(&duration, &duration) == -1 && errno == EINTR)
+		;
+}
+
+struct PlatformThread {
+	pthread_t thread;
+	ThreadFunction function;
+	LPVOID param;
+};
+
+static void* thread_entry(void* param) {
+	struct PlatformThread* thread = param;
+
+	thread->function(thread->param);
+
+	return NULL;
+}
+
+ThreadHandle start_thread(ThreadFunction function, LPVOID param) {
+	struct PlatformThread* thread = malloc(sizeof(*thread));
+
+	thread->function = function;
+	thread->param = param;
+
+	if(pthread_create(&thread->thread, NULL, thread_entry, thread) != 0) {
+		free(thread);
+
+		return NULL;
+	}
+
+	return thread;
+}
+
+void join_thread(ThreadHandle thread) {
+	pthread_join(thread->thread, NULL);
+	free(thread);
+}
+
+struct PlatformEvent {
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	BOOL signaled;
+};
+
+EventHandle create_event(void) {
+	struct PlatformEvent* event = malloc(sizeof(*event));
+	pthread_condattr_t conditionAttributes;
+
+	pthread_mutex_init(&event->mutex, NULL);
+	pthread_condattr_init(&conditionAttributes);
+	pthread_condattr_setclock(&conditionAttributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&event->condition, &conditionAttributes);
+	pthread_condattr_destroy(&conditionAttributes);
+	event->signaled = FALSE;
+
+	return event;
+}
+
+BOOL wait_for_event(EventHandle event, DWORD timeoutMs) {
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000l;
+
+	if(deadline.tv_nsec >= 1000000000l) {
+		++deadline.tv_sec;
+		deadline.tv_nsec -= 1000000000l;
+	}
+
+	pthread_mutex_lock(&event->mutex);
+
+	while(!event->signaled) {
+		if(pthread_cond_timedwait(&event->condition, &event->mutex, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	BOOL signaled = event->signaled;
+
+	pthread_mutex_unlock(&event->mutex);
+
+	return signaled;
+}
+
+void signal_event(EventHandle event) {
+	pthread_mutex_lock(&event->mutex);
+	event->signaled = TRUE;
+	pthread_cond_broadcast(&event->condition);
+	pthread_mutex_unlock(&event->mutex);
+}
+
+void destroy_event(EventHandle event) {
+	pthread_cond_destroy(&event->condition);
+	pthread_mutex_destroy(&event->mutex);
+	free(event);
+}
+
+UINT64 atomic_add64(volatile UINT64* value, UINT64 addend) {
+	return __atomic_fetch_add(value, addend, __ATOMIC_SEQ_CST);
+}
+
+UINT64 atomic_load64(volatile UINT64* value) {
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+void atomic_store64(volatile UINT64* value, UINT64 newValue) {
+	__atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+}
+
+BOOL atomic_compare_exchange64(volatile UINT64* value, UINT64 expected, UINT64 newValue) {
+	return __atomic_compare_exchange_n(value, &expected, newValue, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,841 @@
+#include <winsock2.h> // Must come before Windows.h
+#include <ws2tcpip.h>
+#include "platform.h"
+#include <ShlObj.h>
+#include <winhttp.h>
+#include <io.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * Quotes an argument the way CommandLineToArgvW and the C runtime expect it so that the child process sees exactly the
+ * same argument. Returns the number of characters written or needed if buffer is NULL.
+ */
+static int quote_argument(LPCWSTR arg, LPWSTR buffer) {
+	int length = 0;
+
+#define PUT(c) do { if(buffer) buffer[length] = (c); ++length; } while(0)
+
+	PUT(L'\"');
+
+	for(LPCWSTR c = arg; ; ++c) {
+		int numBackslashes = 0;
+
+		while(*c == L'\\') {
+			++c;
+			++numBackslashes;
+		}
+
+		if(*c == L'\0') {
+			// Backslashes before the closing quote need to be escaped
+			for(int i = 0; i < numBackslashes * 2; ++i)
+				PUT(L'\\');
+
+			break;
+		}
+
+		if(*c == L'\"') {
+			for(int i = 0; i < numBackslashes * 2 + 1; ++i)
+				PUT(L'\\');
+		} else {
+			for(int i = 0; i < numBackslashes; ++i)
+				PUT(L'\\');
+		}
+
+		PUT(*c);
+	}
+
+	PUT(L'\"');
+
+#undef PUT
+
+	return length;
+}
+
+/*
+ * The result must be freed with free.
+ */
+static LPWSTR make_command_line(int argc, LPCWSTR* argv) {
+	int cmdLineLength = 0;
+
+	for(int i = 0; i < argc; ++i)
+		cmdLineLength += quote_argument(argv[i], NULL) + 1; // Separating space or null terminator
+
+	LPWSTR cmdLine = malloc(cmdLineLength * sizeof(WCHAR));
+	LPWSTR cmdLineEnd = cmdLine;
+
+	for(int i = 0; i < argc; ++i) {
+		cmdLineEnd += quote_argument(argv[i], cmdLineEnd);
+		*cmdLineEnd++ = L' ';
+	}
+
+	cmdLineEnd[-1] = L'\0';
+
+	return cmdLine;
+}
+
+BOOL launch_process(int argc, LPCWSTR* argv, FileHandle outputFile, ProcessHandle* outProcess) {
+	STARTUPINFOW startupInfo = {0};
+	LPWSTR cmdLine = make_command_line(argc, argv);
+
+	startupInfo.cb = sizeof(startupInfo);
+
+	if(outputFile != INVALID_FILE_HANDLE) {
+		startupInfo.dwFlags = STARTF_USESTDHANDLES;
+		startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+		startupInfo.hStdOutput = outputFile;
+		startupInfo.hStdError = outputFile;
+	}
+
+	BOOL result = CreateProcessW(argv[0], cmdLine, NULL, NULL, outputFile != INVALID_FILE_HANDLE, 0, 0, NULL, &startupInfo, outProcess);
+
+	if(!result)
+		wprintf(L"Unable to start %ls\n", argv[0]);
+
+	free(cmdLine);
+
+	return result;
+}
+
+DWORD wait_for_process(ProcessHandle* process) {
+	DWORD exitCode = 0;
+
+	WaitForSingleObject(process->hProcess, INFINITE);
+	GetExitCodeProcess(process->hProcess, &exitCode);
+	CloseHandle(process->hThread);
+	CloseHandle(process->hProcess);
+
+	return exitCode;
+}
+
+BOOL launch_process_with_pipes(int argc, LPCWSTR* argv, FileHandle* outInput, FileHandle* outOutput, ProcessHandle* outProcess) {
+	SECURITY_ATTRIBUTES securityAttributes = {sizeof(securityAttributes), NULL, TRUE};
+	HANDLE childInput, input, output, childOutput;
+
+	if(!CreatePipe(&childInput, &input, &securityAttributes, 0))
+		return FALSE;
+
+	if(!CreatePipe(&output, &childOutput, &securityAttributes, 0)) {
+		CloseHandle(childInput);
+		CloseHandle(input);
+
+		return FALSE;
+	}
+
+	// Only the child's ends are inherited
+	SetHandleInformation(input, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(output, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOW startupInfo = {0};
+	LPWSTR cmdLine = make_command_line(argc, argv);
+
+	startupInfo.cb = sizeof(startupInfo);
+	startupInfo.dwFlags = STARTF_USESTDHANDLES;
+	startupInfo.hStdInput = childInput;
+	startupInfo.hStdOutput = childOutput;
+	startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	BOOL result = CreateProcessW(argv[0], cmdLine, NULL, NULL, TRUE, 0, NULL, NULL, &startupInfo, outProcess);
+
+	free(cmdLine);
+	CloseHandle(childInput);
+	CloseHandle(childOutput);
+
+	if(!result) {
+		wprintf(L"Unable to start %ls\n", argv[0]);
+		CloseHandle(input);
+		CloseHandle(output);
+
+		return FALSE;
+	}
+
+	*outInput = input;
+	*outOutput = output;
+
+	return TRUE;
+}
+
+BOOL launch_detached_process(int argc, LPCWSTR* argv) {
+	STARTUPINFOW startupInfo = {0};
+	PROCESS_INFORMATION processInfo;
+	LPWSTR cmdLine = make_command_line(argc, argv);
+
+	startupInfo.cb = sizeof(startupInfo);
+
+	BOOL result = CreateProcessW(argv[0], cmdLine, NULL, NULL, FALSE, DETACHED_PROCESS | CREATE_NEW_PROCESS_GROUP, NULL, NULL, &startupInfo, &processInfo);
+
+	if(result) {
+		CloseHandle(processInfo.hThread);
+		CloseHandle(processInfo.hProcess);
+	}
+
+	free(cmdLine);
+
+	return result;
+}
+
+BOOL current_executable_path(LPWSTR buffer) {
+	DWORD length = GetModuleFileNameW(NULL, buffer, MAX_PATH);
+
+	return length > 0 && length < MAX_PATH;
+}
+
+DWORD current_process_id(void) {
+	return GetCurrentProcessId();
+}
+
+BOOL is_local_process_dead(DWORD pid) {
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+
+	if(!process)
+		return GetLastError() == ERROR_INVALID_PARAMETER; // Any other error means the process exists but can't be opened
+
+	BOOL exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+
+	CloseHandle(process);
+
+	return exited;
+}
+
+void get_host_name(LPWSTR buffer, SIZE_T bufferLength) {
+	DWORD length = (DWORD)bufferLength;
+
+	if(!GetComputerNameW(buffer, &length))
+		*buffer = L'\0';
+}
+
+BOOL get_environment_variable(LPCWSTR name, LPWSTR buffer, SIZE_T bufferLength) {
+	DWORD length = GetEnvironmentVariableW(name, buffer, (DWORD)bufferLength);
+
+	return length > 0 && length < bufferLength;
+}
+
+FileHandle open_file(LPCWSTR path, enum OpenMode mode) {
+	switch(mode) {
+	case OPEN_FOR_READING:
+		return CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	case OPEN_FOR_WRITING:
+		return CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	case OPEN_FOR_APPENDING:
+		return CreateFileW(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	}
+
+	return INVALID_FILE_HANDLE;
+}
+
+SIZE_T read_file(FileHandle file, LPVOID buffer, SIZE_T size) {
+	SIZE_T totalBytesRead = 0;
+
+	while(totalBytesRead < size) {
+		DWORD numBytesRead;
+		DWORD numBytesToRead = (DWORD)min(size - totalBytesRead, 0x40000000);
+
+		if(!ReadFile(file, (BYTE*)buffer + totalBytesRead, numBytesToRead, &numBytesRead, NULL) || numBytesRead == 0)
+			break;
+
+		totalBytesRead += numBytesRead;
+	}
+
+	return totalBytesRead;
+}
+
+BOOL write_file(FileHandle file, LPCVOID data, SIZE_T size) {
+	SIZE_T totalBytesWritten = 0;
+
+	while(totalBytesWritten < size) {
+		DWORD numBytesWritten;
+		DWORD numBytesToWrite = (DWORD)min(size - totalBytesWritten, 0x40000000);
+
+		if(!WriteFile(file, (const BYTE*)data + totalBytesWritten, numBytesToWrite, &numBytesWritten, NULL))
+			return FALSE;
+
+		totalBytesWritten += numBytesWritten;
+	}
+
+	return TRUE;
+}
+
+BOOL seek_file(FileHandle file, UINT64 offset) {
+	LARGE_INTEGER distance;
+
+	distance.QuadPart = (LONGLONG)offset;
+
+	return SetFilePointerEx(file, distance, NULL, FILE_BEGIN);
+}
+
+UINT64 file_handle_size(FileHandle file) {
+	LARGE_INTEGER fileSize;
+
+	return GetFileSizeEx(file, &fileSize) ? (UINT64)fileSize.QuadPart : 0;
+}
+
+void close_file(FileHandle file) {
+	CloseHandle(file);
+}
+
+FileHandle create_exclusive_file(LPCWSTR path, BOOL* outAlreadyExists) {
+	HANDLE file = CreateFileW(path,
+							  GENERIC_READ | GENERIC_WRITE,
+							  FILE_SHARE_READ | FILE_SHARE_DELETE,
+							  NULL,
+							  CREATE_NEW,
+							  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE,
+							  NULL);
+
+	if(file == INVALID_HANDLE_VALUE) {
+		DWORD error = GetLastError();
+
+		// ERROR_ACCESS_DENIED is returned while a file that was closed by its owner is still pending deletion
+		*outAlreadyExists = error == ERROR_FILE_EXISTS || error == ERROR_ACCESS_DENIED;
+	}
+
+	return file;
+}
+
+UINT64 file_size(LPCWSTR filePath) {
+	WIN32_FILE_ATTRIBUTE_DATA fileAttribData;
+
+	// This is much faster than GetFileSize
+	return GetFileAttributesExW(filePath, GetFileExInfoStandard, &fileAttribData) ?
+		(UINT64)fileAttribData.nFileSizeHigh << 32 | fileAttribData.nFileSizeLow : 0;
+}
+
+UINT64 file_modification_time(LPCWSTR filePath) {
+	WIN32_FILE_ATTRIBUTE_DATA fileAttribData;
+
+	return GetFileAttributesExW(filePath, GetFileExInfoStandard, &fileAttribData) ?
+		(UINT64)fileAttribData.ftLastWriteTime.dwHighDateTime << 32 | fileAttribData.ftLastWriteTime.dwLowDateTime : 0;
+}
+
+BOOL file_exists(LPCWSTR path) {
+	return GetFileAttributesW(path) != INVALID_FILE_ATTRIBUTES;
+}
+
+BOOL is_directory(LPCWSTR path) {
+	DWORD attributes = GetFileAttributesW(path);
+
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+BOOL create_directory(LPCWSTR path) {
+	return CreateDirectoryW(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+BOOL copy_file(LPCWSTR sourcePath, LPCWSTR destinationPath) {
+	return CopyFileW(sourcePath, destinationPath, FALSE);
+}
+
+BOOL move_file(LPCWSTR sourcePath, LPCWSTR destinationPath) {
+	return MoveFileExW(sourcePath, destinationPath, MOVEFILE_REPLACE_EXISTING);
+}
+
+BOOL delete_file(LPCWSTR path) {
+	return DeleteFileW(path);
+}
+
+BOOL remove_directory(LPCWSTR path) {
+	return RemoveDirectoryW(path);
+}
+
+BOOL touch_file(LPCWSTR path) {
+	HANDLE file = CreateFileW(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(file == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	FILETIME now;
+
+	GetSystemTimeAsFileTime(&now);
+
+	BOOL result = SetFileTime(file, NULL, NULL, &now);
+
+	CloseHandle(file);
+
+	return result;
+}
+
+BOOL current_directory(LPWSTR buffer) {
+	DWORD length = GetCurrentDirectoryW(MAX_PATH, buffer);
+
+	return length > 0 && length < MAX_PATH;
+}
+
+BOOL full_path(LPCWSTR path, LPWSTR buffer) {
+	DWORD length = GetFullPathNameW(path, MAX_PATH, buffer, NULL);
+
+	return length > 0 && length < MAX_PATH;
+}
+
+BOOL list_directory(LPCWSTR path, DirectoryCallback callback, LPVOID context) {
+	WCHAR pattern[MAX_PATH];
+	WIN32_FIND_DATAW findData;
+
+	if(swprintf(pattern, MAX_PATH, L"%ls\\*", path) < 0)
+		return FALSE;
+
+	HANDLE find = FindFirstFileW(pattern, &findData);
+
+	if(find == INVALID_HANDLE_VALUE)
+		return GetLastError() == ERROR_FILE_NOT_FOUND; // Empty directory
+
+	do {
+		if(lstrcmpW(findData.cFileName, L".") == 0 || lstrcmpW(findData.cFileName, L"..") == 0)
+			continue;
+
+		if(!callback(findData.cFileName, (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0, context))
+			break;
+	} while(FindNextFileW(find, &findData));
+
+	FindClose(find);
+
+	return TRUE;
+}
+
+struct PlatformFileMapping {
+	LPVOID view;
+};
+
+FileMappingHandle map_file(LPCWSTR path, LPCVOID* outData, UINT64* outSize) {
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER size;
+	HANDLE fileMapping = GetFileSizeEx(file, &size) && size.QuadPart > 0 ? CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	LPVOID view = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+	// The view keeps the file and the mapping object alive
+	if(fileMapping)
+		CloseHandle(fileMapping);
+
+	CloseHandle(file);
+
+	if(!view)
+		return NULL;
+
+	struct PlatformFileMapping* mapping = malloc(sizeof(*mapping));
+
+	mapping->view = view;
+	*outData = view;
+	*outSize = (UINT64)size.QuadPart;
+
+	return mapping;
+}
+
+void unmap_file(FileMappingHandle mapping) {
+	if(mapping) {
+		UnmapViewOfFile(mapping->view);
+		free(mapping);
+	}
+}
+
+FileMappingHandle map_shared_memory(LPCWSTR path, SIZE_T size, LPVOID* outData) {
+	HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	// Mapping more than the size of the file grows it
+	HANDLE fileMapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, (DWORD)((UINT64)size >> 32), (DWORD)size, NULL);
+	LPVOID view = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+
+	if(fileMapping)
+		CloseHandle(fileMapping);
+
+	CloseHandle(file);
+
+	if(!view)
+		return NULL;
+
+	struct PlatformFileMapping* mapping = malloc(sizeof(*mapping));
+
+	mapping->view = view;
+	*outData = view;
+
+	return mapping;
+}
+
+BOOL find_executable(LPCWSTR name, LPWSTR outPath) {
+	DWORD length = SearchPathW(NULL, name, L".exe", MAX_PATH, outPath, NULL);
+
+	return length > 0 && length < MAX_PATH;
+}
+
+BOOL create_temporary_file(LPCWSTR directory, LPCWSTR prefix, LPWSTR outPath) {
+	return GetTempFileNameW(directory, prefix, 0, outPath) != 0;
+}
+
+FileHandle create_output_capture_file(void) {
+	SECURITY_ATTRIBUTES securityAttributes = {sizeof(securityAttributes), NULL, TRUE}; // Inherited by child processes
+	WCHAR tempPath[MAX_PATH];
+	WCHAR tempFileName[MAX_PATH];
+
+	if(!GetTempPathW(MAX_PATH, tempPath) || !GetTempFileNameW(tempPath, L"lel", 0, tempFileName))
+		return INVALID_FILE_HANDLE;
+
+	return CreateFileW(tempFileName,
+					   GENERIC_READ | GENERIC_WRITE,
+					   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+					   &securityAttributes,
+					   CREATE_ALWAYS,
+					   FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+					   NULL);
+}
+
+FileHandle open_null_output(void) {
+	SECURITY_ATTRIBUTES securityAttributes = {sizeof(securityAttributes), NULL, TRUE};
+
+	return CreateFileW(L"nul:", GENERIC_WRITE, FILE_SHARE_WRITE, &securityAttributes, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+FileHandle standard_input(void) {
+	return GetStdHandle(STD_INPUT_HANDLE);
+}
+
+FileHandle take_standard_output(void) {
+	fflush(stdout);
+
+	// wprintf writes to the C runtime's descriptor which doesn't follow SetStdHandle
+	int file = _dup(_fileno(stdout));
+
+	_dup2(_fileno(stderr), _fileno(stdout));
+
+	return file != -1 ? (HANDLE)_get_osfhandle(file) : INVALID_HANDLE_VALUE;
+}
+
+void write_to_console(LPCVOID data, SIZE_T size, BOOL errorStream) {
+	fflush(stdout); // Anything printed with wprintf should still appear before the data
+
+	if(size > 0)
+		write_file(GetStdHandle(errorStream ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE), data, size);
+}
+
+void clear_console(void) {
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD mode;
+
+	// Escape sequences need to be enabled explicitly
+	if(GetConsoleMode(console, &mode))
+		SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+	wprintf(L"\x1b[H\x1b[2J");
+	fflush(stdout);
+}
+
+FileHandle lock_file(LPCWSTR path) {
+	HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	OVERLAPPED overlapped = {0};
+
+	if(file != INVALID_HANDLE_VALUE && !LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+		CloseHandle(file);
+
+		return INVALID_FILE_HANDLE;
+	}
+
+	return file;
+}
+
+FileHandle try_lock_file(LPCWSTR path) {
+	HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	OVERLAPPED overlapped = {0};
+
+	if(file != INVALID_HANDLE_VALUE && !LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+		CloseHandle(file);
+
+		return INVALID_FILE_HANDLE;
+	}
+
+	return file;
+}
+
+void unlock_file(FileHandle file) {
+	OVERLAPPED overlapped = {0};
+
+	if(file != INVALID_FILE_HANDLE) {
+		UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &overlapped);
+		CloseHandle(file);
+	}
+}
+
+BOOL config_directory(LPWSTR buffer) {
+	PWSTR appDataLocal;
+
+	if(FAILED(SHGetKnownFolderPath(&FOLDERID_LocalAppData, 0, NULL, &appDataLocal)))
+		return FALSE;
+
+	lstrcpyW(buffer, appDataLocal);
+	lstrcatW(buffer, L"\\lelcache");
+	CoTaskMemFree(appDataLocal);
+
+	return TRUE;
+}
+
+BOOL default_cache_directory(LPWSTR buffer) {
+	PWSTR profile;
+
+	if(FAILED(SHGetKnownFolderPath(&FOLDERID_Profile, 0, NULL, &profile))) // Default cache path is in the user directory
+		return FALSE;
+
+	lstrcpyW(buffer, profile);
+	lstrcatW(buffer, L"\\.lelcache");
+	CoTaskMemFree(profile);
+
+	return TRUE;
+}
+
+BOOL http_request(LPCWSTR method, LPCWSTR url, LPCVOID body, SIZE_T bodySize, DWORD timeoutMs, DWORD* outStatus, LPVOID* outResponse, SIZE_T* outResponseSize) {
+	URL_COMPONENTS urlComponents = {0};
+	WCHAR host[256];
+	BOOL result = FALSE;
+	HINTERNET connection = NULL;
+	HINTERNET request = NULL;
+
+	urlComponents.dwStructSize = sizeof(urlComponents);
+	urlComponents.lpszHostName = host;
+	urlComponents.dwHostNameLength = ARRAYSIZE(host);
+	urlComponents.dwUrlPathLength = (DWORD)-1; // Only a pointer into url is needed for the path
+
+	if(!WinHttpCrackUrl(url, 0, 0, &urlComponents))
+		return FALSE;
+
+	HINTERNET session = WinHttpOpen(L"lelcache", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+
+	if(!session)
+		return FALSE;
+
+	WinHttpSetTimeouts(session, timeoutMs, timeoutMs, timeoutMs, timeoutMs);
+
+	connection = WinHttpConnect(session, host, urlComponents.nPort, 0);
+
+	if(connection) {
+		request = WinHttpOpenRequest(connection, method, urlComponents.lpszUrlPath, NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
+									 urlComponents.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0);
+	}
+
+	if(request &&
+	   WinHttpSendRequest(request, L"Content-Type: application/octet-stream", (DWORD)-1, (LPVOID)body, (DWORD)bodySize, (DWORD)bodySize, 0) &&
+	   WinHttpReceiveResponse(request, NULL)) {
+		DWORD status = 0;
+		DWORD statusSize = sizeof(status);
+
+		if(WinHttpQueryHeaders(request, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, &status, &statusSize, WINHTTP_NO_HEADER_INDEX)) {
+			*outStatus = status;
+			result = TRUE;
+
+			if(outResponse) {
+				SIZE_T capacity = 64 * 1024;
+				SIZE_T size = 0;
+				BYTE* data = malloc(capacity);
+				DWORD numRead;
+
+				while((result = WinHttpReadData(request, data + size, (DWORD)(capacity - size), &numRead)) && numRead > 0) {
+					size += numRead;
+
+					if(size == capacity) {
+						capacity *= 2;
+						data = realloc(data, capacity);
+					}
+				}
+
+				if(result) {
+					*outResponse = data;
+					*outResponseSize = size;
+				} else {
+					free(data);
+				}
+			}
+		}
+	}
+
+	if(request)
+		WinHttpCloseHandle(request);
+
+	if(connection)
+		WinHttpCloseHandle(connection);
+
+	WinHttpCloseHandle(session);
+
+	return result;
+}
+
+static BOOL send_all(SOCKET sock, const char* data, SIZE_T size) {
+	while(size > 0) {
+		int numSent = send(sock, data, (int)min(size, 0x40000000), 0);
+
+		if(numSent <= 0)
+			return FALSE;
+
+		data += numSent;
+		size -= numSent;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Reads the request line of an HTTP request, the headers and a body are ignored.
+ */
+static BOOL receive_request_line(SOCKET sock, char* buffer, int bufferSize) {
+	int length = 0;
+
+	while(length < bufferSize - 1) {
+		int numReceived = recv(sock, buffer + length, bufferSize - 1 - length, 0);
+
+		if(numReceived <= 0)
+			break;
+
+		length += numReceived;
+		buffer[length] = '\0';
+
+		if(strstr(buffer, "\r\n"))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL serve_http(LPCWSTR address, DWORD port, const char* contentType, HttpHandler handler, LPVOID context) {
+	WSADATA wsaData;
+	struct sockaddr_in bindAddress = {0};
+
+	bindAddress.sin_family = AF_INET;
+	bindAddress.sin_port = htons((u_short)port);
+
+	if(InetPtonW(AF_INET, address ? address : L"127.0.0.1", &bindAddress.sin_addr) != 1 || port == 0 || port > 65535)
+		return FALSE;
+
+	if(WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return FALSE;
+
+	SOCKET server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if(server == INVALID_SOCKET)
+		return FALSE;
+
+	if(bind(server, (struct sockaddr*)&bindAddress, sizeof(bindAddress)) != 0 || listen(server, 16) != 0) {
+		closesocket(server);
+
+		return FALSE;
+	}
+
+	for(;;) {
+		SOCKET client = accept(server, NULL, NULL);
+
+		if(client == INVALID_SOCKET)
+			continue;
+
+		// A client that stops talking mustn't block everybody else
+		DWORD timeoutMs = 5000;
+		char request[2048];
+		char method[16];
+		char path[1024];
+
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+
+		if(receive_request_line(client, request, sizeof(request)) && sscanf_s(request, "%15s %1023s", method, (unsigned)sizeof(method), path, (unsigned)sizeof(path)) == 2) {
+			BOOL isHead = strcmp(method, "HEAD") == 0;
+			SIZE_T bodySize = 0;
+			LPVOID body = isHead || strcmp(method, "GET") == 0 ? handler(path, &bodySize, context) : NULL;
+			char header[512];
+			int headerLength = body ? snprintf(header, sizeof(header),
+											   "HTTP/1.1 200 OK\r\n"
+											   "Content-Type: %s\r\n"
+											   "Content-Length: %zu\r\n"
+											   "Connection: close\r\n"
+											   "\r\n",
+											   contentType, bodySize)
+									: snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+			if(headerLength < (int)sizeof(header) && send_all(client, header, headerLength) && body && !isHead)
+				send_all(client, body, bodySize);
+
+			free(body);
+		}
+
+		closesocket(client);
+	}
+}
+
+UINT64 current_system_time(void) {
+	FILETIME now;
+
+	GetSystemTimePreciseAsFileTime(&now); // The regular one only has the resolution of the timer interrupt
+
+	return (UINT64)now.dwHighDateTime << 32 | now.dwLowDateTime;
+}
+
+UINT64 current_tick_count(void) {
+	return GetTickCount64();
+}
+
+void sleep_ms(DWORD milliseconds) {
+	Sleep(milliseconds);
+}
+
+struct PlatformThread {
+	HANDLE handle;
+	ThreadFunction function;
+	LPVOID param;
+};
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+	struct PlatformThread* thread = param;
+
+	return thread->function(thread->param);
+}
+
+ThreadHandle start_thread(ThreadFunction function, LPVOID param) {
+	struct PlatformThread* thread = malloc(sizeof(*thread));
+
+	thread->function = function;
+	thread->param = param;
+	thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+
+	if(!thread->handle) {
+		free(thread);
+
+		return NULL;
+	}
+
+	return thread;
+}
+
+void join_thread(ThreadHandle thread) {
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+	free(thread);
+}
+
+EventHandle create_event(void) {
+	return (EventHandle)CreateEventW(NULL, TRUE, FALSE, NULL);
+}
+
+BOOL wait_for_event(EventHandle event, DWORD timeoutMs) {
+	return WaitForSingleObject((HANDLE)event, timeoutMs) == WAIT_OBJECT_0;
+}
+
+void signal_event(EventHandle event) {
+	SetEvent((HANDLE)event);
+}
+
+void destroy_event(EventHandle event) {
+	CloseHandle((HANDLE)event);
+}
+
+UINT64 atomic_add64(volatile UINT64* value, UINT64 addend) {
+	return (UINT64)InterlockedExchangeAdd64((volatile LONG64*)value, (LONG64)addend);
+}
+
+UINT64 atomic_load64(volatile UINT64* value) {
+	return (UINT64)InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+}
+
+void atomic_store64(volatile UINT64* value, UINT64 newValue) {
+	InterlockedExchange64((volatile LONG64*)value, (LONG64)newValue);
+}
+
+BOOL atomic_compare_exchange64(volatile UINT64* value, UINT64 expected, UINT64 newValue) {
+	return (UINT64)InterlockedCompareExchange64((volatile LONG64*)value, (LONG64)newValue, (LONG64)expected) == expected;
+}
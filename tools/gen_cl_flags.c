@@ -0,0 +1,289 @@
+/*
+ * Generates cl_flags.h from cl_flags.txt which is the output of 'cl /?'.
+ * Every option in there is assigned a role depending on the section it is listed in, with a few exceptions that are listed
+ * in roleOverrides below. The options are stored in a perfect hash table so that lelcache can classify a flag with a
+ * single lookup per prefix length.
+ *
+ * Usage (from the repository root):
+ *     cc tools/gen_cl_flags.c -o gen_cl_flags && ./gen_cl_flags cl_flags.txt > cl_flags.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_FLAGS 512
+#define MAX_FLAG_LENGTH 32
+#define TABLE_SIZE 256
+#define NUM_BUCKETS 64
+#define MAX_DISPLACEMENT 255
+
+struct SectionRole {
+	const char* section;
+	const char* role;
+};
+
+/*
+ * Default role of all options in a section of the help text.
+ */
+const struct SectionRole sectionRoles[] = {
+	{"-OPTIMIZATION-", "CL_FLAG_CODEGEN"},
+	{"-CODE GENERATION-", "CL_FLAG_CODEGEN"},
+	{"-OUTPUT FILES-", "CL_FLAG_UNCACHEABLE"}, // Additional output files are not cached
+	{"-PREPROCESSOR-", "CL_FLAG_PREPROCESSOR"},
+	{"-LANGUAGE-", "CL_FLAG_CODEGEN"},
+	{"-MISCELLANEOUS-", "CL_FLAG_CODEGEN"},
+	{"-LINKING-", "CL_FLAG_LINKER"},
+	{"-CODE ANALYSIS-", "CL_FLAG_CODEGEN"},
+	{"-DIAGNOSTICS-", "CL_FLAG_CODEGEN"} // Warnings decide whether a compilation fails with /WX so they need to be hashed
+};
+
+struct RoleOverride {
+	const char* flag;
+	const char* role;
+};
+
+const struct RoleOverride roleOverrides[] = {
+	// Output files
+	{"Fo", "CL_FLAG_OUTPUT"},
+	{"Fd", "CL_FLAG_OUTPUT"},
+	{"Fe", "CL_FLAG_IGNORABLE"}, // Only used when linking
+	{"Fm", "CL_FLAG_IGNORABLE"},
+	{"Fi", "CL_FLAG_IGNORABLE"}, // Only used together with /P
+	// Preprocessor
+	{"E", "CL_FLAG_UNCACHEABLE"}, // Only preprocess, don't compile
+	{"EP", "CL_FLAG_UNCACHEABLE"},
+	{"P", "CL_FLAG_UNCACHEABLE"},
+	{"Fx", "CL_FLAG_UNCACHEABLE"}, // Writes an additional file
+	{"FU", "CL_FLAG_CODEGEN"},     // #using is resolved by the compiler, not the preprocessor
+	// Language
+	{"Zs", "CL_FLAG_UNCACHEABLE"}, // Syntax check only
+	// Miscellaneous
+	{"?", "CL_FLAG_UNCACHEABLE"},
+	{"help", "CL_FLAG_UNCACHEABLE"},
+	{"errorReport", "CL_FLAG_IGNORABLE"},
+	{"MP", "CL_FLAG_IGNORABLE"},
+	{"FS", "CL_FLAG_IGNORABLE"},
+	{"nologo", "CL_FLAG_IGNORABLE"},
+	{"showIncludes", "CL_FLAG_UNCACHEABLE"}, // Build systems read the include list from the output which isn't replayed
+	{"Tc", "CL_FLAG_UNCACHEABLE"},           // The source file is part of the flag
+	{"Tp", "CL_FLAG_UNCACHEABLE"},
+	{"Yc", "CL_FLAG_UNCACHEABLE"}, // Precompiled headers
+	{"Yd", "CL_FLAG_UNCACHEABLE"},
+	{"Yl", "CL_FLAG_UNCACHEABLE"},
+	{"Yu", "CL_FLAG_UNCACHEABLE"},
+	{"Y-", "CL_FLAG_UNCACHEABLE"},
+	// Linking, the runtime library selects predefined macros and the default library stored in the object file
+	{"MD", "CL_FLAG_CODEGEN"},
+	{"MDd", "CL_FLAG_CODEGEN"},
+	{"MT", "CL_FLAG_CODEGEN"},
+	{"MTd", "CL_FLAG_CODEGEN"},
+	// Code analysis writes its results to additional files
+	{"analyze", "CL_FLAG_UNCACHEABLE"},
+	// Diagnostics
+	{"diagnostics", "CL_FLAG_IGNORABLE"} // Only changes the format of the output
+};
+
+struct Flag {
+	char name[MAX_FLAG_LENGTH + 1];
+	const char* role;
+	uint32_t slot;
+};
+
+/*
+ * Must be identical to cl_flag_hash in lelcache.c.
+ */
+uint32_t cl_flag_hash(const char* str, size_t length, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ (seed * 16777619u);
+
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+
+	return hash ^ (hash >> 15);
+}
+
+struct Flag flags[MAX_FLAGS];
+int numFlags = 0;
+
+/*
+ * Extracts the name of the option at the start of a line like '/Ob<n> inline expansion'. The name ends before the first
+ * placeholder, optional part or suboption. Suboptions (e.g. '/Zc:') don't need their own entry since they always have the
+ * role of their option and lookups match the longest prefix of a flag.
+ */
+void add_flag_from_line(const char* line, const char* role) {
+	const char* end = line;
+
+	while(*end && !strchr(" \t[<{:,", *end))
+		++end;
+
+	size_t length = end - line;
+
+	if(length == 0 || length > MAX_FLAG_LENGTH)
+		return;
+
+	for(int i = 0; i < numFlags; ++i) {
+		if(strlen(flags[i].name) == length && memcmp(flags[i].name, line, length) == 0)
+			return;
+	}
+
+	if(numFlags == MAX_FLAGS) {
+		fprintf(stderr, "Too many flags\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct Flag* flag = &flags[numFlags++];
+
+	memcpy(flag->name, line, length);
+	flag->name[length] = '\0';
+	flag->role = role;
+
+	for(int i = 0; i < sizeof(roleOverrides) / sizeof(*roleOverrides); ++i) {
+		if(strcmp(roleOverrides[i].flag, flag->name) == 0)
+			flag->role = roleOverrides[i].role;
+	}
+}
+
+int bucketSizes[NUM_BUCKETS];
+
+int compare_buckets_for_qsort(const void* a, const void* b) {
+	return bucketSizes[*(const int*)b] - bucketSizes[*(const int*)a];
+}
+
+int main(int argc, char** argv) {
+	if(argc != 2) {
+		fprintf(stderr, "Usage: gen_cl_flags <path_to_cl_flags.txt>\n");
+
+		return EXIT_FAILURE;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+
+	if(!file) {
+		fprintf(stderr, "Unable to open '%s'\n", argv[1]);
+
+		return EXIT_FAILURE;
+	}
+
+	char line[1024];
+	const char* role = NULL;
+
+	while(fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		const char* start = line + strspn(line, " ");
+
+		for(int i = 0; i < sizeof(sectionRoles) / sizeof(*sectionRoles); ++i) {
+			if(strcmp(start, sectionRoles[i].section) == 0)
+				role = sectionRoles[i].role;
+		}
+
+		// Options start at the beginning of a line, indented lines describe their values
+		if(line[0] != '/' || !role)
+			continue;
+
+		add_flag_from_line(line + 1, role);
+
+		// '/?, /help' lists two names for the same option
+		const char* alias = strstr(line, ", /");
+
+		if(alias)
+			add_flag_from_line(alias + 3, role);
+	}
+
+	fclose(file);
+
+	// Hash and displace: the keys are distributed into buckets which are then placed into the table one after another,
+	// starting with the largest one. For each bucket a seed is searched for which all of its keys land in free slots.
+
+	int buckets[NUM_BUCKETS];
+	int displacements[NUM_BUCKETS] = {0};
+	int occupied[TABLE_SIZE];
+
+	memset(occupied, -1, sizeof(occupied));
+
+	for(int i = 0; i < NUM_BUCKETS; ++i)
+		buckets[i] = i;
+
+	for(int i = 0; i < numFlags; ++i)
+		++bucketSizes[cl_flag_hash(flags[i].name, strlen(flags[i].name), 0) % NUM_BUCKETS];
+
+	qsort(buckets, NUM_BUCKETS, sizeof(*buckets), compare_buckets_for_qsort);
+
+	for(int b = 0; b < NUM_BUCKETS && bucketSizes[buckets[b]] > 0; ++b) {
+		int bucket = buckets[b];
+		int displacement;
+
+		for(displacement = 1; displacement <= MAX_DISPLACEMENT; ++displacement) {
+			int numPlaced = 0;
+			int placed[MAX_FLAGS];
+
+			for(int i = 0; i < numFlags; ++i) {
+				size_t length = strlen(flags[i].name);
+
+				if(cl_flag_hash(flags[i].name, length, 0) % NUM_BUCKETS != bucket)
+					continue;
+
+				uint32_t slot = cl_flag_hash(flags[i].name, length, displacement) % TABLE_SIZE;
+
+				if(occupied[slot] != -1)
+					break;
+
+				occupied[slot] = i;
+				flags[i].slot = slot;
+				placed[numPlaced++] = i;
+			}
+
+			if(numPlaced == bucketSizes[bucket])
+				break;
+
+			for(int i = 0; i < numPlaced; ++i) // Undoing the partial placement
+				occupied[flags[placed[i]].slot] = -1;
+		}
+
+		if(displacement > MAX_DISPLACEMENT) {
+			fprintf(stderr, "Unable to find a perfect hash, try increasing TABLE_SIZE or NUM_BUCKETS\n");
+
+			return EXIT_FAILURE;
+		}
+
+		displacements[bucket] = displacement;
+	}
+
+	size_t maxLength = 0;
+
+	for(int i = 0; i < numFlags; ++i) {
+		if(strlen(flags[i].name) > maxLength)
+			maxLength = strlen(flags[i].name);
+	}
+
+	printf("/*\r\n"
+		   " * Generated by tools/gen_cl_flags.c from cl_flags.txt, do not edit.\r\n"
+		   " */\r\n"
+		   "\r\n"
+		   "#define CL_FLAG_TABLE_SIZE %d\r\n"
+		   "#define CL_FLAG_NUM_BUCKETS %d\r\n"
+		   "#define CL_FLAG_MAX_LENGTH %zu\r\n"
+		   "\r\n"
+		   "const BYTE clFlagDisplacements[CL_FLAG_NUM_BUCKETS] = {",
+		   TABLE_SIZE, NUM_BUCKETS, maxLength);
+
+	for(int i = 0; i < NUM_BUCKETS; ++i)
+		printf("%s%d,", i % 16 == 0 ? "\r\n\t" : " ", displacements[i]);
+
+	printf("\r\n};\r\n\r\nconst struct ClFlag clFlagTable[CL_FLAG_TABLE_SIZE] = {\r\n");
+
+	for(int i = 0; i < TABLE_SIZE; ++i) {
+		if(occupied[i] != -1) {
+			struct Flag* flag = &flags[occupied[i]];
+
+			printf("\t[%d] = {\"%s\", %zu, %s},\r\n", i, flag->name, strlen(flag->name), flag->role);
+		}
+	}
+
+	printf("};\r\n");
+
+	return EXIT_SUCCESS;
+}